@@ -0,0 +1,302 @@
+/*
+ * LibUSB stub driver for testing the Saitek X52/X52 Pro
+ * Latency and fault injection
+ *
+ * Copyright (C) 2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "libusbx52.h"
+
+static const struct {
+    const char *name;
+    int error;
+    bool unplug;
+    bool reject;
+} fault_names[] = {
+    {"timeout", LIBUSB_ERROR_TIMEOUT, false, false},
+    {"pipe", LIBUSB_ERROR_PIPE, false, false},
+    {"io", LIBUSB_ERROR_IO, false, false},
+    {"nodev", LIBUSB_ERROR_NO_DEVICE, false, false},
+    {"unplug", LIBUSB_ERROR_NO_DEVICE, true, false},
+    {"reject", LIBUSB_ERROR_IO, false, true},
+};
+
+uint64_t libusbx52_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* xorshift64*, returns a number in [0, 1) */
+static double next_random(libusb_context *ctx)
+{
+    ctx->rng ^= ctx->rng >> 12;
+    ctx->rng ^= ctx->rng << 25;
+    ctx->rng ^= ctx->rng >> 27;
+    return ((ctx->rng * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int parse_ulong(const char *str, char **end, unsigned long *value)
+{
+    if (*str < '0' || *str > '9') {
+        return -1;
+    }
+    *value = strtoul(str, end, 10);
+    return 0;
+}
+
+static int parse_rate(const char *str, char **end, double *rate)
+{
+    *rate = strtod(str, end);
+    if (*end == str || *rate < 0 || *rate > 1) {
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_delay(libusb_context *ctx, const char *str)
+{
+    char *end;
+
+    if (!strncmp(str, "fixed:", 6)) {
+        str += 6;
+    }
+
+    if (!strncmp(str, "uniform:", 8)) {
+        ctx->delay_type = LIBUSBX52_DELAY_UNIFORM;
+        if (parse_ulong(str + 8, &end, &ctx->delay_us) || *end != ':' ||
+            parse_ulong(end + 1, &end, &ctx->delay_max_us) ||
+            ctx->delay_max_us < ctx->delay_us) {
+            return -1;
+        }
+    } else if (!strncmp(str, "spike:", 6)) {
+        ctx->delay_type = LIBUSBX52_DELAY_SPIKE;
+        if (parse_ulong(str + 6, &end, &ctx->delay_us) || *end != ':' ||
+            parse_rate(end + 1, &end, &ctx->spike_rate) || *end != ':' ||
+            parse_ulong(end + 1, &end, &ctx->delay_max_us)) {
+            return -1;
+        }
+    } else {
+        ctx->delay_type = LIBUSBX52_DELAY_FIXED;
+        if (parse_ulong(str, &end, &ctx->delay_us)) {
+            return -1;
+        }
+    }
+
+    return (*end == '\0') ? 0 : -1;
+}
+
+static int parse_fault(struct libusbx52_fault *fault, char *str)
+{
+    size_t i;
+    size_t len;
+    char *end;
+
+    for (i = 0; i < sizeof(fault_names) / sizeof(fault_names[0]); i++) {
+        len = strlen(fault_names[i].name);
+        if (!strncmp(str, fault_names[i].name, len) &&
+            (str[len] == '@' || str[len] == '#')) {
+            break;
+        }
+    }
+    if (i == sizeof(fault_names) / sizeof(fault_names[0])) {
+        return -1;
+    }
+
+    fault->error = fault_names[i].error;
+    fault->unplug = fault_names[i].unplug;
+    fault->reject = fault_names[i].reject;
+    str += len;
+
+    if (*str == '@') {
+        if (parse_rate(str + 1, &end, &fault->rate) || fault->rate == 0) {
+            return -1;
+        }
+    } else {
+        if (parse_ulong(str + 1, &end, &fault->first)) {
+            return -1;
+        }
+        fault->last = fault->first;
+        if (*end == '-' && parse_ulong(end + 1, &end, &fault->last)) {
+            return -1;
+        }
+        if (fault->first == 0 || fault->last < fault->first) {
+            return -1;
+        }
+    }
+
+    return (*end == '\0') ? 0 : -1;
+}
+
+static int parse_faults(libusb_context *ctx, const char *str)
+{
+    char *copy;
+    char *saveptr;
+    char *tok;
+    int rc = 0;
+
+    copy = strdup(str);
+    if (copy == NULL) {
+        return -1;
+    }
+
+    for (tok = strtok_r(copy, ",", &saveptr); tok != NULL;
+         tok = strtok_r(NULL, ",", &saveptr)) {
+        if (ctx->num_faults == LIBUSBX52_MAX_FAULTS ||
+            parse_fault(&ctx->faults[ctx->num_faults], tok)) {
+            rc = -1;
+            break;
+        }
+        ctx->num_faults++;
+    }
+
+    free(copy);
+    return rc;
+}
+
+int libusbx52_faults_init(libusb_context *ctx)
+{
+    const char *env;
+    char *end;
+
+    pthread_mutex_init(&ctx->lock, NULL);
+    ctx->rng = 1;
+
+    env = getenv(SEED_ENV);
+    if (env != NULL && env[0] != '\0') {
+        ctx->rng = strtoull(env, &end, 0);
+        if (*end != '\0') {
+            fprintf(stderr, "libusbx52: Invalid %s %s\n", SEED_ENV, env);
+            return LIBUSB_ERROR_INVALID_PARAM;
+        }
+        /* xorshift never leaves the all zeroes state */
+        if (ctx->rng == 0) {
+            ctx->rng = 1;
+        }
+    }
+
+    env = getenv(DELAY_ENV);
+    if (env != NULL && env[0] != '\0' && parse_delay(ctx, env)) {
+        fprintf(stderr, "libusbx52: Invalid %s %s\n", DELAY_ENV, env);
+        return LIBUSB_ERROR_INVALID_PARAM;
+    }
+
+    env = getenv(FAULTS_ENV);
+    if (env != NULL && env[0] != '\0' && parse_faults(ctx, env)) {
+        fprintf(stderr, "libusbx52: Invalid %s %s\n", FAULTS_ENV, env);
+        return LIBUSB_ERROR_INVALID_PARAM;
+    }
+
+    env = getenv(REPLUG_ENV);
+    if (env != NULL && env[0] != '\0') {
+        if (parse_ulong(env, &end, &ctx->replug_ms) || *end != '\0') {
+            fprintf(stderr, "libusbx52: Invalid %s %s\n", REPLUG_ENV, env);
+            return LIBUSB_ERROR_INVALID_PARAM;
+        }
+    }
+
+    return LIBUSB_SUCCESS;
+}
+
+/* Must be called with the context lock held */
+static bool device_present(libusb_device *dev)
+{
+    if (dev->unplugged && dev->replug_ns != 0 &&
+        libusbx52_now_ns() >= dev->replug_ns) {
+        dev->unplugged = false;
+    }
+
+    return !dev->unplugged;
+}
+
+bool libusbx52_device_present(libusb_device *dev)
+{
+    bool present;
+
+    pthread_mutex_lock(&dev->context->lock);
+    present = device_present(dev);
+    pthread_mutex_unlock(&dev->context->lock);
+
+    return present;
+}
+
+static uint64_t next_delay(libusb_context *ctx)
+{
+    switch (ctx->delay_type) {
+    case LIBUSBX52_DELAY_FIXED:
+        return ctx->delay_us;
+
+    case LIBUSBX52_DELAY_UNIFORM:
+        return ctx->delay_us + (uint64_t)(next_random(ctx) *
+                                (ctx->delay_max_us - ctx->delay_us + 1));
+
+    case LIBUSBX52_DELAY_SPIKE:
+        return (next_random(ctx) < ctx->spike_rate) ?
+               ctx->delay_max_us : ctx->delay_us;
+
+    case LIBUSBX52_DELAY_NONE:
+    default:
+        return 0;
+    }
+}
+
+int libusbx52_fault_next(libusb_device_handle *hdl, unsigned int timeout,
+                         uint64_t *delay_us, bool *reject)
+{
+    libusb_context *ctx = hdl->ctx;
+    struct libusbx52_fault *fault;
+    unsigned long seq;
+    int rc = LIBUSB_SUCCESS;
+    int i;
+
+    pthread_mutex_lock(&ctx->lock);
+
+    seq = ++ctx->transfer_seq;
+    *delay_us = 0;
+    *reject = false;
+
+    if (!device_present(hdl->dev)) {
+        pthread_mutex_unlock(&ctx->lock);
+        return LIBUSB_ERROR_NO_DEVICE;
+    }
+
+    *delay_us = next_delay(ctx);
+
+    for (i = 0; i < ctx->num_faults; i++) {
+        fault = &ctx->faults[i];
+        if (fault->rate > 0) {
+            if (next_random(ctx) >= fault->rate) {
+                continue;
+            }
+        } else if (seq < fault->first || seq > fault->last) {
+            continue;
+        }
+
+        rc = fault->error;
+        *reject = fault->reject;
+        if (fault->unplug) {
+            hdl->dev->unplugged = true;
+            hdl->dev->replug_ns = 0;
+            if (ctx->replug_ms != 0) {
+                hdl->dev->replug_ns = libusbx52_now_ns() +
+                                      ctx->replug_ms * 1000000ULL;
+            }
+        }
+        if (rc == LIBUSB_ERROR_TIMEOUT && timeout != 0) {
+            *delay_us = (uint64_t)timeout * 1000;
+        }
+        break;
+    }
+
+    pthread_mutex_unlock(&ctx->lock);
+    return rc;
+}
@@ -7,6 +7,9 @@
  */
 
 #include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
 #include <libusb.h>
 
 struct libusb_device {
@@ -14,14 +17,53 @@ struct libusb_device {
     int index;
     int ref_count;
     struct libusb_device_descriptor desc;
+    bool unplugged;         // Removed by an unplug fault
+    uint64_t replug_ns;     // Time at which it comes back, 0 for never
 };
 
+/* Distribution of the simulated transfer time */
+enum libusbx52_delay_type {
+    LIBUSBX52_DELAY_NONE,
+    LIBUSBX52_DELAY_FIXED,      // Always delay_us
+    LIBUSBX52_DELAY_UNIFORM,    // Between delay_us and delay_max_us
+    LIBUSBX52_DELAY_SPIKE,      // delay_us, or delay_max_us at spike_rate
+};
+
+/* Injected transfer outcome, see LIBUSBX52_FAULTS */
+struct libusbx52_fault {
+    int error;              // LIBUSB_ERROR_* returned by the transfer
+    bool unplug;            // Remove the device as well
+    bool reject;            // Fail the submission, not the transfer
+    double rate;            // Probability per transfer, or 0 to use seq
+    unsigned long first;    // First sequence number to fail
+    unsigned long last;     // Last sequence number to fail
+};
+
+#define LIBUSBX52_MAX_FAULTS    16
+
+struct libusbx52_transfer;
+
 struct libusb_context {
     int block_size;     // Set to LIBUSBX52_MEMORY_BLOCK_SIZE
     int max_devices;    // Calculated based on block_size
     int debug_level;
     int num_devices;
     struct libusb_device *devices;
+
+    /* Fault injection, protected by lock */
+    pthread_mutex_t lock;
+    unsigned long transfer_seq;
+    uint64_t rng;
+    enum libusbx52_delay_type delay_type;
+    unsigned long delay_us;
+    unsigned long delay_max_us;
+    double spike_rate;
+    unsigned long replug_ms;
+    int num_faults;
+    struct libusbx52_fault faults[LIBUSBX52_MAX_FAULTS];
+
+    /* Asynchronous transfers in flight, in order of completion */
+    struct libusbx52_transfer *pending;
 };
 
 struct libusb_device_handle {
@@ -29,6 +71,19 @@ struct libusb_device_handle {
     struct libusb_device *dev;
     int packets_written;
     FILE *packet_data_file;
+    uint64_t busy_until_ns; // Completion time of the last transfer
+};
+
+/*
+ * Asynchronous transfer. The libusb_transfer must be the last member, since
+ * it ends in a flexible array.
+ */
+struct libusbx52_transfer {
+    struct libusbx52_transfer *next;
+    uint64_t complete_ns;
+    int status;
+    bool submitted;
+    struct libusb_transfer xfer;
 };
 
 /**
@@ -64,5 +119,72 @@ struct libusb_device_handle {
  */
 #define DEFAULT_OUTPUT_DATA_FILE        "/tmp/libusbx52_output_data"
 
+/**
+ * @brief Transfer delay environment variable
+ *
+ * Simulated time taken by each control transfer, in microseconds. This is
+ * one of the following:
+ * - \c N or \c fixed:N - every transfer takes N microseconds
+ * - \c uniform:MIN:MAX - uniformly distributed between MIN and MAX
+ * - \c spike:N:RATE:MAX - N microseconds, except that a fraction RATE of the
+ *   transfers take MAX microseconds, like a hub that stalls now and then
+ */
+#define DELAY_ENV                       "LIBUSBX52_DELAY"
+
+/**
+ * @brief Fault injection environment variable
+ *
+ * Comma separated list of faults to inject into control transfers. Each
+ * fault is an error name followed by either \c @RATE, the probability that
+ * any transfer fails, or \c \#SEQ or \c \#FIRST-LAST, the sequence numbers
+ * of the transfers that fail. Transfers are numbered from 1 in the order
+ * they are sent, and the first matching fault applies. The error names are:
+ * - \c timeout - the transfer times out after its timeout has elapsed
+ * - \c pipe - the device stalls the transfer
+ * - \c io - the transfer fails with an I/O error
+ * - \c nodev - the transfer fails as though the device was unplugged
+ * - \c unplug - the device is unplugged, and all further transfers fail
+ *   until it is plugged back in, see \ref REPLUG_ENV
+ * - \c reject - an asynchronous transfer cannot be submitted, and
+ *   libusb_submit_transfer fails with an I/O error. A synchronous transfer
+ *   fails with an I/O error.
+ *
+ * For example, <tt>pipe\@0.01,timeout\#5,unplug\#40</tt>
+ */
+#define FAULTS_ENV                      "LIBUSBX52_FAULTS"
+
+/**
+ * @brief Replug delay environment variable
+ *
+ * Time in milliseconds after which an unplugged device appears again. If
+ * this is not set, the device stays unplugged.
+ */
+#define REPLUG_ENV                      "LIBUSBX52_REPLUG_MS"
+
+/**
+ * @brief Random seed environment variable
+ *
+ * Seed for fault rates and random delays. The same seed and the same
+ * sequence of transfers always inject the same faults. Defaults to 1.
+ */
+#define SEED_ENV                        "LIBUSBX52_SEED"
+
 /* Open file from environment variable */
 FILE * fopen_env(const char *env, const char *env_default, const char *mode);
+
+/* Parse the fault injection environment into the context */
+int libusbx52_faults_init(libusb_context *ctx);
+
+/*
+ * Decide the outcome of the next control transfer on the handle. Returns
+ * the LIBUSB_ERROR_* to report, and the simulated transfer time in delay_us.
+ * reject is set if the error applies to the submission of the transfer.
+ */
+int libusbx52_fault_next(libusb_device_handle *hdl, unsigned int timeout,
+                         uint64_t *delay_us, bool *reject);
+
+/* Check if the device is plugged in, plugging it back in when it is time */
+bool libusbx52_device_present(libusb_device *dev);
+
+/* Monotonic time in nanoseconds */
+uint64_t libusbx52_now_ns(void);
@@ -11,6 +11,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <errno.h>
+#include <time.h>
 #include <libusb.h>
 #include "libusbx52.h"
 
@@ -37,6 +40,11 @@ int libusb_init(libusb_context **ctx)
         goto init_err_recovery;
     }
 
+    rc = libusbx52_faults_init(tmp_ctx);
+    if (rc != LIBUSB_SUCCESS) {
+        goto init_err_recovery;
+    }
+
     dev_list = fopen_env(INPUT_DEVICE_LIST_ENV, DEFAULT_INPUT_DEVICE_LIST_FILE, "r");
     if (dev_list == NULL) {
         rc = LIBUSB_ERROR_IO;
@@ -113,6 +121,7 @@ void libusb_exit(libusb_context *ctx)
         if (ctx->devices) {
             free(ctx->devices);
         }
+        pthread_mutex_destroy(&ctx->lock);
         free(ctx);
     }
 }
@@ -143,6 +152,12 @@ int libusb_set_option(libusb_context *ctx, enum libusb_option option, ...)
 }
 #endif
 
+int libusb_has_capability(uint32_t capability)
+{
+    /* The stub does not generate hotplug events */
+    return (capability == LIBUSB_CAP_HAS_CAPABILITY);
+}
+
 ssize_t libusb_get_device_list(libusb_context *ctx, libusb_device ***list)
 {
     /* Allocate a list of num_devices, each pointing to a corresponding
@@ -153,22 +168,26 @@ ssize_t libusb_get_device_list(libusb_context *ctx, libusb_device ***list)
      */
     libusb_device **tmp_list = calloc(ctx->num_devices + 1, sizeof(*tmp_list));
     libusb_device *dev;
+    int count = 0;
     int i;
 
     if (tmp_list == NULL) {
         return LIBUSB_ERROR_NO_MEM;
     }
 
-    /* Initialize the list with pointers to the individual devices */
+    /* Initialize the list with pointers to the devices that are plugged in */
     for (i = 0; i < ctx->num_devices; i++) {
         dev = &(ctx->devices[i]);
+        if (!libusbx52_device_present(dev)) {
+            continue;
+        }
         /* Increment the refcount */
         dev->ref_count += 1;
-        tmp_list[i] = dev;
+        tmp_list[count++] = dev;
     }
 
     *list = tmp_list;
-    return ctx->num_devices;
+    return count;
 }
 
 void libusb_free_device_list(libusb_device **list, int unref_devices)
@@ -184,6 +203,17 @@ void libusb_free_device_list(libusb_device **list, int unref_devices)
     free(list);
 }
 
+libusb_device *libusb_ref_device(libusb_device *dev)
+{
+    dev->ref_count += 1;
+    return dev;
+}
+
+void libusb_unref_device(libusb_device *dev)
+{
+    dev->ref_count -= 1;
+}
+
 int libusb_get_device_descriptor(libusb_device *dev,
                                  struct libusb_device_descriptor *desc)
 {
@@ -192,6 +222,48 @@ int libusb_get_device_descriptor(libusb_device *dev,
     return 0;
 }
 
+/* All simulated devices are on bus 1, each plugged into its own root port */
+uint8_t libusb_get_bus_number(libusb_device *dev)
+{
+    (void)dev;
+    return 1;
+}
+
+uint8_t libusb_get_device_address(libusb_device *dev)
+{
+    return (uint8_t)(dev->index + 1);
+}
+
+int libusb_get_port_numbers(libusb_device *dev,
+                            uint8_t *port_numbers,
+                            int port_numbers_len)
+{
+    if (port_numbers_len < 1) {
+        return LIBUSB_ERROR_OVERFLOW;
+    }
+
+    port_numbers[0] = (uint8_t)(dev->index + 1);
+    return 1;
+}
+
+int libusb_get_string_descriptor_ascii(libusb_device_handle *dev_handle,
+                                       uint8_t desc_index,
+                                       unsigned char *data,
+                                       int length)
+{
+    int rc;
+
+    (void)desc_index;
+
+    /* Generate a serial number which is unique to the device index */
+    rc = snprintf((char *)data, length, "STUB%04d", dev_handle->dev->index);
+    if (rc < 0) {
+        return LIBUSB_ERROR_OTHER;
+    }
+
+    return (rc < length) ? rc : length - 1;
+}
+
 #define LIBUSB_DUMP_LOG_FILE(hdl, loglevel, fmt_str, ...) do { \
     if (hdl->ctx->debug_level != LIBUSB_LOG_LEVEL_NONE && \
         hdl->ctx->debug_level >= loglevel) { \
@@ -201,8 +273,15 @@ int libusb_get_device_descriptor(libusb_device *dev,
 
 int libusb_open(libusb_device *dev, libusb_device_handle **handle)
 {
+    libusb_device_handle *tmp_hdl;
+
+    /* An unplugged device cannot be opened */
+    if (!libusbx52_device_present(dev)) {
+        return LIBUSB_ERROR_NO_DEVICE;
+    }
+
     /* Allocate a handle for the application */
-    libusb_device_handle *tmp_hdl = calloc(1, sizeof(*tmp_hdl));
+    tmp_hdl = calloc(1, sizeof(*tmp_hdl));
     if (tmp_hdl == NULL) {
         return LIBUSB_ERROR_NO_MEM;
     }
@@ -252,6 +331,38 @@ void libusb_close(libusb_device_handle *dev_handle)
     free(dev_handle);
 }
 
+static const char *error_name(int rc)
+{
+    switch (rc) {
+    case LIBUSB_ERROR_TIMEOUT:      return "LIBUSB_ERROR_TIMEOUT";
+    case LIBUSB_ERROR_PIPE:         return "LIBUSB_ERROR_PIPE";
+    case LIBUSB_ERROR_IO:           return "LIBUSB_ERROR_IO";
+    case LIBUSB_ERROR_NO_DEVICE:    return "LIBUSB_ERROR_NO_DEVICE";
+    default:                        return "LIBUSB_ERROR_OTHER";
+    }
+}
+
+static void sleep_us(uint64_t delay_us)
+{
+    struct timespec ts;
+
+    ts.tv_sec = delay_us / 1000000;
+    ts.tv_nsec = (delay_us % 1000000) * 1000;
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR) {
+        /* Sleep for the remaining time */
+    }
+}
+
+/* Sleep until the given monotonic time */
+static void sleep_until_ns(uint64_t deadline_ns)
+{
+    uint64_t now = libusbx52_now_ns();
+
+    if (deadline_ns > now) {
+        sleep_us((deadline_ns - now + 999) / 1000);
+    }
+}
+
 int libusb_control_transfer(libusb_device_handle *dev_handle,
                             uint8_t request_type,
                             uint8_t bRequest,
@@ -261,6 +372,10 @@ int libusb_control_transfer(libusb_device_handle *dev_handle,
                             uint16_t wLength,
                             unsigned int timeout)
 {
+    uint64_t delay_us;
+    bool reject;
+    int rc;
+
     /* Always log the control transfer */
     fprintf(dev_handle->packet_data_file,
         "%s: RqType: %02x bRequest: %02x wValue: %04x wIndex: %04x timeout: %u\n",
@@ -275,5 +390,244 @@ int libusb_control_transfer(libusb_device_handle *dev_handle,
         fprintf(dev_handle->packet_data_file, "\n");
     }
 
-    return 0;
+    rc = libusbx52_fault_next(dev_handle, timeout, &delay_us, &reject);
+    if (rc != LIBUSB_SUCCESS) {
+        fprintf(dev_handle->packet_data_file, "%s: Injected: %s\n",
+                __func__, error_name(rc));
+    }
+
+    sleep_us(delay_us);
+    return rc;
+}
+
+/*
+ * Asynchronous transfers complete in submission order, each one taking the
+ * delay chosen for it once the previous one on the same handle is done,
+ * just like the default control endpoint. They only complete from within
+ * the event handling functions, which call the callbacks.
+ */
+#define STUB_TRANSFER(x) \
+    ((struct libusbx52_transfer *)((char *)(x) - \
+        offsetof(struct libusbx52_transfer, xfer)))
+
+struct libusb_transfer *libusb_alloc_transfer(int iso_packets)
+{
+    struct libusbx52_transfer *t;
+
+    t = calloc(1, sizeof(*t) +
+                  iso_packets * sizeof(struct libusb_iso_packet_descriptor));
+    if (t == NULL) {
+        return NULL;
+    }
+
+    t->xfer.num_iso_packets = iso_packets;
+    return &t->xfer;
+}
+
+void libusb_free_transfer(struct libusb_transfer *transfer)
+{
+    if (transfer == NULL) {
+        return;
+    }
+
+    if (transfer->flags & LIBUSB_TRANSFER_FREE_BUFFER) {
+        free(transfer->buffer);
+    }
+
+    free(STUB_TRANSFER(transfer));
+}
+
+/* Insert the transfer into the pending list, which must be locked */
+static void insert_pending(libusb_context *ctx, struct libusbx52_transfer *t)
+{
+    struct libusbx52_transfer **p = &ctx->pending;
+
+    while (*p != NULL && (*p)->complete_ns <= t->complete_ns) {
+        p = &(*p)->next;
+    }
+
+    t->next = *p;
+    *p = t;
+}
+
+int libusb_submit_transfer(struct libusb_transfer *transfer)
+{
+    struct libusbx52_transfer *t = STUB_TRANSFER(transfer);
+    libusb_device_handle *hdl = transfer->dev_handle;
+    struct libusb_control_setup *setup;
+    uint64_t delay_us;
+    uint64_t start;
+    bool reject;
+    int rc;
+
+    if (t->submitted) {
+        return LIBUSB_ERROR_BUSY;
+    }
+
+    if (!libusbx52_device_present(hdl->dev)) {
+        return LIBUSB_ERROR_NO_DEVICE;
+    }
+
+    setup = libusb_control_transfer_get_setup(transfer);
+    fprintf(hdl->packet_data_file,
+        "%s: RqType: %02x bRequest: %02x wValue: %04x wIndex: %04x timeout: %u\n",
+        __func__, setup->bmRequestType, setup->bRequest,
+        libusb_le16_to_cpu(setup->wValue), libusb_le16_to_cpu(setup->wIndex),
+        transfer->timeout);
+
+    rc = libusbx52_fault_next(hdl, transfer->timeout, &delay_us, &reject);
+    if (reject) {
+        /* The transfer is never queued, so the callback is not called */
+        fprintf(hdl->packet_data_file, "%s: Injected: %s\n",
+                __func__, error_name(rc));
+        return rc;
+    }
+
+    switch (rc) {
+    case LIBUSB_SUCCESS:
+        t->status = LIBUSB_TRANSFER_COMPLETED;
+        break;
+
+    case LIBUSB_ERROR_TIMEOUT:
+        t->status = LIBUSB_TRANSFER_TIMED_OUT;
+        break;
+
+    case LIBUSB_ERROR_PIPE:
+        t->status = LIBUSB_TRANSFER_STALL;
+        break;
+
+    case LIBUSB_ERROR_NO_DEVICE:
+        t->status = LIBUSB_TRANSFER_NO_DEVICE;
+        break;
+
+    default:
+        t->status = LIBUSB_TRANSFER_ERROR;
+        break;
+    }
+
+    if (rc != LIBUSB_SUCCESS) {
+        fprintf(hdl->packet_data_file, "%s: Injected: %s\n",
+                __func__, error_name(rc));
+    }
+
+    pthread_mutex_lock(&hdl->ctx->lock);
+    start = libusbx52_now_ns();
+    if (hdl->busy_until_ns > start) {
+        start = hdl->busy_until_ns;
+    }
+    t->complete_ns = start + delay_us * 1000;
+    hdl->busy_until_ns = t->complete_ns;
+    t->submitted = true;
+    insert_pending(hdl->ctx, t);
+    pthread_mutex_unlock(&hdl->ctx->lock);
+
+    return LIBUSB_SUCCESS;
+}
+
+int libusb_cancel_transfer(struct libusb_transfer *transfer)
+{
+    struct libusbx52_transfer *t = STUB_TRANSFER(transfer);
+    libusb_context *ctx = transfer->dev_handle->ctx;
+    struct libusbx52_transfer **p;
+
+    pthread_mutex_lock(&ctx->lock);
+    for (p = &ctx->pending; *p != NULL && *p != t; p = &(*p)->next) {
+        /* Find the transfer */
+    }
+
+    if (*p == NULL) {
+        pthread_mutex_unlock(&ctx->lock);
+        return LIBUSB_ERROR_NOT_FOUND;
+    }
+
+    /* Complete it as cancelled on the next event handling call */
+    *p = t->next;
+    t->status = LIBUSB_TRANSFER_CANCELLED;
+    t->complete_ns = 0;
+    insert_pending(ctx, t);
+    pthread_mutex_unlock(&ctx->lock);
+
+    return LIBUSB_SUCCESS;
+}
+
+static void complete_transfer(struct libusbx52_transfer *t)
+{
+    struct libusb_transfer *xfer = &t->xfer;
+
+    t->submitted = false;
+    xfer->status = t->status;
+    xfer->actual_length = 0;
+    if (t->status == LIBUSB_TRANSFER_COMPLETED) {
+        xfer->actual_length = xfer->length - LIBUSB_CONTROL_SETUP_SIZE;
+    }
+
+    xfer->callback(xfer);
+
+    if (xfer->flags & LIBUSB_TRANSFER_FREE_TRANSFER) {
+        libusb_free_transfer(xfer);
+    }
+}
+
+/*
+ * Complete the transfers that are due, waiting until the deadline for the
+ * next one. With no transfers pending, there is nothing that could happen,
+ * so only wait if there is a deadline.
+ */
+static int handle_events(libusb_context *ctx, uint64_t deadline_ns,
+                         int *completed)
+{
+    struct libusbx52_transfer *t;
+    int handled = 0;
+    uint64_t now;
+
+    for (;;) {
+        now = libusbx52_now_ns();
+
+        pthread_mutex_lock(&ctx->lock);
+        t = ctx->pending;
+        if (t != NULL && t->complete_ns <= now) {
+            ctx->pending = t->next;
+            pthread_mutex_unlock(&ctx->lock);
+            complete_transfer(t);
+            handled++;
+            continue;
+        }
+        pthread_mutex_unlock(&ctx->lock);
+
+        if (handled > 0 || (completed != NULL && *completed)) {
+            return LIBUSB_SUCCESS;
+        }
+
+        if (t == NULL) {
+            if (deadline_ns != UINT64_MAX) {
+                sleep_until_ns(deadline_ns);
+            }
+            return LIBUSB_SUCCESS;
+        }
+
+        if (now >= deadline_ns) {
+            return LIBUSB_SUCCESS;
+        }
+
+        sleep_until_ns(t->complete_ns < deadline_ns ? t->complete_ns : deadline_ns);
+    }
+}
+
+int libusb_handle_events_completed(libusb_context *ctx, int *completed)
+{
+    return handle_events(ctx, UINT64_MAX, completed);
+}
+
+int libusb_handle_events_timeout_completed(libusb_context *ctx,
+                                           struct timeval *tv,
+                                           int *completed)
+{
+    uint64_t deadline_ns = UINT64_MAX;
+
+    if (tv != NULL) {
+        deadline_ns = libusbx52_now_ns() + tv->tv_sec * 1000000000ULL +
+                      tv->tv_usec * 1000ULL;
+    }
+
+    return handle_events(ctx, deadline_ns, completed);
 }
@@ -23,6 +23,7 @@
 #include <time.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -227,6 +228,396 @@ typedef enum {
     LIBX52_FEATURE_LED,
 } libx52_feature;
 
+/**
+ * @brief Maximum depth of the USB port path in \ref libx52_device_info
+ * @ingroup libx52dev
+ */
+#define LIBX52_MAX_PORT_DEPTH 7
+
+/**
+ * @brief Identity of a supported joystick
+ *
+ * This identifies a single joystick among several that may be attached to
+ * the host. It is returned by \ref libx52_enumerate, and may be passed to
+ * \ref libx52_connect_device to connect to that joystick.
+ *
+ * @ingroup libx52dev
+ */
+typedef struct {
+    /** USB vendor ID */
+    uint16_t vendor_id;
+
+    /** USB product ID */
+    uint16_t product_id;
+
+    /** USB bus number */
+    uint8_t bus;
+
+    /** USB device address on the bus. This changes when the joystick is
+     * reconnected */
+    uint8_t address;
+
+    /** Number of valid entries in \c ports */
+    uint8_t port_depth;
+
+    /** Port numbers from the root hub to the joystick */
+    uint8_t ports[LIBX52_MAX_PORT_DEPTH];
+
+    /** Serial number, or an empty string if it could not be read */
+    char serial_number[64];
+} libx52_device_info;
+
+/**
+ * @brief Retry policy for vendor commands
+ *
+ * The retry policy controls how libx52 handles a failed USB transfer to the
+ * joystick. Each vendor command is attempted up to \c attempts times, with a
+ * delay between attempts that doubles after every failure, starting from
+ * \c backoff_ms and limited to \c backoff_max_ms. A command that fails with
+ * \ref LIBX52_ERROR_NO_DEVICE is never retried.
+ *
+ * If \c breaker_threshold is nonzero, then libx52 disconnects from the
+ * joystick after that many consecutive commands have failed, and all further
+ * commands fail immediately with \ref LIBX52_ERROR_NO_DEVICE until the
+ * application calls \ref libx52_connect.
+ *
+ * @ingroup libx52misc
+ */
+typedef struct {
+    /** Timeout for a single transfer in milliseconds, 0 for the default of
+     * 5000ms */
+    unsigned int timeout_ms;
+
+    /** Maximum number of attempts per command, 0 for the default of 3 */
+    unsigned int attempts;
+
+    /** Delay before the first retry in milliseconds, 0 to retry immediately */
+    unsigned int backoff_ms;
+
+    /** Upper limit on the delay between retries in milliseconds, 0 for no
+     * limit */
+    unsigned int backoff_max_ms;
+
+    /** Random variation applied to each delay, as a percentage of the delay */
+    unsigned int jitter_percent;
+
+    /** Number of consecutive failed commands after which libx52 disconnects
+     * from the joystick, 0 to disable */
+    unsigned int breaker_threshold;
+} libx52_retry_policy;
+
+/**
+ * @brief Outcome counters for vendor commands
+ *
+ * @ingroup libx52misc
+ */
+typedef struct {
+    /** Commands that succeeded on the first attempt */
+    unsigned long success;
+
+    /** Commands that succeeded after one or more retries */
+    unsigned long retried_success;
+
+    /** Commands that failed after all attempts */
+    unsigned long failed;
+
+    /** Commands that failed because the joystick was disconnected */
+    unsigned long no_device;
+
+    /** Total number of retries across all commands */
+    unsigned long retries;
+
+    /** Number of times the circuit breaker disconnected the joystick */
+    unsigned long breaker_trips;
+
+    /** Commands rejected while the circuit breaker was open */
+    unsigned long fast_fails;
+} libx52_retry_counters;
+
+/**
+ * @brief Vendor commands tracked by the command statistics
+ *
+ * Each vendor command sent to the joystick is accounted under one of these
+ * identifiers. See \ref libx52_get_stats.
+ *
+ * @ingroup libx52misc
+ */
+typedef enum {
+    /** Write characters to MFD line 1 */
+    LIBX52_COMMAND_MFD_LINE1_WRITE,
+
+    /** Clear MFD line 1 */
+    LIBX52_COMMAND_MFD_LINE1_CLEAR,
+
+    /** Write characters to MFD line 2 */
+    LIBX52_COMMAND_MFD_LINE2_WRITE,
+
+    /** Clear MFD line 2 */
+    LIBX52_COMMAND_MFD_LINE2_CLEAR,
+
+    /** Write characters to MFD line 3 */
+    LIBX52_COMMAND_MFD_LINE3_WRITE,
+
+    /** Clear MFD line 3 */
+    LIBX52_COMMAND_MFD_LINE3_CLEAR,
+
+    /** Set the MFD brightness */
+    LIBX52_COMMAND_MFD_BRIGHTNESS,
+
+    /** Set the LED brightness */
+    LIBX52_COMMAND_LED_BRIGHTNESS,
+
+    /** Set the state of an individual LED */
+    LIBX52_COMMAND_LED,
+
+    /** Set the time on clock 1 */
+    LIBX52_COMMAND_TIME_CLOCK1,
+
+    /** Set the offset of clock 2 */
+    LIBX52_COMMAND_OFFS_CLOCK2,
+
+    /** Set the offset of clock 3 */
+    LIBX52_COMMAND_OFFS_CLOCK3,
+
+    /** Set the day and month */
+    LIBX52_COMMAND_DATE_DDMM,
+
+    /** Set the year */
+    LIBX52_COMMAND_DATE_YEAR,
+
+    /** Set the shift indicator */
+    LIBX52_COMMAND_SHIFT,
+
+    /** Set the blink indicator */
+    LIBX52_COMMAND_BLINK,
+
+    /** Any other command sent by \ref libx52_vendor_command */
+    LIBX52_COMMAND_OTHER,
+
+    /** Number of tracked commands, not a valid command */
+    LIBX52_COMMAND_MAX,
+} libx52_command;
+
+/**
+ * @brief Number of buckets in the command latency histogram
+ * @ingroup libx52misc
+ */
+#define LIBX52_STATS_BUCKETS 24
+
+/**
+ * @brief Statistics for a single vendor command
+ *
+ * The latency of a command is the time taken to send it to the joystick,
+ * including any retries. The latency histogram uses logarithmic buckets.
+ * Bucket 0 counts commands that took under 1 microsecond, and bucket \c n
+ * counts commands that took between 2<sup>n-1</sup> and 2<sup>n</sup>
+ * microseconds. The last bucket also counts all slower commands.
+ *
+ * @ingroup libx52misc
+ */
+typedef struct {
+    /** Number of times the command was sent */
+    unsigned long count;
+
+    /** Number of times the command failed */
+    unsigned long errors;
+
+    /** Number of retries of the command */
+    unsigned long retries;
+
+    /** Total latency of all the commands, in nanoseconds */
+    uint64_t total_ns;
+
+    /** Largest latency of any command, in nanoseconds */
+    uint64_t max_ns;
+
+    /** Latency histogram */
+    unsigned long histogram[LIBX52_STATS_BUCKETS];
+} libx52_command_stats;
+
+/** Magic number at the start of a command journal, "X52J" */
+#define LIBX52_JOURNAL_MAGIC    0x4a323558
+
+/** Version of the command journal format */
+#define LIBX52_JOURNAL_VERSION  1
+
+/**
+ * @brief Header of a command journal file
+ *
+ * The header is followed by an array of \ref libx52_journal_record. All
+ * fields are in host byte order.
+ *
+ * @ingroup libx52misc
+ */
+typedef struct {
+    /** \ref LIBX52_JOURNAL_MAGIC */
+    uint32_t magic;
+
+    /** \ref LIBX52_JOURNAL_VERSION */
+    uint16_t version;
+
+    /** Size of each record in bytes */
+    uint16_t record_size;
+
+    /** Time at which the journal was started, in nanoseconds since the epoch */
+    uint64_t start_ns;
+} libx52_journal_header;
+
+/**
+ * @brief Record of a single vendor command in a command journal
+ *
+ * @ingroup libx52misc
+ */
+typedef struct {
+    /** Time at which the command was started, in nanoseconds since the start
+     * of the journal */
+    uint64_t time_ns;
+
+    /** Time taken by the command, including any retries, in microseconds */
+    uint32_t latency_us;
+
+    /** wIndex of the command */
+    uint16_t index;
+
+    /** wValue of the command */
+    uint16_t value;
+
+    /** Result of the command, as a \ref libx52_error_code */
+    int16_t result;
+
+    /** Number of retries of the command */
+    uint8_t retries;
+
+    /** Reserved, always 0 */
+    uint8_t reserved[5];
+} libx52_journal_record;
+
+/**
+ * @brief Update classes used when scheduling writes to the joystick
+ *
+ * Pending updates are written in the order of their class, and updates which
+ * have waited longer than the deadline of their class are written first. See
+ * \ref libx52_set_update_deadline.
+ *
+ * @ingroup libx52misc
+ */
+typedef enum {
+    /** Shift and blink indicators, LEDs and brightness */
+    LIBX52_UPDATE_CLASS_INDICATOR,
+
+    /** Date, time and secondary clocks */
+    LIBX52_UPDATE_CLASS_CLOCK,
+
+    /** MFD text */
+    LIBX52_UPDATE_CLASS_TEXT,
+
+    /** Number of update classes, not a valid class */
+    LIBX52_UPDATE_CLASS_MAX,
+} libx52_update_class;
+
+/**
+ * @brief Scheduling statistics for an update class
+ *
+ * The queueing delay of an update is the time between the first libx52_set
+ * call that changed the setting, and the start of the write to the joystick.
+ *
+ * @ingroup libx52misc
+ */
+typedef struct {
+    /** Number of updates written */
+    unsigned long updates;
+
+    /** Number of updates that were written after their deadline */
+    unsigned long deadline_misses;
+
+    /** Sum of the queueing delays of all updates, in microseconds */
+    uint64_t total_delay_us;
+
+    /** Largest queueing delay of any update, in microseconds */
+    uint64_t max_delay_us;
+} libx52_update_stats;
+
+/** Maximum number of MFD pages */
+#define LIBX52_PAGE_MAX         16
+
+/** Maximum length of a line of text on an MFD page */
+#define LIBX52_PAGE_LINE_MAX    256
+
+/** Default interval between scroll steps of a long line, in milliseconds */
+#define LIBX52_PAGE_SCROLL_MS   250
+
+/** Maximum number of keyframes in an animation */
+#define LIBX52_ANIM_KEYFRAME_MAX    32
+
+/** Interval between animation steps while a fade is running, in milliseconds */
+#define LIBX52_ANIM_TICK_MS         20
+
+/**
+ * @brief Animation keyframe
+ *
+ * @ingroup libx52anim
+ */
+typedef struct {
+    /** Time of the keyframe from the start of the animation, in milliseconds */
+    uint32_t time_ms;
+
+    /** \ref libx52_led_state for LED animations, or the brightness value */
+    uint16_t value;
+} libx52_keyframe;
+
+/**
+ * @brief Writer handle for a shared memory state segment
+ *
+ * This is returned by \ref libx52_shm_attach, in a process which publishes
+ * changes to the joystick state without owning the joystick.
+ *
+ * @ingroup libx52shm
+ */
+typedef struct libx52_shm libx52_shm;
+
+/**
+ * @brief MFD page input events
+ *
+ * These correspond to the buttons below the MFD on the X52 Pro.
+ *
+ * @ingroup libx52pages
+ */
+typedef enum {
+    /** Page Up button, switches to the previous page */
+    LIBX52_PAGE_EVENT_PG_UP,
+
+    /** Page Down button, switches to the next page */
+    LIBX52_PAGE_EVENT_PG_DN,
+
+    /** Up button */
+    LIBX52_PAGE_EVENT_UP,
+
+    /** Down button */
+    LIBX52_PAGE_EVENT_DN,
+
+    /** Select button */
+    LIBX52_PAGE_EVENT_SELECT,
+} libx52_page_event;
+
+/**
+ * @brief MFD page callback
+ *
+ * Called for every input event passed to \ref libx52_page_input, with the ID
+ * of the page that was active when the event happened. The callback may call
+ * any libx52 function, including the page functions.
+ *
+ * @param[in]   x52         Pointer to the device context
+ * @param[in]   page_id     ID of the active page
+ * @param[in]   event       Input event
+ * @param[in]   pressed     true if the button was pressed, false if released
+ * @param[in]   user_data   Pointer passed to \ref libx52_page_create
+ *
+ * @ingroup libx52pages
+ */
+typedef void (*libx52_page_callback)(libx52_device *x52, uint8_t page_id,
+                                     libx52_page_event event, bool pressed,
+                                     void *user_data);
+
 /**
  * @defgroup libx52init Library Initialization and Deinitialization
  *
@@ -313,6 +704,11 @@ void libx52_exit(libx52_device *dev);
  * If this function is called after it has already connected to a joystick,
  * then it will re-enumerate the bus and ensure that it is still connected.
  *
+ * If libusb supports hotplug notifications on this platform, libx52 tracks the
+ * attached joysticks as they are plugged in and unplugged, and this function
+ * opens the most recently seen joystick without rescanning the bus. The bus is
+ * still scanned if no joystick has been seen, or it cannot be opened.
+ *
  * @param[in]   dev     Pointer to the device context
  *
  * @returns \ref libx52_error_code indicating status
@@ -326,6 +722,10 @@ int libx52_connect(libx52_device *dev);
  * Applications must reconnect to the joystick using \ref libx52_connect prior
  * to calling \ref libx52_update.
  *
+ * Calling this function also suspends the automatic reconnection described in
+ * \ref libx52_update, until the application calls \ref libx52_connect or
+ * \ref libx52_connect_device.
+ *
  * @param[in]   dev     Pointer to the device context
  *
  * @returns \ref libx52_error_code indicating status
@@ -353,6 +753,76 @@ int libx52_disconnect(libx52_device *dev);
  */
 bool libx52_is_connected(libx52_device *dev);
 
+/**
+ * @brief List the supported joysticks attached to the host
+ *
+ * This function fills in the identity of every supported joystick, up to
+ * \p max entries, and returns the total number of joysticks found in \p
+ * found. If \p found is larger than \p max, then the application can call
+ * this again with a larger array.
+ *
+ * Each joystick is briefly opened to read its serial number. Joysticks that
+ * cannot be opened are still listed, with an empty serial number.
+ *
+ * @par Example
+ * @code
+ * libx52_device_info info[4];
+ * size_t found;
+ * size_t i;
+ *
+ * libx52_enumerate(dev, info, 4, &found);
+ * for (i = 0; i < found && i < 4; i++) {
+ *     printf("%04x:%04x on bus %d, serial %s\n", info[i].vendor_id,
+ *            info[i].product_id, info[i].bus, info[i].serial_number);
+ * }
+ * @endcode
+ *
+ * @param[in]   dev     Pointer to a device context
+ * @param[out]  info    Array of at least \p max entries
+ * @param[in]   max     Number of entries in \p info
+ * @param[out]  found   Number of supported joysticks found
+ *
+ * @returns \ref libx52_error_code indicating status
+ */
+int libx52_enumerate(libx52_device *dev, libx52_device_info *info,
+                     size_t max, size_t *found);
+
+/**
+ * @brief Connect to a specific joystick
+ *
+ * This function is similar to \ref libx52_connect, but connects to the
+ * joystick matching \p info, instead of the first supported joystick. If \p
+ * info has a serial number, the joystick is matched by its serial number,
+ * otherwise it is matched by its bus and port path. The device address is
+ * never used for matching, since it changes when the joystick is reconnected.
+ *
+ * To drive several joysticks, the application must use a separate device
+ * context for each one.
+ *
+ * @param[in]   dev     Pointer to the device context
+ * @param[in]   info    Identity of the joystick, from \ref libx52_enumerate
+ *
+ * @returns
+ * - 0 on success
+ * - \ref LIBX52_ERROR_NO_DEVICE if no matching joystick was found
+ * - \ref LIBX52_ERROR_INVALID_PARAM if either parameter is not valid
+ * - Another \ref libx52_error_code if the joystick could not be opened
+ */
+int libx52_connect_device(libx52_device *dev, const libx52_device_info *info);
+
+/**
+ * @brief Get the identity of the connected joystick
+ *
+ * @param[in]   dev     Pointer to the device context
+ * @param[out]  info    Identity of the connected joystick
+ *
+ * @returns
+ * - 0 on success
+ * - \ref LIBX52_ERROR_NO_DEVICE if no joystick is connected
+ * - \ref LIBX52_ERROR_INVALID_PARAM if either parameter is not valid
+ */
+int libx52_get_device_info(libx52_device *dev, libx52_device_info *info);
+
 /** @} */
 
 /**
@@ -423,109 +893,691 @@ int libx52_set_led_state(libx52_device *x52,
 /** @} */
 
 /**
- * @defgroup libx52clock Clock control
+ * @defgroup libx52pages MFD pages
  *
- * Control the clocks on the MFD
+ * Display multiple pages of text on the MFD, and switch between them using
+ * the buttons below the MFD.
+ *
+ * Each page has 3 lines of up to \ref LIBX52_PAGE_LINE_MAX characters. Lines
+ * longer than 16 characters scroll by one character every \ref
+ * LIBX52_PAGE_SCROLL_MS milliseconds, as long as the application calls \ref
+ * libx52_page_tick. The pages are displayed using \ref libx52_set_text, so
+ * the application must still call \ref libx52_update or one of its
+ * alternatives to write the text to the joystick. Only lines whose visible
+ * text has changed are set again.
+ *
+ * The page functions must not be called concurrently from multiple threads.
  *
  * @{
  */
 
 /**
- * @brief Set the clock
- *
- * This function sets the primary clock's date and time with the specified Unix
- * time value.  \p time can be obtained from \c time(2). \p local controls
- * whether the primary clock displays local time or GMT.
- *
- * If this function is called again within the same minute as calculated by
- * \c localtime(3) or \c gmtime(3), it will return \ref LIBX52_ERROR_TRY_AGAIN,
- * as it does not require any updates to be written to the joystick. However,
- * if the call changes the timezone from local time to GMT or vice-versa, then
- * the function will return 0, since it requires a write to the device to
- * update the clock with the new timezone.
+ * @brief Create an MFD page
  *
- * The secondary and tertiary clocks are driven off the primary clock and set
- * using \ref libx52_set_clock_timezone.
+ * The first page created becomes the active page. No page is displayed until
+ * \ref libx52_page_activate is called for the first time.
  *
- * @param[in]   x52     Pointer to the device context
- * @param[in]   time    Time value from \c time(3)
- * @param[in]   local   0 for GM time, non-zero for localtime
+ * @param[in]   x52         Pointer to the device context
+ * @param[out]  page_id     Pointer to save the ID of the new page
+ * @param[in]   callback    Callback for input events on this page, may be NULL
+ * @param[in]   user_data   Pointer passed to the callback
  *
  * @returns
- * - 0 on success
- * - \ref LIBX52_ERROR_TRY_AGAIN if no change from previous time
- * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 is not valid.
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 or \p page_id is not valid
+ * - \ref LIBX52_ERROR_OUT_OF_MEMORY if the page storage cannot be allocated
+ * - \ref LIBX52_ERROR_NOT_SUPPORTED if \ref LIBX52_PAGE_MAX pages already
+ *   exist
  */
-int libx52_set_clock(libx52_device *x52, time_t time, int local);
+int libx52_page_create(libx52_device *x52, uint8_t *page_id,
+                       libx52_page_callback callback, void *user_data);
 
 /**
- * @brief Set the timezone for the secondary and tertiary clocks.
- *
- * The X52 Pro has a total of 3 clock displays. The secondary and tertiary
- * clocks are controlled as an offset from the primary clock in minutes.
- * However, for convenience, the X52 library calculates this offset internally
- * and only requires you to set the timezone as the number of minutes east
- * of UTC. \p offset is limited to &plusmn; 1440 minutes, and any offset outside
- * this range will result in a return value of \ref LIBX52_ERROR_OUT_OF_RANGE
+ * @brief Delete an MFD page
  *
- * @par Example
- * @code
- * // Set clock 2 timezone to Pacific Standard Time (UTC-08:00)
- * rc = libx52_set_clock_timezone(dev, LIBX52_CLOCK_2, -480);
- * // Set clock 3 timezone to Indian Standard Time (UTC+05:30)
- * rc = libx52_set_clock_timezone(dev, LIBX52_CLOCK_2, 330);
- * @endcode
+ * If the page is active, the next page becomes active and is displayed.
  *
- * @param[in]   x52     Pointer to the device context
- * @param[in]   clock   \ref libx52_clock_id, cannot be \ref
- *                      LIBX52_CLOCK_1
- * @param[in]   offset  Offset in minutes from GMT (east is positive, west
- *                      is negative)
+ * @param[in]   x52         Pointer to the device context
+ * @param[in]   page_id     ID of the page
  *
  * @returns
- * - 0 on success
- * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 is invalid
- * - \ref LIBX52_ERROR_NOT_SUPPORTED if \p clock is \ref LIBX52_CLOCK_1
- * - \ref LIBX52_ERROR_OUT_OF_RANGE if \p offset is more than &plusmn; 24 hours.
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 or \p page_id is not valid
  */
-int libx52_set_clock_timezone(libx52_device *x52,
-                              libx52_clock_id clock,
-                              int offset);
+int libx52_page_delete(libx52_device *x52, uint8_t page_id);
 
 /**
- * @brief Set whether the clock is displayed in 12 hour or 24 hour format.
- *
- * The clocks on the X52 Pro MFD are all displayed as HH:MM, but can be set to
- * display it in 12-hour (AM/PM) or 24-hour format. The default format if not
- * specified is 12-hour.
+ * @brief Set the text of a line on an MFD page
  *
- * @par Limitations
- * The hardware has a limitation that it cannot display 12:00 am in 12 hour
- * mode - instead it will display as 00:00 am
+ * If the page is active, the line is displayed immediately, starting from the
+ * first character.
  *
- * @param[in]   x52     Pointer to the device context
- * @param[in]   clock   \ref libx52_clock_id
- * @param[in]   format  \ref libx52_clock_format
+ * @param[in]   x52         Pointer to the device context
+ * @param[in]   page_id     ID of the page
+ * @param[in]   line        Line to be updated (0, 1 or 2)
+ * @param[in]   text        Pointer to the text, in the MFD character map
+ * @param[in]   length      Length of the text, characters beyond \ref
+ *                          LIBX52_PAGE_LINE_MAX are discarded
  *
  * @returns
- * - 0 on success
- * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 is not valid, or if either of \p
- *   clock or \p format are outside their respective ranges.
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if any parameter is not valid
  */
-int libx52_set_clock_format(libx52_device *x52,
-                            libx52_clock_id clock,
-                            libx52_clock_format format);
+int libx52_page_set_line(libx52_device *x52, uint8_t page_id, uint8_t line,
+                         const char *text, uint16_t length);
 
 /**
- * @brief Set the hour and minute on clock 1
+ * @brief Display an MFD page
  *
- * This is a raw API which can be used for manual control if the user
- * so desires, however, it will not update the timezone or the date
- * values.
+ * All three lines of the page are set in a single frame, see \ref
+ * libx52_begin_frame.
  *
- * @param[in]   x52     Pointer to the device context
- * @param[in]   hour    Hour to display
- * @param[in]   minute  Minute to display
+ * @param[in]   x52         Pointer to the device context
+ * @param[in]   page_id     ID of the page
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 or \p page_id is not valid
+ */
+int libx52_page_activate(libx52_device *x52, uint8_t page_id);
+
+/**
+ * @brief Get the active MFD page
+ *
+ * @param[in]   x52         Pointer to the device context
+ * @param[out]  page_id     Pointer to save the ID of the active page
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 or \p page_id is not valid
+ * - \ref LIBX52_ERROR_NOT_SUPPORTED if there are no pages
+ */
+int libx52_page_get_active(libx52_device *x52, uint8_t *page_id);
+
+/**
+ * @brief Scroll the long lines on the active MFD page
+ *
+ * The application should call this function periodically. Each call after the
+ * scroll interval has elapsed advances the long lines of the active page by
+ * one character. If a call is late, the scroll is not caught up, instead the
+ * next step is scheduled one interval later.
+ *
+ * @param[in]   x52         Pointer to the device context
+ * @param[out]  next_ms     Pointer to save the time until the next call is
+ *                          due, in milliseconds. May be NULL.
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 is not valid
+ */
+int libx52_page_tick(libx52_device *x52, unsigned int *next_ms);
+
+/**
+ * @brief Set the scroll interval of long lines
+ *
+ * @param[in]   x52         Pointer to the device context
+ * @param[in]   interval_ms Interval between scroll steps in milliseconds, or
+ *                          0 for the default of \ref LIBX52_PAGE_SCROLL_MS
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 is not valid
+ */
+int libx52_page_set_scroll_interval(libx52_device *x52, unsigned int interval_ms);
+
+/**
+ * @brief Pass a button event to the MFD pages
+ *
+ * The event is passed to the callback of the active page. Pressing \ref
+ * LIBX52_PAGE_EVENT_PG_UP or \ref LIBX52_PAGE_EVENT_PG_DN then switches to the
+ * previous or next page, wrapping around at either end.
+ *
+ * The application is responsible for reading the buttons, for example, using
+ * libx52io, and calling this function when the state of one of the page
+ * buttons changes.
+ *
+ * @param[in]   x52         Pointer to the device context
+ * @param[in]   event       Input event
+ * @param[in]   pressed     true if the button was pressed, false if released
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 or \p event is not valid
+ * - \ref LIBX52_ERROR_NOT_SUPPORTED if there are no pages
+ */
+int libx52_page_input(libx52_device *x52, libx52_page_event event, bool pressed);
+
+/** @} */
+
+/**
+ * @defgroup libx52anim LED and brightness animations
+ *
+ * Animate the LEDs and the brightness of the MFD and LEDs in software.
+ *
+ * An animation is a list of up to \ref LIBX52_ANIM_KEYFRAME_MAX keyframes,
+ * each of which sets a value at a time relative to the start of the
+ * animation. LED animations step from one state to the next, while
+ * brightness animations fade linearly between keyframes. All animations are
+ * driven by \ref libx52_animation_tick, which the application should call
+ * at the interval it returns, and then call \ref libx52_update or one of the
+ * other update functions to write the changes.
+ *
+ * Values are applied using \ref libx52_set_led_state and \ref
+ * libx52_set_brightness, so an animation overrides any value that the
+ * application sets for the same LED or brightness while it is running.
+ *
+ * @{
+ */
+
+/**
+ * @brief Animate an LED
+ *
+ * Starting an animation on an LED replaces any animation already running on
+ * it. The animation starts immediately, and the state of the LED is not
+ * changed before the time of the first keyframe.
+ *
+ * @par Example
+ * @code
+ * // Flash the A button red and off, twice a second
+ * static const libx52_keyframe flash[] = {
+ *     {0, LIBX52_LED_STATE_RED},
+ *     {250, LIBX52_LED_STATE_OFF},
+ *     {500, LIBX52_LED_STATE_OFF},
+ * };
+ * rc = libx52_animate_led(dev, LIBX52_LED_A, flash, 3, true);
+ * @endcode
+ *
+ * @param[in]   x52     Pointer to the device context
+ * @param[in]   led     LED identifier (refer \ref libx52_led_id)
+ * @param[in]   frames  Keyframes, in increasing order of time. The values are
+ *                      \ref libx52_led_state
+ * @param[in]   count   Number of keyframes, or 0 to stop the animation and
+ *                      leave the LED in its current state
+ * @param[in]   repeat  true to restart the animation from the beginning at
+ *                      the time of the last keyframe
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52, \p led or \p frames is not
+ *   valid, or if all the keyframes of a repeating animation have the same
+ *   time
+ * - \ref LIBX52_ERROR_NOT_SUPPORTED if a keyframe has a state which the LED
+ *   does not support, or if the joystick is not an X52 Pro
+ * - \ref LIBX52_ERROR_OUT_OF_MEMORY if the animation could not be allocated
+ */
+int libx52_animate_led(libx52_device *x52, libx52_led_id led,
+                       const libx52_keyframe *frames, uint8_t count,
+                       bool repeat);
+
+/**
+ * @brief Animate the MFD or LED brightness
+ *
+ * The brightness fades linearly from each keyframe to the next. Starting an
+ * animation replaces any animation already running on the same brightness.
+ *
+ * @param[in]   x52     Pointer to the device context
+ * @param[in]   mfd     0 for the LED brightness, 1 for the MFD brightness
+ * @param[in]   frames  Keyframes, in increasing order of time. The values are
+ *                      brightness values as for \ref libx52_set_brightness
+ * @param[in]   count   Number of keyframes, or 0 to stop the animation and
+ *                      leave the brightness at its current value
+ * @param[in]   repeat  true to restart the animation from the beginning at
+ *                      the time of the last keyframe
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 or \p frames is not valid,
+ *   or if all the keyframes of a repeating animation have the same time
+ * - \ref LIBX52_ERROR_OUT_OF_MEMORY if the animation could not be allocated
+ */
+int libx52_animate_brightness(libx52_device *x52, uint8_t mfd,
+                              const libx52_keyframe *frames, uint8_t count,
+                              bool repeat);
+
+/**
+ * @brief Advance all running animations
+ *
+ * Each call applies the current value of every animation which has changed
+ * since the previous call. All the changes of a call are applied together in
+ * a frame, so that they are written in the same update. If the application
+ * has a frame open, the changes become part of that frame instead.
+ *
+ * If a transfer budget is set, and the changes would exceed it, then they
+ * are dropped rather than queued. The next call applies the values as of
+ * its own time, so intermediate steps are skipped, but the final value of
+ * every animation is always written.
+ *
+ * @param[in]   x52         Pointer to the device context
+ * @param[out]  next_ms     Pointer to save the time until the next call is
+ *                          due, in milliseconds. May be NULL.
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 is not valid
+ */
+int libx52_animation_tick(libx52_device *x52, unsigned int *next_ms);
+
+/**
+ * @brief Limit the rate of transfers used by animations
+ *
+ * The limit applies to the transfers needed by the changes applied in \ref
+ * libx52_animation_tick, and allows short bursts of up to 100 milliseconds
+ * worth of transfers. It does not limit the other settings, or animations
+ * which change the same value faster than the joystick is updated.
+ *
+ * @param[in]   x52                 Pointer to the device context
+ * @param[in]   transfers_per_sec   Maximum transfers per second, or 0 for no
+ *                                  limit
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 is not valid
+ * - \ref LIBX52_ERROR_OUT_OF_MEMORY if the animation state could not be
+ *   allocated
+ */
+int libx52_animation_set_budget(libx52_device *x52, unsigned int transfers_per_sec);
+
+/** @} */
+
+/**
+ * @defgroup libx52shm Shared memory state segment
+ *
+ * Publish changes to the joystick state from other processes, through a
+ * shared memory segment.
+ *
+ * The process which owns the joystick creates the segment with \ref
+ * libx52_shm_create, and passes the returned file descriptor to the writer
+ * processes, e.g., over a Unix domain socket. A writer maps the segment with
+ * \ref libx52_shm_attach, and changes the MFD text, LEDs, brightness and
+ * clock settings with the libx52_shm_set functions. These only copy the new
+ * value into the segment, and make no system calls unless the owner is
+ * waiting in \ref libx52_shm_wait.
+ *
+ * The owner calls \ref libx52_shm_sync to apply the settings which the
+ * writers changed since the last call, and then calls \ref libx52_update or
+ * one of the other update functions to write them to the joystick. Settings
+ * which the writers did not change are left alone, so the owner can keep
+ * setting them directly.
+ *
+ * The segment uses a sequence counter, so the owner always sees complete
+ * changes. Writers are serialized by a spin lock in the segment, which is
+ * only held while a value is being copied. If a writer is killed while
+ * holding it, the lock is taken over by the next writer, or by \ref
+ * libx52_shm_sync, and the part of the value it copied is applied.
+ *
+ * The shared memory segment is only supported on Linux.
+ *
+ * @{
+ */
+
+/**
+ * @brief Create the shared memory state segment
+ *
+ * The segment starts out with the current settings of the device context.
+ * Only one segment can be created for each device context, and it is
+ * destroyed by \ref libx52_shm_destroy or \ref libx52_exit.
+ *
+ * @param[in]   x52     Pointer to the device context
+ * @param[out]  fd      File descriptor of the segment, to pass to the
+ *                      writers. This is owned by libx52, and must not be
+ *                      closed by the application.
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 or \p fd is not valid
+ * - \ref LIBX52_ERROR_BUSY if the segment has already been created
+ * - \ref LIBX52_ERROR_OUT_OF_MEMORY if the segment could not be allocated
+ * - \ref LIBX52_ERROR_NOT_SUPPORTED if shared memory segments are not
+ *   supported on this platform
+ */
+int libx52_shm_create(libx52_device *x52, int *fd);
+
+/**
+ * @brief Apply the changes made by the writers
+ *
+ * This compares the segment with the settings it held at the previous call,
+ * and applies the settings which have changed using the libx52_set
+ * functions. All the changes are applied in a single frame, unless the
+ * application already has a frame open.
+ *
+ * A setting which the libx52_set functions reject is not applied, and the
+ * first such error is returned after the other settings have been applied.
+ * The rejected setting is tried again the next time a writer changes the
+ * segment.
+ *
+ * This function does not make any system calls, unless a writer is in the
+ * middle of a change.
+ *
+ * @param[in]   x52     Pointer to the device context
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success, or if nothing has changed
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 is not valid
+ * - \ref LIBX52_ERROR_NOT_SUPPORTED if the segment has not been created
+ * - \ref LIBX52_ERROR_TRY_AGAIN if a writer is still copying a value. No
+ *   changes are applied, call this again later.
+ * - Any error returned by the libx52_set functions, if a setting in the
+ *   segment was rejected
+ */
+int libx52_shm_sync(libx52_device *x52);
+
+/**
+ * @brief Wait for a writer to change the segment
+ *
+ * This function returns as soon as the segment has changed since the last
+ * call to \ref libx52_shm_sync, or the timeout expires.
+ *
+ * @param[in]   x52         Pointer to the device context
+ * @param[in]   timeout_ms  Timeout in milliseconds, or -1 to wait forever
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS if the segment has changed
+ * - \ref LIBX52_ERROR_TIMEOUT if the timeout expired first
+ * - \ref LIBX52_ERROR_INTERRUPTED if the wait was interrupted by a signal
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 is not valid
+ * - \ref LIBX52_ERROR_NOT_SUPPORTED if the segment has not been created
+ */
+int libx52_shm_wait(libx52_device *x52, int timeout_ms);
+
+/**
+ * @brief Destroy the shared memory state segment
+ *
+ * Writers which still have the segment mapped may keep writing to it, but
+ * their changes are no longer applied.
+ *
+ * @param[in]   x52     Pointer to the device context
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success, or if there is no segment
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 is not valid
+ */
+int libx52_shm_destroy(libx52_device *x52);
+
+/**
+ * @brief Map a shared memory state segment for writing
+ *
+ * @param[in]   fd      File descriptor of the segment, as returned by \ref
+ *                      libx52_shm_create in the owning process. The
+ *                      descriptor may be closed once this function returns.
+ * @param[out]  shm     Pointer to save the writer handle
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p shm is not valid, or \p fd is
+ *   not a libx52 state segment
+ * - \ref LIBX52_ERROR_NOT_SUPPORTED if the segment was created by an
+ *   incompatible version of libx52, or if shared memory segments are not
+ *   supported on this platform
+ * - \ref LIBX52_ERROR_OUT_OF_MEMORY if the segment could not be mapped
+ */
+int libx52_shm_attach(int fd, libx52_shm **shm);
+
+/**
+ * @brief Unmap a shared memory state segment
+ *
+ * @param[in]   shm     Writer handle
+ */
+void libx52_shm_detach(libx52_shm *shm);
+
+/**
+ * @brief Publish the text on an MFD line
+ *
+ * The arguments are the same as for \ref libx52_set_text.
+ *
+ * @param[in]   shm     Writer handle
+ * @param[in]   line    Line to be updated (0, 1 or 2)
+ * @param[in]   text    Pointer to the text string
+ * @param[in]   length  Length of the text to display, text longer than 16
+ *                      characters is truncated
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if any parameter is not valid
+ */
+int libx52_shm_set_text(libx52_shm *shm, uint8_t line, const char *text, uint8_t length);
+
+/**
+ * @brief Publish the state of an LED
+ *
+ * The arguments are the same as for \ref libx52_set_led_state.
+ *
+ * @param[in]   shm     Writer handle
+ * @param[in]   led     LED identifier (refer \ref libx52_led_id)
+ * @param[in]   state   State of the LED (refer \ref libx52_led_state)
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p shm, \p led or \p state is not
+ *   valid
+ * - \ref LIBX52_ERROR_NOT_SUPPORTED if the LED does not support \p state
+ */
+int libx52_shm_set_led_state(libx52_shm *shm, libx52_led_id led, libx52_led_state state);
+
+/**
+ * @brief Publish the MFD or LED brightness
+ *
+ * @param[in]   shm         Writer handle
+ * @param[in]   mfd         0 for the LED brightness, 1 for the MFD brightness
+ * @param[in]   brightness  Brightness level, as for \ref
+ *                          libx52_set_brightness
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p shm is not valid
+ */
+int libx52_shm_set_brightness(libx52_shm *shm, uint8_t mfd, uint16_t brightness);
+
+/**
+ * @brief Publish the state of the shift indicator
+ *
+ * @param[in]   shm     Writer handle
+ * @param[in]   state   0 for off, 1 for on
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p shm is not valid
+ */
+int libx52_shm_set_shift(libx52_shm *shm, uint8_t state);
+
+/**
+ * @brief Publish the blinking state of the POV hat LED
+ *
+ * @param[in]   shm     Writer handle
+ * @param[in]   state   0 for off, 1 for on
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p shm is not valid
+ */
+int libx52_shm_set_blink(libx52_shm *shm, uint8_t state);
+
+/**
+ * @brief Publish the offset of a secondary clock
+ *
+ * The arguments are the same as for \ref libx52_set_clock_timezone.
+ *
+ * @param[in]   shm     Writer handle
+ * @param[in]   clock   \ref LIBX52_CLOCK_2 or \ref LIBX52_CLOCK_3
+ * @param[in]   offset  Offset in minutes from UTC
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p shm or \p clock is not valid
+ * - \ref LIBX52_ERROR_NOT_SUPPORTED if \p clock is \ref LIBX52_CLOCK_1
+ * - \ref LIBX52_ERROR_OUT_OF_RANGE if \p offset is more than +/- 24 hours
+ */
+int libx52_shm_set_clock_timezone(libx52_shm *shm, libx52_clock_id clock, int offset);
+
+/**
+ * @brief Publish the time format of a clock
+ *
+ * @param[in]   shm     Writer handle
+ * @param[in]   clock   Clock identifier (refer \ref libx52_clock_id)
+ * @param[in]   format  Time format (refer \ref libx52_clock_format)
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if any parameter is not valid
+ */
+int libx52_shm_set_clock_format(libx52_shm *shm, libx52_clock_id clock,
+                                libx52_clock_format format);
+
+/**
+ * @brief Publish the date format
+ *
+ * @param[in]   shm     Writer handle
+ * @param[in]   format  Date format (refer \ref libx52_date_format)
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if any parameter is not valid
+ */
+int libx52_shm_set_date_format(libx52_shm *shm, libx52_date_format format);
+
+/** @} */
+
+/**
+ * @defgroup libx52clock Clock control
+ *
+ * Control the clocks on the MFD
+ *
+ * @{
+ */
+
+/**
+ * @brief Set the clock
+ *
+ * This function sets the primary clock's date and time with the specified Unix
+ * time value.  \p time can be obtained from \c time(2). \p local controls
+ * whether the primary clock displays local time or GMT.
+ *
+ * If this function is called again within the same minute as calculated by
+ * \c localtime(3) or \c gmtime(3), it will return \ref LIBX52_ERROR_TRY_AGAIN,
+ * as it does not require any updates to be written to the joystick. However,
+ * if the call changes the timezone from local time to GMT or vice-versa, then
+ * the function will return 0, since it requires a write to the device to
+ * update the clock with the new timezone.
+ *
+ * The secondary and tertiary clocks are driven off the primary clock and set
+ * using \ref libx52_set_clock_timezone. If they follow a zone set with
+ * \ref libx52_set_clock_zone, then this function also updates their offsets
+ * when \p time crosses a daylight saving transition in that zone.
+ *
+ * @param[in]   x52     Pointer to the device context
+ * @param[in]   time    Time value from \c time(3)
+ * @param[in]   local   0 for GM time, non-zero for localtime
+ *
+ * @returns
+ * - 0 on success
+ * - \ref LIBX52_ERROR_TRY_AGAIN if no change from previous time
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 is not valid.
+ */
+int libx52_set_clock(libx52_device *x52, time_t time, int local);
+
+/**
+ * @brief Set the timezone for the secondary and tertiary clocks.
+ *
+ * The X52 Pro has a total of 3 clock displays. The secondary and tertiary
+ * clocks are controlled as an offset from the primary clock in minutes.
+ * However, for convenience, the X52 library calculates this offset internally
+ * and only requires you to set the timezone as the number of minutes east
+ * of UTC. \p offset is limited to &plusmn; 1440 minutes, and any offset outside
+ * this range will result in a return value of \ref LIBX52_ERROR_OUT_OF_RANGE
+ *
+ * @par Example
+ * @code
+ * // Set clock 2 timezone to Pacific Standard Time (UTC-08:00)
+ * rc = libx52_set_clock_timezone(dev, LIBX52_CLOCK_2, -480);
+ * // Set clock 3 timezone to Indian Standard Time (UTC+05:30)
+ * rc = libx52_set_clock_timezone(dev, LIBX52_CLOCK_2, 330);
+ * @endcode
+ *
+ * @param[in]   x52     Pointer to the device context
+ * @param[in]   clock   \ref libx52_clock_id, cannot be \ref
+ *                      LIBX52_CLOCK_1
+ * @param[in]   offset  Offset in minutes from GMT (east is positive, west
+ *                      is negative)
+ *
+ * @returns
+ * - 0 on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 is invalid
+ * - \ref LIBX52_ERROR_NOT_SUPPORTED if \p clock is \ref LIBX52_CLOCK_1
+ * - \ref LIBX52_ERROR_OUT_OF_RANGE if \p offset is more than &plusmn; 24 hours.
+ */
+int libx52_set_clock_timezone(libx52_device *x52,
+                              libx52_clock_id clock,
+                              int offset);
+
+/**
+ * @brief Set the secondary or tertiary clock to follow a time zone
+ *
+ * Instead of a fixed offset, the secondary and tertiary clocks can follow a
+ * zone from the IANA time zone database, such as \c America/New_York. The
+ * zone is read from the directory given by the \c TZDIR environment
+ * variable, or \c /usr/share/zoneinfo if it is not set. The zone file is
+ * parsed once, and each subsequent call to \ref libx52_set_clock updates the
+ * clock offset if a daylight saving transition has occurred.
+ *
+ * The clock is set to the current offset of the zone immediately. Calling
+ * \ref libx52_set_clock_timezone, or this function with a NULL \p zone,
+ * stops the clock from following the zone.
+ *
+ * @par Example
+ * @code
+ * rc = libx52_set_clock_zone(dev, LIBX52_CLOCK_2, "Europe/London");
+ * @endcode
+ *
+ * @param[in]   x52     Pointer to the device context
+ * @param[in]   clock   \ref libx52_clock_id, cannot be \ref
+ *                      LIBX52_CLOCK_1
+ * @param[in]   zone    Name of the zone, relative to the zoneinfo directory,
+ *                      or NULL to keep the current offset fixed
+ *
+ * @returns
+ * - 0 on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 or \p zone is invalid
+ * - \ref LIBX52_ERROR_NOT_SUPPORTED if \p clock is \ref LIBX52_CLOCK_1
+ * - \ref LIBX52_ERROR_NOT_FOUND if the zone does not exist
+ * - \ref LIBX52_ERROR_IO if the zone file is not valid
+ * - \ref LIBX52_ERROR_OUT_OF_MEMORY if the zone could not be loaded
+ */
+int libx52_set_clock_zone(libx52_device *x52, libx52_clock_id clock,
+                          const char *zone);
+
+/**
+ * @brief Set whether the clock is displayed in 12 hour or 24 hour format.
+ *
+ * The clocks on the X52 Pro MFD are all displayed as HH:MM, but can be set to
+ * display it in 12-hour (AM/PM) or 24-hour format. The default format if not
+ * specified is 12-hour.
+ *
+ * @par Limitations
+ * The hardware has a limitation that it cannot display 12:00 am in 12 hour
+ * mode - instead it will display as 00:00 am
+ *
+ * @param[in]   x52     Pointer to the device context
+ * @param[in]   clock   \ref libx52_clock_id
+ * @param[in]   format  \ref libx52_clock_format
+ *
+ * @returns
+ * - 0 on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 is not valid, or if either of \p
+ *   clock or \p format are outside their respective ranges.
+ */
+int libx52_set_clock_format(libx52_device *x52,
+                            libx52_clock_id clock,
+                            libx52_clock_format format);
+
+/**
+ * @brief Set the hour and minute on clock 1
+ *
+ * This is a raw API which can be used for manual control if the user
+ * so desires, however, it will not update the timezone or the date
+ * values.
+ *
+ * @param[in]   x52     Pointer to the device context
+ * @param[in]   hour    Hour to display
+ * @param[in]   minute  Minute to display
  *
  * @returns
  * - 0 on success
@@ -564,6 +1616,86 @@ int libx52_set_date(libx52_device *x52, uint8_t dd, uint8_t mm, uint8_t yy);
  */
 int libx52_set_date_format(libx52_device *x52, libx52_date_format format);
 
+/**
+ * @brief Start the clock service
+ *
+ * The clock service keeps the primary clock in sync with the system time,
+ * without the application having to call \ref libx52_set_clock periodically.
+ * It returns a file descriptor which becomes readable at the start of every
+ * minute, and also when the system time is changed. The application should
+ * wait for it with \c poll(2) or similar, and call
+ * \ref libx52_clock_service_dispatch whenever it is readable.
+ *
+ * This function sets the clock to the current time, so the application
+ * should call \ref libx52_update after starting the service.
+ *
+ * @par Example
+ * @code
+ * struct pollfd pfd = { .events = POLLIN };
+ *
+ * rc = libx52_clock_service_start(dev, 1, &pfd.fd);
+ * libx52_update(dev);
+ * while (poll(&pfd, 1, -1) > 0) {
+ *     if (libx52_clock_service_dispatch(dev) == LIBX52_SUCCESS) {
+ *         libx52_update(dev);
+ *     }
+ * }
+ * @endcode
+ *
+ * The file descriptor belongs to the library, and is closed by
+ * \ref libx52_clock_service_stop or \ref libx52_exit.
+ *
+ * @param[in]   x52     Pointer to the device context
+ * @param[in]   local   0 for GM time, non-zero for localtime
+ * @param[out]  fd      File descriptor to wait on
+ *
+ * @returns
+ * - 0 on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 or \p fd is not valid
+ * - \ref LIBX52_ERROR_BUSY if the clock service is already running
+ * - \ref LIBX52_ERROR_NOT_SUPPORTED if the system has no timerfd support
+ * - \ref LIBX52_ERROR_INIT_FAILURE or \ref LIBX52_ERROR_OUT_OF_MEMORY if
+ *   the timer could not be created
+ */
+int libx52_clock_service_start(libx52_device *x52, int local, int *fd);
+
+/**
+ * @brief Handle an expiry of the clock service timer
+ *
+ * Call this function when the file descriptor returned by
+ * \ref libx52_clock_service_start is readable. It sets the clock to the
+ * current time, and arms the timer for the next minute. The time and date
+ * are only marked for update if the value displayed on the MFD changes, as
+ * with \ref libx52_set_clock. If the update thread is running, it is asked
+ * to write the change immediately.
+ *
+ * @param[in]   x52     Pointer to the device context
+ *
+ * @returns
+ * - 0 if the clock needs to be written to the joystick
+ * - \ref LIBX52_ERROR_TRY_AGAIN if the timer has not expired, or if the
+ *   displayed clock did not change
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 is not valid
+ * - \ref LIBX52_ERROR_NOT_SUPPORTED if the clock service is not running
+ * - \ref LIBX52_ERROR_IO if the timer could not be read or armed
+ */
+int libx52_clock_service_dispatch(libx52_device *x52);
+
+/**
+ * @brief Stop the clock service
+ *
+ * This closes the file descriptor returned by
+ * \ref libx52_clock_service_start. It is not an error to call this function
+ * if the clock service is not running.
+ *
+ * @param[in]   x52     Pointer to the device context
+ *
+ * @returns
+ * - 0 on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 is not valid
+ */
+int libx52_clock_service_stop(libx52_device *x52);
+
 /** @} */
 
 /**
@@ -635,12 +1767,492 @@ int libx52_set_blink(libx52_device *x52, uint8_t state);
  * not actually write anything to the joystick. This function writes the saved
  * data to the joystick and updates the internal data structures as necessary.
  *
+ * libx52 remembers the state that was last written to the joystick, and skips
+ * any settings that have not changed since then. For example, setting the
+ * same text on an MFD line and calling libx52_update does not write the line
+ * again. Use \ref libx52_get_saved_transfers to see how many transfers were
+ * skipped.
+ *
+ * Updates are written in order of priority, as described in \ref
+ * libx52_set_update_deadline. If a write fails, the remaining updates are
+ * still written, and the failed update is retried on the next call. The
+ * update stops early only if the joystick has been disconnected.
+ *
+ * If libusb supports hotplug notifications, and the joystick was unplugged,
+ * this function reconnects to it once it has been plugged back in, and writes
+ * every setting the application has made, since the joystick has lost them.
+ * The joystick is identified by its serial number if it has one, and by its
+ * USB port otherwise. Until it is plugged back in, this function returns
+ * \ref LIBX52_ERROR_NO_DEVICE without scanning the bus.
+ *
  * @param[in]   x52     Pointer to the device context
  *
  * @returns \ref libx52_error_code indicating status
  */
 int libx52_update(libx52_device *x52);
 
+/**
+ * @brief Start building a frame
+ *
+ * A frame groups several changes, so that they are written to the joystick
+ * together. After this call, the libx52_set functions modify a separate copy
+ * of the joystick state, which is not visible to \ref libx52_update, \ref
+ * libx52_update_submit or the update thread, until the frame is committed
+ * with \ref libx52_commit_frame. This ensures that an update never writes
+ * part of a frame, for example, the first line of a new page of text along
+ * with the second line of the old page.
+ *
+ * The next frame can be built while the previous one is still being written
+ * to the joystick.
+ *
+ * @param[in]   x52     Pointer to the device context
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if the device context is not valid
+ * - \ref LIBX52_ERROR_BUSY if a frame is already being built
+ */
+int libx52_begin_frame(libx52_device *x52);
+
+/**
+ * @brief Commit a frame
+ *
+ * This makes all the changes since \ref libx52_begin_frame visible to the
+ * next update in a single step. Only the settings whose value the frame has
+ * changed are written to the joystick.
+ *
+ * @param[in]   x52     Pointer to the device context
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if the device context is not valid, or
+ *   no frame is being built
+ */
+int libx52_commit_frame(libx52_device *x52);
+
+/**
+ * @brief Discard a frame
+ *
+ * This discards all the changes since \ref libx52_begin_frame.
+ *
+ * @param[in]   x52     Pointer to the device context
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if the device context is not valid, or
+ *   no frame is being built
+ */
+int libx52_abort_frame(libx52_device *x52);
+
+/**
+ * @brief Start an asynchronous update of the X52
+ *
+ * This function is the non-blocking equivalent of \ref libx52_update. It
+ * converts all the pending updates into vendor commands and submits them
+ * to the joystick using asynchronous USB transfers, keeping several of them
+ * in flight at a time. It returns as soon as the first batch of transfers has
+ * been submitted.
+ *
+ * The application must call \ref libx52_update_poll to process the transfer
+ * completions, until it returns a value other than \ref
+ * LIBX52_ERROR_TRY_AGAIN. While an asynchronous update is in progress, calls
+ * to \ref libx52_update and \ref libx52_update_submit return \ref
+ * LIBX52_ERROR_BUSY. The libx52_set functions may still be called, and their
+ * changes will be written on the next update.
+ *
+ * Commands are sent in the same order as \ref libx52_update. If a transfer
+ * fails, only the setting that generated it is affected. It is marked to be
+ * written again on the next update, while the remaining settings continue to
+ * be written.
+ *
+ * @par Example
+ * @code
+ * rc = libx52_update_submit(dev);
+ * // Do other work
+ * while ((rc = libx52_update_poll(dev, 0)) == LIBX52_ERROR_TRY_AGAIN) {
+ *     // Do other work
+ * }
+ * @endcode
+ *
+ * @param[in]   x52     Pointer to the device context
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS if the transfers were submitted
+ * - \ref LIBX52_ERROR_BUSY if an asynchronous update is already in progress
+ * - \ref LIBX52_ERROR_NO_DEVICE if the joystick is not connected
+ * - Another \ref libx52_error_code on other failures
+ */
+int libx52_update_submit(libx52_device *x52);
+
+/**
+ * @brief Process completions for an asynchronous update
+ *
+ * This function handles the USB events for an update started by \ref
+ * libx52_update_submit, and submits further transfers as earlier ones
+ * complete.
+ *
+ * @param[in]   x52     Pointer to the device context
+ * @param[in]   timeout Maximum time to wait in milliseconds. A value of 0
+ *                      only processes the events which are already pending,
+ *                      while a negative value waits until the update has
+ *                      completed.
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS if the update has completed successfully, or if there
+ *   is no update in progress
+ * - \ref LIBX52_ERROR_TRY_AGAIN if the update is still in progress
+ * - The \ref libx52_error_code of the first failed transfer otherwise. If
+ *   the joystick was disconnected, this returns \ref LIBX52_ERROR_NO_DEVICE
+ *   and the application must call \ref libx52_connect to reconnect.
+ */
+int libx52_update_poll(libx52_device *x52, int timeout);
+
+/**
+ * @brief Update several joysticks in parallel
+ *
+ * This function starts an update on each of the device contexts, and returns
+ * without waiting for the updates to complete, so that a slow or
+ * unresponsive joystick does not delay the updates to the others. A device
+ * with an update thread is flushed as if by \ref libx52_update_async. Any
+ * other device is written with asynchronous transfers, as if by \ref
+ * libx52_update_submit.
+ *
+ * If the transfers to a device are still in flight, its result is \ref
+ * LIBX52_ERROR_TRY_AGAIN. The application may complete the update with \ref
+ * libx52_update_poll, or simply call this function again, typically once
+ * per frame. The next call collects the result of the earlier update, and
+ * only starts a new update on that device once the earlier one has
+ * completed.
+ *
+ * @param[in]   devs    Array of device contexts, one per joystick
+ * @param[in]   count   Number of entries in \p devs
+ * @param[out]  results Array of \p count entries, which receives the result
+ *                      for each device. May be NULL.
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS if all the updates have completed or are still in
+ *   progress without errors
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p devs or any entry in it is NULL
+ * - The first error reported for any of the devices otherwise
+ */
+int libx52_update_all(libx52_device **devs, size_t count, int *results);
+
+/**
+ * @brief Allow the device context to be used from multiple threads
+ *
+ * By default, the application must serialize all calls to libx52 for a given
+ * device context. After this function is called, the libx52_set functions,
+ * the frame functions and the update functions may be called concurrently
+ * from any number of threads, and each update writes a consistent snapshot
+ * of the settings made so far.
+ *
+ * The LED, shift and blink setters do not take a lock, unless a frame is
+ * open, so a thread which only changes LEDs never waits behind a thread which
+ * is writing to the joystick. The other setters take a short lock, which is
+ * never held during USB transfers.
+ *
+ * 
+ef libx52_update_thread_start enables thread safety automatically. It
+ * cannot be disabled again, and 
+ef libx52_exit must still only be called
+ * once all other threads are done with the device context.
+ *
+ * @param[in]   x52     Pointer to the device context
+ *
+ * @returns
+ * - 
+ef LIBX52_SUCCESS on success, or if thread safety is already enabled
+ * - 
+ef LIBX52_ERROR_INVALID_PARAM if \p x52 is not valid
+ * - 
+ef LIBX52_ERROR_OUT_OF_MEMORY if the locks could not be allocated
+ */
+int libx52_enable_thread_safety(libx52_device *x52);
+
+/**
+ * @brief Start the background update thread
+ *
+ * This function starts a thread owned by the device context, which writes
+ * the pending updates to the joystick on its own, so that the application
+ * never blocks on USB transfers. Once the thread is running, the libx52_set
+ * functions only record the new state, and the thread writes it to the
+ * joystick every \p interval_ms milliseconds. Multiple changes to the same
+ * setting between two writes are combined into a single write.
+ *
+ * While the thread is running, \ref libx52_update and \ref
+ * libx52_update_submit return \ref LIBX52_ERROR_BUSY. Use \ref
+ * libx52_update_async to request an immediate write instead.
+ *
+ * The thread keeps running if the joystick is disconnected, and resumes
+ * writing once the application reconnects with \ref libx52_connect.
+ *
+ * @param[in]   x52         Pointer to the device context
+ * @param[in]   interval_ms Interval between writes in milliseconds. If this
+ *                          is 0, the thread only writes the pending updates
+ *                          when requested by \ref libx52_update_async.
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS if the thread was started
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 is not valid
+ * - \ref LIBX52_ERROR_BUSY if the thread is already running, or if an
+ *   asynchronous update is in progress
+ * - \ref LIBX52_ERROR_OUT_OF_MEMORY if the thread data could not be allocated
+ * - \ref LIBX52_ERROR_TRY_AGAIN or \ref LIBX52_ERROR_INIT_FAILURE if the
+ *   thread could not be created
+ */
+int libx52_update_thread_start(libx52_device *x52, unsigned int interval_ms);
+
+/**
+ * @brief Stop the background update thread
+ *
+ * This function stops the thread started by \ref libx52_update_thread_start
+ * and waits for it to exit. Any updates which have not yet been written
+ * remain pending, and will be written by the next call to \ref
+ * libx52_update. \ref libx52_exit stops the thread automatically.
+ *
+ * @param[in]   x52     Pointer to the device context
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success, or if the thread is not running
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 is not valid
+ */
+int libx52_update_thread_stop(libx52_device *x52);
+
+/**
+ * @brief Request an immediate update from the background thread
+ *
+ * This function wakes up the update thread to write the pending updates to
+ * the joystick, without waiting for the next interval. It returns without
+ * waiting for the write to complete.
+ *
+ * @param[in]   x52     Pointer to the device context
+ *
+ * @returns
+ * - The \ref libx52_error_code of the previous write by the update thread
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 is not valid
+ * - \ref LIBX52_ERROR_NOT_SUPPORTED if the update thread is not running
+ */
+int libx52_update_async(libx52_device *x52);
+
+/**
+ * @brief Get the number of transfers skipped by the update functions
+ *
+ * \ref libx52_update and \ref libx52_update_submit do not write settings
+ * which the joystick already has, and append to MFD text which only extends
+ * the text already displayed. This function returns the number of USB
+ * transfers that were avoided as a result.
+ *
+ * The saved state is discarded when the joystick is disconnected, or when
+ * \ref libx52_vendor_command is called, since the state of the joystick is
+ * no longer known. The next update will write all pending settings.
+ *
+ * @param[in]   x52     Pointer to the device context
+ * @param[out]  last    Transfers skipped by the most recent update, may be NULL
+ * @param[out]  total   Transfers skipped since the context was initialized,
+ *                      may be NULL
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 is not valid
+ */
+int libx52_get_saved_transfers(libx52_device *x52, unsigned int *last,
+                               unsigned long *total);
+
+/**
+ * @brief Set the scheduling deadline for an update class
+ *
+ * The update functions write pending updates in order of their class -
+ * indicators and LEDs first, then the clocks, and finally the MFD text. Each
+ * pending update has a deadline, which is the time at which it was first set,
+ * plus the deadline of its class. Updates that have passed their deadline are
+ * written ahead of all others, earliest deadline first. This prevents a
+ * constant stream of indicator updates from starving the MFD text when a
+ * transfer budget is set with \ref libx52_set_update_budget.
+ *
+ * The default deadlines are 50ms for indicators, 1 second for the clocks and
+ * 500ms for the MFD text.
+ *
+ * @param[in]   x52         Pointer to the device context
+ * @param[in]   update_class Update class to modify
+ * @param[in]   deadline_ms Deadline in milliseconds, 0 to disable
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 or \p update_class is not valid
+ */
+int libx52_set_update_deadline(libx52_device *x52,
+                               libx52_update_class update_class,
+                               unsigned int deadline_ms);
+
+/**
+ * @brief Limit the number of USB transfers made by a single update
+ *
+ * By default, \ref libx52_update writes all pending updates to the joystick.
+ * If a budget is set, then an update stops once the next pending update would
+ * exceed the budget, and the remaining updates are left for the next call.
+ * An update always writes at least one pending setting, even if it needs more
+ * transfers than the budget allows.
+ *
+ * @param[in]   x52         Pointer to the device context
+ * @param[in]   transfers   Maximum number of transfers, 0 for no limit
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 is not valid
+ */
+int libx52_set_update_budget(libx52_device *x52, unsigned int transfers);
+
+/**
+ * @brief Get the scheduling statistics for an update class
+ *
+ * @param[in]   x52         Pointer to the device context
+ * @param[in]   update_class Update class to query
+ * @param[out]  stats       Statistics for the update class
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if any of the parameters is not valid
+ */
+int libx52_get_update_stats(libx52_device *x52,
+                            libx52_update_class update_class,
+                            libx52_update_stats *stats);
+
+/**
+ * @brief Reset the scheduling statistics for all update classes
+ *
+ * @param[in]   x52         Pointer to the device context
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 is not valid
+ */
+int libx52_reset_update_stats(libx52_device *x52);
+
+/**
+ * @brief Set the retry policy for vendor commands
+ *
+ * The policy applies to all commands sent by \ref libx52_update, the update
+ * thread and \ref libx52_vendor_command. Commands sent by \ref
+ * libx52_update_submit use the timeout from the policy, but are not retried
+ * individually. Failed settings are retried on the next update instead.
+ *
+ * @par Example
+ * @code
+ * libx52_retry_policy policy;
+ * libx52_get_retry_policy(dev, &policy);
+ * policy.timeout_ms = 500;
+ * policy.backoff_ms = 10;
+ * policy.backoff_max_ms = 100;
+ * policy.breaker_threshold = 5;
+ * libx52_set_retry_policy(dev, &policy);
+ * @endcode
+ *
+ * @param[in]   x52     Pointer to the device context
+ * @param[in]   policy  New retry policy
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 or \p policy is not valid, or
+ *   if \c jitter_percent is more than 100
+ */
+int libx52_set_retry_policy(libx52_device *x52,
+                            const libx52_retry_policy *policy);
+
+/**
+ * @brief Get the retry policy for vendor commands
+ *
+ * @param[in]   x52     Pointer to the device context
+ * @param[out]  policy  Current retry policy
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 or \p policy is not valid
+ */
+int libx52_get_retry_policy(libx52_device *x52, libx52_retry_policy *policy);
+
+/**
+ * @brief Get the outcome counters for vendor commands
+ *
+ * @param[in]   x52         Pointer to the device context
+ * @param[out]  counters    Outcome counters since the context was initialized
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 or \p counters is not valid
+ */
+int libx52_get_retry_counters(libx52_device *x52,
+                              libx52_retry_counters *counters);
+
+/**
+ * @brief Get the statistics for a vendor command
+ *
+ * libx52 records the number of times each vendor command was sent, the number
+ * of errors and retries, and a histogram of the time it took to complete.
+ * These can be used to find out which commands dominate the time spent on USB
+ * transfers.
+ *
+ * @param[in]   x52     Pointer to the device context
+ * @param[in]   command Command to query
+ * @param[out]  stats   Statistics for the command
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if any of the parameters is not valid
+ */
+int libx52_get_stats(libx52_device *x52, libx52_command command,
+                     libx52_command_stats *stats);
+
+/**
+ * @brief Reset the statistics for all vendor commands
+ *
+ * @param[in]   x52     Pointer to the device context
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 is not valid
+ */
+int libx52_reset_stats(libx52_device *x52);
+
+/**
+ * @brief Start recording vendor commands to a journal
+ *
+ * Every vendor command sent to the joystick after this call, whether by an
+ * update function or by \ref libx52_vendor_command, is appended to the file
+ * at \p path as a \ref libx52_journal_record. The records have a fixed size,
+ * so the journal can be mapped into memory and indexed directly. The file is
+ * truncated when the journal is started.
+ *
+ * The x52replay utility sends the commands in a journal to a joystick again,
+ * which can be used to reproduce a problem, or to benchmark a workload.
+ *
+ * @param[in]   x52     Pointer to the device context
+ * @param[in]   path    Path of the journal file
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 or \p path is not valid
+ * - \ref LIBX52_ERROR_BUSY if a journal is already being recorded
+ * - \ref LIBX52_ERROR_PERM if the file could not be opened for writing
+ * - \ref LIBX52_ERROR_NOT_FOUND if the directory of the file does not exist
+ * - \ref LIBX52_ERROR_IO if the header could not be written
+ */
+int libx52_journal_start(libx52_device *x52, const char *path);
+
+/**
+ * @brief Stop recording vendor commands
+ *
+ * This flushes the journal and closes the file. \ref libx52_exit stops the
+ * journal automatically.
+ *
+ * @param[in]   x52     Pointer to the device context
+ *
+ * @returns
+ * - \ref LIBX52_SUCCESS on success, or if no journal is being recorded
+ * - \ref LIBX52_ERROR_INVALID_PARAM if \p x52 is not valid
+ * - \ref LIBX52_ERROR_IO if the journal could not be written completely
+ */
+int libx52_journal_stop(libx52_device *x52);
+
 /**
  * @brief Write a raw vendor control packet
  *
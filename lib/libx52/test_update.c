@@ -0,0 +1,542 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Update test suite
+ *
+ * These tests run libx52 against the libusbx52 stub, which logs every
+ * transfer to a file, and simulates transfer delays and failures.
+ *
+ * Copyright (C) 2012-2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "x52_commands.h"
+#include "x52_common.h"
+
+/* Maximum number of transfers checked by a test */
+#define MAX_TRANSFERS   64
+
+/* Simulated time taken by each transfer to the slow joystick */
+#define SLOW_DELAY      "200000"
+#define SLOW_DELAY_MS   200
+
+struct transfer {
+    uint16_t index;
+    uint16_t value;
+    bool failed;        /* The stub injected a fault into this transfer */
+};
+
+struct test_device {
+    libx52_device *dev;
+    char output[32];
+};
+
+static char device_list[32];
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void sleep_ms(unsigned int ms)
+{
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000L };
+
+    nanosleep(&ts, NULL);
+}
+
+/*
+ * Connect to a simulated joystick, with the given transfer delay and faults,
+ * either of which may be NULL. The stub reads both when libusb is
+ * initialized, and opens the output file when the joystick is connected.
+ */
+static void open_device(struct test_device *t, const char *delay,
+                        const char *faults)
+{
+    int fd;
+
+    strcpy(t->output, "/tmp/x52updateXXXXXX");
+    fd = mkstemp(t->output);
+    assert_true(fd >= 0);
+    close(fd);
+
+    setenv("LIBUSBX52_DEVICE_LIST", device_list, 1);
+    setenv("LIBUSBX52_OUTPUT_DATA", t->output, 1);
+    if (delay != NULL) {
+        setenv("LIBUSBX52_DELAY", delay, 1);
+    } else {
+        unsetenv("LIBUSBX52_DELAY");
+    }
+    if (faults != NULL) {
+        setenv("LIBUSBX52_FAULTS", faults, 1);
+    } else {
+        unsetenv("LIBUSBX52_FAULTS");
+    }
+
+    assert_int_equal(libx52_init(&t->dev), LIBX52_SUCCESS);
+    assert_true(libx52_is_connected(t->dev));
+}
+
+static void close_device(struct test_device *t)
+{
+    libx52_exit(t->dev);
+    unlink(t->output);
+}
+
+/* Read back the transfers logged by the stub, returns the number read */
+static int read_transfers(struct test_device *t, struct transfer *xfers)
+{
+    char line[256];
+    unsigned int value;
+    unsigned int index;
+    int count = 0;
+    FILE *fp;
+
+    fp = fopen(t->output, "r");
+    assert_non_null(fp);
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (strstr(line, "Injected:") != NULL) {
+            assert_true(count > 0);
+            xfers[count - 1].failed = true;
+        } else if (sscanf(line, "%*s RqType: %*x bRequest: %*x wValue: %x wIndex: %x",
+                          &value, &index) == 2) {
+            assert_true(count < MAX_TRANSFERS);
+            xfers[count].index = index;
+            xfers[count].value = value;
+            xfers[count].failed = false;
+            count++;
+        }
+    }
+
+    fclose(fp);
+    return count;
+}
+
+/* Wait for the given number of transfers to be logged */
+static int wait_transfers(struct test_device *t, struct transfer *xfers,
+                          int count)
+{
+    uint64_t deadline = now_ms() + 5000;
+    int n;
+
+    while ((n = read_transfers(t, xfers)) < count && now_ms() < deadline) {
+        sleep_ms(10);
+    }
+
+    return n;
+}
+
+static void assert_transfer(const struct transfer *xfer, uint16_t index,
+                            uint16_t value)
+{
+    assert_int_equal(xfer->index, index);
+    assert_int_equal(xfer->value, value);
+}
+
+static int group_setup(void **state)
+{
+    FILE *fp;
+    int fd;
+
+    strcpy(device_list, "/tmp/x52devlistXXXXXX");
+    fd = mkstemp(device_list);
+    if (fd < 0) {
+        return -1;
+    }
+
+    /* Each device context sees a single X52 Pro */
+    fp = fdopen(fd, "w");
+    fprintf(fp, "%04x %04x\n", 0x06a3, 0x0762);
+    fclose(fp);
+
+    return 0;
+}
+
+static int group_teardown(void **state)
+{
+    unlink(device_list);
+    return 0;
+}
+
+/* Run an asynchronous update to completion */
+static int update_async(libx52_device *dev)
+{
+    int rc;
+
+    rc = libx52_update_submit(dev);
+    if (rc != LIBX52_SUCCESS) {
+        return rc;
+    }
+
+    return libx52_update_poll(dev, -1);
+}
+
+/* Check the transfers for "Hello!" on MFD line 1 */
+static void assert_hello(const struct transfer *xfers)
+{
+    assert_transfer(&xfers[0], X52_MFD_LINE1 | X52_MFD_CLEAR_LINE, 0);
+    assert_transfer(&xfers[1], X52_MFD_LINE1, 0x6548);
+    assert_transfer(&xfers[2], X52_MFD_LINE1, 0x6c6c);
+    assert_transfer(&xfers[3], X52_MFD_LINE1, 0x216f);
+}
+
+static void test_submit_clear_first(void **state)
+{
+    struct test_device t;
+    struct transfer xfers[MAX_TRANSFERS];
+
+    /* Keep all the transfers in flight together */
+    open_device(&t, "1000", NULL);
+
+    assert_int_equal(libx52_set_text(t.dev, 0, "Hello!", 6), LIBX52_SUCCESS);
+    assert_int_equal(update_async(t.dev), LIBX52_SUCCESS);
+
+    /* The line is cleared before it is written */
+    assert_int_equal(read_transfers(&t, xfers), 4);
+    assert_hello(xfers);
+
+    close_device(&t);
+}
+
+static void test_submit_in_flight(void **state)
+{
+    struct test_device t;
+    struct transfer xfers[MAX_TRANSFERS];
+    int rc;
+
+    open_device(&t, "50000", NULL);
+
+    /* One clear and eight writes */
+    assert_int_equal(libx52_set_text(t.dev, 1, "0123456789abcdef", 16),
+                     LIBX52_SUCCESS);
+    assert_int_equal(libx52_update_submit(t.dev), LIBX52_SUCCESS);
+
+    /* The stub logs the transfers as they are submitted */
+    assert_int_equal(read_transfers(&t, xfers), X52_PIPELINE_DEPTH);
+    assert_int_equal(libx52_update_poll(t.dev, 0), LIBX52_ERROR_TRY_AGAIN);
+
+    /* Only one update can be in progress */
+    assert_int_equal(libx52_update_submit(t.dev), LIBX52_ERROR_BUSY);
+    assert_int_equal(libx52_update(t.dev), LIBX52_ERROR_BUSY);
+
+    /* The remaining write is submitted once a transfer has completed */
+    rc = libx52_update_poll(t.dev, -1);
+    assert_int_equal(rc, LIBX52_SUCCESS);
+    assert_int_equal(read_transfers(&t, xfers), X52_PIPELINE_DEPTH + 1);
+    assert_transfer(&xfers[0], X52_MFD_LINE2 | X52_MFD_CLEAR_LINE, 0);
+    assert_transfer(&xfers[8], X52_MFD_LINE2, 0x6665);
+
+    close_device(&t);
+}
+
+static void test_submit_requeue(void **state)
+{
+    struct test_device t;
+    struct transfer xfers[MAX_TRANSFERS];
+
+    /* The indicators are written first, so the clear of the line fails */
+    open_device(&t, NULL, "pipe#2");
+
+    assert_int_equal(libx52_set_shift(t.dev, 1), LIBX52_SUCCESS);
+    assert_int_equal(libx52_set_text(t.dev, 0, "Hello!", 6), LIBX52_SUCCESS);
+    assert_int_equal(update_async(t.dev), LIBX52_ERROR_PIPE);
+
+    assert_int_equal(read_transfers(&t, xfers), 5);
+    assert_transfer(&xfers[0], X52_SHIFT_INDICATOR, X52_SHIFT_ON);
+    assert_false(xfers[0].failed);
+    assert_hello(&xfers[1]);
+    assert_true(xfers[1].failed);
+
+    /* Only the failed line is written again, in full */
+    assert_int_equal(update_async(t.dev), LIBX52_SUCCESS);
+    assert_int_equal(read_transfers(&t, xfers), 9);
+    assert_hello(&xfers[5]);
+
+    /* Nothing is left to write */
+    assert_int_equal(update_async(t.dev), LIBX52_SUCCESS);
+    assert_int_equal(read_transfers(&t, xfers), 9);
+
+    close_device(&t);
+}
+
+static void test_submit_skip_failed(void **state)
+{
+    struct test_device t;
+    struct transfer xfers[MAX_TRANSFERS];
+    int i;
+
+    /* The clear fails, and is the first transfer to complete */
+    open_device(&t, "1000", "io#1");
+
+    assert_int_equal(libx52_set_text(t.dev, 2, "0123456789abcdef", 16),
+                     LIBX52_SUCCESS);
+    assert_int_equal(update_async(t.dev), LIBX52_ERROR_IO);
+
+    /* The writes in flight complete, but the last one is never submitted */
+    assert_int_equal(read_transfers(&t, xfers), X52_PIPELINE_DEPTH);
+    assert_true(xfers[0].failed);
+
+    /* The next update rewrites the whole line */
+    assert_int_equal(update_async(t.dev), LIBX52_SUCCESS);
+    assert_int_equal(read_transfers(&t, xfers), X52_PIPELINE_DEPTH + 9);
+    assert_transfer(&xfers[X52_PIPELINE_DEPTH],
+                    X52_MFD_LINE3 | X52_MFD_CLEAR_LINE, 0);
+    for (i = X52_PIPELINE_DEPTH + 1; i < X52_PIPELINE_DEPTH + 9; i++) {
+        assert_int_equal(xfers[i].index, X52_MFD_LINE3);
+        assert_false(xfers[i].failed);
+    }
+
+    close_device(&t);
+}
+
+static void test_submit_rejected(void **state)
+{
+    static const libx52_led_id leds[] = {
+        LIBX52_LED_A, LIBX52_LED_B, LIBX52_LED_D, LIBX52_LED_E, LIBX52_LED_T1
+    };
+    struct test_device t;
+    struct transfer xfers[MAX_TRANSFERS];
+    char faults[32];
+    int i;
+
+    /* A full pipeline worth of transfers fail to submit */
+    snprintf(faults, sizeof(faults), "reject#1-%d", X52_PIPELINE_DEPTH);
+    open_device(&t, NULL, faults);
+
+    /* Each LED is written with two commands, for different update bits */
+    for (i = 0; i < 5; i++) {
+        assert_int_equal(libx52_set_led_state(t.dev, leds[i],
+                                              LIBX52_LED_STATE_RED),
+                         LIBX52_SUCCESS);
+    }
+
+    /* The remaining commands are still submitted, and the update finishes */
+    assert_int_equal(update_async(t.dev), LIBX52_ERROR_IO);
+    assert_int_equal(read_transfers(&t, xfers), 10);
+    for (i = 0; i < 10; i++) {
+        assert_true(xfers[i].failed == (i < X52_PIPELINE_DEPTH));
+    }
+
+    /* The next update retries the commands which could not be submitted */
+    assert_int_equal(update_async(t.dev), LIBX52_SUCCESS);
+    assert_int_equal(read_transfers(&t, xfers), 10 + X52_PIPELINE_DEPTH);
+    for (i = 10; i < 10 + X52_PIPELINE_DEPTH; i++) {
+        assert_false(xfers[i].failed);
+    }
+
+    close_device(&t);
+}
+
+static void test_update_all_invalid(void **state)
+{
+    struct test_device t;
+    libx52_device *devs[2];
+
+    open_device(&t, NULL, NULL);
+
+    devs[0] = t.dev;
+    devs[1] = NULL;
+    assert_int_equal(libx52_update_all(NULL, 1, NULL),
+                     LIBX52_ERROR_INVALID_PARAM);
+    assert_int_equal(libx52_update_all(devs, 2, NULL),
+                     LIBX52_ERROR_INVALID_PARAM);
+    assert_int_equal(libx52_update_all(devs, 0, NULL), LIBX52_SUCCESS);
+
+    close_device(&t);
+}
+
+static void test_update_all_slow_device(void **state)
+{
+    struct test_device fast;
+    struct test_device slow;
+    struct transfer xfers[MAX_TRANSFERS];
+    libx52_device *devs[2];
+    int results[2];
+    uint64_t start;
+    int rc;
+
+    open_device(&fast, NULL, NULL);
+    open_device(&slow, SLOW_DELAY, NULL);
+    devs[0] = slow.dev;
+    devs[1] = fast.dev;
+
+    assert_int_equal(libx52_set_led_state(slow.dev, LIBX52_LED_FIRE,
+                                          LIBX52_LED_STATE_OFF),
+                     LIBX52_SUCCESS);
+    assert_int_equal(libx52_set_led_state(fast.dev, LIBX52_LED_FIRE,
+                                          LIBX52_LED_STATE_OFF),
+                     LIBX52_SUCCESS);
+
+    /* The fast joystick is updated without waiting for the slow one */
+    start = now_ms();
+    rc = libx52_update_all(devs, 2, results);
+    assert_true(now_ms() - start < SLOW_DELAY_MS);
+    assert_int_equal(rc, LIBX52_SUCCESS);
+    assert_int_equal(results[0], LIBX52_ERROR_TRY_AGAIN);
+    assert_int_equal(results[1], LIBX52_SUCCESS);
+
+    assert_int_equal(read_transfers(&fast, xfers), 1);
+    assert_transfer(&xfers[0], X52_LED, 0x0100);
+
+    /* Another change to the fast joystick doesn't wait either */
+    assert_int_equal(libx52_set_led_state(fast.dev, LIBX52_LED_THROTTLE,
+                                          LIBX52_LED_STATE_OFF),
+                     LIBX52_SUCCESS);
+    rc = libx52_update_all(devs, 2, results);
+    assert_int_equal(rc, LIBX52_SUCCESS);
+    assert_int_equal(results[0], LIBX52_ERROR_TRY_AGAIN);
+    assert_int_equal(results[1], LIBX52_SUCCESS);
+    assert_int_equal(read_transfers(&fast, xfers), 2);
+    assert_transfer(&xfers[1], X52_LED, 0x1400);
+
+    /* Later calls collect the result from the slow joystick */
+    start = now_ms();
+    while (results[0] == LIBX52_ERROR_TRY_AGAIN && now_ms() - start < 5000) {
+        sleep_ms(10);
+        rc = libx52_update_all(devs, 2, results);
+    }
+    assert_int_equal(rc, LIBX52_SUCCESS);
+    assert_int_equal(results[0], LIBX52_SUCCESS);
+    assert_int_equal(results[1], LIBX52_SUCCESS);
+
+    assert_int_equal(read_transfers(&slow, xfers), 1);
+    assert_transfer(&xfers[0], X52_LED, 0x0100);
+    assert_int_equal(read_transfers(&fast, xfers), 2);
+
+    close_device(&slow);
+    close_device(&fast);
+}
+
+static void test_update_all_error(void **state)
+{
+    struct test_device good;
+    struct test_device bad;
+    struct transfer xfers[MAX_TRANSFERS];
+    libx52_device *devs[2];
+    int results[2];
+    int rc;
+
+    open_device(&good, NULL, NULL);
+    open_device(&bad, NULL, "pipe#1");
+    devs[0] = bad.dev;
+    devs[1] = good.dev;
+
+    assert_int_equal(libx52_set_blink(bad.dev, 1), LIBX52_SUCCESS);
+    assert_int_equal(libx52_set_blink(good.dev, 1), LIBX52_SUCCESS);
+
+    /* The error is reported for the failed joystick only */
+    rc = libx52_update_all(devs, 2, results);
+    assert_int_equal(rc, LIBX52_ERROR_PIPE);
+    assert_int_equal(results[0], LIBX52_ERROR_PIPE);
+    assert_int_equal(results[1], LIBX52_SUCCESS);
+
+    /* The failed setting is written again on the next call */
+    rc = libx52_update_all(devs, 2, results);
+    assert_int_equal(rc, LIBX52_SUCCESS);
+    assert_int_equal(results[0], LIBX52_SUCCESS);
+    assert_int_equal(results[1], LIBX52_SUCCESS);
+
+    assert_int_equal(read_transfers(&bad, xfers), 2);
+    assert_transfer(&xfers[0], X52_BLINK_INDICATOR, X52_BLINK_ON);
+    assert_true(xfers[0].failed);
+    assert_transfer(&xfers[1], X52_BLINK_INDICATOR, X52_BLINK_ON);
+    assert_false(xfers[1].failed);
+    assert_int_equal(read_transfers(&good, xfers), 1);
+
+    close_device(&bad);
+    close_device(&good);
+}
+
+static void test_update_all_thread(void **state)
+{
+    struct test_device threaded;
+    struct test_device plain;
+    struct transfer xfers[MAX_TRANSFERS];
+    libx52_device *devs[2];
+    int results[2];
+    int rc;
+
+    open_device(&threaded, SLOW_DELAY, NULL);
+    open_device(&plain, NULL, NULL);
+    devs[0] = threaded.dev;
+    devs[1] = plain.dev;
+
+    /* Only flush the thread on request */
+    assert_int_equal(libx52_update_thread_start(threaded.dev, 0),
+                     LIBX52_SUCCESS);
+
+    assert_int_equal(libx52_set_shift(threaded.dev, 1), LIBX52_SUCCESS);
+    assert_int_equal(libx52_set_shift(plain.dev, 1), LIBX52_SUCCESS);
+
+    /* The update thread is woken up to write the change */
+    rc = libx52_update_all(devs, 2, results);
+    assert_int_equal(rc, LIBX52_SUCCESS);
+    assert_int_equal(results[0], LIBX52_SUCCESS);
+    assert_int_equal(results[1], LIBX52_SUCCESS);
+    assert_int_equal(read_transfers(&plain, xfers), 1);
+
+    assert_int_equal(wait_transfers(&threaded, xfers, 1), 1);
+    assert_transfer(&xfers[0], X52_SHIFT_INDICATOR, X52_SHIFT_ON);
+
+    close_device(&plain);
+    close_device(&threaded);
+}
+
+static void test_connect_hotplug_missed(void **state)
+{
+    struct test_device t;
+
+    open_device(&t, NULL, NULL);
+
+    /*
+     * The stub does not support hotplug, so pretend that the callback is
+     * registered, but has not reported the joystick yet. Connecting must
+     * still find it on the bus, and cache it for the next connect.
+     */
+    t.dev->hotplug = true;
+    assert_int_equal(libx52_connect(t.dev), LIBX52_SUCCESS);
+    assert_true(libx52_is_connected(t.dev));
+    assert_non_null(t.dev->hotplug_device);
+
+    assert_int_equal(libx52_connect(t.dev), LIBX52_SUCCESS);
+    assert_true(libx52_is_connected(t.dev));
+
+    /* There is no callback to deregister */
+    t.dev->hotplug = false;
+    close_device(&t);
+}
+
+const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_submit_clear_first),
+    cmocka_unit_test(test_submit_in_flight),
+    cmocka_unit_test(test_submit_requeue),
+    cmocka_unit_test(test_submit_skip_failed),
+    cmocka_unit_test(test_submit_rejected),
+    cmocka_unit_test(test_update_all_invalid),
+    cmocka_unit_test(test_update_all_slow_device),
+    cmocka_unit_test(test_update_all_error),
+    cmocka_unit_test(test_update_all_thread),
+    cmocka_unit_test(test_connect_hotplug_missed),
+};
+
+int main(void)
+{
+    cmocka_set_message_output(CM_OUTPUT_TAP);
+    cmocka_run_group_tests(tests, group_setup, group_teardown);
+    return 0;
+}
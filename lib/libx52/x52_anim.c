@@ -0,0 +1,369 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - LED and brightness animations
+ *
+ * Copyright (C) 2012-2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "libx52.h"
+#include "x52_common.h"
+
+/*
+ * All the animations are driven by libx52_animation_tick. Each tick works
+ * out the value of every track at the current time, and applies all the
+ * values that changed in a single frame, so that keyframes of different
+ * tracks which fall in the same tick are written in the same update pass.
+ *
+ * The transfer budget is a token bucket, kept as a time credit which
+ * refills at one nanosecond per nanosecond, up to X52_ANIM_BURST_NS. Each
+ * transfer costs 1/budget seconds of credit. A tick which cannot be paid
+ * for is dropped rather than queued, and the next tick writes the values
+ * as of its own time, so a slow device skips intermediate frames instead of
+ * falling behind.
+ */
+
+static int _x52_anim_alloc(libx52_device *x52)
+{
+    if (x52->anim == NULL) {
+        /* All animation storage is allocated up front, ticks never allocate */
+        x52->anim = calloc(1, sizeof(*x52->anim));
+        if (x52->anim == NULL) {
+            return LIBX52_ERROR_OUT_OF_MEMORY;
+        }
+    }
+
+    return LIBX52_SUCCESS;
+}
+
+static int _x52_anim_start(libx52_device *x52, unsigned int id,
+                           const libx52_keyframe *frames, uint8_t count,
+                           bool repeat, bool fade)
+{
+    struct x52_anim_track *track;
+    uint8_t i;
+    int rc;
+
+    if (count == 0) {
+        /* Stop the animation, and leave the last value on the device */
+        if (x52->anim != NULL) {
+            x52->anim->track[id].active = false;
+        }
+        return LIBX52_SUCCESS;
+    }
+
+    if (!frames || count > LIBX52_ANIM_KEYFRAME_MAX) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    for (i = 1; i < count; i++) {
+        if (frames[i].time_ms < frames[i - 1].time_ms) {
+            return LIBX52_ERROR_INVALID_PARAM;
+        }
+    }
+
+    /*
+     * A repeating animation restarts at the time of its last keyframe, so it
+     * would never reach its first keyframe if they were at the same time.
+     */
+    if (repeat && frames[count - 1].time_ms <= frames[0].time_ms) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    rc = _x52_anim_alloc(x52);
+    if (rc != LIBX52_SUCCESS) {
+        return rc;
+    }
+
+    track = &x52->anim->track[id];
+    memcpy(track->frame, frames, count * sizeof(*frames));
+    track->count = count;
+    track->repeat = repeat;
+    track->fade = fade;
+    track->shown = -1;
+    track->start_ns = _x52_monotonic_ns();
+    track->active = true;
+
+    return LIBX52_SUCCESS;
+}
+
+/*
+ * Compute the value of a track after elapsed milliseconds, or -1 if the
+ * first keyframe has not been reached. next_ms is set to the time until the
+ * value changes again, and finished is set once the final keyframe of a
+ * non-repeating animation has been reached.
+ */
+static int32_t _x52_anim_value(const struct x52_anim_track *track,
+                               uint64_t elapsed, uint64_t *next_ms,
+                               bool *finished)
+{
+    const libx52_keyframe *f = track->frame;
+    uint32_t duration = f[track->count - 1].time_ms;
+    uint8_t i;
+
+    *finished = false;
+
+    if (track->repeat) {
+        elapsed %= duration;
+    } else if (elapsed >= duration) {
+        *finished = true;
+        *next_ms = UINT_MAX;
+        return f[track->count - 1].value;
+    }
+
+    if (elapsed < f[0].time_ms) {
+        *next_ms = f[0].time_ms - elapsed;
+        return -1;
+    }
+
+    /* elapsed is before the last keyframe, so keyframe i + 1 exists */
+    i = 0;
+    while (f[i + 1].time_ms <= elapsed) {
+        i++;
+    }
+
+    if (track->fade && f[i].value != f[i + 1].value) {
+        *next_ms = LIBX52_ANIM_TICK_MS;
+        return (int32_t)(f[i].value +
+                         ((int64_t)f[i + 1].value - f[i].value) *
+                         (int64_t)(elapsed - f[i].time_ms) /
+                         (f[i + 1].time_ms - f[i].time_ms));
+    }
+
+    *next_ms = f[i + 1].time_ms - elapsed;
+    return f[i].value;
+}
+
+/* Number of transfers needed to write a new value for the track */
+static unsigned int _x52_anim_cost(unsigned int id)
+{
+    switch (id) {
+    case LIBX52_LED_FIRE / 2:
+    case LIBX52_LED_THROTTLE / 2:
+    case X52_ANIM_TRACK_BRI_LED:
+    case X52_ANIM_TRACK_BRI_MFD:
+        return 1;
+
+    default:
+        /* The red and green elements of the LED are written separately */
+        return 2;
+    }
+}
+
+/* Take the cost of a tick from the token bucket, if there is enough */
+static bool _x52_anim_spend(struct x52_anim *anim, uint64_t now,
+                            unsigned int transfers)
+{
+    uint64_t price;
+
+    if (anim->budget == 0) {
+        return true;
+    }
+
+    anim->credit_ns += now - anim->refill_ns;
+    if (anim->credit_ns > X52_ANIM_BURST_NS) {
+        anim->credit_ns = X52_ANIM_BURST_NS;
+    }
+    anim->refill_ns = now;
+
+    price = transfers * 1000000000ULL / anim->budget;
+    if (anim->credit_ns >= price) {
+        anim->credit_ns -= price;
+        return true;
+    }
+
+    /* A tick which costs more than a full bucket still has to go out */
+    if (anim->credit_ns == X52_ANIM_BURST_NS) {
+        anim->credit_ns = 0;
+        return true;
+    }
+
+    return false;
+}
+
+static void _x52_anim_apply(libx52_device *x52, unsigned int id, int32_t value)
+{
+    switch (id) {
+    case X52_ANIM_TRACK_BRI_LED:
+    case X52_ANIM_TRACK_BRI_MFD:
+        (void)libx52_set_brightness(x52, id == X52_ANIM_TRACK_BRI_MFD,
+                                    (uint16_t)value);
+        break;
+
+    default:
+        (void)libx52_set_led_state(x52, id ? id * 2 : LIBX52_LED_FIRE,
+                                   (libx52_led_state)value);
+        break;
+    }
+}
+
+static bool _x52_anim_led_valid(libx52_led_id led, libx52_led_state state)
+{
+    switch (led) {
+    case LIBX52_LED_FIRE:
+    case LIBX52_LED_THROTTLE:
+        return (state == LIBX52_LED_STATE_OFF || state == LIBX52_LED_STATE_ON);
+
+    case LIBX52_LED_A:
+    case LIBX52_LED_B:
+    case LIBX52_LED_D:
+    case LIBX52_LED_E:
+    case LIBX52_LED_T1:
+    case LIBX52_LED_T2:
+    case LIBX52_LED_T3:
+    case LIBX52_LED_POV:
+    case LIBX52_LED_CLUTCH:
+        return (state == LIBX52_LED_STATE_OFF || state == LIBX52_LED_STATE_RED ||
+                state == LIBX52_LED_STATE_AMBER || state == LIBX52_LED_STATE_GREEN);
+
+    default:
+        return false;
+    }
+}
+
+int libx52_animate_led(libx52_device *x52, libx52_led_id led,
+                       const libx52_keyframe *frames, uint8_t count,
+                       bool repeat)
+{
+    uint8_t i;
+    int rc;
+
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    rc = libx52_check_feature(x52, LIBX52_FEATURE_LED);
+    if (rc != LIBX52_SUCCESS) {
+        return rc;
+    }
+
+    if (!_x52_anim_led_valid(led, LIBX52_LED_STATE_OFF)) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    for (i = 0; frames != NULL && i < count; i++) {
+        if (!_x52_anim_led_valid(led, frames[i].value)) {
+            return LIBX52_ERROR_NOT_SUPPORTED;
+        }
+    }
+
+    return _x52_anim_start(x52, led / 2, frames, count, repeat, false);
+}
+
+int libx52_animate_brightness(libx52_device *x52, uint8_t mfd,
+                              const libx52_keyframe *frames, uint8_t count,
+                              bool repeat)
+{
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    return _x52_anim_start(x52,
+                           mfd ? X52_ANIM_TRACK_BRI_MFD : X52_ANIM_TRACK_BRI_LED,
+                           frames, count, repeat, true);
+}
+
+int libx52_animation_set_budget(libx52_device *x52, unsigned int transfers_per_sec)
+{
+    int rc;
+
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    rc = _x52_anim_alloc(x52);
+    if (rc != LIBX52_SUCCESS) {
+        return rc;
+    }
+
+    x52->anim->budget = transfers_per_sec;
+    x52->anim->credit_ns = X52_ANIM_BURST_NS;
+    x52->anim->refill_ns = _x52_monotonic_ns();
+
+    return LIBX52_SUCCESS;
+}
+
+int libx52_animation_tick(libx52_device *x52, unsigned int *next_ms)
+{
+    struct x52_anim *anim;
+    struct x52_anim_track *track;
+    int32_t value[X52_ANIM_TRACKS];
+    bool finished[X52_ANIM_TRACKS];
+    unsigned int transfers = 0;
+    uint64_t next = UINT_MAX;
+    uint64_t track_next;
+    uint64_t now;
+    bool framed;
+    unsigned int id;
+
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    anim = x52->anim;
+    if (anim == NULL) {
+        if (next_ms) {
+            *next_ms = LIBX52_ANIM_TICK_MS;
+        }
+        return LIBX52_SUCCESS;
+    }
+
+    now = _x52_monotonic_ns();
+
+    for (id = 0; id < X52_ANIM_TRACKS; id++) {
+        track = &anim->track[id];
+        value[id] = -1;
+        if (!track->active) {
+            continue;
+        }
+
+        value[id] = _x52_anim_value(track, (now - track->start_ns) / 1000000,
+                                    &track_next, &finished[id]);
+        if (value[id] == track->shown) {
+            /* Nothing to write, and the animation is over once it is shown */
+            track->active = !finished[id];
+            value[id] = -1;
+        } else if (value[id] >= 0) {
+            transfers += _x52_anim_cost(id);
+        }
+
+        if (track_next < next) {
+            next = track_next;
+        }
+    }
+
+    if (transfers > 0) {
+        if (_x52_anim_spend(anim, now, transfers)) {
+            /* If the application has a frame open, the tick becomes part of it */
+            framed = (libx52_begin_frame(x52) == LIBX52_SUCCESS);
+
+            for (id = 0; id < X52_ANIM_TRACKS; id++) {
+                if (value[id] >= 0) {
+                    _x52_anim_apply(x52, id, value[id]);
+                    anim->track[id].shown = value[id];
+                    anim->track[id].active = !finished[id];
+                }
+            }
+
+            if (framed) {
+                (void)libx52_commit_frame(x52);
+            }
+        } else if (next > LIBX52_ANIM_TICK_MS) {
+            /* Dropped, try again soon so the latest values get written */
+            next = LIBX52_ANIM_TICK_MS;
+        }
+    }
+
+    if (next_ms) {
+        *next_ms = (next == UINT_MAX) ? LIBX52_ANIM_TICK_MS : (unsigned int)next;
+    }
+
+    return LIBX52_SUCCESS;
+}
@@ -0,0 +1,450 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - asynchronous update pipeline
+ *
+ * Copyright (C) 2012-2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "libx52.h"
+#include "x52_commands.h"
+#include "x52_common.h"
+
+/*
+ * The pipeline converts the pending update mask into a queue of vendor
+ * commands, and keeps up to X52_PIPELINE_DEPTH of them in flight using the
+ * libusb asynchronous API. All control transfers go to the default control
+ * endpoint, which processes them in submission order. This guarantees that
+ * the clear command for an MFD line always reaches the device before the
+ * writes for that line.
+ *
+ * A failed transfer only affects the update bit that generated it. The bit
+ * is set again in the update mask, and any remaining commands for that bit
+ * are skipped, since a partially written line or date must be rewritten in
+ * full. Commands for all other bits continue to be sent.
+ */
+
+bool _x52_pipeline_active(libx52_device *x52)
+{
+    struct x52_pipeline *p = x52->pipeline;
+
+    return (p != NULL && (p->in_flight > 0 || p->next < p->queued));
+}
+
+int _x52_pipeline_queue(libx52_device *x52, uint32_t bit,
+                        uint16_t index, uint16_t value)
+{
+    struct x52_pipeline *p = x52->pipeline;
+    struct x52_pipeline_cmd *cmd;
+
+    if (p->queued >= X52_PIPELINE_QUEUE) {
+        return LIBX52_ERROR_OUT_OF_MEMORY;
+    }
+
+    cmd = &p->queue[p->queued++];
+    cmd->index = index;
+    cmd->value = value;
+    cmd->bit = bit;
+
+    return LIBX52_SUCCESS;
+}
+
+/*
+ * Mark the update bit as failed, so that it gets retried on the next pass.
+ * The shadow of the committed state was updated when the commands were
+ * queued, so it must be invalidated as well.
+ */
+static void _x52_pipeline_fail(struct x52_pipeline *p, uint32_t bit, int rc)
+{
+    set_bit(&p->failed_mask, bit);
+    atomic_set_bit(&p->dev->update_mask, bit);
+    clr_bit(&p->dev->committed_mask, bit);
+
+    if (p->status == LIBX52_SUCCESS) {
+        p->status = rc;
+    }
+}
+
+/* Abandon any commands that have not yet been submitted */
+static void _x52_pipeline_abandon(struct x52_pipeline *p, int rc)
+{
+    for (; p->next < p->queued; p->next++) {
+        _x52_pipeline_fail(p, p->queue[p->next].bit, rc);
+    }
+}
+
+static void LIBUSB_CALL _x52_pipeline_callback(struct libusb_transfer *xfer);
+
+/* Submit the command in the slot, returns the libusb error code */
+static int _x52_pipeline_submit(struct x52_pipeline *p,
+                                struct x52_pipeline_slot *slot)
+{
+    struct x52_pipeline_cmd *cmd = &p->queue[slot->cmd];
+    int rc;
+
+    libusb_fill_control_setup(slot->setup,
+        LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE | LIBUSB_ENDPOINT_OUT,
+        X52_VENDOR_REQUEST, cmd->value, cmd->index, 0);
+    libusb_fill_control_transfer(slot->xfer, p->dev->hdl, slot->setup,
+        _x52_pipeline_callback, slot, _x52_vendor_timeout(p->dev));
+
+    slot->active = true;
+    slot->submitted = _x52_monotonic_ns();
+    p->in_flight++;
+
+    rc = libusb_submit_transfer(slot->xfer);
+    if (rc != LIBUSB_SUCCESS) {
+        slot->active = false;
+        p->in_flight--;
+    }
+
+    return rc;
+}
+
+/* Submit queued commands until the pipeline is full */
+static void _x52_pipeline_fill(struct x52_pipeline *p)
+{
+    unsigned int i;
+    uint32_t bit;
+    int rc;
+
+    for (i = 0; i < X52_PIPELINE_DEPTH && p->next < p->queued; i++) {
+        struct x52_pipeline_slot *slot = &p->slot[i];
+
+        /*
+         * A command which fails to submit leaves the slot free, so the next
+         * command is tried in the same slot. Otherwise a fill in which every
+         * submit failed would leave commands queued with no transfer in
+         * flight whose callback would submit them.
+         */
+        while (!slot->active) {
+            /* Skip the remaining commands of any bit that has already failed */
+            while (p->next < p->queued &&
+                   tst_bit(&p->failed_mask, p->queue[p->next].bit)) {
+                p->next++;
+            }
+            if (p->next >= p->queued) {
+                return;
+            }
+
+            slot->cmd = p->next++;
+            rc = _x52_pipeline_submit(p, slot);
+            if (rc == LIBUSB_SUCCESS) {
+                break;
+            }
+
+            bit = p->queue[slot->cmd].bit;
+            if (rc == LIBUSB_ERROR_NO_DEVICE) {
+                _x52_pipeline_fail(p, bit, LIBX52_ERROR_NO_DEVICE);
+                _x52_pipeline_abandon(p, LIBX52_ERROR_NO_DEVICE);
+            } else {
+                _x52_pipeline_fail(p, bit, _x52_translate_libusb_error(rc));
+            }
+        }
+    }
+}
+
+static void LIBUSB_CALL _x52_pipeline_callback(struct libusb_transfer *xfer)
+{
+    struct x52_pipeline_slot *slot = xfer->user_data;
+    struct x52_pipeline *p = slot->pipeline;
+    uint32_t bit = p->queue[slot->cmd].bit;
+    int rc;
+
+    slot->active = false;
+    p->in_flight--;
+
+    switch (xfer->status) {
+    case LIBUSB_TRANSFER_COMPLETED:
+        rc = LIBX52_SUCCESS;
+        break;
+
+    case LIBUSB_TRANSFER_NO_DEVICE:
+        rc = LIBX52_ERROR_NO_DEVICE;
+        break;
+
+    case LIBUSB_TRANSFER_TIMED_OUT:
+        rc = LIBX52_ERROR_TIMEOUT;
+        break;
+
+    case LIBUSB_TRANSFER_STALL:
+        rc = LIBX52_ERROR_PIPE;
+        break;
+
+    case LIBUSB_TRANSFER_OVERFLOW:
+        rc = LIBX52_ERROR_OVERFLOW;
+        break;
+
+    case LIBUSB_TRANSFER_CANCELLED:
+        rc = LIBX52_ERROR_INTERRUPTED;
+        break;
+
+    case LIBUSB_TRANSFER_ERROR:
+    default:
+        rc = LIBX52_ERROR_IO;
+        break;
+    }
+
+    _x52_record_command(p->dev, p->queue[slot->cmd].index,
+                        p->queue[slot->cmd].value, rc, 0,
+                        _x52_monotonic_ns() - slot->submitted);
+
+    /* Cancelled transfers are not failures of the device */
+    if (rc != LIBX52_ERROR_INTERRUPTED && _x52_command_done(p->dev, rc, 0)) {
+        /* The circuit breaker has tripped, treat this as a disconnect so
+         * that libx52_update_poll closes the device handle.
+         */
+        rc = LIBX52_ERROR_NO_DEVICE;
+    }
+
+    if (rc == LIBX52_ERROR_NO_DEVICE) {
+        _x52_pipeline_fail(p, bit, rc);
+        _x52_pipeline_abandon(p, rc);
+    } else if (rc != LIBX52_SUCCESS) {
+        _x52_pipeline_fail(p, bit, rc);
+    }
+
+    _x52_pipeline_fill(p);
+}
+
+static int _x52_pipeline_alloc(libx52_device *x52)
+{
+    struct x52_pipeline *p;
+    int i;
+
+    p = calloc(1, sizeof(*p));
+    if (p == NULL) {
+        return LIBX52_ERROR_OUT_OF_MEMORY;
+    }
+
+    p->dev = x52;
+    for (i = 0; i < X52_PIPELINE_DEPTH; i++) {
+        p->slot[i].pipeline = p;
+        p->slot[i].xfer = libusb_alloc_transfer(0);
+        if (p->slot[i].xfer == NULL) {
+            x52->pipeline = p;
+            _x52_pipeline_free(x52);
+            return LIBX52_ERROR_OUT_OF_MEMORY;
+        }
+    }
+
+    x52->pipeline = p;
+    return LIBX52_SUCCESS;
+}
+
+void _x52_pipeline_cancel(libx52_device *x52)
+{
+    struct x52_pipeline *p = x52->pipeline;
+    int i;
+
+    if (p == NULL) {
+        return;
+    }
+
+    /* Don't submit anything else, and cancel whatever is in flight */
+    p->next = p->queued;
+    for (i = 0; i < X52_PIPELINE_DEPTH; i++) {
+        if (p->slot[i].active) {
+            (void)libusb_cancel_transfer(p->slot[i].xfer);
+        }
+    }
+
+    /* libusb requires all transfers to complete before closing the handle */
+    while (p->in_flight > 0) {
+        if (libusb_handle_events_completed(x52->ctx, NULL) != LIBUSB_SUCCESS) {
+            break;
+        }
+    }
+}
+
+void _x52_pipeline_free(libx52_device *x52)
+{
+    struct x52_pipeline *p = x52->pipeline;
+    int i;
+
+    if (p == NULL) {
+        return;
+    }
+
+    for (i = 0; i < X52_PIPELINE_DEPTH; i++) {
+        if (p->slot[i].xfer != NULL) {
+            libusb_free_transfer(p->slot[i].xfer);
+        }
+    }
+
+    free(p);
+    x52->pipeline = NULL;
+}
+
+int libx52_update_submit(libx52_device *x52)
+{
+    struct x52_pipeline *p;
+    struct x52_state state;
+    uint32_t update_mask;
+    uint8_t order[32];
+    unsigned int count;
+    unsigned int n;
+    int rc = LIBX52_SUCCESS;
+
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    if (_x52_pipeline_active(x52) || _x52_worker_active(x52)) {
+        return LIBX52_ERROR_BUSY;
+    }
+
+    if (!x52->hdl && _x52_reconnect(x52) != LIBX52_SUCCESS) {
+        return LIBX52_ERROR_NO_DEVICE;
+    }
+
+    if (x52->pipeline == NULL) {
+        rc = _x52_pipeline_alloc(x52);
+        if (rc != LIBX52_SUCCESS) {
+            return rc;
+        }
+    }
+
+    p = x52->pipeline;
+
+    p->queued = 0;
+    p->next = 0;
+    p->failed_mask = 0;
+    p->status = LIBX52_SUCCESS;
+
+    update_mask = atomic_take_mask(&x52->update_mask);
+    _x52_snapshot(x52, &state);
+    x52->saved_last = 0;
+
+    /* Run the update handlers to build the command queue, in the same
+     * order and with the same budget as libx52_update.
+     */
+    count = _x52_schedule(x52, &state, update_mask, order);
+    p->building = true;
+    for (n = 0; n < count; n++) {
+        unsigned int start = p->queued;
+        uint32_t i = order[n];
+        unsigned int transfers;
+        int handler_rc;
+
+        if (_x52_handlers[i] == NULL) {
+            continue;
+        }
+
+        /* Skip settings which the device already has */
+        if (_x52_state_unchanged(x52, &state, i)) {
+            x52->saved_last += _x52_transfer_count(&state, i);
+            continue;
+        }
+
+        transfers = _x52_write_count(x52, &state, i);
+        if (x52->transfer_budget != 0 && start != 0 &&
+            start + transfers > x52->transfer_budget) {
+            /* Leave this and all remaining bits for the next pass */
+            for (; n < count; n++) {
+                atomic_set_bit(&x52->update_mask, order[n]);
+            }
+            break;
+        }
+
+        _x52_record_delay(x52, &state, i);
+
+        handler_rc = (*_x52_handlers[i])(x52, &state, i);
+        if (handler_rc == LIBX52_SUCCESS) {
+            x52->saved_last += _x52_transfer_count(&state, i) - transfers;
+            _x52_state_commit(x52, &state, i);
+        } else {
+            /* Drop any partial commands, and retry the bit on the next pass */
+            p->queued = start;
+            atomic_set_bit(&x52->update_mask, i);
+            if (rc == LIBX52_SUCCESS) {
+                rc = handler_rc;
+            }
+        }
+    }
+    p->building = false;
+    x52->saved_total += x52->saved_last;
+
+    _x52_pipeline_fill(p);
+
+    return rc;
+}
+
+int libx52_update_poll(libx52_device *x52, int timeout)
+{
+    struct x52_pipeline *p;
+    struct timespec deadline;
+    struct timespec now;
+    struct timeval tv;
+    long remaining = 0;
+    int rc;
+
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    p = x52->pipeline;
+    if (p == NULL) {
+        return LIBX52_SUCCESS;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    if (timeout > 0) {
+        deadline.tv_sec += timeout / 1000;
+        deadline.tv_nsec += (long)(timeout % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    while (_x52_pipeline_active(x52)) {
+        if (timeout < 0) {
+            rc = libusb_handle_events_completed(x52->ctx, NULL);
+        } else {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            remaining = (deadline.tv_sec - now.tv_sec) * 1000000L +
+                        (deadline.tv_nsec - now.tv_nsec) / 1000;
+            if (remaining < 0) {
+                remaining = 0;
+            }
+
+            tv.tv_sec = remaining / 1000000L;
+            tv.tv_usec = remaining % 1000000L;
+            rc = libusb_handle_events_timeout_completed(x52->ctx, &tv, NULL);
+        }
+
+        if (rc != LIBUSB_SUCCESS && rc != LIBUSB_ERROR_INTERRUPTED) {
+            return _x52_translate_libusb_error(rc);
+        }
+
+        if (timeout >= 0 && remaining == 0) {
+            break;
+        }
+    }
+
+    if (_x52_pipeline_active(x52)) {
+        return LIBX52_ERROR_TRY_AGAIN;
+    }
+
+    /* The pass has completed, report the first error, if any */
+    rc = p->status;
+    p->status = LIBX52_SUCCESS;
+
+    if (rc == LIBX52_ERROR_NO_DEVICE) {
+        /* Physical device has likely been disconnected, disconnect the virtual
+         * handle, and report the failure.
+         */
+        (void)_x52_disconnect(x52);
+    }
+
+    return rc;
+}
@@ -0,0 +1,358 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - update throughput benchmark
+ *
+ * Copyright (C) 2012-2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+/*
+ * This program is built from the libx52 sources and the libusbx52 stub, so
+ * no joystick is needed, and measures the host side cost of libx52_update
+ * for several workloads. It is run by `make bench`.
+ *
+ * The libx52 sources are built with malloc, calloc and realloc redirected to
+ * the counting wrappers below, in the same way that the unit tests redirect
+ * libusb_control_transfer.
+ */
+
+/* The wrappers themselves need the real allocator */
+#undef malloc
+#undef calloc
+#undef realloc
+
+#include "config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libx52.h"
+
+void *bench_malloc(size_t size);
+void *bench_calloc(size_t nmemb, size_t size);
+void *bench_realloc(void *ptr, size_t size);
+
+static unsigned long alloc_count;
+
+void *bench_malloc(size_t size)
+{
+    alloc_count++;
+    return malloc(size);
+}
+
+void *bench_calloc(size_t nmemb, size_t size)
+{
+    alloc_count++;
+    return calloc(nmemb, size);
+}
+
+void *bench_realloc(void *ptr, size_t size)
+{
+    alloc_count++;
+    return realloc(ptr, size);
+}
+
+struct bench_result {
+    unsigned long updates;
+    unsigned long commands;
+    unsigned long allocs;
+    uint64_t update_ns;
+};
+
+typedef void (*bench_step)(libx52_device *x52, unsigned long i);
+
+static const libx52_led_id bench_leds[] = {
+    LIBX52_LED_A, LIBX52_LED_B, LIBX52_LED_D, LIBX52_LED_E,
+    LIBX52_LED_T1, LIBX52_LED_T2, LIBX52_LED_T3, LIBX52_LED_POV,
+    LIBX52_LED_CLUTCH,
+};
+
+static const libx52_led_state bench_states[] = {
+    LIBX52_LED_STATE_OFF, LIBX52_LED_STATE_RED,
+    LIBX52_LED_STATE_AMBER, LIBX52_LED_STATE_GREEN,
+};
+
+#define N_BENCH_LEDS    (sizeof(bench_leds) / sizeof(bench_leds[0]))
+
+/* Fixed start time, so that every run updates the same date fields */
+#define BENCH_EPOCH     1577836800
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void set_leds(libx52_device *x52, unsigned long i)
+{
+    size_t led;
+
+    for (led = 0; led < N_BENCH_LEDS; led++) {
+        libx52_set_led_state(x52, bench_leds[led], bench_states[(i + led) % 4]);
+    }
+    libx52_set_led_state(x52, LIBX52_LED_FIRE,
+                         (i & 1) ? LIBX52_LED_STATE_ON : LIBX52_LED_STATE_OFF);
+    libx52_set_led_state(x52, LIBX52_LED_THROTTLE,
+                         (i & 1) ? LIBX52_LED_STATE_OFF : LIBX52_LED_STATE_ON);
+}
+
+static void set_line(libx52_device *x52, uint8_t line, unsigned long i)
+{
+    char text[24];
+    int length;
+
+    length = snprintf(text, sizeof(text), "Line %u %9lu", line + 1, i % 1000000000);
+    libx52_set_text(x52, line, text, (uint8_t)length);
+}
+
+/* Every setting changes on every update */
+static void step_redraw(libx52_device *x52, unsigned long i)
+{
+    uint8_t line;
+
+    for (line = 0; line < 3; line++) {
+        set_line(x52, line, i);
+    }
+    set_leds(x52, i);
+    libx52_set_brightness(x52, 1, (uint16_t)(i % 128));
+    libx52_set_brightness(x52, 0, (uint16_t)(127 - i % 128));
+    libx52_set_shift(x52, (uint8_t)(i & 1));
+    libx52_set_blink(x52, (uint8_t)(i & 1));
+    libx52_set_clock(x52, BENCH_EPOCH + (time_t)i * 86400, 0);
+}
+
+/* Every LED changes on every update */
+static void step_leds(libx52_device *x52, unsigned long i)
+{
+    set_leds(x52, i);
+}
+
+/* The clock advances by one minute on every update */
+static void step_clock(libx52_device *x52, unsigned long i)
+{
+    libx52_set_clock(x52, BENCH_EPOCH + (time_t)i * 60, 0);
+}
+
+/*
+ * Clock ticks, with a few LED changes, and an occasional text or brightness
+ * change, similar to an application showing the state of a simulator
+ */
+static void step_mixed(libx52_device *x52, unsigned long i)
+{
+    libx52_set_clock(x52, BENCH_EPOCH + (time_t)i * 60, 0);
+    libx52_set_led_state(x52, bench_leds[i % N_BENCH_LEDS],
+                         bench_states[(i / N_BENCH_LEDS) % 4]);
+    if (i % 8 == 0) {
+        set_line(x52, (uint8_t)((i / 8) % 3), i);
+    }
+    if (i % 64 == 0) {
+        libx52_set_brightness(x52, 1, (uint16_t)((i / 64) % 128));
+    }
+}
+
+static const struct {
+    const char *name;
+    bench_step step;
+} workloads[] = {
+    {"redraw", step_redraw},
+    {"leds", step_leds},
+    {"clock", step_clock},
+    {"mixed", step_mixed},
+};
+
+#define N_WORKLOADS     (sizeof(workloads) / sizeof(workloads[0]))
+
+static unsigned long total_commands(libx52_device *x52)
+{
+    libx52_command_stats stats;
+    unsigned long count = 0;
+    int cmd;
+
+    for (cmd = 0; cmd < LIBX52_COMMAND_MAX; cmd++) {
+        if (libx52_get_stats(x52, cmd, &stats) == LIBX52_SUCCESS) {
+            count += stats.count;
+        }
+    }
+
+    return count;
+}
+
+static int run_workload(bench_step step, unsigned long iterations,
+                        struct bench_result *result)
+{
+    libx52_device *x52;
+    unsigned long i;
+    uint64_t start;
+    unsigned long allocs;
+    int rc;
+
+    rc = libx52_init(&x52);
+    if (rc != LIBX52_SUCCESS) {
+        return rc;
+    }
+
+    rc = libx52_connect(x52);
+    if (rc != LIBX52_SUCCESS) {
+        libx52_exit(x52);
+        return rc;
+    }
+
+    /* Write the initial state, so that it is not counted */
+    step(x52, 0);
+    rc = libx52_update(x52);
+    if (rc != LIBX52_SUCCESS) {
+        libx52_exit(x52);
+        return rc;
+    }
+    libx52_reset_stats(x52);
+
+    memset(result, 0, sizeof(*result));
+    for (i = 1; i <= iterations; i++) {
+        step(x52, i);
+
+        allocs = alloc_count;
+        start = monotonic_ns();
+        rc = libx52_update(x52);
+        result->update_ns += monotonic_ns() - start;
+        result->allocs += alloc_count - allocs;
+
+        if (rc != LIBX52_SUCCESS) {
+            break;
+        }
+    }
+
+    result->updates = i - 1;
+    result->commands = total_commands(x52);
+    libx52_exit(x52);
+
+    return rc;
+}
+
+/*
+ * Point the stub at a device list with a single X52 Pro, and discard the
+ * transfers, unless the caller has set up the stub already
+ */
+static int setup_stub(char *dev_list, size_t size)
+{
+    static const char pro[] = "06a3 0762\n";
+    const char *tmpdir = getenv("TMPDIR");
+    int fd;
+
+    if (getenv("LIBUSBX52_DEVICE_LIST") == NULL) {
+        snprintf(dev_list, size, "%s/x52bench.XXXXXX",
+                 tmpdir ? tmpdir : "/tmp");
+        fd = mkstemp(dev_list);
+        if (fd < 0) {
+            perror(dev_list);
+            return -1;
+        }
+        if (write(fd, pro, sizeof(pro) - 1) != (ssize_t)(sizeof(pro) - 1)) {
+            perror(dev_list);
+            close(fd);
+            unlink(dev_list);
+            return -1;
+        }
+        close(fd);
+        setenv("LIBUSBX52_DEVICE_LIST", dev_list, 1);
+    } else {
+        dev_list[0] = '\0';
+    }
+
+    setenv("LIBUSBX52_OUTPUT_DATA", "/dev/null", 0);
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    size_t w;
+
+    fprintf(stderr, "Usage: %s [-n iterations] [workload...]\n", prog);
+    fprintf(stderr, "Workloads:");
+    for (w = 0; w < N_WORKLOADS; w++) {
+        fprintf(stderr, " %s", workloads[w].name);
+    }
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+    struct bench_result result;
+    unsigned long iterations = 100000;
+    char dev_list[256];
+    bool selected[N_WORKLOADS];
+    bool any = false;
+    char *end;
+    size_t w;
+    int opt;
+    int rc = 0;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n':
+            iterations = strtoul(optarg, &end, 0);
+            if (*end != '\0' || iterations == 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    memset(selected, 0, sizeof(selected));
+    for (; optind < argc; optind++) {
+        for (w = 0; w < N_WORKLOADS; w++) {
+            if (!strcmp(argv[optind], workloads[w].name)) {
+                selected[w] = true;
+                any = true;
+                break;
+            }
+        }
+        if (w == N_WORKLOADS) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (setup_stub(dev_list, sizeof(dev_list)) < 0) {
+        return EXIT_FAILURE;
+    }
+
+    printf("%-8s %10s %10s %12s %12s %14s %14s\n", "workload", "updates",
+           "commands", "commands/s", "ns/update", "ns/command",
+           "allocs/update");
+
+    for (w = 0; w < N_WORKLOADS; w++) {
+        if (any && !selected[w]) {
+            continue;
+        }
+
+        rc = run_workload(workloads[w].step, iterations, &result);
+        if (rc != LIBX52_SUCCESS) {
+            fprintf(stderr, "%s: %s\n", workloads[w].name, libx52_strerror(rc));
+            break;
+        }
+
+        printf("%-8s %10lu %10lu %12.0f %12.0f %14.1f %14.2f\n",
+               workloads[w].name, result.updates, result.commands,
+               result.update_ns ? result.commands * 1e9 / result.update_ns : 0.0,
+               (double)result.update_ns / result.updates,
+               result.commands ? (double)result.update_ns / result.commands : 0.0,
+               (double)result.allocs / result.updates);
+    }
+
+    if (dev_list[0] != '\0') {
+        unlink(dev_list);
+    }
+
+    return (rc == LIBX52_SUCCESS) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
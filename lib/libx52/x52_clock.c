@@ -0,0 +1,166 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - clock service
+ *
+ * Copyright (C) 2012-2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+#endif
+
+#include "libx52.h"
+#include "x52_common.h"
+
+/*
+ * The clock service keeps the primary clock up to date without having the
+ * application poll libx52_set_clock. It uses a timer on the realtime clock,
+ * which expires at the start of every minute, so the display changes at the
+ * same moment as the system clock. The timer is cancelled by the kernel if
+ * the realtime clock is set, in which case the clock is refreshed and the
+ * timer armed again for the new minute boundary.
+ */
+
+#if HAVE_SYS_TIMERFD_H
+/* Arm the timer for the start of the next minute */
+static int _x52_clock_arm(libx52_device *x52)
+{
+    struct itimerspec its;
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = (now.tv_sec / 60 + 1) * 60;
+
+    if (timerfd_settime(x52->clock_fd,
+                        TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET,
+                        &its, NULL) < 0) {
+        return LIBX52_ERROR_IO;
+    }
+
+    return LIBX52_SUCCESS;
+}
+
+/*
+ * Refresh the primary clock from the system time. libx52_set_clock only
+ * marks the time and date for update if the displayed value has changed.
+ */
+static int _x52_clock_refresh(libx52_device *x52)
+{
+    int rc;
+
+    rc = libx52_set_clock(x52, time(NULL), x52->clock_local);
+    if (rc == LIBX52_SUCCESS && _x52_worker_active(x52)) {
+        (void)libx52_update_async(x52);
+    }
+
+    return rc;
+}
+#endif
+
+int libx52_clock_service_start(libx52_device *x52, int local, int *fd)
+{
+#if HAVE_SYS_TIMERFD_H
+    int rc;
+
+    if (!x52 || !fd) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    if (x52->clock_service) {
+        return LIBX52_ERROR_BUSY;
+    }
+
+    x52->clock_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (x52->clock_fd < 0) {
+        return (errno == ENOMEM) ? LIBX52_ERROR_OUT_OF_MEMORY :
+                                   LIBX52_ERROR_INIT_FAILURE;
+    }
+
+    x52->clock_local = local;
+    rc = _x52_clock_arm(x52);
+    if (rc != LIBX52_SUCCESS) {
+        close(x52->clock_fd);
+        return rc;
+    }
+
+    x52->clock_service = true;
+    (void)_x52_clock_refresh(x52);
+
+    *fd = x52->clock_fd;
+    return LIBX52_SUCCESS;
+#else
+    (void)x52;
+    (void)local;
+    (void)fd;
+    return LIBX52_ERROR_NOT_SUPPORTED;
+#endif
+}
+
+int libx52_clock_service_dispatch(libx52_device *x52)
+{
+#if HAVE_SYS_TIMERFD_H
+    uint64_t expirations;
+    ssize_t rc;
+
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    if (!x52->clock_service) {
+        return LIBX52_ERROR_NOT_SUPPORTED;
+    }
+
+    rc = read(x52->clock_fd, &expirations, sizeof(expirations));
+    if (rc < 0) {
+        switch (errno) {
+        case EAGAIN:
+        case EINTR:
+            /* The timer has not expired yet */
+            return LIBX52_ERROR_TRY_AGAIN;
+
+        case ECANCELED:
+            /* The realtime clock was set, the minute boundary has moved */
+            break;
+
+        default:
+            return LIBX52_ERROR_IO;
+        }
+    }
+
+    if (_x52_clock_arm(x52) != LIBX52_SUCCESS) {
+        return LIBX52_ERROR_IO;
+    }
+
+    return _x52_clock_refresh(x52);
+#else
+    (void)x52;
+    return LIBX52_ERROR_NOT_SUPPORTED;
+#endif
+}
+
+int libx52_clock_service_stop(libx52_device *x52)
+{
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    if (x52->clock_service) {
+        close(x52->clock_fd);
+        x52->clock_service = false;
+    }
+
+    return LIBX52_SUCCESS;
+}
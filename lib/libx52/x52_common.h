@@ -9,6 +9,7 @@
 #ifndef X52JOY_COMMON_H
 #define X52JOY_COMMON_H
 
+#include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <libusb.h>
@@ -25,18 +26,65 @@
 #define X52_MFD_LINES       3
 #define X52_MFD_CLOCKS      3
 
+/* Default timeout for a single vendor control transfer, in milliseconds */
+#define X52_VENDOR_TIMEOUT  5000
+
+/* Default number of attempts for a single vendor command */
+#define X52_VENDOR_ATTEMPTS 3
+
+/*
+ * The update pipeline keeps up to X52_PIPELINE_DEPTH control transfers in
+ * flight. X52_PIPELINE_QUEUE must be large enough to hold every command
+ * generated by a single update pass: 1 shift + 20 LEDs + 3 * (1 clear +
+ * 8 writes) + 1 blink + 2 brightness + 2 date + 3 clocks = 56 commands.
+ */
+#define X52_PIPELINE_DEPTH  8
+#define X52_PIPELINE_QUEUE  64
+
 struct x52_mfd_line {
     uint8_t     text[X52_MFD_LINE_SIZE];
     uint8_t     length;
 };
 
-struct libx52_device {
-    libusb_context *ctx;
-    libusb_device_handle *hdl;
+struct x52_pipeline_cmd {
+    uint16_t    index;
+    uint16_t    value;
+    uint8_t     bit;
+};
 
-    uint32_t update_mask;
-    uint32_t flags;
+struct x52_pipeline;
+
+struct x52_pipeline_slot {
+    struct libusb_transfer *xfer;
+    struct x52_pipeline *pipeline;
+    unsigned int cmd;
+    uint64_t submitted;         /* Monotonic time of submission in ns */
+    bool active;
+    unsigned char setup[LIBUSB_CONTROL_SETUP_SIZE];
+};
 
+struct x52_pipeline {
+    libx52_device *dev;
+
+    struct x52_pipeline_slot slot[X52_PIPELINE_DEPTH];
+    struct x52_pipeline_cmd queue[X52_PIPELINE_QUEUE];
+
+    unsigned int queued;        /* Number of commands in the queue */
+    unsigned int next;          /* Next command to be submitted */
+    unsigned int in_flight;     /* Number of submitted transfers */
+
+    uint32_t failed_mask;       /* Update bits with a failed transfer */
+    int status;                 /* First error seen in this pass */
+    bool building;              /* Handlers queue instead of sending */
+};
+
+/*
+ * Device state that is written to the joystick. A single copy of this holds
+ * the pending state set by the libx52_set functions, while a second copy
+ * holds the state that was last committed to the hardware. New settings must
+ * also be copied in _x52_frame_copy.
+ */
+struct x52_state {
     uint32_t led_mask;
     uint16_t mfd_brightness;
     uint16_t led_brightness;
@@ -51,8 +99,226 @@ struct libx52_device {
 
     int timezone[X52_MFD_CLOCKS];
     libx52_clock_format time_format[X52_MFD_CLOCKS];
+
+    /* Monotonic time in ns at which each pending update bit was first set */
+    uint64_t pending_since[32];
+};
+
+/* Scheduling statistics for a single update class */
+struct x52_class_stats {
+    unsigned long updates;
+    unsigned long deadline_misses;
+    uint64_t total_delay_ns;
+    uint64_t max_delay_ns;
+};
+
+/*
+ * MFD pages. A line longer than the MFD is scrolled by treating its text,
+ * followed by X52_PAGE_SCROLL_GAP blanks, as a ring, and displaying the
+ * window of X52_MFD_LINE_SIZE characters starting at offset.
+ */
+#define X52_PAGE_SCROLL_GAP 4
+
+struct x52_page_line {
+    char text[LIBX52_PAGE_LINE_MAX];
+    uint16_t length;
+    uint16_t offset;
+};
+
+struct x52_page {
+    bool used;
+    libx52_page_callback callback;
+    void *user_data;
+    struct x52_page_line line[X52_MFD_LINES];
+};
+
+struct x52_pages {
+    struct x52_page page[LIBX52_PAGE_MAX];
+    uint8_t active;
+    unsigned int count;
+    bool shown;                 /* Active page is displayed on the MFD */
+
+    unsigned int scroll_ms;     /* Scroll interval, 0 for the default */
+    uint64_t next_scroll_ns;    /* Monotonic time of the next scroll step */
+};
+
+/*
+ * Animations. There is one track for each LED, indexed by the LED identifier
+ * divided by 2, followed by one track for each brightness setting.
+ */
+#define X52_ANIM_TRACK_BRI_LED  11
+#define X52_ANIM_TRACK_BRI_MFD  12
+#define X52_ANIM_TRACKS         13
+
+/* Largest burst of transfers allowed by the budget, as a time credit */
+#define X52_ANIM_BURST_NS       100000000ULL
+
+struct x52_anim_track {
+    bool active;
+    bool repeat;
+    bool fade;                  /* Interpolate between keyframes */
+    uint8_t count;
+    int32_t shown;              /* Value last applied, -1 if none */
+    uint64_t start_ns;          /* Monotonic time of the start */
+    libx52_keyframe frame[LIBX52_ANIM_KEYFRAME_MAX];
+};
+
+struct x52_anim {
+    struct x52_anim_track track[X52_ANIM_TRACKS];
+
+    unsigned int budget;        /* Transfers per second, 0 for unlimited */
+    uint64_t credit_ns;         /* Token bucket, as time credit */
+    uint64_t refill_ns;         /* Monotonic time of the last refill */
+};
+
+/*
+ * Shared memory state segment. The segment is mapped by several processes,
+ * so it only holds fixed size types, and starts with a magic number and the
+ * version of the layout.
+ */
+#define X52_SHM_MAGIC       0x53323558  /* "X52S" */
+#define X52_SHM_VERSION     1
+
+struct x52_shm_data {
+    uint32_t led_mask;
+    uint16_t mfd_brightness;
+    uint16_t led_brightness;
+    uint8_t line_length[X52_MFD_LINES];
+    uint8_t line[X52_MFD_LINES][X52_MFD_LINE_SIZE];
+    int16_t timezone[X52_MFD_CLOCKS];
+    uint8_t time_format[X52_MFD_CLOCKS];
+    uint8_t date_format;
+};
+
+struct x52_shm_segment {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;               /* Odd while a writer is copying, futex word */
+    uint32_t lock;              /* Thread ID of the writer holding it, or 0 */
+    uint32_t waiting;           /* Owner is waiting on seq */
+    struct x52_shm_data data;
 };
 
+/* Owner side of the segment */
+struct x52_shm {
+    struct x52_shm_segment *seg;
+    int fd;
+    uint32_t seq;               /* Sequence number of the shadow */
+    struct x52_shm_data shadow; /* Segment contents last applied */
+};
+
+struct x52_worker;
+struct x52_sync;
+
+struct libx52_device {
+    libusb_context *ctx;
+    libusb_device_handle *hdl;
+
+    struct x52_pipeline *pipeline;
+
+    /*
+     * Background update thread, only allocated while it is running. Set and
+     * cleared under the state lock.
+     */
+    struct x52_worker *worker;
+
+    /*
+     * Locks, allocated by libx52_enable_thread_safety or when the update
+     * thread is first started, and kept until libx52_exit. Once allocated,
+     * update_mask may be changed by the LED setters without the state lock.
+     */
+    struct x52_sync *sync;
+
+    uint32_t update_mask;
+    uint32_t flags;
+
+    /* Pending state, written to the device by libx52_update */
+    struct x52_state state;
+
+    /*
+     * Shadow of the state last written to the device. Only the update bits
+     * set in committed_mask have a valid shadow. Since the secondary clocks
+     * are programmed relative to clock 1, the timezone entries for clocks 2
+     * and 3 in the shadow hold the offset that was written to the device.
+     */
+    struct x52_state committed;
+    uint32_t committed_mask;
+
+    /* Number of transfers skipped because the device was already up to date */
+    unsigned int saved_last;
+    unsigned long saved_total;
+
+    /* Update scheduling parameters and statistics */
+    unsigned int deadline_ms[LIBX52_UPDATE_CLASS_MAX];
+    unsigned int transfer_budget;
+    struct x52_class_stats class_stats[LIBX52_UPDATE_CLASS_MAX];
+
+    /* Vendor command retry policy and circuit breaker */
+    libx52_retry_policy retry;
+    libx52_retry_counters retry_counters;
+    unsigned int consecutive_failures;
+    bool breaker_open;
+    uint32_t jitter_seed;
+
+    /* Per command statistics */
+    libx52_command_stats stats[LIBX52_COMMAND_MAX];
+
+    /* Identity of the connected device */
+    libx52_device_info identity;
+
+    /*
+     * Hotplug support. The hotplug callback keeps a reference to a supported
+     * device that is ready to be opened, so that reconnecting does not need
+     * to rescan the bus. The callback runs from within libusb event handling,
+     * which only happens inside libx52 calls.
+     */
+    bool hotplug;                       /* Hotplug callback is registered */
+    libusb_hotplug_callback_handle hotplug_handle;
+    libusb_device *hotplug_device;      /* Cached supported device */
+    bool hotplug_arrived;               /* Supported device plugged in */
+    bool hotplug_rescan;                /* Cached device left, rescan once */
+    bool reconnect_suspended;           /* Application called disconnect */
+
+    /* Settings set by the application, replayed to a reconnected device */
+    uint32_t configured_mask;
+
+    /*
+     * Back buffer for the frame being built between libx52_begin_frame and
+     * libx52_commit_frame. frame_mask has the settings changed in the frame.
+     */
+    struct x52_state frame;
+    uint32_t frame_mask;
+    bool in_frame;
+    uint32_t frame_gen;         /* Incremented when a frame is committed */
+
+    /* MFD pages, allocated when the first page is created */
+    struct x52_pages *pages;
+
+    /* Animations, allocated when the first animation is started */
+    struct x52_anim *anim;
+
+    /* Zones followed by the secondary clocks, NULL for a fixed offset */
+    struct x52_zone *zone[LIBX52_CLOCK_3 + 1];
+
+    /* Clock service timer, valid only if clock_service is set */
+    bool clock_service;
+    int clock_fd;
+    int clock_local;
+
+    /* Shared memory state segment, allocated by libx52_shm_create */
+    struct x52_shm *shm;
+
+    /* Command journal, NULL if not recording */
+    FILE *journal;
+    uint64_t journal_start_ns;  /* Monotonic time of the journal start */
+    bool journal_error;         /* A record could not be written */
+};
+
+/* Default scheduling deadlines for each update class, in milliseconds */
+#define X52_DEADLINE_INDICATOR  50
+#define X52_DEADLINE_CLOCK      1000
+#define X52_DEADLINE_TEXT       500
+
 /** Flag bits */
 #define X52_FLAG_IS_PRO         0
 
@@ -99,11 +365,90 @@ static inline void clr_bit(uint32_t *value, uint32_t bit)
     *value &= ~(1UL << bit);
 }
 
-static inline uint32_t tst_bit(uint32_t *value, uint32_t bit)
+static inline uint32_t tst_bit(const uint32_t *value, uint32_t bit)
 {
     return (*value & (1UL << bit));
 }
 
+/*
+ * Atomic variants for the masks which may be changed concurrently, without
+ * the state lock. These are cheap enough to be used unconditionally.
+ */
+static inline void atomic_set_bit(uint32_t *value, uint32_t bit)
+{
+    __atomic_fetch_or(value, 1UL << bit, __ATOMIC_SEQ_CST);
+}
+
+static inline void atomic_or_mask(uint32_t *value, uint32_t mask)
+{
+    __atomic_fetch_or(value, mask, __ATOMIC_SEQ_CST);
+}
+
+static inline uint32_t atomic_tst_bit(const uint32_t *value, uint32_t bit)
+{
+    return (__atomic_load_n(value, __ATOMIC_SEQ_CST) & (1UL << bit));
+}
+
+static inline uint32_t atomic_take_mask(uint32_t *value)
+{
+    return __atomic_exchange_n(value, 0, __ATOMIC_SEQ_CST);
+}
+
+typedef int (*x52_handler)(libx52_device *, const struct x52_state *, uint32_t);
+extern const x52_handler _x52_handlers[32];
+
 int _x52_translate_libusb_error(enum libusb_error errcode);
+int _x52_vendor_command(libx52_device *x52, uint16_t index, uint16_t value);
+unsigned int _x52_vendor_timeout(libx52_device *x52);
+unsigned int _x52_retry_delay(libx52_device *x52, unsigned int retry);
+bool _x52_command_done(libx52_device *x52, int rc, unsigned int retries);
+void _x52_record_command(libx52_device *x52, uint16_t index, uint16_t value,
+                         int rc, unsigned int retries, uint64_t elapsed_ns);
+void _x52_journal_record(libx52_device *x52, uint16_t index, uint16_t value,
+                         int rc, unsigned int retries, uint64_t elapsed_ns);
+
+bool _x52_state_unchanged(libx52_device *x52, const struct x52_state *state,
+                          uint32_t bit);
+bool _x52_state_differs(const struct x52_state *a, const struct x52_state *b,
+                        uint32_t bit);
+void _x52_state_commit(libx52_device *x52, const struct x52_state *state,
+                       uint32_t bit);
+struct x52_zone;
+int _x52_zone_load(const char *name, struct x52_zone **zone);
+int _x52_zone_offset(struct x52_zone *zone, int64_t t);
+void _x52_zone_free(struct x52_zone *zone);
+
+unsigned int _x52_transfer_count(const struct x52_state *state, uint32_t bit);
+unsigned int _x52_write_count(libx52_device *x52, const struct x52_state *state,
+                              uint32_t bit);
+int _x52_flush(libx52_device *x52, const struct x52_state *state,
+               uint32_t *update_mask);
+
+uint64_t _x52_monotonic_ns(void);
+void _x52_queue_update(libx52_device *x52, uint32_t bit);
+void _x52_mark_update(libx52_device *x52, uint32_t bit);
+struct x52_state *_x52_pending_state(libx52_device *x52);
+unsigned int _x52_schedule(libx52_device *x52, const struct x52_state *state,
+                           uint32_t update_mask, uint8_t *order);
+void _x52_record_delay(libx52_device *x52, const struct x52_state *state,
+                       uint32_t bit);
+
+int _x52_disconnect(libx52_device *dev);
+int _x52_reconnect(libx52_device *dev);
+
+bool _x52_worker_active(libx52_device *x52);
+int _x52_sync_init(libx52_device *x52);
+void _x52_sync_free(libx52_device *x52);
+void _x52_snapshot(libx52_device *x52, struct x52_state *state);
+void _x52_lock(libx52_device *x52);
+void _x52_unlock(libx52_device *x52);
+void _x52_io_lock(libx52_device *x52);
+void _x52_io_unlock(libx52_device *x52);
+
+bool _x52_pipeline_active(libx52_device *x52);
+int _x52_pipeline_queue(libx52_device *x52, uint32_t bit,
+                        uint16_t index, uint16_t value);
+void _x52_pipeline_cancel(libx52_device *x52);
+void _x52_pipeline_free(libx52_device *x52);
 
 #endif /* !defined X52JOY_COMMON_H */
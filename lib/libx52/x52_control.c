@@ -12,6 +12,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
 
 #include "libx52.h"
 #include "x52_commands.h"
@@ -66,60 +67,325 @@ int _x52_translate_libusb_error(enum libusb_error errcode)
     };
 }
 
-int libx52_vendor_command(libx52_device *x52, uint16_t index, uint16_t value)
+unsigned int _x52_vendor_timeout(libx52_device *x52)
+{
+    return x52->retry.timeout_ms ? x52->retry.timeout_ms : X52_VENDOR_TIMEOUT;
+}
+
+/* Delay before the given retry, in milliseconds */
+unsigned int _x52_retry_delay(libx52_device *x52, unsigned int retry)
 {
-    int j;
+    const libx52_retry_policy *policy = &x52->retry;
+    uint64_t delay = policy->backoff_ms;
+    uint32_t r;
+    uint64_t jitter;
+
+    if (delay == 0) {
+        return 0;
+    }
+
+    /* Double the delay on every retry, up to the limit */
+    while (--retry > 0 && (policy->backoff_max_ms == 0 ||
+                           delay < policy->backoff_max_ms)) {
+        delay *= 2;
+        if (delay > UINT32_MAX) {
+            delay = UINT32_MAX;
+            break;
+        }
+    }
+    if (policy->backoff_max_ms != 0 && delay > policy->backoff_max_ms) {
+        delay = policy->backoff_max_ms;
+    }
+
+    if (policy->jitter_percent != 0) {
+        /* xorshift32, the jitter doesn't need a high quality generator */
+        r = x52->jitter_seed ? x52->jitter_seed : 0x5ea1ed;
+        r ^= r << 13;
+        r ^= r >> 17;
+        r ^= r << 5;
+        x52->jitter_seed = r;
+
+        /* Uniformly distributed in [-jitter, +jitter] */
+        jitter = delay * policy->jitter_percent / 100;
+        delay = delay - jitter + (r % (2 * jitter + 1));
+    }
+
+    return (unsigned int)delay;
+}
+
+static void _x52_sleep_ms(unsigned int ms)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+        /* Sleep for the remaining time */
+    }
+}
+
+/*
+ * Update the outcome counters and the circuit breaker after a command has
+ * completed. Returns true if the circuit breaker has just tripped, in which
+ * case the caller must disconnect from the device.
+ */
+bool _x52_command_done(libx52_device *x52, int rc, unsigned int retries)
+{
+    libx52_retry_counters *counters = &x52->retry_counters;
+
+    counters->retries += retries;
+
+    if (rc == LIBX52_SUCCESS) {
+        if (retries == 0) {
+            counters->success++;
+        } else {
+            counters->retried_success++;
+        }
+        x52->consecutive_failures = 0;
+        return false;
+    }
+
+    if (rc == LIBX52_ERROR_NO_DEVICE) {
+        counters->no_device++;
+    } else {
+        counters->failed++;
+    }
+
+    x52->consecutive_failures++;
+    if (x52->retry.breaker_threshold != 0 && !x52->breaker_open &&
+        x52->consecutive_failures >= x52->retry.breaker_threshold) {
+        x52->breaker_open = true;
+        counters->breaker_trips++;
+        return true;
+    }
+
+    return false;
+}
+
+/* Map a vendor command index to the statistics entry for that command */
+static libx52_command _x52_command_id(uint16_t index)
+{
+    switch (index) {
+    case X52_MFD_LINE1 | X52_MFD_WRITE_LINE:
+        return LIBX52_COMMAND_MFD_LINE1_WRITE;
+    case X52_MFD_LINE1 | X52_MFD_CLEAR_LINE:
+        return LIBX52_COMMAND_MFD_LINE1_CLEAR;
+    case X52_MFD_LINE2 | X52_MFD_WRITE_LINE:
+        return LIBX52_COMMAND_MFD_LINE2_WRITE;
+    case X52_MFD_LINE2 | X52_MFD_CLEAR_LINE:
+        return LIBX52_COMMAND_MFD_LINE2_CLEAR;
+    case X52_MFD_LINE3 | X52_MFD_WRITE_LINE:
+        return LIBX52_COMMAND_MFD_LINE3_WRITE;
+    case X52_MFD_LINE3 | X52_MFD_CLEAR_LINE:
+        return LIBX52_COMMAND_MFD_LINE3_CLEAR;
+    case X52_MFD_BRIGHTNESS:
+        return LIBX52_COMMAND_MFD_BRIGHTNESS;
+    case X52_LED_BRIGHTNESS:
+        return LIBX52_COMMAND_LED_BRIGHTNESS;
+    case X52_LED:
+        return LIBX52_COMMAND_LED;
+    case X52_TIME_CLOCK1:
+        return LIBX52_COMMAND_TIME_CLOCK1;
+    case X52_OFFS_CLOCK2:
+        return LIBX52_COMMAND_OFFS_CLOCK2;
+    case X52_OFFS_CLOCK3:
+        return LIBX52_COMMAND_OFFS_CLOCK3;
+    case X52_DATE_DDMM:
+        return LIBX52_COMMAND_DATE_DDMM;
+    case X52_DATE_YEAR:
+        return LIBX52_COMMAND_DATE_YEAR;
+    case X52_SHIFT_INDICATOR:
+        return LIBX52_COMMAND_SHIFT;
+    case X52_BLINK_INDICATOR:
+        return LIBX52_COMMAND_BLINK;
+    default:
+        return LIBX52_COMMAND_OTHER;
+    }
+}
+
+/* Record the outcome and latency of a vendor command */
+void _x52_record_command(libx52_device *x52, uint16_t index, uint16_t value,
+                         int rc, unsigned int retries, uint64_t elapsed_ns)
+{
+    libx52_command_stats *stats = &x52->stats[_x52_command_id(index)];
+    uint64_t us = elapsed_ns / 1000;
+    unsigned int bucket = 0;
+
+    stats->count++;
+    stats->retries += retries;
+    if (rc != LIBX52_SUCCESS) {
+        stats->errors++;
+    }
+
+    stats->total_ns += elapsed_ns;
+    if (elapsed_ns > stats->max_ns) {
+        stats->max_ns = elapsed_ns;
+    }
+
+    /* Bucket n holds latencies in [2^(n-1), 2^n) microseconds */
+    while (us > 0 && bucket < LIBX52_STATS_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    stats->histogram[bucket]++;
+
+    /*
+     * Asynchronous completions don't hold the I/O lock, which is recursive,
+     * and keeps the journal from being closed during the write.
+     */
+    _x52_io_lock(x52);
+    if (x52->journal != NULL) {
+        _x52_journal_record(x52, index, value, rc, retries, elapsed_ns);
+    }
+    _x52_io_unlock(x52);
+}
+
+int _x52_vendor_command(libx52_device *x52, uint16_t index, uint16_t value)
+{
+    unsigned int attempts;
+    unsigned int j;
+    uint64_t start;
     int rc = 0;
 
     /* It is possible for the vendor command to be called when the joystick
      * is not connected. Check for this and return an appropriate error.
      */
     if (!x52->hdl) {
+        if (x52->breaker_open) {
+            x52->retry_counters.fast_fails++;
+        }
         return LIBX52_ERROR_NO_DEVICE;
     }
 
+    attempts = x52->retry.attempts ? x52->retry.attempts : X52_VENDOR_ATTEMPTS;
+    start = _x52_monotonic_ns();
+
     /* Allow retry in case of failure */
-    for (j = 0; j < 3; j++) {
+    for (j = 0; j < attempts; j++) {
+        if (j > 0) {
+            _x52_sleep_ms(_x52_retry_delay(x52, j));
+        }
+
         rc = libusb_control_transfer(x52->hdl,
             LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE | LIBUSB_ENDPOINT_OUT,
-            X52_VENDOR_REQUEST, value, index, NULL, 0, 5000);
+            X52_VENDOR_REQUEST, value, index, NULL, 0, _x52_vendor_timeout(x52));
 
-        if (rc == LIBUSB_SUCCESS) {
+        /* There is no point in retrying if the device has gone away */
+        if (rc == LIBUSB_SUCCESS || rc == LIBUSB_ERROR_NO_DEVICE) {
             break;
         }
     }
 
-    /* Handle device removal */
-    if (rc == LIBUSB_ERROR_NO_DEVICE) {
-        /* Physical device has likely been disconnected, disconnect the virtual
-         * handle, and report the failure.
+    if (j == attempts) {
+        /* All attempts failed, don't count the first one as a retry */
+        j--;
+    }
+
+    _x52_record_command(x52, index, value, _x52_translate_libusb_error(rc), j,
+                        _x52_monotonic_ns() - start);
+
+    if (_x52_command_done(x52, _x52_translate_libusb_error(rc), j) ||
+        rc == LIBUSB_ERROR_NO_DEVICE) {
+        /* Physical device has likely been disconnected, or is not responding,
+         * disconnect the virtual handle, and report the failure.
          */
-        (void)libx52_disconnect(x52);
+        (void)_x52_disconnect(x52);
     }
 
     return _x52_translate_libusb_error(rc);
 }
 
-static int _x52_write_shift(libx52_device *x52, uint32_t bit)
+int libx52_vendor_command(libx52_device *x52, uint16_t index, uint16_t value)
+{
+    int rc;
+
+    _x52_io_lock(x52);
+
+    /* A raw command may change any of the device state behind our back, so
+     * the shadow of the committed state can no longer be trusted.
+     */
+    if (x52->hdl) {
+        x52->committed_mask = 0;
+    }
+
+    rc = _x52_vendor_command(x52, index, value);
+
+    _x52_io_unlock(x52);
+
+    return rc;
+}
+
+/*
+ * Send a vendor command on behalf of an update handler. If the handler is
+ * being run to build an asynchronous update pass, then the command is queued
+ * in the pipeline instead of being written to the device immediately.
+ */
+static int _x52_send_command(libx52_device *x52, uint32_t bit,
+                             uint16_t index, uint16_t value)
+{
+    if (x52->pipeline != NULL && x52->pipeline->building) {
+        return _x52_pipeline_queue(x52, bit, index, value);
+    }
+
+    return _x52_vendor_command(x52, index, value);
+}
+
+static int _x52_write_shift(libx52_device *x52,
+                            const struct x52_state *state, uint32_t bit)
 {
     uint16_t value;
-    value = tst_bit(&x52->led_mask, X52_BIT_SHIFT) ? X52_SHIFT_ON : X52_SHIFT_OFF;
-    return libx52_vendor_command(x52, X52_SHIFT_INDICATOR, value);
+    value = tst_bit(&state->led_mask, X52_BIT_SHIFT) ? X52_SHIFT_ON : X52_SHIFT_OFF;
+    return _x52_send_command(x52, bit, X52_SHIFT_INDICATOR, value);
 }
 
-static int _x52_write_led(libx52_device *x52, uint32_t bit)
+static int _x52_write_led(libx52_device *x52,
+                          const struct x52_state *state, uint32_t bit)
 {
     uint16_t value;
     /* The bits correspond exactly to the LED identifiers */
-    value = tst_bit(&x52->led_mask, bit) ? 1 : 0;
-    return libx52_vendor_command(x52, X52_LED, value | (bit << 8));
+    value = tst_bit(&state->led_mask, bit) ? 1 : 0;
+    return _x52_send_command(x52, bit, X52_LED, value | (bit << 8));
 }
 
-static int _x52_write_line(libx52_device *x52, uint32_t bit)
+/*
+ * The write line command appends two characters at the cursor of the line.
+ * If the device already shows a prefix of the new text, then only the
+ * remaining characters need to be written. An odd length line was padded
+ * with a space, so the cursor is always at an even offset. Returns the offset
+ * of the first character to write, or 0 if the line must be cleared first.
+ */
+static uint8_t _x52_line_append_offset(libx52_device *x52,
+                                       const struct x52_state *state,
+                                       uint32_t bit)
+{
+    uint8_t line_index = bit - X52_BIT_MFD_LINE1;
+    const struct x52_mfd_line *old = &x52->committed.line[line_index];
+    const struct x52_mfd_line *new = &state->line[line_index];
+    uint8_t cursor;
+
+    if (!tst_bit(&x52->committed_mask, bit)) {
+        return 0;
+    }
+
+    cursor = (old->length + 1) & ~1;
+    if (cursor == 0 || new->length < old->length) {
+        return 0;
+    }
+
+    /* Both lines are padded with spaces beyond their length */
+    if (memcmp(old->text, new->text, cursor)) {
+        return 0;
+    }
+
+    return cursor;
+}
+
+static int _x52_write_line(libx52_device *x52,
+                           const struct x52_state *state, uint32_t bit)
 {
     uint8_t i;
     uint8_t line_index = bit - X52_BIT_MFD_LINE1;
-    int rc;
+    int rc = LIBX52_SUCCESS;
 
     const uint16_t line_index_map[X52_MFD_LINES] = {
         X52_MFD_LINE1,
@@ -127,19 +393,22 @@ static int _x52_write_line(libx52_device *x52, uint32_t bit)
         X52_MFD_LINE3,
     };
 
-    /* Clear the line first */
-    rc = libx52_vendor_command(x52,
-            line_index_map[line_index] | X52_MFD_CLEAR_LINE, 0);
-    if (rc) {
-        return rc;
+    /* Append to the existing text if possible, otherwise clear the line */
+    i = _x52_line_append_offset(x52, state, bit);
+    if (i == 0) {
+        rc = _x52_send_command(x52, bit,
+                line_index_map[line_index] | X52_MFD_CLEAR_LINE, 0);
+        if (rc) {
+            return rc;
+        }
     }
 
-    for (i = 0; i < x52->line[line_index].length; i += 2) {
+    for (; i < state->line[line_index].length; i += 2) {
         uint16_t value;
-        value = x52->line[line_index].text[i + 1] << 8 |
-                x52->line[line_index].text[i];
+        value = state->line[line_index].text[i + 1] << 8 |
+                state->line[line_index].text[i];
 
-        rc = libx52_vendor_command(x52,
+        rc = _x52_send_command(x52, bit,
                 line_index_map[line_index] | X52_MFD_WRITE_LINE, value);
         if (rc) {
             return rc;
@@ -149,72 +418,81 @@ static int _x52_write_line(libx52_device *x52, uint32_t bit)
     return rc;
 }
 
-static int _x52_write_pov_blink(libx52_device *x52, uint32_t bit)
+static int _x52_write_pov_blink(libx52_device *x52,
+                                const struct x52_state *state, uint32_t bit)
 {
     uint16_t value;
-    value = tst_bit(&x52->led_mask, X52_BIT_POV_BLINK) ? X52_BLINK_ON : X52_BLINK_OFF;
-    return libx52_vendor_command(x52, X52_BLINK_INDICATOR, value);
+    value = tst_bit(&state->led_mask, X52_BIT_POV_BLINK) ? X52_BLINK_ON : X52_BLINK_OFF;
+    return _x52_send_command(x52, bit, X52_BLINK_INDICATOR, value);
 }
 
-static int _x52_write_brightness(libx52_device *x52, uint32_t bit)
+static int _x52_write_brightness(libx52_device *x52,
+                                 const struct x52_state *state, uint32_t bit)
 {
     uint16_t index;
     uint16_t value;
 
     if (bit == X52_BIT_BRI_MFD) {
         index = X52_MFD_BRIGHTNESS;
-        value = x52->mfd_brightness;
+        value = state->mfd_brightness;
     } else {
         index = X52_LED_BRIGHTNESS;
-        value = x52->led_brightness;
+        value = state->led_brightness;
     }
 
-    return libx52_vendor_command(x52, index, value);
+    return _x52_send_command(x52, bit, index, value);
 }
 
-static int _x52_write_date(libx52_device *x52, uint32_t bit)
+static int _x52_write_date(libx52_device *x52,
+                           const struct x52_state *state, uint32_t bit)
 {
     uint16_t value1; //dd-mm
     uint16_t value2; //yy
     int rc;
 
-    switch (x52->date_format) {
+    switch (state->date_format) {
     case LIBX52_DATE_FORMAT_YYMMDD:
-        value1 = x52->date_month << 8 |
-                 x52->date_year;
-        value2 = x52->date_day;
+        value1 = state->date_month << 8 |
+                 state->date_year;
+        value2 = state->date_day;
         break;
 
     case LIBX52_DATE_FORMAT_MMDDYY:
-        value1 = x52->date_day << 8 |
-                 x52->date_month;
-        value2 = x52->date_year;
+        value1 = state->date_day << 8 |
+                 state->date_month;
+        value2 = state->date_year;
         break;
 
     case LIBX52_DATE_FORMAT_DDMMYY:
-        value1 = x52->date_month << 8 |
-                 x52->date_day;
-        value2 = x52->date_year;
+        value1 = state->date_month << 8 |
+                 state->date_day;
+        value2 = state->date_year;
         break;
 
     default:
         return LIBX52_ERROR_INVALID_PARAM;
     }
 
-    rc = libx52_vendor_command(x52, X52_DATE_DDMM, value1);
+    rc = _x52_send_command(x52, bit, X52_DATE_DDMM, value1);
     if (rc == LIBX52_SUCCESS) {
-        rc = libx52_vendor_command(x52, X52_DATE_YEAR, value2);
+        rc = _x52_send_command(x52, bit, X52_DATE_YEAR, value2);
     }
 
     return rc;
 }
 
-static uint16_t _x52_calculate_clock_offset(libx52_device *x52, libx52_clock_id clock, uint16_t h24)
+/* Offset of the given clock from the base clock, in minutes */
+static int _x52_clock_offset(const struct x52_state *state, libx52_clock_id clock)
+{
+    return state->timezone[clock] - state->timezone[LIBX52_CLOCK_1];
+}
+
+static uint16_t _x52_calculate_clock_offset(const struct x52_state *state, libx52_clock_id clock, uint16_t h24)
 {
     int offset;
     int negative;
 
-    offset = x52->timezone[clock] - x52->timezone[LIBX52_CLOCK_1];
+    offset = _x52_clock_offset(state, clock);
 
     /* Save the preliminary state, if negative, set the negative flag */
     if (offset < 0) {
@@ -248,7 +526,8 @@ static uint16_t _x52_calculate_clock_offset(libx52_device *x52, libx52_clock_id
     return (h24 << 15 | negative << 10 | (offset & 0x3FF));
 }
 
-static int _x52_write_time(libx52_device *x52, uint32_t bit)
+static int _x52_write_time(libx52_device *x52,
+                           const struct x52_state *state, uint32_t bit)
 {
     uint16_t value = 0;
     uint16_t index;
@@ -273,21 +552,19 @@ static int _x52_write_time(libx52_device *x52, uint32_t bit)
         return LIBX52_ERROR_INVALID_PARAM;
     }
 
-    h24 = !!(x52->time_format[clock]);
+    h24 = !!(state->time_format[clock]);
 
     if (clock != LIBX52_CLOCK_1) {
-        value = _x52_calculate_clock_offset(x52, clock, h24);
+        value = _x52_calculate_clock_offset(state, clock, h24);
     } else {
         value = h24 << 15 |
-                (x52->time_hour & 0x7F) << 8 |
-                (x52->time_minute & 0xFF);
+                (state->time_hour & 0x7F) << 8 |
+                (state->time_minute & 0xFF);
     }
 
-    return libx52_vendor_command(x52, index, value);
+    return _x52_send_command(x52, bit, index, value);
 }
 
-typedef int (*x52_handler)(libx52_device *, uint32_t);
-
 const x52_handler _x52_handlers[32] = {
     [X52_BIT_SHIFT]         = _x52_write_shift,
     [X52_BIT_LED_FIRE]      = _x52_write_led,
@@ -322,42 +599,566 @@ const x52_handler _x52_handlers[32] = {
     [X52_BIT_MFD_OFFS2]     = _x52_write_time,
 };
 
-int libx52_update(libx52_device *x52)
+/*
+ * Check if the setting controlled by the given update bit is the same in both
+ * states. If shadow is true, then c is the shadow of the committed state,
+ * which holds the secondary clock offsets as written to the device.
+ */
+static bool _x52_state_equal(const struct x52_state *s,
+                             const struct x52_state *c,
+                             bool shadow, uint32_t bit)
+{
+    libx52_clock_id clock;
+    uint8_t line;
+
+    switch (bit) {
+    case X52_BIT_MFD_LINE1:
+    case X52_BIT_MFD_LINE2:
+    case X52_BIT_MFD_LINE3:
+        line = bit - X52_BIT_MFD_LINE1;
+        return (s->line[line].length == c->line[line].length &&
+                !memcmp(s->line[line].text, c->line[line].text,
+                        X52_MFD_LINE_SIZE));
+
+    case X52_BIT_BRI_MFD:
+        return (s->mfd_brightness == c->mfd_brightness);
+
+    case X52_BIT_BRI_LED:
+        return (s->led_brightness == c->led_brightness);
+
+    case X52_BIT_MFD_DATE:
+        return (s->date_format == c->date_format &&
+                s->date_day == c->date_day &&
+                s->date_month == c->date_month &&
+                s->date_year == c->date_year);
+
+    case X52_BIT_MFD_TIME:
+        return (s->time_format[LIBX52_CLOCK_1] == c->time_format[LIBX52_CLOCK_1] &&
+                s->time_hour == c->time_hour &&
+                s->time_minute == c->time_minute);
+
+    case X52_BIT_MFD_OFFS1:
+    case X52_BIT_MFD_OFFS2:
+        clock = LIBX52_CLOCK_2 + (bit - X52_BIT_MFD_OFFS1);
+        return (s->time_format[clock] == c->time_format[clock] &&
+                _x52_clock_offset(s, clock) ==
+                    (shadow ? c->timezone[clock] : _x52_clock_offset(c, clock)));
+
+    default:
+        /* Shift, blink and the LEDs are stored in the LED mask, which may
+         * be changed by the LED setters without the state lock
+         */
+        return !((__atomic_load_n(&s->led_mask, __ATOMIC_RELAXED) ^
+                  __atomic_load_n(&c->led_mask, __ATOMIC_RELAXED)) &
+                 (1UL << bit));
+    }
+}
+
+/*
+ * Check if the setting controlled by the given update bit already matches
+ * the state that was last written to the device.
+ */
+bool _x52_state_unchanged(libx52_device *x52, const struct x52_state *s,
+                          uint32_t bit)
+{
+    if (!tst_bit(&x52->committed_mask, bit)) {
+        return false;
+    }
+
+    return _x52_state_equal(s, &x52->committed, true, bit);
+}
+
+/* Check if the setting controlled by the given update bit differs */
+bool _x52_state_differs(const struct x52_state *a, const struct x52_state *b,
+                        uint32_t bit)
 {
+    return !_x52_state_equal(a, b, false, bit);
+}
+
+/* Record that the setting for the given update bit was written to the device */
+void _x52_state_commit(libx52_device *x52, const struct x52_state *s,
+                       uint32_t bit)
+{
+    struct x52_state *c = &x52->committed;
+    libx52_clock_id clock;
+    uint8_t line;
+
+    switch (bit) {
+    case X52_BIT_MFD_LINE1:
+    case X52_BIT_MFD_LINE2:
+    case X52_BIT_MFD_LINE3:
+        line = bit - X52_BIT_MFD_LINE1;
+        c->line[line] = s->line[line];
+        break;
+
+    case X52_BIT_BRI_MFD:
+        c->mfd_brightness = s->mfd_brightness;
+        break;
+
+    case X52_BIT_BRI_LED:
+        c->led_brightness = s->led_brightness;
+        break;
+
+    case X52_BIT_MFD_DATE:
+        c->date_format = s->date_format;
+        c->date_day = s->date_day;
+        c->date_month = s->date_month;
+        c->date_year = s->date_year;
+        break;
+
+    case X52_BIT_MFD_TIME:
+        c->time_format[LIBX52_CLOCK_1] = s->time_format[LIBX52_CLOCK_1];
+        c->time_hour = s->time_hour;
+        c->time_minute = s->time_minute;
+        break;
+
+    case X52_BIT_MFD_OFFS1:
+    case X52_BIT_MFD_OFFS2:
+        clock = LIBX52_CLOCK_2 + (bit - X52_BIT_MFD_OFFS1);
+        c->time_format[clock] = s->time_format[clock];
+        c->timezone[clock] = _x52_clock_offset(s, clock);
+        break;
+
+    default:
+        c->led_mask &= ~(1UL << bit);
+        c->led_mask |= s->led_mask & (1UL << bit);
+        break;
+    }
+
+    set_bit(&x52->committed_mask, bit);
+}
+
+/* Number of vendor commands needed to write the setting for an update bit */
+unsigned int _x52_transfer_count(const struct x52_state *state, uint32_t bit)
+{
+    switch (bit) {
+    case X52_BIT_MFD_LINE1:
+    case X52_BIT_MFD_LINE2:
+    case X52_BIT_MFD_LINE3:
+        /* Clear command, followed by one write for every 2 characters */
+        return 1 + (state->line[bit - X52_BIT_MFD_LINE1].length + 1) / 2;
+
+    case X52_BIT_MFD_DATE:
+        return 2;
+
+    default:
+        return 1;
+    }
+}
+
+/*
+ * Number of vendor commands the update handler will actually send, given the
+ * state that was last written to the device. This differs from
+ * _x52_transfer_count only when an MFD line can be appended to.
+ */
+unsigned int _x52_write_count(libx52_device *x52, const struct x52_state *state,
+                              uint32_t bit)
+{
+    uint8_t offset;
+
+    switch (bit) {
+    case X52_BIT_MFD_LINE1:
+    case X52_BIT_MFD_LINE2:
+    case X52_BIT_MFD_LINE3:
+        offset = _x52_line_append_offset(x52, state, bit);
+        if (offset == 0) {
+            break;
+        }
+        return (state->line[bit - X52_BIT_MFD_LINE1].length - offset + 1) / 2;
+
+    default:
+        break;
+    }
+
+    return _x52_transfer_count(state, bit);
+}
+
+uint64_t _x52_monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Mark a setting as pending, and save the time at which it became pending */
+void _x52_queue_update(libx52_device *x52, uint32_t bit)
+{
+    if (!atomic_tst_bit(&x52->update_mask, bit)) {
+        __atomic_store_n(&x52->state.pending_since[bit], _x52_monotonic_ns(),
+                         __ATOMIC_RELAXED);
+    }
+    atomic_set_bit(&x52->update_mask, bit);
+    atomic_set_bit(&x52->configured_mask, bit);
+}
+
+/*
+ * Mark a setting changed by a libx52_set function. Within a frame, the change
+ * is only recorded in the frame, and is queued when the frame is committed.
+ */
+void _x52_mark_update(libx52_device *x52, uint32_t bit)
+{
+    if (__atomic_load_n(&x52->in_frame, __ATOMIC_SEQ_CST)) {
+        set_bit(&x52->frame_mask, bit);
+    } else {
+        _x52_queue_update(x52, bit);
+    }
+}
+
+/* Get the state which the libx52_set functions should modify */
+struct x52_state *_x52_pending_state(libx52_device *x52)
+{
+    return (x52->in_frame ? &x52->frame : &x52->state);
+}
+
+static libx52_update_class _x52_update_class(uint32_t bit)
+{
+    switch (bit) {
+    case X52_BIT_MFD_LINE1:
+    case X52_BIT_MFD_LINE2:
+    case X52_BIT_MFD_LINE3:
+        return LIBX52_UPDATE_CLASS_TEXT;
+
+    case X52_BIT_MFD_DATE:
+    case X52_BIT_MFD_TIME:
+    case X52_BIT_MFD_OFFS1:
+    case X52_BIT_MFD_OFFS2:
+        return LIBX52_UPDATE_CLASS_CLOCK;
+
+    default:
+        return LIBX52_UPDATE_CLASS_INDICATOR;
+    }
+}
+
+/*
+ * Order the pending update bits for writing, and return the number of bits
+ * in the order array. Bits are ordered by class, and by bit number within a
+ * class. A bit which has been pending for longer than the deadline of its
+ * class is moved ahead of all bits that are still within their deadline,
+ * with the earliest deadline first.
+ */
+unsigned int _x52_schedule(libx52_device *x52, const struct x52_state *state,
+                           uint32_t update_mask, uint8_t *order)
+{
+    uint64_t key[32];
+    uint64_t now = _x52_monotonic_ns();
+    unsigned int count = 0;
     unsigned int i;
-    uint32_t update_mask;
+    unsigned int j;
+
+    for (i = 0; i < 32; i++) {
+        libx52_update_class cls;
+        uint64_t deadline;
+        uint64_t k;
+
+        if (!tst_bit(&update_mask, i)) {
+            continue;
+        }
+
+        cls = _x52_update_class(i);
+        deadline = state->pending_since[i] +
+                   (uint64_t)x52->deadline_ms[cls] * 1000000ULL;
+
+        if (x52->deadline_ms[cls] != 0 && deadline < now) {
+            /* Overdue, the top bit is clear so this sorts first */
+            k = deadline >> 1;
+        } else {
+            k = (1ULL << 63) | (uint64_t)cls << 5 | i;
+        }
+
+        /* Insertion sort, there are at most 32 entries */
+        for (j = count; j > 0 && key[j - 1] > k; j--) {
+            key[j] = key[j - 1];
+            order[j] = order[j - 1];
+        }
+        key[j] = k;
+        order[j] = i;
+        count++;
+    }
+
+    return count;
+}
+
+/* Record the queueing delay of an update that is about to be written */
+void _x52_record_delay(libx52_device *x52, const struct x52_state *state,
+                       uint32_t bit)
+{
+    libx52_update_class cls = _x52_update_class(bit);
+    struct x52_class_stats *stats = &x52->class_stats[cls];
+    uint64_t now = _x52_monotonic_ns();
+    uint64_t delay = 0;
+
+    if (now > state->pending_since[bit]) {
+        delay = now - state->pending_since[bit];
+    }
+
+    stats->updates++;
+    stats->total_delay_ns += delay;
+    if (delay > stats->max_delay_ns) {
+        stats->max_delay_ns = delay;
+    }
+
+    if (x52->deadline_ms[cls] != 0 &&
+        delay > (uint64_t)x52->deadline_ms[cls] * 1000000ULL) {
+        stats->deadline_misses++;
+    }
+}
+
+/*
+ * Write the settings selected by update_mask from the given state to the
+ * device, in the order given by _x52_schedule. A failed setting does not
+ * prevent the remaining ones from being written, unless the device has been
+ * disconnected. On return, update_mask holds the bits which still need to be
+ * written, and the return value is the first error encountered.
+ */
+int _x52_flush(libx52_device *x52, const struct x52_state *state,
+               uint32_t *update_mask)
+{
+    uint8_t order[32];
+    unsigned int count;
+    unsigned int sent = 0;
+    unsigned int n;
     int rc = LIBX52_SUCCESS;
-    x52_handler handler;
+
+    x52->saved_last = 0;
+    count = _x52_schedule(x52, state, *update_mask, order);
+
+    for (n = 0; n < count; n++) {
+        uint32_t i = order[n];
+        unsigned int transfers;
+        x52_handler handler;
+        int bit_rc = LIBX52_SUCCESS;
+
+        /* Skip settings which the device already has */
+        if (_x52_state_unchanged(x52, state, i)) {
+            x52->saved_last += _x52_transfer_count(state, i);
+            clr_bit(update_mask, i);
+            continue;
+        }
+
+        /* Leave the remaining settings for the next update once the budget
+         * is exhausted, but always make progress on at least one.
+         */
+        transfers = _x52_write_count(x52, state, i);
+        if (x52->transfer_budget != 0 && sent != 0 &&
+            sent + transfers > x52->transfer_budget) {
+            break;
+        }
+        sent += transfers;
+
+        _x52_record_delay(x52, state, i);
+
+        handler = _x52_handlers[i];
+        if (handler != NULL) {
+            bit_rc = (*handler)(x52, state, i);
+        }
+
+        if (bit_rc == LIBX52_SUCCESS) {
+            x52->saved_last += _x52_transfer_count(state, i) - transfers;
+            _x52_state_commit(x52, state, i);
+            clr_bit(update_mask, i);
+            continue;
+        }
+
+        /* The device may have been left with a partial update, so the
+         * shadow is no longer valid. The bit stays set in update_mask.
+         */
+        clr_bit(&x52->committed_mask, i);
+        if (rc == LIBX52_SUCCESS) {
+            rc = bit_rc;
+        }
+
+        if (bit_rc == LIBX52_ERROR_NO_DEVICE) {
+            break;
+        }
+    }
+
+    x52->saved_total += x52->saved_last;
+
+    return rc;
+}
+
+int libx52_update(libx52_device *x52)
+{
+    struct x52_state state;
+    uint32_t update_mask;
+    int rc;
+
+    /* An asynchronous update pass or the update thread owns the update mask */
+    if (_x52_pipeline_active(x52) || _x52_worker_active(x52)) {
+        return LIBX52_ERROR_BUSY;
+    }
 
     /* It is possible for the update command to be called when the joystick
-     * is not connected. Check for this and return an appropriate error.
+     * is not connected. Reconnect if the joystick has been plugged back in,
+     * otherwise return an appropriate error.
      */
-    if (!x52->hdl) {
+    if (!x52->hdl && _x52_reconnect(x52) != LIBX52_SUCCESS) {
         return LIBX52_ERROR_NO_DEVICE;
     }
 
-    /* Save the update mask */
-    update_mask = x52->update_mask;
-    /* Reset the device update mask to 0 */
-    x52->update_mask = 0;
+    /* Take the update mask, and then the state that goes with it. Setters
+     * on other threads may keep changing the pending state meanwhile.
+     */
+    update_mask = atomic_take_mask(&x52->update_mask);
+    _x52_snapshot(x52, &state);
 
-    for (i = 0; i < 32; i++) {
-        if (tst_bit(&update_mask, i)) {
-            rc = LIBX52_SUCCESS;
-            handler = _x52_handlers[i];
-            if (handler != NULL) {
-                rc = (*handler)(x52, i);
-            }
-
-            if (rc == LIBX52_SUCCESS) {
-                clr_bit(&update_mask, i);
-            } else {
-                /* Last transfer failed - reset the update mask */
-                x52->update_mask = update_mask;
-                break;
-            }
-        }
-    }
+    _x52_io_lock(x52);
+    rc = _x52_flush(x52, &state, &update_mask);
+    _x52_io_unlock(x52);
+
+    /* Any bits that were not written are retried on the next update */
+    atomic_or_mask(&x52->update_mask, update_mask);
 
     return rc;
 }
+
+int libx52_get_saved_transfers(libx52_device *x52, unsigned int *last,
+                               unsigned long *total)
+{
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    _x52_io_lock(x52);
+    if (last) {
+        *last = x52->saved_last;
+    }
+
+    if (total) {
+        *total = x52->saved_total;
+    }
+    _x52_io_unlock(x52);
+
+    return LIBX52_SUCCESS;
+}
+
+int libx52_set_update_deadline(libx52_device *x52,
+                               libx52_update_class update_class,
+                               unsigned int deadline_ms)
+{
+    if (!x52 || update_class >= LIBX52_UPDATE_CLASS_MAX) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    _x52_io_lock(x52);
+    x52->deadline_ms[update_class] = deadline_ms;
+    _x52_io_unlock(x52);
+
+    return LIBX52_SUCCESS;
+}
+
+int libx52_set_update_budget(libx52_device *x52, unsigned int transfers)
+{
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    _x52_io_lock(x52);
+    x52->transfer_budget = transfers;
+    _x52_io_unlock(x52);
+
+    return LIBX52_SUCCESS;
+}
+
+int libx52_get_update_stats(libx52_device *x52,
+                            libx52_update_class update_class,
+                            libx52_update_stats *stats)
+{
+    struct x52_class_stats *cs;
+
+    if (!x52 || !stats || update_class >= LIBX52_UPDATE_CLASS_MAX) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    _x52_io_lock(x52);
+    cs = &x52->class_stats[update_class];
+    stats->updates = cs->updates;
+    stats->deadline_misses = cs->deadline_misses;
+    stats->total_delay_us = cs->total_delay_ns / 1000;
+    stats->max_delay_us = cs->max_delay_ns / 1000;
+    _x52_io_unlock(x52);
+
+    return LIBX52_SUCCESS;
+}
+
+int libx52_reset_update_stats(libx52_device *x52)
+{
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    _x52_io_lock(x52);
+    memset(x52->class_stats, 0, sizeof(x52->class_stats));
+    _x52_io_unlock(x52);
+
+    return LIBX52_SUCCESS;
+}
+
+int libx52_set_retry_policy(libx52_device *x52,
+                            const libx52_retry_policy *policy)
+{
+    if (!x52 || !policy || policy->jitter_percent > 100) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    _x52_io_lock(x52);
+    x52->retry = *policy;
+    _x52_io_unlock(x52);
+
+    return LIBX52_SUCCESS;
+}
+
+int libx52_get_retry_policy(libx52_device *x52, libx52_retry_policy *policy)
+{
+    if (!x52 || !policy) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    _x52_io_lock(x52);
+    *policy = x52->retry;
+    _x52_io_unlock(x52);
+
+    return LIBX52_SUCCESS;
+}
+
+int libx52_get_retry_counters(libx52_device *x52,
+                              libx52_retry_counters *counters)
+{
+    if (!x52 || !counters) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    _x52_io_lock(x52);
+    *counters = x52->retry_counters;
+    _x52_io_unlock(x52);
+
+    return LIBX52_SUCCESS;
+}
+
+int libx52_get_stats(libx52_device *x52, libx52_command command,
+                     libx52_command_stats *stats)
+{
+    if (!x52 || !stats || command >= LIBX52_COMMAND_MAX) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    _x52_io_lock(x52);
+    *stats = x52->stats[command];
+    _x52_io_unlock(x52);
+
+    return LIBX52_SUCCESS;
+}
+
+int libx52_reset_stats(libx52_device *x52)
+{
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    _x52_io_lock(x52);
+    memset(x52->stats, 0, sizeof(x52->stats));
+    _x52_io_unlock(x52);
+
+    return LIBX52_SUCCESS;
+}
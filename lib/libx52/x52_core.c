@@ -47,34 +47,242 @@ bool libx52_is_connected(libx52_device *dev)
     return (dev && dev->hdl);
 }
 
-int libx52_disconnect(libx52_device *dev)
+int _x52_disconnect(libx52_device *dev)
 {
-    if (!dev) {
-       return LIBX52_ERROR_INVALID_PARAM;
-    }
+    /* Wait for the update thread to finish with the handle */
+    _x52_io_lock(dev);
 
     if (dev->hdl) {
+        /* Wait for any in-flight asynchronous transfers to be cancelled */
+        _x52_pipeline_cancel(dev);
+
         libusb_close(dev->hdl);
         dev->hdl = NULL;
         dev->flags = 0;
+
+        /* The state of the next device to be connected is unknown */
+        dev->committed_mask = 0;
     }
 
+    _x52_io_unlock(dev);
+
     return LIBX52_SUCCESS;
 }
 
-int libx52_connect(libx52_device *dev)
+int libx52_disconnect(libx52_device *dev)
 {
     int rc;
+
+    if (!dev) {
+       return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    /* Don't reconnect behind the application's back until it asks for it */
+    _x52_io_lock(dev);
+    dev->reconnect_suspended = true;
+    rc = _x52_disconnect(dev);
+    _x52_io_unlock(dev);
+
+    return rc;
+}
+
+/*
+ * Get the identity of a USB device. The serial number can only be read from
+ * an open device, so it is left empty if hdl is NULL.
+ */
+static void _x52_get_identity(libusb_device *device, libusb_device_handle *hdl,
+                              const struct libusb_device_descriptor *desc,
+                              libx52_device_info *info)
+{
+    int rc;
+
+    memset(info, 0, sizeof(*info));
+    info->vendor_id = desc->idVendor;
+    info->product_id = desc->idProduct;
+    info->bus = libusb_get_bus_number(device);
+    info->address = libusb_get_device_address(device);
+
+    rc = libusb_get_port_numbers(device, info->ports, LIBX52_MAX_PORT_DEPTH);
+    info->port_depth = (rc > 0) ? rc : 0;
+
+    if (hdl != NULL && desc->iSerialNumber != 0) {
+        rc = libusb_get_string_descriptor_ascii(hdl, desc->iSerialNumber,
+                (unsigned char *)info->serial_number,
+                sizeof(info->serial_number));
+        if (rc < 0) {
+            info->serial_number[0] = '\0';
+        }
+    }
+}
+
+/*
+ * Check if a device matches the requested identity. The serial number is
+ * used if the requested identity has one, since it is the only identifier
+ * which remains the same when the joystick is moved to another port.
+ * Otherwise, the device must be on the same bus and port path.
+ */
+static bool _x52_identity_matches(const libx52_device_info *want,
+                                  const libx52_device_info *have)
+{
+    if (want->vendor_id != have->vendor_id ||
+        want->product_id != have->product_id) {
+        return false;
+    }
+
+    if (want->serial_number[0] != '\0') {
+        return !strncmp(want->serial_number, have->serial_number,
+                        sizeof(want->serial_number));
+    }
+
+    return (want->bus == have->bus &&
+            want->port_depth == have->port_depth &&
+            !memcmp(want->ports, have->ports, want->port_depth));
+}
+
+/* Bind the device context to an opened device */
+static void _x52_bind(libx52_device *dev, libusb_device *device,
+                      libusb_device_handle *hdl,
+                      const struct libusb_device_descriptor *desc)
+{
+    dev->hdl = hdl;
+
+    if (libx52_device_is_x52pro(desc->idProduct)) {
+        set_bit(&(dev->flags), X52_FLAG_IS_PRO);
+    }
+
+    _x52_get_identity(device, hdl, desc, &dev->identity);
+
+    /* Any arrivals so far have been accounted for */
+    dev->hotplug_arrived = false;
+
+    /* Remember the device, so that a reconnect doesn't need a rescan */
+    if (dev->hotplug && dev->hotplug_device != device) {
+        if (dev->hotplug_device != NULL) {
+            libusb_unref_device(dev->hotplug_device);
+        }
+        dev->hotplug_device = libusb_ref_device(device);
+    }
+}
+
+/* Process any pending hotplug events, without blocking */
+static void _x52_hotplug_poll(libx52_device *dev)
+{
+    struct timeval tv = {0, 0};
+
+    (void)libusb_handle_events_timeout_completed(dev->ctx, &tv, NULL);
+}
+
+static int LIBUSB_CALL _x52_hotplug_callback(libusb_context *ctx,
+                                             libusb_device *device,
+                                             libusb_hotplug_event event,
+                                             void *user_data)
+{
+    libx52_device *dev = user_data;
+    struct libusb_device_descriptor desc;
+
+    (void)ctx;
+
+    if (libusb_get_device_descriptor(device, &desc) ||
+        !libx52_check_product(desc.idVendor, desc.idProduct)) {
+        return 0;
+    }
+
+    /* The device must not be opened from within the callback, just record
+     * the event, and let the next connect or update act on it.
+     */
+    switch (event) {
+    case LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED:
+        if (dev->hotplug_device == NULL) {
+            dev->hotplug_device = libusb_ref_device(device);
+        }
+        dev->hotplug_arrived = true;
+        break;
+
+    case LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT:
+        if (dev->hotplug_device == device) {
+            libusb_unref_device(device);
+            dev->hotplug_device = NULL;
+
+            /* Another supported joystick may still be attached */
+            dev->hotplug_rescan = true;
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    /* Keep the callback registered */
+    return 0;
+}
+
+static void _x52_hotplug_register(libx52_device *dev)
+{
+    int rc;
+
+    if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+        return;
+    }
+
+    /* Joysticks which are already attached are reported immediately */
+    rc = libusb_hotplug_register_callback(dev->ctx,
+            LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+            LIBUSB_HOTPLUG_ENUMERATE, VENDOR_SAITEK, LIBUSB_HOTPLUG_MATCH_ANY,
+            LIBUSB_HOTPLUG_MATCH_ANY, _x52_hotplug_callback, dev,
+            &dev->hotplug_handle);
+
+    dev->hotplug = (rc == LIBUSB_SUCCESS);
+}
+
+static void _x52_hotplug_deregister(libx52_device *dev)
+{
+    if (dev->hotplug) {
+        libusb_hotplug_deregister_callback(dev->ctx, dev->hotplug_handle);
+        dev->hotplug = false;
+    }
+
+    if (dev->hotplug_device != NULL) {
+        libusb_unref_device(dev->hotplug_device);
+        dev->hotplug_device = NULL;
+    }
+}
+
+/* Open the device cached by the hotplug callback */
+static int _x52_connect_cached(libx52_device *dev)
+{
+    libusb_device_handle *hdl;
+    struct libusb_device_descriptor desc;
+    int rc;
+
+    if (dev->hotplug_device == NULL) {
+        return LIBX52_ERROR_NO_DEVICE;
+    }
+
+    rc = libusb_get_device_descriptor(dev->hotplug_device, &desc);
+    if (rc == LIBUSB_SUCCESS) {
+        rc = libusb_open(dev->hotplug_device, &hdl);
+    }
+    if (rc != LIBUSB_SUCCESS) {
+        return _x52_translate_libusb_error(rc);
+    }
+
+    _x52_bind(dev, dev->hotplug_device, hdl, &desc);
+    return LIBX52_SUCCESS;
+}
+
+/*
+ * Connect to the first supported joystick matching the identity, or the first
+ * supported joystick if identity is NULL.
+ */
+static int _x52_connect(libx52_device *dev, const libx52_device_info *identity)
+{
+    int rc = LIBX52_ERROR_NO_DEVICE;
     ssize_t count;
     int i;
     libusb_device **list;
     libusb_device_handle *hdl;
     struct libusb_device_descriptor desc;
-
-    /* Make sure that we have a valid pointer */
-    if (!dev) {
-        return LIBX52_ERROR_INVALID_PARAM;
-    }
+    libx52_device_info info;
 
     /* Disconnect any existing handles. This will force libx52 to rescan the
      * device list and bind to the first supported joystick, if any. If the
@@ -82,39 +290,228 @@ int libx52_connect(libx52_device *dev)
      * it will return a No device error. This also means that a new device
      * handle is cached in the device structure.
      */
-    (void)libx52_disconnect(dev);
+    (void)_x52_disconnect(dev);
+
+    /* Close the circuit breaker, the new device gets a fresh start */
+    dev->breaker_open = false;
+    dev->consecutive_failures = 0;
+
+    if (dev->hotplug && identity == NULL) {
+        _x52_hotplug_poll(dev);
+
+        /* The hotplug callback tracks the attached joysticks, so the bus only
+         * needs to be rescanned if the cached joystick has been unplugged, or
+         * cannot be opened. The latter also covers a joystick whose arrival
+         * has not been reported yet.
+         */
+        if (!dev->hotplug_rescan && _x52_connect_cached(dev) == LIBX52_SUCCESS) {
+            return LIBX52_SUCCESS;
+        }
+        dev->hotplug_rescan = false;
+    }
 
     count = libusb_get_device_list(dev->ctx, &list);
     for (i = 0; i < count; i++) {
         libusb_device *device;
 
         device = list[i];
-        if (!libusb_get_device_descriptor(device, &desc)) {
-            if (libx52_check_product(desc.idVendor, desc.idProduct)) {
-                rc = libusb_open(device, &hdl);
-                if (rc) {
-                    return _x52_translate_libusb_error(rc);
-                }
-
-                dev->hdl = hdl;
-
-                if (libx52_device_is_x52pro(desc.idProduct)) {
-                    set_bit(&(dev->flags), X52_FLAG_IS_PRO);
-                }
-                break;
+        if (libusb_get_device_descriptor(device, &desc) ||
+            !libx52_check_product(desc.idVendor, desc.idProduct)) {
+            continue;
+        }
+
+        if (identity != NULL && identity->serial_number[0] == '\0') {
+            /* Filter on the port path before opening the device */
+            _x52_get_identity(device, NULL, &desc, &info);
+            if (!_x52_identity_matches(identity, &info)) {
+                continue;
+            }
+        }
+
+        rc = libusb_open(device, &hdl);
+        if (rc) {
+            rc = _x52_translate_libusb_error(rc);
+            if (identity != NULL) {
+                /* The device we are looking for may still be further on */
+                continue;
+            }
+            break;
+        }
+
+        if (identity != NULL && identity->serial_number[0] != '\0') {
+            _x52_get_identity(device, hdl, &desc, &info);
+            if (!_x52_identity_matches(identity, &info)) {
+                libusb_close(hdl);
+                rc = LIBX52_ERROR_NO_DEVICE;
+                continue;
             }
         }
+
+        _x52_bind(dev, device, hdl, &desc);
+        rc = LIBX52_SUCCESS;
+        break;
     }
     libusb_free_device_list(list, 1);
 
-    /* Make sure we actually have an X52 device detected */
-    if (!dev->hdl) {
-        return LIBX52_ERROR_NO_DEVICE;
+    return rc;
+}
+
+int libx52_connect(libx52_device *dev)
+{
+    int rc;
+
+    /* Make sure that we have a valid pointer */
+    if (!dev) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    _x52_io_lock(dev);
+    dev->reconnect_suspended = false;
+    rc = _x52_connect(dev, NULL);
+    _x52_io_unlock(dev);
+
+    return rc;
+}
+
+int libx52_connect_device(libx52_device *dev, const libx52_device_info *info)
+{
+    int rc;
+
+    if (!dev || !info) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    _x52_io_lock(dev);
+    dev->reconnect_suspended = false;
+    rc = _x52_connect(dev, info);
+    _x52_io_unlock(dev);
+
+    return rc;
+}
+
+int libx52_enumerate(libx52_device *dev, libx52_device_info *info,
+                     size_t max, size_t *found)
+{
+    ssize_t count;
+    ssize_t i;
+    size_t n = 0;
+    libusb_device **list;
+    libusb_device_handle *hdl;
+    struct libusb_device_descriptor desc;
+
+    if (!dev || !found || (max > 0 && !info)) {
+        return LIBX52_ERROR_INVALID_PARAM;
     }
 
+    count = libusb_get_device_list(dev->ctx, &list);
+    if (count < 0) {
+        return _x52_translate_libusb_error(count);
+    }
+
+    for (i = 0; i < count; i++) {
+        libusb_device *device = list[i];
+
+        if (libusb_get_device_descriptor(device, &desc) ||
+            !libx52_check_product(desc.idVendor, desc.idProduct)) {
+            continue;
+        }
+
+        if (n < max) {
+            /* Open the device briefly to read the serial number. A device
+             * that cannot be opened is still listed, without the serial.
+             */
+            hdl = NULL;
+            if (libusb_open(device, &hdl) != LIBUSB_SUCCESS) {
+                hdl = NULL;
+            }
+
+            _x52_get_identity(device, hdl, &desc, &info[n]);
+
+            if (hdl != NULL) {
+                libusb_close(hdl);
+            }
+        }
+        n++;
+    }
+    libusb_free_device_list(list, 1);
+
+    *found = n;
     return LIBX52_SUCCESS;
 }
 
+int _x52_reconnect(libx52_device *dev)
+{
+    libx52_device_info identity;
+    uint32_t bit;
+    int rc = LIBX52_ERROR_NO_DEVICE;
+
+    if (!dev->hotplug) {
+        return LIBX52_ERROR_NO_DEVICE;
+    }
+
+    _x52_io_lock(dev);
+
+    if (dev->hdl != NULL) {
+        rc = LIBX52_SUCCESS;
+        goto unlock;
+    }
+
+    if (dev->reconnect_suspended) {
+        goto unlock;
+    }
+
+    /* Nothing to do unless a supported joystick has been plugged in since
+     * the last attempt, this avoids rescanning the bus on every update.
+     */
+    _x52_hotplug_poll(dev);
+    if (!dev->hotplug_arrived) {
+        goto unlock;
+    }
+    dev->hotplug_arrived = false;
+
+    /* Reconnect to the same joystick, if it was ever connected */
+    if (dev->identity.vendor_id != 0) {
+        identity = dev->identity;
+        rc = _x52_connect(dev, &identity);
+    } else {
+        rc = _x52_connect(dev, NULL);
+    }
+
+    if (rc == LIBX52_SUCCESS) {
+        /* The new handle has none of the settings, so write all of them */
+        _x52_lock(dev);
+        for (bit = 0; bit < 32; bit++) {
+            if (tst_bit(&dev->configured_mask, bit)) {
+                _x52_queue_update(dev, bit);
+            }
+        }
+        _x52_unlock(dev);
+    }
+
+unlock:
+    _x52_io_unlock(dev);
+    return rc;
+}
+
+int libx52_get_device_info(libx52_device *dev, libx52_device_info *info)
+{
+    int rc = LIBX52_SUCCESS;
+
+    if (!dev || !info) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    _x52_io_lock(dev);
+    if (dev->hdl) {
+        *info = dev->identity;
+    } else {
+        rc = LIBX52_ERROR_NO_DEVICE;
+    }
+    _x52_io_unlock(dev);
+
+    return rc;
+}
+
 int libx52_init(libx52_device **dev)
 {
     int rc;
@@ -131,6 +528,13 @@ int libx52_init(libx52_device **dev)
         return LIBX52_ERROR_OUT_OF_MEMORY;
     }
 
+    x52_dev->deadline_ms[LIBX52_UPDATE_CLASS_INDICATOR] = X52_DEADLINE_INDICATOR;
+    x52_dev->deadline_ms[LIBX52_UPDATE_CLASS_CLOCK] = X52_DEADLINE_CLOCK;
+    x52_dev->deadline_ms[LIBX52_UPDATE_CLASS_TEXT] = X52_DEADLINE_TEXT;
+
+    x52_dev->retry.timeout_ms = X52_VENDOR_TIMEOUT;
+    x52_dev->retry.attempts = X52_VENDOR_ATTEMPTS;
+
     rc = libusb_init(&(x52_dev->ctx));
     if (rc) {
         free(x52_dev);
@@ -148,6 +552,8 @@ int libx52_init(libx52_device **dev)
     libusb_set_debug(x52_dev->ctx, LIBUSB_LOG_LEVEL_WARNING);
     #endif
 
+    _x52_hotplug_register(x52_dev);
+
     /* Try to connect to any supported joystick. It's OK if there aren't
      * any available to connect to, subsequent calls to libx52_connect will
      * be used to open the device handle
@@ -164,8 +570,19 @@ int libx52_init(libx52_device **dev)
 
 void libx52_exit(libx52_device *dev)
 {
+    (void)libx52_update_thread_stop(dev);
+    (void)libx52_clock_service_stop(dev);
     libx52_disconnect(dev);
+    _x52_pipeline_free(dev);
+    _x52_hotplug_deregister(dev);
     libusb_exit(dev->ctx);
+    free(dev->pages);
+    free(dev->anim);
+    (void)libx52_shm_destroy(dev);
+    (void)libx52_journal_stop(dev);
+    _x52_zone_free(dev->zone[LIBX52_CLOCK_2]);
+    _x52_zone_free(dev->zone[LIBX52_CLOCK_3]);
+    _x52_sync_free(dev);
 
     /* Clear the memory to prevent reuse */
     memset(dev, 0, sizeof(*dev));
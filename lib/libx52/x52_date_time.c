@@ -56,6 +56,9 @@ int libx52_set_clock(libx52_device *x52, time_t time, int local)
     int local_time_hour;
     int local_time_minute;
     int update_required = 0;
+    struct x52_state *pending;
+    libx52_clock_id clock;
+    int offset;
 
     if (!x52) {
         return LIBX52_ERROR_INVALID_PARAM;
@@ -90,64 +93,96 @@ int libx52_set_clock(libx52_device *x52, time_t time, int local)
     local_time_hour = timeval.tm_hour;
     local_time_minute = timeval.tm_min;
 
+    _x52_lock(x52);
+    pending = _x52_pending_state(x52);
+
     /* Update the date only if it has changed */
-    if (x52->date_day != local_date_day ||
-        x52->date_month != local_date_month ||
-        x52->date_year != local_date_year) {
+    if (pending->date_day != local_date_day ||
+        pending->date_month != local_date_month ||
+        pending->date_year != local_date_year) {
 
         libx52_set_date(x52, local_date_day, local_date_month, local_date_year);
         update_required = 1;
     }
 
     /* Update the time only if it has changed */
-    if (x52->time_hour != local_time_hour ||
-        x52->time_minute != local_time_minute) {
+    if (pending->time_hour != local_time_hour ||
+        pending->time_minute != local_time_minute) {
 
         libx52_set_time(x52, local_time_hour, local_time_minute);
         update_required = 1;
     }
 
     /* Update the offset fields only if the timezone has changed */
-    if (x52->timezone[LIBX52_CLOCK_1] != local_tz) {
-        set_bit(&x52->update_mask, X52_BIT_MFD_OFFS1);
-        set_bit(&x52->update_mask, X52_BIT_MFD_OFFS2);
+    if (pending->timezone[LIBX52_CLOCK_1] != local_tz) {
+        _x52_mark_update(x52, X52_BIT_MFD_OFFS1);
+        _x52_mark_update(x52, X52_BIT_MFD_OFFS2);
         update_required = 1;
     }
 
     /* Save the timezone */
-    x52->timezone[LIBX52_CLOCK_1] = local_tz;
+    pending->timezone[LIBX52_CLOCK_1] = local_tz;
+
+    /* Clocks which follow a zone pick up its daylight saving transitions */
+    for (clock = LIBX52_CLOCK_2; clock <= LIBX52_CLOCK_3; clock++) {
+        if (x52->zone[clock] == NULL) {
+            continue;
+        }
+
+        offset = _x52_zone_offset(x52->zone[clock], time);
+        if (pending->timezone[clock] != offset) {
+            pending->timezone[clock] = offset;
+            _x52_mark_update(x52, X52_BIT_MFD_OFFS1 + (clock - LIBX52_CLOCK_2));
+            update_required = 1;
+        }
+    }
+
+    _x52_unlock(x52);
     return (update_required ? LIBX52_SUCCESS : LIBX52_ERROR_TRY_AGAIN);
 }
 
 int libx52_set_time(libx52_device *x52, uint8_t hour, uint8_t minute)
 {
+    struct x52_state *pending;
+
     if (!x52) {
         return LIBX52_ERROR_INVALID_PARAM;
     }
 
-    x52->time_hour = hour;
-    x52->time_minute = minute;
-    set_bit(&x52->update_mask, X52_BIT_MFD_TIME);
+    _x52_lock(x52);
+    pending = _x52_pending_state(x52);
+    pending->time_hour = hour;
+    pending->time_minute = minute;
+    _x52_mark_update(x52, X52_BIT_MFD_TIME);
+    _x52_unlock(x52);
 
     return LIBX52_SUCCESS;
 }
 
 int libx52_set_date(libx52_device *x52, uint8_t dd, uint8_t mm, uint8_t yy)
 {
+    struct x52_state *pending;
+
     if (!x52) {
         return LIBX52_ERROR_INVALID_PARAM;
     }
 
-    x52->date_day = dd;
-    x52->date_month = mm;
-    x52->date_year = yy;
-    set_bit(&x52->update_mask, X52_BIT_MFD_DATE);
+    _x52_lock(x52);
+    pending = _x52_pending_state(x52);
+    pending->date_day = dd;
+    pending->date_month = mm;
+    pending->date_year = yy;
+    _x52_mark_update(x52, X52_BIT_MFD_DATE);
+    _x52_unlock(x52);
 
     return LIBX52_SUCCESS;
 }
 
 int libx52_set_clock_timezone(libx52_device *x52, libx52_clock_id clock, int offset)
 {
+    struct x52_state *pending;
+    uint32_t update_bit;
+
     if (!x52) {
         return LIBX52_ERROR_INVALID_PARAM;
     }
@@ -159,13 +194,11 @@ int libx52_set_clock_timezone(libx52_device *x52, libx52_clock_id clock, int off
 
     switch (clock) {
     case LIBX52_CLOCK_2:
-        x52->timezone[clock] = offset;
-        set_bit(&x52->update_mask, X52_BIT_MFD_OFFS1);
+        update_bit = X52_BIT_MFD_OFFS1;
         break;
 
     case LIBX52_CLOCK_3:
-        x52->timezone[clock] = offset;
-        set_bit(&x52->update_mask, X52_BIT_MFD_OFFS2);
+        update_bit = X52_BIT_MFD_OFFS2;
         break;
 
     case LIBX52_CLOCK_1:
@@ -175,6 +208,64 @@ int libx52_set_clock_timezone(libx52_device *x52, libx52_clock_id clock, int off
         return LIBX52_ERROR_INVALID_PARAM;
     }
 
+    _x52_lock(x52);
+    pending = _x52_pending_state(x52);
+    pending->timezone[clock] = offset;
+    _x52_mark_update(x52, update_bit);
+
+    /* A fixed offset replaces any zone that the clock was following */
+    _x52_zone_free(x52->zone[clock]);
+    x52->zone[clock] = NULL;
+    _x52_unlock(x52);
+
+    return LIBX52_SUCCESS;
+}
+
+int libx52_set_clock_zone(libx52_device *x52, libx52_clock_id clock,
+                          const char *zone)
+{
+    struct x52_zone *z = NULL;
+    int offset;
+    int rc;
+
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    if (clock == LIBX52_CLOCK_1) {
+        return LIBX52_ERROR_NOT_SUPPORTED;
+    }
+
+    if (clock != LIBX52_CLOCK_2 && clock != LIBX52_CLOCK_3) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    if (zone == NULL) {
+        /* Keep the current offset, but stop following the zone */
+        _x52_lock(x52);
+        _x52_zone_free(x52->zone[clock]);
+        x52->zone[clock] = NULL;
+        _x52_unlock(x52);
+        return LIBX52_SUCCESS;
+    }
+
+    /* Parse the zone file without holding the state lock */
+    rc = _x52_zone_load(zone, &z);
+    if (rc != LIBX52_SUCCESS) {
+        return rc;
+    }
+
+    offset = _x52_zone_offset(z, time(NULL));
+    rc = libx52_set_clock_timezone(x52, clock, offset);
+    if (rc != LIBX52_SUCCESS) {
+        _x52_zone_free(z);
+        return rc;
+    }
+
+    _x52_lock(x52);
+    x52->zone[clock] = z;
+    _x52_unlock(x52);
+
     return LIBX52_SUCCESS;
 }
 
@@ -182,6 +273,9 @@ int libx52_set_clock_format(libx52_device *x52,
                             libx52_clock_id clock,
                             libx52_clock_format format)
 {
+    struct x52_state *pending;
+    uint32_t update_bit;
+
     if (!x52) {
         return LIBX52_ERROR_INVALID_PARAM;
     }
@@ -194,32 +288,41 @@ int libx52_set_clock_format(libx52_device *x52,
 
     switch (clock) {
     case LIBX52_CLOCK_1:
-        set_bit(&x52->update_mask, X52_BIT_MFD_TIME);
+        update_bit = X52_BIT_MFD_TIME;
         break;
 
     case LIBX52_CLOCK_2:
-        set_bit(&x52->update_mask, X52_BIT_MFD_OFFS1);
+        update_bit = X52_BIT_MFD_OFFS1;
         break;
 
     case LIBX52_CLOCK_3:
-        set_bit(&x52->update_mask, X52_BIT_MFD_OFFS2);
+        update_bit = X52_BIT_MFD_OFFS2;
         break;
 
     default:
         return LIBX52_ERROR_INVALID_PARAM;
     }
 
-    x52->time_format[clock] = format;
+    _x52_lock(x52);
+    pending = _x52_pending_state(x52);
+    _x52_mark_update(x52, update_bit);
+    pending->time_format[clock] = format;
+    _x52_unlock(x52);
     return LIBX52_SUCCESS;
 }
 
 int libx52_set_date_format(libx52_device *x52, libx52_date_format format)
 {
+    struct x52_state *pending;
+
     if (!x52) {
         return LIBX52_ERROR_INVALID_PARAM;
     }
 
-    x52->date_format = format;
-    set_bit(&x52->update_mask, X52_BIT_MFD_DATE);
+    _x52_lock(x52);
+    pending = _x52_pending_state(x52);
+    pending->date_format = format;
+    _x52_mark_update(x52, X52_BIT_MFD_DATE);
+    _x52_unlock(x52);
     return LIBX52_SUCCESS;
 }
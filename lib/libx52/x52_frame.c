@@ -0,0 +1,147 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - frame updates
+ *
+ * Copyright (C) 2012-2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libx52.h"
+#include "x52_common.h"
+
+/*
+ * A frame is built in a back buffer, which starts out as a copy of the
+ * pending state. The libx52_set functions modify the back buffer while a
+ * frame is open, and libx52_commit_frame copies it over the pending state in
+ * a single step under the state lock. libx52_update and the update thread only
+ * ever read the pending state, so they either see all of a frame or none of
+ * it.
+ *
+ * The LED setters may change the pending state without the state lock, if
+ * no frame is open. A setter which races with the start or the commit of a
+ * frame notices the change of in_frame or frame_gen, and applies its change
+ * again under the lock, so that the frame does not overwrite it.
+ */
+
+/*
+ * Copy the settings from one state to another. The LED mask is copied
+ * atomically, since the LED setters may change it without the state lock. The
+ * queueing times are not copied, they only have a meaning in the pending
+ * state.
+ */
+static void _x52_frame_copy(struct x52_state *dst, const struct x52_state *src)
+{
+    int i;
+
+    dst->mfd_brightness = src->mfd_brightness;
+    dst->led_brightness = src->led_brightness;
+
+    for (i = 0; i < X52_MFD_LINES; i++) {
+        dst->line[i] = src->line[i];
+    }
+
+    dst->date_format = src->date_format;
+    dst->date_day = src->date_day;
+    dst->date_month = src->date_month;
+    dst->date_year = src->date_year;
+    dst->time_hour = src->time_hour;
+    dst->time_minute = src->time_minute;
+
+    for (i = 0; i < X52_MFD_CLOCKS; i++) {
+        dst->timezone[i] = src->timezone[i];
+        dst->time_format[i] = src->time_format[i];
+    }
+
+    __atomic_store_n(&dst->led_mask,
+                     __atomic_load_n(&src->led_mask, __ATOMIC_SEQ_CST),
+                     __ATOMIC_SEQ_CST);
+}
+
+int libx52_begin_frame(libx52_device *x52)
+{
+    int rc = LIBX52_SUCCESS;
+
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    _x52_lock(x52);
+    if (x52->in_frame) {
+        rc = LIBX52_ERROR_BUSY;
+    } else {
+        _x52_frame_copy(&x52->frame, &x52->state);
+        x52->frame_mask = 0;
+        __atomic_store_n(&x52->in_frame, true, __ATOMIC_SEQ_CST);
+    }
+    _x52_unlock(x52);
+
+    return rc;
+}
+
+int libx52_commit_frame(libx52_device *x52)
+{
+    uint32_t changed = 0;
+    uint32_t bit;
+    int rc = LIBX52_SUCCESS;
+
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    _x52_lock(x52);
+    if (!x52->in_frame) {
+        rc = LIBX52_ERROR_INVALID_PARAM;
+        goto unlock;
+    }
+
+    /* Only queue the settings which the frame actually changed, or which
+     * have never been written before.
+     */
+    for (bit = 0; bit < 32; bit++) {
+        if (tst_bit(&x52->frame_mask, bit) &&
+            (!atomic_tst_bit(&x52->configured_mask, bit) ||
+             _x52_state_differs(&x52->frame, &x52->state, bit))) {
+            set_bit(&changed, bit);
+        }
+    }
+
+    /* This keeps the queueing times of the settings which are still pending */
+    _x52_frame_copy(&x52->state, &x52->frame);
+    __atomic_add_fetch(&x52->frame_gen, 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&x52->in_frame, false, __ATOMIC_SEQ_CST);
+
+    for (bit = 0; bit < 32; bit++) {
+        if (tst_bit(&changed, bit)) {
+            _x52_queue_update(x52, bit);
+        }
+    }
+
+unlock:
+    _x52_unlock(x52);
+    return rc;
+}
+
+int libx52_abort_frame(libx52_device *x52)
+{
+    int rc = LIBX52_SUCCESS;
+
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    _x52_lock(x52);
+    if (x52->in_frame) {
+        __atomic_store_n(&x52->in_frame, false, __ATOMIC_SEQ_CST);
+    } else {
+        rc = LIBX52_ERROR_INVALID_PARAM;
+    }
+    _x52_unlock(x52);
+
+    return rc;
+}
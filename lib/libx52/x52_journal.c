@@ -0,0 +1,114 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - vendor command journal
+ *
+ * Copyright (C) 2012-2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "libx52.h"
+#include "x52_common.h"
+
+/*
+ * The journal is written through stdio, so that recording a command is a
+ * copy into the stream buffer, and the file is only written once the buffer
+ * fills up. Records are timestamped with the monotonic clock, relative to
+ * the start of the journal, while the header holds the wall clock time of
+ * the start for reference.
+ */
+
+int libx52_journal_start(libx52_device *x52, const char *path)
+{
+    libx52_journal_header header;
+    struct timespec now;
+    FILE *journal;
+
+    if (!x52 || !path) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    journal = fopen(path, "wb");
+    if (journal == NULL) {
+        return (errno == ENOENT) ? LIBX52_ERROR_NOT_FOUND : LIBX52_ERROR_PERM;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    memset(&header, 0, sizeof(header));
+    header.magic = LIBX52_JOURNAL_MAGIC;
+    header.version = LIBX52_JOURNAL_VERSION;
+    header.record_size = sizeof(libx52_journal_record);
+    header.start_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+    if (fwrite(&header, sizeof(header), 1, journal) != 1) {
+        fclose(journal);
+        return LIBX52_ERROR_IO;
+    }
+
+    /* Commands are recorded with the I/O lock held, from any thread */
+    _x52_io_lock(x52);
+    if (x52->journal != NULL) {
+        _x52_io_unlock(x52);
+        fclose(journal);
+        return LIBX52_ERROR_BUSY;
+    }
+
+    x52->journal_start_ns = _x52_monotonic_ns();
+    x52->journal_error = false;
+    x52->journal = journal;
+    _x52_io_unlock(x52);
+
+    return LIBX52_SUCCESS;
+}
+
+int libx52_journal_stop(libx52_device *x52)
+{
+    int rc = LIBX52_SUCCESS;
+
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    _x52_io_lock(x52);
+    if (x52->journal != NULL) {
+        if (fclose(x52->journal) != 0 || x52->journal_error) {
+            rc = LIBX52_ERROR_IO;
+        }
+        x52->journal = NULL;
+    }
+    _x52_io_unlock(x52);
+
+    return rc;
+}
+
+/* Append a record for a completed vendor command */
+void _x52_journal_record(libx52_device *x52, uint16_t index, uint16_t value,
+                         int rc, unsigned int retries, uint64_t elapsed_ns)
+{
+    libx52_journal_record record;
+    uint64_t start_ns = _x52_monotonic_ns() - elapsed_ns;
+
+    memset(&record, 0, sizeof(record));
+    if (start_ns > x52->journal_start_ns) {
+        record.time_ns = start_ns - x52->journal_start_ns;
+    }
+    record.latency_us = (elapsed_ns / 1000 > UINT32_MAX) ?
+                        UINT32_MAX : (uint32_t)(elapsed_ns / 1000);
+    record.index = index;
+    record.value = value;
+    record.result = (int16_t)rc;
+    record.retries = (retries > UINT8_MAX) ? UINT8_MAX : (uint8_t)retries;
+
+    if (fwrite(&record, sizeof(record), 1, x52->journal) != 1) {
+        /* Reported when the journal is stopped */
+        x52->journal_error = true;
+    }
+}
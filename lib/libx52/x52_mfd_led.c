@@ -17,6 +17,8 @@
 
 int libx52_set_text(libx52_device *x52, uint8_t line, const char *text, uint8_t length)
 {
+    struct x52_state *pending;
+
     if (!x52 || !text) {
         return LIBX52_ERROR_INVALID_PARAM;
     }
@@ -29,16 +31,77 @@ int libx52_set_text(libx52_device *x52, uint8_t line, const char *text, uint8_t
         length = X52_MFD_LINE_SIZE;
     }
 
-    memset(x52->line[line].text, ' ', X52_MFD_LINE_SIZE);
-    memcpy(x52->line[line].text, text, length);
-    x52->line[line].length = length;
-    set_bit(&x52->update_mask, X52_BIT_MFD_LINE1 + line);
+    _x52_lock(x52);
+    pending = _x52_pending_state(x52);
+    memset(pending->line[line].text, ' ', X52_MFD_LINE_SIZE);
+    memcpy(pending->line[line].text, text, length);
+    pending->line[line].length = length;
+    _x52_mark_update(x52, X52_BIT_MFD_LINE1 + line);
+    _x52_unlock(x52);
 
     return LIBX52_SUCCESS;
 }
 
+/* Change the selected bits of the LED mask in a state, atomically */
+static void _x52_update_led_mask(uint32_t *led_mask, uint32_t mask,
+                                 uint32_t value)
+{
+    uint32_t old = __atomic_load_n(led_mask, __ATOMIC_SEQ_CST);
+
+    while (!__atomic_compare_exchange_n(led_mask, &old, (old & ~mask) | value,
+                                        false, __ATOMIC_SEQ_CST,
+                                        __ATOMIC_SEQ_CST)) {
+        /* old has been updated with the current value, try again */
+    }
+}
+
+/*
+ * Set the bits of the LED mask selected by mask to the bits in value, and
+ * mark them for update. The LED mask and the update mask are changed with
+ * atomic operations, so unless a frame is open, this needs no lock, and LED
+ * changes never wait for a setter of the MFD text or the clocks.
+ */
+static void _x52_set_led_mask(libx52_device *x52, uint32_t mask, uint32_t value)
+{
+    uint32_t gen;
+    uint32_t bit;
+
+    if (x52->sync != NULL) {
+        gen = __atomic_load_n(&x52->frame_gen, __ATOMIC_SEQ_CST);
+        if (!__atomic_load_n(&x52->in_frame, __ATOMIC_SEQ_CST)) {
+            _x52_update_led_mask(&x52->state.led_mask, mask, value);
+            for (bit = 0; bit < 32; bit++) {
+                if (tst_bit(&mask, bit)) {
+                    _x52_queue_update(x52, bit);
+                }
+            }
+
+            if (!__atomic_load_n(&x52->in_frame, __ATOMIC_SEQ_CST) &&
+                __atomic_load_n(&x52->frame_gen, __ATOMIC_SEQ_CST) == gen) {
+                return;
+            }
+
+            /* A frame was started or committed meanwhile, and may not have
+             * the change. Apply it again under the lock.
+             */
+        }
+    }
+
+    _x52_lock(x52);
+    _x52_update_led_mask(&_x52_pending_state(x52)->led_mask, mask, value);
+    for (bit = 0; bit < 32; bit++) {
+        if (tst_bit(&mask, bit)) {
+            _x52_mark_update(x52, bit);
+        }
+    }
+    _x52_unlock(x52);
+}
+
 static int x52pro_set_led_state(libx52_device *x52, libx52_led_id led, libx52_led_state state)
 {
+    uint32_t mask = 0;
+    uint32_t value = 0;
+
     if (!x52) {
         return LIBX52_ERROR_INVALID_PARAM;
     }
@@ -46,13 +109,10 @@ static int x52pro_set_led_state(libx52_device *x52, libx52_led_id led, libx52_le
     switch (led) {
     case LIBX52_LED_FIRE:
     case LIBX52_LED_THROTTLE:
-        if (state == LIBX52_LED_STATE_OFF) {
-            clr_bit(&x52->led_mask, led);
-            set_bit(&x52->update_mask, led);
-        } else if (state == LIBX52_LED_STATE_ON) {
-            set_bit(&x52->led_mask, led);
-            set_bit(&x52->update_mask, led);
-        } else {
+        set_bit(&mask, led);
+        if (state == LIBX52_LED_STATE_ON) {
+            set_bit(&value, led);
+        } else if (state != LIBX52_LED_STATE_OFF) {
             /* Colors not supported */
             return LIBX52_ERROR_NOT_SUPPORTED;
         }
@@ -71,25 +131,24 @@ static int x52pro_set_led_state(libx52_device *x52, libx52_led_id led, libx52_le
          * However, they are composed of individual RED and GREEN LEDs which
          * must be turned on or off individually.
          */
+        set_bit(&mask, led + 0); // Red
+        set_bit(&mask, led + 1); // Green
+
         switch (state) {
         case LIBX52_LED_STATE_OFF:
-            clr_bit(&x52->led_mask, led + 0); // Red
-            clr_bit(&x52->led_mask, led + 1); // Green
             break;
 
         case LIBX52_LED_STATE_RED:
-            set_bit(&x52->led_mask, led + 0); // Red
-            clr_bit(&x52->led_mask, led + 1); // Green
+            set_bit(&value, led + 0); // Red
             break;
 
         case LIBX52_LED_STATE_AMBER:
-            set_bit(&x52->led_mask, led + 0); // Red
-            set_bit(&x52->led_mask, led + 1); // Green
+            set_bit(&value, led + 0); // Red
+            set_bit(&value, led + 1); // Green
             break;
 
         case LIBX52_LED_STATE_GREEN:
-            clr_bit(&x52->led_mask, led + 0); // Red
-            set_bit(&x52->led_mask, led + 1); // Green
+            set_bit(&value, led + 1); // Green
             break;
 
         case LIBX52_LED_STATE_ON:
@@ -100,10 +159,6 @@ static int x52pro_set_led_state(libx52_device *x52, libx52_led_id led, libx52_le
             /* Any other state is not valid */
             return LIBX52_ERROR_INVALID_PARAM;
         }
-
-        /* Set the update mask bits */
-        set_bit(&x52->update_mask, led + 0); // Red
-        set_bit(&x52->update_mask, led + 1); // Green
         break;
 
     default:
@@ -111,6 +166,7 @@ static int x52pro_set_led_state(libx52_device *x52, libx52_led_id led, libx52_le
         return LIBX52_ERROR_INVALID_PARAM;
     }
 
+    _x52_set_led_mask(x52, mask, value);
     return LIBX52_SUCCESS;
 }
 
@@ -135,17 +191,22 @@ int libx52_set_led_state(libx52_device *x52, libx52_led_id led, libx52_led_state
 
 int libx52_set_brightness(libx52_device *x52, uint8_t mfd, uint16_t brightness)
 {
+    struct x52_state *pending;
+
     if (!x52) {
         return LIBX52_ERROR_INVALID_PARAM;
     }
 
+    _x52_lock(x52);
+    pending = _x52_pending_state(x52);
     if (mfd) {
-        x52->mfd_brightness = brightness;
-        set_bit(&x52->update_mask, X52_BIT_BRI_MFD);
+        pending->mfd_brightness = brightness;
+        _x52_mark_update(x52, X52_BIT_BRI_MFD);
     } else {
-        x52->led_brightness = brightness;
-        set_bit(&x52->update_mask, X52_BIT_BRI_LED);
+        pending->led_brightness = brightness;
+        _x52_mark_update(x52, X52_BIT_BRI_LED);
     }
+    _x52_unlock(x52);
 
     return LIBX52_SUCCESS;
 }
@@ -156,13 +217,8 @@ int libx52_set_shift(libx52_device *x52, uint8_t state)
         return LIBX52_ERROR_INVALID_PARAM;
     }
 
-    if (state) {
-        set_bit(&x52->led_mask, X52_BIT_SHIFT);
-    } else {
-        clr_bit(&x52->led_mask, X52_BIT_SHIFT);
-    }
-
-    set_bit(&x52->update_mask, X52_BIT_SHIFT);
+    _x52_set_led_mask(x52, 1UL << X52_BIT_SHIFT,
+                      state ? (1UL << X52_BIT_SHIFT) : 0);
     return LIBX52_SUCCESS;
 }
 
@@ -172,12 +228,7 @@ int libx52_set_blink(libx52_device *x52, uint8_t state)
         return LIBX52_ERROR_INVALID_PARAM;
     }
 
-    if (state) {
-        set_bit(&x52->led_mask, X52_BIT_POV_BLINK);
-    } else {
-        clr_bit(&x52->led_mask, X52_BIT_POV_BLINK);
-    }
-
-    set_bit(&x52->update_mask, X52_BIT_POV_BLINK);
+    _x52_set_led_mask(x52, 1UL << X52_BIT_POV_BLINK,
+                      state ? (1UL << X52_BIT_POV_BLINK) : 0);
     return LIBX52_SUCCESS;
 }
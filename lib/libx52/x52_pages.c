@@ -0,0 +1,369 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - MFD pages
+ *
+ * Copyright (C) 2012-2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libx52.h"
+#include "x52_common.h"
+
+static struct x52_page *_x52_page_get(libx52_device *x52, uint8_t page_id)
+{
+    if (x52->pages == NULL || page_id >= LIBX52_PAGE_MAX ||
+        !x52->pages->page[page_id].used) {
+        return NULL;
+    }
+
+    return &x52->pages->page[page_id];
+}
+
+static uint64_t _x52_page_interval_ns(struct x52_pages *pages)
+{
+    unsigned int ms = pages->scroll_ms ? pages->scroll_ms : LIBX52_PAGE_SCROLL_MS;
+
+    return (uint64_t)ms * 1000000ULL;
+}
+
+/*
+ * Set the visible window of a page line on the MFD. The pending MFD text is
+ * compared first, so that a line which has not changed, such as a line that
+ * fits on the display, is not marked for update at all.
+ */
+static void _x52_page_render(libx52_device *x52, uint8_t line,
+                             const struct x52_page_line *pl)
+{
+    char window[X52_MFD_LINE_SIZE];
+    const char *text = pl->text;
+    uint8_t length;
+    uint16_t ring;
+    uint16_t pos;
+    const struct x52_mfd_line *cur;
+    bool unchanged;
+    int i;
+
+    if (pl->length > X52_MFD_LINE_SIZE) {
+        ring = pl->length + X52_PAGE_SCROLL_GAP;
+        pos = pl->offset;
+        for (i = 0; i < X52_MFD_LINE_SIZE; i++) {
+            window[i] = (pos < pl->length) ? pl->text[pos] : ' ';
+            pos = (pos + 1 == ring) ? 0 : pos + 1;
+        }
+        text = window;
+        length = X52_MFD_LINE_SIZE;
+    } else {
+        length = (uint8_t)pl->length;
+    }
+
+    _x52_lock(x52);
+    cur = &_x52_pending_state(x52)->line[line];
+    unchanged = (cur->length == length && !memcmp(cur->text, text, length));
+    if (!unchanged) {
+        (void)libx52_set_text(x52, line, text, length);
+    }
+    _x52_unlock(x52);
+}
+
+/* Display all the lines of the active page, in a single frame if possible */
+static void _x52_page_show(libx52_device *x52)
+{
+    struct x52_pages *pages = x52->pages;
+    struct x52_page *page = &pages->page[pages->active];
+    bool framed;
+    uint8_t line;
+
+    /* If the application has a frame open, the page becomes part of it */
+    framed = (libx52_begin_frame(x52) == LIBX52_SUCCESS);
+
+    for (line = 0; line < X52_MFD_LINES; line++) {
+        page->line[line].offset = 0;
+        _x52_page_render(x52, line, &page->line[line]);
+    }
+
+    if (framed) {
+        (void)libx52_commit_frame(x52);
+    }
+
+    pages->shown = true;
+    pages->next_scroll_ns = _x52_monotonic_ns() + _x52_page_interval_ns(pages);
+}
+
+/* Find the next used page after start, in the given direction */
+static uint8_t _x52_page_next(struct x52_pages *pages, uint8_t start, int dir)
+{
+    int id = start;
+    int i;
+
+    for (i = 0; i < LIBX52_PAGE_MAX; i++) {
+        id = (id + dir + LIBX52_PAGE_MAX) % LIBX52_PAGE_MAX;
+        if (pages->page[id].used) {
+            break;
+        }
+    }
+
+    return (uint8_t)id;
+}
+
+int libx52_page_create(libx52_device *x52, uint8_t *page_id,
+                       libx52_page_callback callback, void *user_data)
+{
+    struct x52_pages *pages;
+    uint8_t id;
+
+    if (!x52 || !page_id) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    if (x52->pages == NULL) {
+        /* All page storage is allocated up front, scrolling never allocates */
+        x52->pages = calloc(1, sizeof(*x52->pages));
+        if (x52->pages == NULL) {
+            return LIBX52_ERROR_OUT_OF_MEMORY;
+        }
+    }
+
+    pages = x52->pages;
+    for (id = 0; id < LIBX52_PAGE_MAX; id++) {
+        if (!pages->page[id].used) {
+            break;
+        }
+    }
+
+    if (id == LIBX52_PAGE_MAX) {
+        return LIBX52_ERROR_NOT_SUPPORTED;
+    }
+
+    memset(&pages->page[id], 0, sizeof(pages->page[id]));
+    pages->page[id].used = true;
+    pages->page[id].callback = callback;
+    pages->page[id].user_data = user_data;
+
+    if (pages->count == 0) {
+        pages->active = id;
+    }
+    pages->count++;
+
+    *page_id = id;
+    return LIBX52_SUCCESS;
+}
+
+int libx52_page_delete(libx52_device *x52, uint8_t page_id)
+{
+    struct x52_pages *pages;
+    struct x52_page *page;
+
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    page = _x52_page_get(x52, page_id);
+    if (page == NULL) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    pages = x52->pages;
+    page->used = false;
+    pages->count--;
+
+    if (pages->count == 0) {
+        pages->shown = false;
+    } else if (pages->active == page_id) {
+        pages->active = _x52_page_next(pages, page_id, 1);
+        if (pages->shown) {
+            _x52_page_show(x52);
+        }
+    }
+
+    return LIBX52_SUCCESS;
+}
+
+int libx52_page_set_line(libx52_device *x52, uint8_t page_id, uint8_t line,
+                         const char *text, uint16_t length)
+{
+    struct x52_page *page;
+    struct x52_page_line *pl;
+
+    if (!x52 || !text || line >= X52_MFD_LINES) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    page = _x52_page_get(x52, page_id);
+    if (page == NULL) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    if (length > LIBX52_PAGE_LINE_MAX) {
+        length = LIBX52_PAGE_LINE_MAX;
+    }
+
+    pl = &page->line[line];
+    memcpy(pl->text, text, length);
+    pl->length = length;
+    pl->offset = 0;
+
+    if (x52->pages->shown && x52->pages->active == page_id) {
+        _x52_page_render(x52, line, pl);
+    }
+
+    return LIBX52_SUCCESS;
+}
+
+int libx52_page_activate(libx52_device *x52, uint8_t page_id)
+{
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    if (_x52_page_get(x52, page_id) == NULL) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    x52->pages->active = page_id;
+    _x52_page_show(x52);
+
+    return LIBX52_SUCCESS;
+}
+
+int libx52_page_get_active(libx52_device *x52, uint8_t *page_id)
+{
+    if (!x52 || !page_id) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    if (x52->pages == NULL || x52->pages->count == 0) {
+        return LIBX52_ERROR_NOT_SUPPORTED;
+    }
+
+    *page_id = x52->pages->active;
+    return LIBX52_SUCCESS;
+}
+
+int libx52_page_tick(libx52_device *x52, unsigned int *next_ms)
+{
+    struct x52_pages *pages;
+    struct x52_page *page;
+    struct x52_page_line *pl;
+    uint64_t now;
+    uint64_t interval;
+    uint8_t line;
+
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    pages = x52->pages;
+    if (pages == NULL || !pages->shown) {
+        if (next_ms) {
+            *next_ms = LIBX52_PAGE_SCROLL_MS;
+        }
+        return LIBX52_SUCCESS;
+    }
+
+    now = _x52_monotonic_ns();
+    interval = _x52_page_interval_ns(pages);
+
+    if (now >= pages->next_scroll_ns) {
+        page = &pages->page[pages->active];
+        for (line = 0; line < X52_MFD_LINES; line++) {
+            pl = &page->line[line];
+            if (pl->length <= X52_MFD_LINE_SIZE) {
+                continue;
+            }
+
+            pl->offset++;
+            if (pl->offset == pl->length + X52_PAGE_SCROLL_GAP) {
+                pl->offset = 0;
+            }
+            _x52_page_render(x52, line, pl);
+        }
+
+        /* Don't try to catch up on missed steps */
+        pages->next_scroll_ns += interval;
+        if (pages->next_scroll_ns <= now) {
+            pages->next_scroll_ns = now + interval;
+        }
+    }
+
+    if (next_ms) {
+        *next_ms = (unsigned int)((pages->next_scroll_ns - now + 999999) / 1000000);
+    }
+
+    return LIBX52_SUCCESS;
+}
+
+int libx52_page_set_scroll_interval(libx52_device *x52, unsigned int interval_ms)
+{
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    if (x52->pages == NULL) {
+        x52->pages = calloc(1, sizeof(*x52->pages));
+        if (x52->pages == NULL) {
+            return LIBX52_ERROR_OUT_OF_MEMORY;
+        }
+    }
+
+    x52->pages->scroll_ms = interval_ms;
+    return LIBX52_SUCCESS;
+}
+
+int libx52_page_input(libx52_device *x52, libx52_page_event event, bool pressed)
+{
+    struct x52_pages *pages;
+    struct x52_page *page;
+    uint8_t active;
+
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    switch (event) {
+    case LIBX52_PAGE_EVENT_PG_UP:
+    case LIBX52_PAGE_EVENT_PG_DN:
+    case LIBX52_PAGE_EVENT_UP:
+    case LIBX52_PAGE_EVENT_DN:
+    case LIBX52_PAGE_EVENT_SELECT:
+        break;
+
+    default:
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    pages = x52->pages;
+    if (pages == NULL || pages->count == 0) {
+        return LIBX52_ERROR_NOT_SUPPORTED;
+    }
+
+    active = pages->active;
+    page = &pages->page[active];
+    if (page->callback != NULL) {
+        (*page->callback)(x52, active, event, pressed, page->user_data);
+    }
+
+    /* The callback may have switched or deleted pages itself */
+    if (!pressed || pages->count == 0 || pages->active != active) {
+        return LIBX52_SUCCESS;
+    }
+
+    if (event == LIBX52_PAGE_EVENT_PG_UP) {
+        pages->active = _x52_page_next(pages, active, -1);
+    } else if (event == LIBX52_PAGE_EVENT_PG_DN) {
+        pages->active = _x52_page_next(pages, active, 1);
+    } else {
+        return LIBX52_SUCCESS;
+    }
+
+    if (pages->active != active && pages->shown) {
+        _x52_page_show(x52);
+    }
+
+    return LIBX52_SUCCESS;
+}
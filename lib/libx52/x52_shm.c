@@ -0,0 +1,796 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - shared memory state segment
+ *
+ * Copyright (C) 2012-2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if HAVE_MEMFD_CREATE && HAVE_LINUX_FUTEX_H
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#define X52_SHM_SUPPORTED 1
+#endif
+
+#include "libx52.h"
+#include "x52_common.h"
+
+/*
+ * The segment holds a copy of the settings which the writers can change.
+ * Writers take the spin lock in the segment by storing their thread ID in
+ * it, make seq odd, copy the new value in, and make seq even again. The owner
+ * copies the data out while seq is even and unchanged, as with the state
+ * snapshot in x52_thread.c, and compares the copy with the shadow of the
+ * previous sync to find the settings which the writers changed.
+ *
+ * A writer which is killed while holding the lock would otherwise block the
+ * other writers, and the owner, forever. The owner only retries the copy a
+ * few times, and both sides take the lock over once the thread holding it has
+ * exited.
+ *
+ * seq is also the futex word that the owner sleeps on in libx52_shm_wait.
+ * Writers only wake it if the owner has set waiting, so publishing a change
+ * does not need a system call while the owner is busy.
+ */
+
+/* Attempts to copy the segment before libx52_shm_sync gives up */
+#define X52_SHM_READ_ATTEMPTS   100
+
+struct libx52_shm {
+    struct x52_shm_segment *seg;
+};
+
+#if X52_SHM_SUPPORTED
+/* LEDs in the LED mask, other than the shift and blink indicators */
+static const libx52_led_id x52_shm_leds[] = {
+    LIBX52_LED_FIRE,
+    LIBX52_LED_A,
+    LIBX52_LED_B,
+    LIBX52_LED_D,
+    LIBX52_LED_E,
+    LIBX52_LED_T1,
+    LIBX52_LED_T2,
+    LIBX52_LED_T3,
+    LIBX52_LED_POV,
+    LIBX52_LED_CLUTCH,
+    LIBX52_LED_THROTTLE,
+};
+
+static long _x52_futex(uint32_t *word, int op, uint32_t value,
+                       const struct timespec *timeout)
+{
+    return syscall(SYS_futex, word, op, value, timeout, NULL, 0);
+}
+
+/* Check if the writer holding the lock has exited without releasing it */
+static bool _x52_shm_holder_dead(uint32_t holder)
+{
+    return holder != 0 && kill((pid_t)holder, 0) < 0 && errno == ESRCH;
+}
+
+static void _x52_shm_write_begin(struct x52_shm_segment *seg)
+{
+    uint32_t self = (uint32_t)syscall(SYS_gettid);
+    uint32_t holder = 0;
+
+    while (!__atomic_compare_exchange_n(&seg->lock, &holder, self, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        /*
+         * holder now has the thread ID of the writer holding the lock. If it
+         * has exited, take the lock over from it on the next attempt,
+         * otherwise wait for it to finish copying, which does not take long.
+         */
+        if (!_x52_shm_holder_dead(holder)) {
+            holder = 0;
+            sched_yield();
+        }
+    }
+
+    /* seq is still odd if the previous holder exited while copying */
+    if (!(__atomic_load_n(&seg->seq, __ATOMIC_SEQ_CST) & 1)) {
+        __atomic_add_fetch(&seg->seq, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+static void _x52_shm_write_end(struct x52_shm_segment *seg)
+{
+    __atomic_add_fetch(&seg->seq, 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&seg->lock, 0, __ATOMIC_RELEASE);
+
+    if (__atomic_load_n(&seg->waiting, __ATOMIC_SEQ_CST)) {
+        (void)_x52_futex(&seg->seq, FUTEX_WAKE, INT_MAX, NULL);
+    }
+}
+
+/*
+ * Copy the segment data, and the sequence number of the copy. Gives up with
+ * LIBX52_ERROR_TRY_AGAIN if a writer is still copying after a few attempts.
+ */
+static int _x52_shm_read(struct x52_shm_segment *seg,
+                         struct x52_shm_data *data, uint32_t *seq)
+{
+    int attempt;
+
+    for (attempt = 0; attempt < X52_SHM_READ_ATTEMPTS; attempt++) {
+        *seq = __atomic_load_n(&seg->seq, __ATOMIC_ACQUIRE);
+        if (*seq & 1) {
+            if (_x52_shm_holder_dead(__atomic_load_n(&seg->lock,
+                                                     __ATOMIC_RELAXED))) {
+                /* Publish whatever the writer managed to copy */
+                _x52_shm_write_begin(seg);
+                _x52_shm_write_end(seg);
+            } else {
+                sched_yield();
+            }
+            continue;
+        }
+
+        memcpy(data, &seg->data, sizeof(*data));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&seg->seq, __ATOMIC_RELAXED) == *seq) {
+            return LIBX52_SUCCESS;
+        }
+    }
+
+    return LIBX52_ERROR_TRY_AGAIN;
+}
+
+/* Fill the segment data from the pending state */
+static void _x52_shm_init_data(libx52_device *x52, struct x52_shm_data *data)
+{
+    struct x52_state *pending;
+    int i;
+
+    _x52_lock(x52);
+    pending = _x52_pending_state(x52);
+
+    data->led_mask = __atomic_load_n(&pending->led_mask, __ATOMIC_SEQ_CST);
+    data->mfd_brightness = pending->mfd_brightness;
+    data->led_brightness = pending->led_brightness;
+    for (i = 0; i < X52_MFD_LINES; i++) {
+        data->line_length[i] = pending->line[i].length;
+        memcpy(data->line[i], pending->line[i].text, X52_MFD_LINE_SIZE);
+    }
+    for (i = 0; i < X52_MFD_CLOCKS; i++) {
+        data->timezone[i] = pending->timezone[i];
+        data->time_format[i] = pending->time_format[i];
+    }
+    data->date_format = pending->date_format;
+
+    _x52_unlock(x52);
+}
+
+/*
+ * Record the result of applying a setting in status, unless an earlier
+ * setting has already failed. Returns true if the setting was applied.
+ */
+static bool _x52_shm_applied(int *status, int rc)
+{
+    if (rc != LIBX52_SUCCESS && *status == LIBX52_SUCCESS) {
+        *status = rc;
+    }
+
+    return (rc == LIBX52_SUCCESS);
+}
+
+/*
+ * Apply the LEDs which changed from old_mask. The bits of any LED which
+ * could not be set are restored from old_mask, so that the shadow only
+ * records the LEDs which have been applied.
+ */
+static int _x52_shm_apply_leds(libx52_device *x52, uint32_t *led_mask,
+                               uint32_t old_mask)
+{
+    uint32_t changed = *led_mask ^ old_mask;
+    uint32_t mask;
+    libx52_led_id led;
+    libx52_led_state state;
+    int status = LIBX52_SUCCESS;
+    int rc;
+    size_t i;
+
+    if (changed & (1UL << X52_BIT_SHIFT)) {
+        rc = libx52_set_shift(x52, tst_bit(led_mask, X52_BIT_SHIFT) != 0);
+        if (!_x52_shm_applied(&status, rc)) {
+            mask = 1UL << X52_BIT_SHIFT;
+            *led_mask = (*led_mask & ~mask) | (old_mask & mask);
+        }
+    }
+
+    if (changed & (1UL << X52_BIT_POV_BLINK)) {
+        rc = libx52_set_blink(x52, tst_bit(led_mask, X52_BIT_POV_BLINK) != 0);
+        if (!_x52_shm_applied(&status, rc)) {
+            mask = 1UL << X52_BIT_POV_BLINK;
+            *led_mask = (*led_mask & ~mask) | (old_mask & mask);
+        }
+    }
+
+    for (i = 0; i < sizeof(x52_shm_leds) / sizeof(x52_shm_leds[0]); i++) {
+        led = x52_shm_leds[i];
+
+        if (led == LIBX52_LED_FIRE || led == LIBX52_LED_THROTTLE) {
+            mask = 1UL << led;
+            if (!(changed & mask)) {
+                continue;
+            }
+
+            state = tst_bit(led_mask, led) ? LIBX52_LED_STATE_ON :
+                                             LIBX52_LED_STATE_OFF;
+        } else {
+            mask = 3UL << led;
+            if (!(changed & mask)) {
+                continue;
+            }
+
+            /* The LED is made up of a red and a green element */
+            switch ((*led_mask >> led) & 3) {
+            case 1:
+                state = LIBX52_LED_STATE_RED;
+                break;
+
+            case 2:
+                state = LIBX52_LED_STATE_GREEN;
+                break;
+
+            case 3:
+                state = LIBX52_LED_STATE_AMBER;
+                break;
+
+            default:
+                state = LIBX52_LED_STATE_OFF;
+                break;
+            }
+        }
+
+        rc = libx52_set_led_state(x52, led, state);
+        if (!_x52_shm_applied(&status, rc)) {
+            *led_mask = (*led_mask & ~mask) | (old_mask & mask);
+        }
+    }
+
+    return status;
+}
+#else
+/* Writer handles cannot be created without support, these are never called */
+static void _x52_shm_write_begin(struct x52_shm_segment *seg)
+{
+    (void)seg;
+}
+
+static void _x52_shm_write_end(struct x52_shm_segment *seg)
+{
+    (void)seg;
+}
+#endif
+
+int libx52_shm_create(libx52_device *x52, int *fd)
+{
+#if X52_SHM_SUPPORTED
+    struct x52_shm *shm;
+#endif
+
+    if (!x52 || !fd) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+#if X52_SHM_SUPPORTED
+    if (x52->shm != NULL) {
+        return LIBX52_ERROR_BUSY;
+    }
+
+    shm = calloc(1, sizeof(*shm));
+    if (shm == NULL) {
+        return LIBX52_ERROR_OUT_OF_MEMORY;
+    }
+
+    shm->fd = memfd_create("x52-state", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (shm->fd < 0) {
+        free(shm);
+        return LIBX52_ERROR_OUT_OF_MEMORY;
+    }
+
+    /* Seal the size, so that a writer cannot make the owner fault */
+    if (ftruncate(shm->fd, sizeof(*shm->seg)) < 0 ||
+        fcntl(shm->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+        close(shm->fd);
+        free(shm);
+        return LIBX52_ERROR_OUT_OF_MEMORY;
+    }
+
+    shm->seg = mmap(NULL, sizeof(*shm->seg), PROT_READ | PROT_WRITE,
+                    MAP_SHARED, shm->fd, 0);
+    if (shm->seg == MAP_FAILED) {
+        close(shm->fd);
+        free(shm);
+        return LIBX52_ERROR_OUT_OF_MEMORY;
+    }
+
+    /* The new segment is zero filled, and not visible to any writer yet */
+    _x52_shm_init_data(x52, &shm->shadow);
+    shm->seg->data = shm->shadow;
+    shm->seg->version = X52_SHM_VERSION;
+    __atomic_store_n(&shm->seg->magic, X52_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    x52->shm = shm;
+    *fd = shm->fd;
+    return LIBX52_SUCCESS;
+#else
+    return LIBX52_ERROR_NOT_SUPPORTED;
+#endif
+}
+
+int libx52_shm_destroy(libx52_device *x52)
+{
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+#if X52_SHM_SUPPORTED
+    if (x52->shm != NULL) {
+        munmap(x52->shm->seg, sizeof(*x52->shm->seg));
+        close(x52->shm->fd);
+        free(x52->shm);
+        x52->shm = NULL;
+    }
+#endif
+
+    return LIBX52_SUCCESS;
+}
+
+int libx52_shm_sync(libx52_device *x52)
+{
+#if X52_SHM_SUPPORTED
+    struct x52_shm *shm;
+    struct x52_shm_data data;
+    struct x52_shm_data *old;
+    uint32_t seq;
+    bool framed;
+    int status;
+    int rc;
+    int i;
+
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    shm = x52->shm;
+    if (shm == NULL) {
+        return LIBX52_ERROR_NOT_SUPPORTED;
+    }
+
+    rc = _x52_shm_read(shm->seg, &data, &seq);
+    if (rc != LIBX52_SUCCESS) {
+        return rc;
+    }
+
+    if (seq == shm->seq) {
+        return LIBX52_SUCCESS;
+    }
+
+    old = &shm->shadow;
+    framed = (libx52_begin_frame(x52) == LIBX52_SUCCESS);
+
+    /*
+     * The writers validate the values they publish, but the owner cannot
+     * trust another process to have done so. A setting which is rejected is
+     * left out of the shadow, so that it is tried again once the writers
+     * change the segment, and the first error is returned.
+     */
+    status = LIBX52_SUCCESS;
+    for (i = 0; i < X52_MFD_LINES; i++) {
+        if (data.line_length[i] != old->line_length[i] ||
+            memcmp(data.line[i], old->line[i], X52_MFD_LINE_SIZE)) {
+            rc = LIBX52_ERROR_INVALID_PARAM;
+            if (data.line_length[i] <= X52_MFD_LINE_SIZE) {
+                rc = libx52_set_text(x52, i, (const char *)data.line[i],
+                                     data.line_length[i]);
+            }
+            if (!_x52_shm_applied(&status, rc)) {
+                data.line_length[i] = old->line_length[i];
+                memcpy(data.line[i], old->line[i], X52_MFD_LINE_SIZE);
+            }
+        }
+    }
+
+    if (data.mfd_brightness != old->mfd_brightness) {
+        rc = libx52_set_brightness(x52, 1, data.mfd_brightness);
+        if (!_x52_shm_applied(&status, rc)) {
+            data.mfd_brightness = old->mfd_brightness;
+        }
+    }
+
+    if (data.led_brightness != old->led_brightness) {
+        rc = libx52_set_brightness(x52, 0, data.led_brightness);
+        if (!_x52_shm_applied(&status, rc)) {
+            data.led_brightness = old->led_brightness;
+        }
+    }
+
+    rc = _x52_shm_apply_leds(x52, &data.led_mask, old->led_mask);
+    (void)_x52_shm_applied(&status, rc);
+
+    for (i = LIBX52_CLOCK_1; i <= LIBX52_CLOCK_3; i++) {
+        if (i != LIBX52_CLOCK_1 && data.timezone[i] != old->timezone[i]) {
+            rc = libx52_set_clock_timezone(x52, i, data.timezone[i]);
+            if (!_x52_shm_applied(&status, rc)) {
+                data.timezone[i] = old->timezone[i];
+            }
+        }
+
+        if (data.time_format[i] != old->time_format[i]) {
+            rc = libx52_set_clock_format(x52, i, data.time_format[i]);
+            if (!_x52_shm_applied(&status, rc)) {
+                data.time_format[i] = old->time_format[i];
+            }
+        }
+    }
+
+    if (data.date_format != old->date_format) {
+        /* libx52_set_date_format leaves this to libx52_update to check */
+        rc = LIBX52_ERROR_INVALID_PARAM;
+        if (data.date_format <= LIBX52_DATE_FORMAT_YYMMDD) {
+            rc = libx52_set_date_format(x52, data.date_format);
+        }
+        if (!_x52_shm_applied(&status, rc)) {
+            data.date_format = old->date_format;
+        }
+    }
+
+    if (framed) {
+        (void)libx52_commit_frame(x52);
+    }
+
+    shm->shadow = data;
+    shm->seq = seq;
+    return status;
+#else
+    return x52 ? LIBX52_ERROR_NOT_SUPPORTED : LIBX52_ERROR_INVALID_PARAM;
+#endif
+}
+
+int libx52_shm_wait(libx52_device *x52, int timeout_ms)
+{
+#if X52_SHM_SUPPORTED
+    struct x52_shm_segment *seg;
+    struct timespec timeout;
+    uint32_t seq;
+    long rc;
+    int err = 0;
+
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    if (x52->shm == NULL) {
+        return LIBX52_ERROR_NOT_SUPPORTED;
+    }
+
+    seg = x52->shm->seg;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (long)(timeout_ms % 1000) * 1000000L;
+
+    /*
+     * Set waiting before checking seq. A writer which finishes after the
+     * check sees waiting and wakes us, one which finished before it has
+     * changed seq, so the futex wait returns immediately.
+     */
+    __atomic_store_n(&seg->waiting, 1, __ATOMIC_SEQ_CST);
+    seq = __atomic_load_n(&seg->seq, __ATOMIC_SEQ_CST);
+    if ((seq & ~1U) == x52->shm->seq) {
+        rc = _x52_futex(&seg->seq, FUTEX_WAIT, seq,
+                        timeout_ms < 0 ? NULL : &timeout);
+        if (rc < 0) {
+            err = errno;
+        }
+    }
+    __atomic_store_n(&seg->waiting, 0, __ATOMIC_SEQ_CST);
+
+    switch (err) {
+    case 0:
+    case EAGAIN:
+        /* Woken up, or seq had already changed */
+        break;
+
+    case ETIMEDOUT:
+        return LIBX52_ERROR_TIMEOUT;
+
+    case EINTR:
+        return LIBX52_ERROR_INTERRUPTED;
+
+    default:
+        return LIBX52_ERROR_IO;
+    }
+
+    /* A writer in progress wakes us again when it is done */
+    seq = __atomic_load_n(&seg->seq, __ATOMIC_SEQ_CST);
+    return (seq == x52->shm->seq) ? LIBX52_ERROR_TIMEOUT : LIBX52_SUCCESS;
+#else
+    (void)timeout_ms;
+    return x52 ? LIBX52_ERROR_NOT_SUPPORTED : LIBX52_ERROR_INVALID_PARAM;
+#endif
+}
+
+int libx52_shm_attach(int fd, libx52_shm **shm)
+{
+#if X52_SHM_SUPPORTED
+    struct x52_shm_segment *seg;
+    struct stat st;
+    libx52_shm *handle;
+    int rc = LIBX52_SUCCESS;
+
+    if (!shm) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    if (fstat(fd, &st) < 0 || st.st_size != sizeof(*seg)) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    handle = calloc(1, sizeof(*handle));
+    if (handle == NULL) {
+        return LIBX52_ERROR_OUT_OF_MEMORY;
+    }
+
+    seg = mmap(NULL, sizeof(*seg), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (seg == MAP_FAILED) {
+        free(handle);
+        return LIBX52_ERROR_OUT_OF_MEMORY;
+    }
+
+    if (__atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) != X52_SHM_MAGIC) {
+        rc = LIBX52_ERROR_INVALID_PARAM;
+    } else if (seg->version != X52_SHM_VERSION) {
+        rc = LIBX52_ERROR_NOT_SUPPORTED;
+    }
+
+    if (rc != LIBX52_SUCCESS) {
+        munmap(seg, sizeof(*seg));
+        free(handle);
+        return rc;
+    }
+
+    handle->seg = seg;
+    *shm = handle;
+    return LIBX52_SUCCESS;
+#else
+    (void)fd;
+    return shm ? LIBX52_ERROR_NOT_SUPPORTED : LIBX52_ERROR_INVALID_PARAM;
+#endif
+}
+
+void libx52_shm_detach(libx52_shm *shm)
+{
+#if X52_SHM_SUPPORTED
+    if (shm != NULL) {
+        munmap(shm->seg, sizeof(*shm->seg));
+        free(shm);
+    }
+#else
+    (void)shm;
+#endif
+}
+
+/*
+ * The writer functions validate their arguments as the corresponding
+ * libx52_set functions do, and copy the new value into the segment.
+ */
+
+int libx52_shm_set_text(libx52_shm *shm, uint8_t line, const char *text, uint8_t length)
+{
+    if (!shm || !text || line > 2) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    if (length > X52_MFD_LINE_SIZE) {
+        length = X52_MFD_LINE_SIZE;
+    }
+
+    _x52_shm_write_begin(shm->seg);
+    memset(shm->seg->data.line[line], ' ', X52_MFD_LINE_SIZE);
+    memcpy(shm->seg->data.line[line], text, length);
+    shm->seg->data.line_length[line] = length;
+    _x52_shm_write_end(shm->seg);
+
+    return LIBX52_SUCCESS;
+}
+
+/* Set the selected bits of the LED mask in the segment */
+static void _x52_shm_set_led_mask(libx52_shm *shm, uint32_t mask, uint32_t value)
+{
+    _x52_shm_write_begin(shm->seg);
+    shm->seg->data.led_mask = (shm->seg->data.led_mask & ~mask) | value;
+    _x52_shm_write_end(shm->seg);
+}
+
+int libx52_shm_set_led_state(libx52_shm *shm, libx52_led_id led, libx52_led_state state)
+{
+    uint32_t value = 0;
+
+    if (!shm) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    switch (led) {
+    case LIBX52_LED_FIRE:
+    case LIBX52_LED_THROTTLE:
+        if (state == LIBX52_LED_STATE_ON) {
+            set_bit(&value, led);
+        } else if (state != LIBX52_LED_STATE_OFF) {
+            /* Colors not supported */
+            return LIBX52_ERROR_NOT_SUPPORTED;
+        }
+
+        _x52_shm_set_led_mask(shm, 1UL << led, value);
+        break;
+
+    case LIBX52_LED_A:
+    case LIBX52_LED_B:
+    case LIBX52_LED_D:
+    case LIBX52_LED_E:
+    case LIBX52_LED_T1:
+    case LIBX52_LED_T2:
+    case LIBX52_LED_T3:
+    case LIBX52_LED_POV:
+    case LIBX52_LED_CLUTCH:
+        switch (state) {
+        case LIBX52_LED_STATE_OFF:
+            break;
+
+        case LIBX52_LED_STATE_RED:
+            set_bit(&value, led + 0);
+            break;
+
+        case LIBX52_LED_STATE_AMBER:
+            set_bit(&value, led + 0);
+            set_bit(&value, led + 1);
+            break;
+
+        case LIBX52_LED_STATE_GREEN:
+            set_bit(&value, led + 1);
+            break;
+
+        case LIBX52_LED_STATE_ON:
+            /* Cannot set the LED to "ON" */
+            return LIBX52_ERROR_NOT_SUPPORTED;
+
+        default:
+            return LIBX52_ERROR_INVALID_PARAM;
+        }
+
+        _x52_shm_set_led_mask(shm, 3UL << led, value);
+        break;
+
+    default:
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    return LIBX52_SUCCESS;
+}
+
+int libx52_shm_set_brightness(libx52_shm *shm, uint8_t mfd, uint16_t brightness)
+{
+    if (!shm) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    _x52_shm_write_begin(shm->seg);
+    if (mfd) {
+        shm->seg->data.mfd_brightness = brightness;
+    } else {
+        shm->seg->data.led_brightness = brightness;
+    }
+    _x52_shm_write_end(shm->seg);
+
+    return LIBX52_SUCCESS;
+}
+
+int libx52_shm_set_shift(libx52_shm *shm, uint8_t state)
+{
+    if (!shm) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    _x52_shm_set_led_mask(shm, 1UL << X52_BIT_SHIFT,
+                          state ? (1UL << X52_BIT_SHIFT) : 0);
+    return LIBX52_SUCCESS;
+}
+
+int libx52_shm_set_blink(libx52_shm *shm, uint8_t state)
+{
+    if (!shm) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    _x52_shm_set_led_mask(shm, 1UL << X52_BIT_POV_BLINK,
+                          state ? (1UL << X52_BIT_POV_BLINK) : 0);
+    return LIBX52_SUCCESS;
+}
+
+int libx52_shm_set_clock_timezone(libx52_shm *shm, libx52_clock_id clock, int offset)
+{
+    if (!shm) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    /* Limit offset to +/- 24 hours */
+    if (offset < -1440 || offset > 1440) {
+        return LIBX52_ERROR_OUT_OF_RANGE;
+    }
+
+    switch (clock) {
+    case LIBX52_CLOCK_2:
+    case LIBX52_CLOCK_3:
+        break;
+
+    case LIBX52_CLOCK_1:
+        return LIBX52_ERROR_NOT_SUPPORTED;
+
+    default:
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    _x52_shm_write_begin(shm->seg);
+    shm->seg->data.timezone[clock] = offset;
+    _x52_shm_write_end(shm->seg);
+    return LIBX52_SUCCESS;
+}
+
+int libx52_shm_set_clock_format(libx52_shm *shm, libx52_clock_id clock,
+                                libx52_clock_format format)
+{
+    if (!shm) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    if ((format != LIBX52_CLOCK_FORMAT_12HR) &&
+        (format != LIBX52_CLOCK_FORMAT_24HR)) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    if (clock < LIBX52_CLOCK_1 || clock > LIBX52_CLOCK_3) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    _x52_shm_write_begin(shm->seg);
+    shm->seg->data.time_format[clock] = format;
+    _x52_shm_write_end(shm->seg);
+    return LIBX52_SUCCESS;
+}
+
+int libx52_shm_set_date_format(libx52_shm *shm, libx52_date_format format)
+{
+    if (!shm) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    switch (format) {
+    case LIBX52_DATE_FORMAT_DDMMYY:
+    case LIBX52_DATE_FORMAT_MMDDYY:
+    case LIBX52_DATE_FORMAT_YYMMDD:
+        break;
+
+    default:
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    _x52_shm_write_begin(shm->seg);
+    shm->seg->data.date_format = format;
+    _x52_shm_write_end(shm->seg);
+    return LIBX52_SUCCESS;
+}
@@ -54,10 +54,10 @@ static int test_setup(void **state)
 {
     libx52_device *dev = *state;
     void *context = dev->ctx;
-    void *handle = dev->hdl;
     memset(dev, 0, sizeof(*dev));
     dev->ctx = context;
-    dev->hdl = handle;
+    /* Restore the dummy handle, in case the previous test disconnected */
+    dev->hdl = (void *)(uintptr_t)(-1);
     /* Set flags to 1 to indicate that we are testing X52 Pro */
     dev->flags = 1;
 
@@ -86,6 +86,12 @@ int __wrap_libusb_control_transfer(libusb_device_handle *dev_handle,
     return mock();
 }
 
+/* The dummy handle must not be passed to libusb when disconnecting */
+void __wrap_libusb_close(libusb_device_handle *dev_handle)
+{
+    assert_ptr_equal(dev_handle, (void *)(uintptr_t)(-1));
+}
+
 """
 
 _TEST_FUNCTION_HEADER = """
@@ -100,12 +106,10 @@ _TEST_FUNCTION_FOOTER_NORMAL = """
 
     rc = libx52_update(dev);
     assert_int_equal(rc, LIBX52_SUCCESS);
-}
 """
 
 _TEST_FUNCTION_FOOTER_ERROR = """
     assert_int_equal(rc, LIBX52_ERROR_{});
-}}
 """
 
 class Test():
@@ -124,11 +128,13 @@ class Test():
         if len(self.params_prefix) < len(self.params):
             self.params_prefix.extend([''] * (len(self.params) - len(self.params_prefix)))
 
+        self.checks = group.checks + obj.get("checks", [])
+
         self.output = obj.get("output", [])
         self.retval = obj.get("retval", "")
 
     def definition(self):
-        test_name = self.name + '_' + '_'.join(p.strip('"').replace('-','_') for p in self.params)
+        test_name = '_'.join([self.name] + [p.strip('"').replace('-','_').replace(' ','_') for p in self.params])
         return test_name.lower()
 
     def print(self):
@@ -146,20 +152,33 @@ class Test():
 
         if self.output:
             print("    expect_function_calls(__wrap_libusb_control_transfer, {});".format(len(self.output)))
-            print("    will_return_count(__wrap_libusb_control_transfer, LIBUSB_SUCCESS, {});".format(len(self.output)))
 
-        for idx, val in self.output:
-            print("    expect_value(__wrap_libusb_control_transfer, wIndex, 0x{});".format(idx))
-            print("    expect_value(__wrap_libusb_control_transfer, wValue, 0x{});".format(val))
+        # Each output may give the libusb return code for that transfer,
+        # which defaults to success
+        for out in self.output:
+            result = out[2] if len(out) > 2 else "LIBUSB_SUCCESS"
+            print("    will_return(__wrap_libusb_control_transfer, {});".format(result))
+
+        for out in self.output:
+            print("    expect_value(__wrap_libusb_control_transfer, wIndex, 0x{});".format(out[0]))
+            print("    expect_value(__wrap_libusb_control_transfer, wValue, 0x{});".format(out[1]))
 
-        params = ', '.join(''.join(p) for p in zip(self.params_prefix, self.params))
-        print("    rc = {}(dev, {});".format(self.function, params))
+        params = ', '.join(['dev'] + [''.join(p) for p in zip(self.params_prefix, self.params)])
+        print("    rc = {}({});".format(self.function, params))
 
         if self.retval:
             print(_TEST_FUNCTION_FOOTER_ERROR.format(self.retval))
         else:
             print(_TEST_FUNCTION_FOOTER_NORMAL);
 
+        if self.checks:
+            # Checks are an array of C statements that verify the state of
+            # the device after the test
+            for check in self.checks:
+                print("    {}".format(check))
+
+        print("}")
+
 _TEST_GROUP_HEADER = "const struct CMUnitTest tests[] = {"
 _TEST_GROUP_FOOTER = "};"
 
@@ -172,6 +191,7 @@ class TestGroup():
         self.function = obj["function"]
         self.fields = obj.get("fields", {})
         self.setup_hook = obj.get("setup_hook", [])
+        self.checks = obj.get("checks", [])
         self.params_prefix = obj.get("params_prefix", [])
         self.tests = []
         for test in obj["tests"]:
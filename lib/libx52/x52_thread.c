@@ -0,0 +1,485 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - background update thread
+ *
+ * Copyright (C) 2012-2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "libx52.h"
+#include "x52_common.h"
+
+/*
+ * The update thread takes over the job of calling libx52_update from the
+ * application. The libx52_set functions only modify the pending state and
+ * the update mask, under the state lock. The thread takes a snapshot of the
+ * pending state and the update mask, and then writes the snapshot to the
+ * device without holding the lock, so that the application is never blocked
+ * on USB transfers. Multiple changes to the same setting between two flushes
+ * collapse into a single write.
+ *
+ * The I/O lock serializes all access to the device handle and to the shadow
+ * of the committed state. Both locks are recursive, since libx52_set_clock
+ * calls the other clock setters, and a failed transfer in the thread
+ * disconnects the handle. The I/O lock is always taken before the state lock
+ * when both are needed, as when replaying the settings after a reconnect.
+ *
+ * The state lock is also a sequence lock. The sequence number is odd while
+ * the lock is held through _x52_lock, so the updaters can copy the pending
+ * state without taking the lock, and retry if a setter changed it meanwhile.
+ * Settings which are a single bit of the LED mask, and the update mask
+ * itself, are changed with atomic operations and need no lock at all.
+ */
+struct x52_sync {
+    pthread_mutex_t lock;       /* Protects the pending state */
+    pthread_mutex_t io_lock;    /* Protects the device handle and shadow */
+    unsigned int depth;         /* Recursion depth of the state lock */
+    uint32_t seq;               /* Odd while the state lock is held */
+};
+
+struct x52_worker {
+    libx52_device *x52;
+    pthread_t thread;
+    pthread_cond_t cond;        /* Waits on the state lock */
+
+    unsigned int interval_ms;   /* Flush interval, 0 to flush on request */
+    bool stop;                  /* Thread should exit */
+    bool kick;                  /* Flush requested by libx52_update_async */
+    int status;                 /* Result of the most recent flush */
+};
+
+/* Number of lock-free attempts to copy the state before taking the lock */
+#define X52_SNAPSHOT_TRIES  4
+
+/*
+ * The worker is published and cleared under the state lock. Callers which only
+ * need to know whether a thread is running may check it without the lock.
+ */
+bool _x52_worker_active(libx52_device *x52)
+{
+    return (__atomic_load_n(&x52->worker, __ATOMIC_ACQUIRE) != NULL);
+}
+
+int _x52_sync_init(libx52_device *x52)
+{
+    struct x52_sync *s;
+    pthread_mutexattr_t mattr;
+
+    if (x52->sync != NULL) {
+        return LIBX52_SUCCESS;
+    }
+
+    s = calloc(1, sizeof(*s));
+    if (s == NULL) {
+        return LIBX52_ERROR_OUT_OF_MEMORY;
+    }
+
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_settype(&mattr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&s->lock, &mattr);
+    pthread_mutex_init(&s->io_lock, &mattr);
+    pthread_mutexattr_destroy(&mattr);
+
+    x52->sync = s;
+    return LIBX52_SUCCESS;
+}
+
+void _x52_sync_free(libx52_device *x52)
+{
+    struct x52_sync *s = x52->sync;
+
+    if (s != NULL) {
+        pthread_mutex_destroy(&s->io_lock);
+        pthread_mutex_destroy(&s->lock);
+        free(s);
+        x52->sync = NULL;
+    }
+}
+
+int libx52_enable_thread_safety(libx52_device *x52)
+{
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    return _x52_sync_init(x52);
+}
+
+void _x52_lock(libx52_device *x52)
+{
+    struct x52_sync *s = x52->sync;
+
+    if (s != NULL) {
+        pthread_mutex_lock(&s->lock);
+        if (s->depth++ == 0) {
+            __atomic_add_fetch(&s->seq, 1, __ATOMIC_SEQ_CST);
+        }
+    }
+}
+
+void _x52_unlock(libx52_device *x52)
+{
+    struct x52_sync *s = x52->sync;
+
+    if (s != NULL) {
+        if (--s->depth == 0) {
+            __atomic_add_fetch(&s->seq, 1, __ATOMIC_SEQ_CST);
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+void _x52_io_lock(libx52_device *x52)
+{
+    if (x52->sync != NULL) {
+        pthread_mutex_lock(&x52->sync->io_lock);
+    }
+}
+
+void _x52_io_unlock(libx52_device *x52)
+{
+    if (x52->sync != NULL) {
+        pthread_mutex_unlock(&x52->sync->io_lock);
+    }
+}
+
+/*
+ * Copy the pending state for an update. The copy is only used if no setter
+ * held the state lock while it was taken. The LED mask is changed without
+ * the lock, so it is read again atomically, after the caller has taken the
+ * update mask.
+ */
+void _x52_snapshot(libx52_device *x52, struct x52_state *state)
+{
+    struct x52_sync *s = x52->sync;
+    uint32_t seq;
+    int tries;
+
+    if (s == NULL) {
+        *state = x52->state;
+        return;
+    }
+
+    for (tries = 0; tries < X52_SNAPSHOT_TRIES; tries++) {
+        seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+
+        memcpy(state, &x52->state, sizeof(*state));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq) {
+            goto done;
+        }
+    }
+
+    /* The setters are busy, wait for them instead of spinning */
+    _x52_lock(x52);
+    memcpy(state, &x52->state, sizeof(*state));
+    _x52_unlock(x52);
+
+done:
+    state->led_mask = __atomic_load_n(&x52->state.led_mask, __ATOMIC_SEQ_CST);
+}
+
+static void _x52_worker_next_deadline(struct timespec *deadline,
+                                      unsigned int interval_ms)
+{
+    struct timespec now;
+
+    deadline->tv_sec += interval_ms / 1000;
+    deadline->tv_nsec += (long)(interval_ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+
+    /* If a flush overran the interval, restart the cadence from now, rather
+     * than trying to catch up with back to back flushes.
+     */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (deadline->tv_sec < now.tv_sec ||
+        (deadline->tv_sec == now.tv_sec && deadline->tv_nsec < now.tv_nsec)) {
+        *deadline = now;
+        _x52_worker_next_deadline(deadline, interval_ms);
+    }
+}
+
+/* Called with the state lock held, returns with the state lock held */
+static void _x52_worker_flush(libx52_device *x52, struct x52_worker *w)
+{
+    struct x52_sync *s = x52->sync;
+    struct x52_state state;
+    uint32_t update_mask;
+    int rc = LIBX52_SUCCESS;
+
+    if (x52->hotplug) {
+        /* A reconnect takes the state lock to replay the settings */
+        pthread_mutex_unlock(&s->lock);
+        (void)_x52_reconnect(x52);
+        pthread_mutex_lock(&s->lock);
+    }
+
+    update_mask = atomic_take_mask(&x52->update_mask);
+    if (update_mask == 0) {
+        return;
+    }
+
+    pthread_mutex_unlock(&s->lock);
+    _x52_snapshot(x52, &state);
+
+    pthread_mutex_lock(&s->io_lock);
+    if (x52->hdl == NULL) {
+        rc = LIBX52_ERROR_NO_DEVICE;
+    } else {
+        rc = _x52_flush(x52, &state, &update_mask);
+    }
+    pthread_mutex_unlock(&s->io_lock);
+
+    pthread_mutex_lock(&s->lock);
+    /* Retry any unwritten settings, unless they have been changed since */
+    atomic_or_mask(&x52->update_mask, update_mask);
+    w->status = rc;
+}
+
+static void *_x52_worker_main(void *arg)
+{
+    struct x52_worker *w = arg;
+    libx52_device *x52 = w->x52;
+    struct x52_sync *s = x52->sync;
+    struct timespec deadline;
+    int rc;
+
+    /* Without an interval, the thread only flushes on request */
+    if (w->interval_ms != 0) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        _x52_worker_next_deadline(&deadline, w->interval_ms);
+    }
+
+    /*
+     * The thread holds the state lock directly rather than through _x52_lock
+     * while it waits, so that snapshots are not held up.
+     */
+    pthread_mutex_lock(&s->lock);
+    while (!w->stop) {
+        if (!w->kick) {
+            if (w->interval_ms == 0) {
+                pthread_cond_wait(&w->cond, &s->lock);
+                continue;
+            }
+
+            rc = pthread_cond_timedwait(&w->cond, &s->lock, &deadline);
+            if (rc != ETIMEDOUT) {
+                /* Woken up to stop or flush early */
+                continue;
+            }
+
+            _x52_worker_next_deadline(&deadline, w->interval_ms);
+        }
+
+        w->kick = false;
+        _x52_worker_flush(x52, w);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    return NULL;
+}
+
+static void _x52_worker_free(struct x52_worker *w)
+{
+    pthread_cond_destroy(&w->cond);
+    free(w);
+}
+
+int libx52_update_thread_start(libx52_device *x52, unsigned int interval_ms)
+{
+    struct x52_worker *w;
+    pthread_condattr_t cattr;
+    int rc;
+
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    if (_x52_worker_active(x52) || _x52_pipeline_active(x52)) {
+        return LIBX52_ERROR_BUSY;
+    }
+
+    rc = _x52_sync_init(x52);
+    if (rc != LIBX52_SUCCESS) {
+        return rc;
+    }
+
+    w = calloc(1, sizeof(*w));
+    if (w == NULL) {
+        return LIBX52_ERROR_OUT_OF_MEMORY;
+    }
+
+    w->x52 = x52;
+    w->interval_ms = interval_ms;
+    w->status = LIBX52_SUCCESS;
+
+    /* The flush deadlines are on the monotonic clock */
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&w->cond, &cattr);
+    pthread_condattr_destroy(&cattr);
+
+    pthread_mutex_lock(&x52->sync->lock);
+    if (x52->worker != NULL) {
+        /* Another thread started the update thread meanwhile */
+        pthread_mutex_unlock(&x52->sync->lock);
+        _x52_worker_free(w);
+        return LIBX52_ERROR_BUSY;
+    }
+
+    __atomic_store_n(&x52->worker, w, __ATOMIC_RELEASE);
+    rc = pthread_create(&w->thread, NULL, _x52_worker_main, w);
+    if (rc != 0) {
+        __atomic_store_n(&x52->worker, NULL, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&x52->sync->lock);
+
+    if (rc != 0) {
+        _x52_worker_free(w);
+        return (rc == EAGAIN) ? LIBX52_ERROR_TRY_AGAIN : LIBX52_ERROR_INIT_FAILURE;
+    }
+
+    return LIBX52_SUCCESS;
+}
+
+int libx52_update_thread_stop(libx52_device *x52)
+{
+    struct x52_worker *w;
+
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    /* The locks outlive the thread, so they are still valid after the join */
+    if (x52->sync == NULL) {
+        return LIBX52_SUCCESS;
+    }
+
+    /* Clear the worker first, so that no other caller can find it once freed */
+    pthread_mutex_lock(&x52->sync->lock);
+    w = x52->worker;
+    if (w != NULL) {
+        __atomic_store_n(&x52->worker, NULL, __ATOMIC_RELEASE);
+        w->stop = true;
+        pthread_cond_signal(&w->cond);
+    }
+    pthread_mutex_unlock(&x52->sync->lock);
+
+    if (w == NULL) {
+        return LIBX52_SUCCESS;
+    }
+
+    pthread_join(w->thread, NULL);
+    _x52_worker_free(w);
+
+    return LIBX52_SUCCESS;
+}
+
+int libx52_update_async(libx52_device *x52)
+{
+    struct x52_worker *w;
+    int rc;
+
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    if (x52->sync == NULL) {
+        return LIBX52_ERROR_NOT_SUPPORTED;
+    }
+
+    pthread_mutex_lock(&x52->sync->lock);
+    w = x52->worker;
+    if (w == NULL) {
+        rc = LIBX52_ERROR_NOT_SUPPORTED;
+    } else {
+        w->kick = true;
+        pthread_cond_signal(&w->cond);
+        rc = w->status;
+    }
+    pthread_mutex_unlock(&x52->sync->lock);
+
+    return rc;
+}
+
+/*
+ * Start the update of a single device without waiting for it. A device with
+ * an update thread is flushed by its thread, and any other device is written
+ * with asynchronous transfers, which the next call picks up again if they are
+ * still in flight.
+ */
+static int _x52_update_start(libx52_device *x52)
+{
+    int prev = LIBX52_SUCCESS;
+    int rc;
+
+    if (_x52_worker_active(x52)) {
+        return libx52_update_async(x52);
+    }
+
+    if (_x52_pipeline_active(x52)) {
+        /* Collect the result of the update started by the previous call */
+        prev = libx52_update_poll(x52, 0);
+        if (prev == LIBX52_ERROR_TRY_AGAIN) {
+            return prev;
+        }
+    }
+
+    rc = libx52_update_submit(x52);
+    if (rc == LIBX52_SUCCESS && _x52_pipeline_active(x52)) {
+        /* Pick up any transfers which have completed already */
+        rc = libx52_update_poll(x52, 0);
+    }
+
+    return (prev != LIBX52_SUCCESS) ? prev : rc;
+}
+
+int libx52_update_all(libx52_device **devs, size_t count, int *results)
+{
+    size_t i;
+    int rc = LIBX52_SUCCESS;
+    int dev_rc;
+
+    if (devs == NULL) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (devs[i] == NULL) {
+            return LIBX52_ERROR_INVALID_PARAM;
+        }
+    }
+
+    /* Each device has its own libusb context, so the transfers to all the
+     * devices proceed concurrently, and none of them waits for another.
+     */
+    for (i = 0; i < count; i++) {
+        dev_rc = _x52_update_start(devs[i]);
+
+        if (results != NULL) {
+            results[i] = dev_rc;
+        }
+
+        if (rc == LIBX52_SUCCESS && dev_rc != LIBX52_ERROR_TRY_AGAIN) {
+            rc = dev_rc;
+        }
+    }
+
+    return rc;
+}
@@ -0,0 +1,542 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - zoneinfo support
+ *
+ * Copyright (C) 2012-2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "libx52.h"
+#include "x52_common.h"
+
+/*
+ * The secondary clocks can follow a zone from the IANA time zone database.
+ * The zone file (RFC 8536) is parsed once, into a table of transition times
+ * and the UTC offset that applies from each of them. Times beyond the end
+ * of the table are handled by the POSIX TZ rule in the footer of the file.
+ *
+ * The offset that was found last is cached, along with the range of times
+ * over which it is valid, so that the lookup on every call to
+ * libx52_set_clock is a pair of comparisons. The table is only searched
+ * again once the time crosses the next transition.
+ */
+
+#define X52_ZONE_FILE_MAX   (256 * 1024)
+#define X52_ZONE_DIR        "/usr/share/zoneinfo"
+
+/* Rule for the start or end of daylight saving time in a POSIX TZ string */
+struct x52_zone_rule {
+    enum {
+        X52_ZONE_RULE_JULIAN,   /* Jn: day 1-365, Feb 29 is never counted */
+        X52_ZONE_RULE_DAY,      /* n: day 0-365, Feb 29 is counted */
+        X52_ZONE_RULE_MONTH,    /* Mm.w.d: day d of week w of month m */
+    } type;
+    int day;
+    int week;
+    int month;
+    int32_t time;               /* Seconds after local midnight */
+};
+
+struct x52_zone {
+    /* Transition table */
+    uint32_t count;
+    int64_t *times;
+    int32_t *offsets;           /* Seconds east of UTC from times[i] */
+    int32_t initial;            /* Offset before the first transition */
+
+    /* POSIX TZ rule for times after the last transition */
+    bool has_rule;
+    bool has_dst;
+    int32_t std_offset;
+    int32_t dst_offset;
+    struct x52_zone_rule start;
+    struct x52_zone_rule end;
+
+    /* Cached result of the last lookup */
+    int64_t valid_from;
+    int64_t valid_until;
+    int32_t offset;
+};
+
+static uint32_t _x52_zone_be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static int64_t _x52_zone_be64(const uint8_t *p)
+{
+    return (int64_t)(((uint64_t)_x52_zone_be32(p) << 32) |
+                     _x52_zone_be32(p + 4));
+}
+
+/* Days since 1970-01-01 of the given date in the proleptic Gregorian calendar */
+static int64_t _x52_zone_days(int64_t year, int month, int day)
+{
+    int64_t era;
+    int64_t yoe;
+    int64_t doy;
+
+    year -= (month <= 2);
+    era = (year >= 0 ? year : year - 399) / 400;
+    yoe = year - era * 400;
+    doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+
+    return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+}
+
+static bool _x52_zone_leap(int64_t year)
+{
+    return (year % 4 == 0 && (year % 100 != 0 || year % 400 == 0));
+}
+
+/* Local time, in seconds since the epoch, at which the rule applies */
+static int64_t _x52_zone_rule_time(const struct x52_zone_rule *rule,
+                                   int64_t year)
+{
+    static const int mdays[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    int64_t days;
+    int64_t first;
+    int wday;
+    int last;
+
+    switch (rule->type) {
+    case X52_ZONE_RULE_JULIAN:
+        days = _x52_zone_days(year, 1, 1) + rule->day - 1;
+        if (_x52_zone_leap(year) && rule->day >= 60) {
+            days++;
+        }
+        break;
+
+    case X52_ZONE_RULE_DAY:
+        days = _x52_zone_days(year, 1, 1) + rule->day;
+        break;
+
+    default:
+        first = _x52_zone_days(year, rule->month, 1);
+        /* 1970-01-01 was a Thursday */
+        wday = (int)(((first + 4) % 7 + 7) % 7);
+        days = first + (rule->day - wday + 7) % 7 + 7 * (rule->week - 1);
+
+        last = mdays[rule->month - 1] +
+               (rule->month == 2 && _x52_zone_leap(year));
+        while (days - first >= last) {
+            /* Week 5 means the last such day of the month */
+            days -= 7;
+        }
+        break;
+    }
+
+    return days * 86400 + rule->time;
+}
+
+/* Parse [+-]hh[:mm[:ss]], returning the number of seconds */
+static const char *_x52_zone_parse_time(const char *s, int32_t *secs)
+{
+    int sign = 1;
+    long hh;
+    long mm = 0;
+    long ss = 0;
+    char *end;
+
+    if (*s == '+' || *s == '-') {
+        sign = (*s == '-') ? -1 : 1;
+        s++;
+    }
+
+    if (!isdigit((unsigned char)*s)) {
+        return NULL;
+    }
+
+    hh = strtol(s, &end, 10);
+    s = end;
+    if (*s == ':') {
+        mm = strtol(s + 1, &end, 10);
+        s = end;
+        if (*s == ':') {
+            ss = strtol(s + 1, &end, 10);
+            s = end;
+        }
+    }
+
+    if (hh > 167 || mm > 59 || ss > 59) {
+        return NULL;
+    }
+
+    *secs = sign * (int32_t)(hh * 3600 + mm * 60 + ss);
+    return s;
+}
+
+static const char *_x52_zone_parse_name(const char *s)
+{
+    if (*s == '<') {
+        s = strchr(s, '>');
+        return (s == NULL) ? NULL : s + 1;
+    }
+
+    while (isalpha((unsigned char)*s)) {
+        s++;
+    }
+
+    return s;
+}
+
+static const char *_x52_zone_parse_rule(const char *s,
+                                        struct x52_zone_rule *rule)
+{
+    char *end;
+
+    if (*s == 'M') {
+        rule->type = X52_ZONE_RULE_MONTH;
+        rule->month = (int)strtol(s + 1, &end, 10);
+        if (*end != '.') {
+            return NULL;
+        }
+        rule->week = (int)strtol(end + 1, &end, 10);
+        if (*end != '.') {
+            return NULL;
+        }
+        rule->day = (int)strtol(end + 1, &end, 10);
+        if (rule->month < 1 || rule->month > 12 ||
+            rule->week < 1 || rule->week > 5 ||
+            rule->day < 0 || rule->day > 6) {
+            return NULL;
+        }
+    } else if (*s == 'J') {
+        rule->type = X52_ZONE_RULE_JULIAN;
+        rule->day = (int)strtol(s + 1, &end, 10);
+        if (rule->day < 1 || rule->day > 365) {
+            return NULL;
+        }
+    } else if (isdigit((unsigned char)*s)) {
+        rule->type = X52_ZONE_RULE_DAY;
+        rule->day = (int)strtol(s, &end, 10);
+        if (rule->day > 365) {
+            return NULL;
+        }
+    } else {
+        return NULL;
+    }
+
+    s = end;
+    rule->time = 2 * 3600;
+    if (*s == '/') {
+        s = _x52_zone_parse_time(s + 1, &rule->time);
+    }
+
+    return s;
+}
+
+/*
+ * Parse the POSIX TZ string in the footer, e.g. EST5EDT,M3.2.0,M11.1.0.
+ * POSIX offsets are west of UTC, so they are negated here.
+ */
+static bool _x52_zone_parse_tz(struct x52_zone *zone, const char *s)
+{
+    int32_t offset;
+
+    s = _x52_zone_parse_name(s);
+    if (s == NULL || (s = _x52_zone_parse_time(s, &offset)) == NULL) {
+        return false;
+    }
+
+    zone->std_offset = -offset;
+    zone->dst_offset = zone->std_offset;
+    zone->has_dst = false;
+
+    if (*s != '\0') {
+        s = _x52_zone_parse_name(s);
+        if (s == NULL) {
+            return false;
+        }
+
+        zone->dst_offset = zone->std_offset + 3600;
+        if (*s != ',' && *s != '\0') {
+            s = _x52_zone_parse_time(s, &offset);
+            if (s == NULL) {
+                return false;
+            }
+            zone->dst_offset = -offset;
+        }
+
+        /* A zone without a rule for its daylight saving time is not useful */
+        if (*s != ',' || (s = _x52_zone_parse_rule(s + 1, &zone->start)) == NULL ||
+            *s != ',' || (s = _x52_zone_parse_rule(s + 1, &zone->end)) == NULL ||
+            *s != '\0') {
+            return false;
+        }
+
+        zone->has_dst = true;
+    }
+
+    zone->has_rule = true;
+    return true;
+}
+
+/* Parse the TZif data, preferring the 64-bit block of version 2 and later */
+static int _x52_zone_parse(struct x52_zone *zone, const uint8_t *data,
+                           size_t size)
+{
+    const uint8_t *p = data;
+    const uint8_t *types;
+    const uint8_t *info;
+    uint32_t isutcnt, isstdcnt, leapcnt, timecnt, typecnt, charcnt;
+    size_t time_size = 4;
+    size_t block;
+    uint32_t i;
+    int pass;
+
+    for (pass = 0; pass < 2; pass++) {
+        if (size - (size_t)(p - data) < 44 || memcmp(p, "TZif", 4) != 0) {
+            return LIBX52_ERROR_IO;
+        }
+
+        isutcnt = _x52_zone_be32(p + 20);
+        isstdcnt = _x52_zone_be32(p + 24);
+        leapcnt = _x52_zone_be32(p + 28);
+        timecnt = _x52_zone_be32(p + 32);
+        typecnt = _x52_zone_be32(p + 36);
+        charcnt = _x52_zone_be32(p + 40);
+
+        if (typecnt == 0 || typecnt > 256 || timecnt > 65536 ||
+            leapcnt > 65536 || charcnt > 65536 ||
+            isutcnt > typecnt || isstdcnt > typecnt) {
+            return LIBX52_ERROR_IO;
+        }
+
+        block = timecnt * time_size + timecnt + typecnt * 6 + charcnt +
+                leapcnt * (time_size + 4) + isstdcnt + isutcnt;
+        if (size - (size_t)(p - data) - 44 < block) {
+            return LIBX52_ERROR_IO;
+        }
+
+        if (pass == 0 && p[4] >= '2') {
+            /* Skip the 32-bit block, the 64-bit block follows it */
+            p += 44 + block;
+            time_size = 8;
+            continue;
+        }
+
+        break;
+    }
+
+    p += 44;
+    types = p + timecnt * time_size;
+    info = types + timecnt;
+
+    zone->count = timecnt;
+    zone->times = calloc(timecnt ? timecnt : 1, sizeof(*zone->times));
+    zone->offsets = calloc(timecnt ? timecnt : 1, sizeof(*zone->offsets));
+    if (zone->times == NULL || zone->offsets == NULL) {
+        return LIBX52_ERROR_OUT_OF_MEMORY;
+    }
+
+    for (i = 0; i < timecnt; i++) {
+        if (types[i] >= typecnt) {
+            return LIBX52_ERROR_IO;
+        }
+
+        zone->times[i] = (time_size == 8) ? _x52_zone_be64(p + i * 8) :
+                         (int32_t)_x52_zone_be32(p + i * 4);
+        zone->offsets[i] = (int32_t)_x52_zone_be32(info + types[i] * 6);
+
+        if (i > 0 && zone->times[i] <= zone->times[i - 1]) {
+            return LIBX52_ERROR_IO;
+        }
+    }
+
+    /* Local time type 0 applies before the first transition */
+    zone->initial = (int32_t)_x52_zone_be32(info);
+
+    /* The footer follows the 64-bit block, enclosed in newlines */
+    if (time_size == 8) {
+        const char *footer = (const char *)(p + block);
+        size_t remaining = size - (size_t)((const uint8_t *)footer - data);
+        char tz[64];
+        const char *nl;
+
+        if (remaining > 1 && footer[0] == '\n') {
+            nl = memchr(footer + 1, '\n', remaining - 1);
+            if (nl != NULL && (size_t)(nl - footer - 1) < sizeof(tz) &&
+                nl > footer + 1) {
+                memcpy(tz, footer + 1, nl - footer - 1);
+                tz[nl - footer - 1] = '\0';
+                (void)_x52_zone_parse_tz(zone, tz);
+            }
+        }
+    }
+
+    return LIBX52_SUCCESS;
+}
+
+void _x52_zone_free(struct x52_zone *zone)
+{
+    if (zone != NULL) {
+        free(zone->times);
+        free(zone->offsets);
+        free(zone);
+    }
+}
+
+int _x52_zone_load(const char *name, struct x52_zone **zone)
+{
+    const char *dir;
+    char path[1024];
+    uint8_t *data;
+    size_t size;
+    struct x52_zone *z;
+    FILE *fp;
+    int rc;
+
+    /* Only accept names relative to the zoneinfo directory */
+    if (name[0] == '\0' || name[0] == '/' || strstr(name, "..") != NULL) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    dir = getenv("TZDIR");
+    if (dir == NULL || dir[0] == '\0') {
+        dir = X52_ZONE_DIR;
+    }
+
+    if ((size_t)snprintf(path, sizeof(path), "%s/%s", dir, name) >= sizeof(path)) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return (errno == EACCES) ? LIBX52_ERROR_PERM : LIBX52_ERROR_NOT_FOUND;
+    }
+
+    data = malloc(X52_ZONE_FILE_MAX);
+    if (data == NULL) {
+        fclose(fp);
+        return LIBX52_ERROR_OUT_OF_MEMORY;
+    }
+
+    size = fread(data, 1, X52_ZONE_FILE_MAX, fp);
+    fclose(fp);
+
+    z = calloc(1, sizeof(*z));
+    if (z == NULL) {
+        free(data);
+        return LIBX52_ERROR_OUT_OF_MEMORY;
+    }
+
+    rc = _x52_zone_parse(z, data, size);
+    free(data);
+    if (rc != LIBX52_SUCCESS) {
+        _x52_zone_free(z);
+        return rc;
+    }
+
+    /* Force a lookup on first use */
+    z->valid_from = INT64_MAX;
+    z->valid_until = INT64_MIN;
+
+    *zone = z;
+    return LIBX52_SUCCESS;
+}
+
+/* Look up the offset after the last transition, using the POSIX TZ rule */
+static void _x52_zone_lookup_rule(struct x52_zone *zone, int64_t t)
+{
+    int64_t change[6];
+    int32_t after[6];
+    int64_t year;
+    int n = 0;
+    int i;
+    int j;
+
+    if (!zone->has_dst) {
+        zone->offset = zone->std_offset;
+        zone->valid_until = INT64_MAX;
+        return;
+    }
+
+    /* Approximate year of t, the years on either side cover the rest */
+    year = 1970 + (t / 86400 - (t % 86400 < 0)) * 400 / 146097;
+    for (year--, i = 0; i < 3; year++, i++) {
+        change[n] = _x52_zone_rule_time(&zone->start, year) - zone->std_offset;
+        after[n++] = zone->dst_offset;
+        change[n] = _x52_zone_rule_time(&zone->end, year) - zone->dst_offset;
+        after[n++] = zone->std_offset;
+    }
+
+    /* Sort the changes, there are only 6 of them */
+    for (i = 1; i < n; i++) {
+        for (j = i; j > 0 && change[j] < change[j - 1]; j--) {
+            int64_t tc = change[j];
+            int32_t ta = after[j];
+            change[j] = change[j - 1];
+            after[j] = after[j - 1];
+            change[j - 1] = tc;
+            after[j - 1] = ta;
+        }
+    }
+
+    /* The changes in the year before t are always at or before t */
+    i = 0;
+    while (i < n - 1 && change[i + 1] <= t) {
+        i++;
+    }
+
+    zone->offset = after[i];
+    if (zone->valid_from < change[i]) {
+        zone->valid_from = change[i];
+    }
+    zone->valid_until = (i + 1 < n) ? change[i + 1] : INT64_MAX;
+}
+
+int _x52_zone_offset(struct x52_zone *zone, int64_t t)
+{
+    uint32_t lo;
+    uint32_t hi;
+
+    if (t >= zone->valid_from && t < zone->valid_until) {
+        return zone->offset / 60;
+    }
+
+    if (zone->count == 0 || t < zone->times[0]) {
+        zone->valid_from = INT64_MIN;
+        zone->valid_until = (zone->count == 0) ? INT64_MAX : zone->times[0];
+        zone->offset = zone->initial;
+        if (zone->count == 0 && zone->has_rule) {
+            _x52_zone_lookup_rule(zone, t);
+        }
+        return zone->offset / 60;
+    }
+
+    /* Find the last transition at or before t */
+    lo = 0;
+    hi = zone->count;
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (zone->times[mid] <= t) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    zone->offset = zone->offsets[lo];
+    zone->valid_from = zone->times[lo];
+    if (lo + 1 < zone->count) {
+        zone->valid_until = zone->times[lo + 1];
+    } else if (zone->has_rule) {
+        _x52_zone_lookup_rule(zone, t);
+    } else {
+        zone->valid_until = INT64_MAX;
+    }
+
+    return zone->offset / 60;
+}
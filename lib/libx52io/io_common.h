@@ -14,11 +14,14 @@
 #include "hidapi.h"
 
 // Function handler for parsing reports
-typedef int (*x52_parse_report)(unsigned char *data, int length, libx52io_report *report);
+typedef int (*x52_parse_report)(unsigned char *data, int length, libx52io_packed_report *packed);
 
 struct libx52io_context {
     hid_device *handle;
 
+    /* hidraw node for polling, -1 if the hidapi backend has none */
+    int fd;
+
     int32_t axis_min[LIBX52IO_AXIS_MAX];
     int32_t axis_max[LIBX52IO_AXIS_MAX];
 
@@ -31,14 +34,35 @@ struct libx52io_context {
     char *serial_number;
 
     x52_parse_report parser;
+
+    /* Reader thread and its report queue, NULL if not running */
+    struct x52io_reader *reader;
+
+    /* Report values as of the last delta, see libx52io_read_delta */
+    libx52io_report delta_last;
+    int32_t hysteresis[LIBX52IO_AXIS_MAX];
 };
 
 void _x52io_set_axis_range(libx52io_context *ctx);
 void _x52io_set_report_parser(libx52io_context *ctx);
 int _x52io_parse_report(libx52io_context *ctx, libx52io_report *report,
                         unsigned char *data, int length);
+int _x52io_parse_packed(libx52io_context *ctx, libx52io_packed_report *packed,
+                        unsigned char *data, int length);
+int _x52io_read_report(libx52io_context *ctx, libx52io_report *report, int timeout);
+
+void _x52io_reset_delta(libx52io_context *ctx);
+void _x52io_compute_delta(libx52io_context *ctx, const libx52io_report *report,
+                          libx52io_delta *delta);
+
+void _x52io_open_fd(libx52io_context *ctx, const char *path);
+void _x52io_close_fd(libx52io_context *ctx);
+int _x52io_read_fd(libx52io_context *ctx, unsigned char *data, size_t length,
+                   int timeout);
 
 void _x52io_save_device_info(libx52io_context *ctx, struct hid_device_info *dev);
 void _x52io_release_device_info(libx52io_context *ctx);
+void _x52io_get_device_identity(libx52io_device_info *info,
+                                const struct hid_device_info *dev);
 
 #endif // !defined IO_COMMON_H
@@ -31,6 +31,7 @@ int libx52io_init(libx52io_context **ctx)
         return LIBX52IO_ERROR_INIT_FAILURE;
     }
 
+    tmp->fd = -1;
     *ctx = tmp;
 
     #if ENABLE_NLS
@@ -58,55 +59,110 @@ int libx52io_close(libx52io_context *ctx)
         return LIBX52IO_ERROR_INVALID;
     }
 
+    libx52io_reader_stop(ctx);
     if (ctx->handle != NULL) {
         hid_close(ctx->handle);
     }
+    _x52io_close_fd(ctx);
     _x52io_release_device_info(ctx);
+    _x52io_reset_delta(ctx);
 
     return LIBX52IO_SUCCESS;
 }
 
-int libx52io_open(libx52io_context *ctx)
+static bool _x52io_is_supported(const struct hid_device_info *dev)
+{
+    switch (dev->product_id) {
+    case X52_PROD_X52_1:
+    case X52_PROD_X52_2:
+    case X52_PROD_X52PRO:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+/*
+ * Open the first supported joystick in the enumeration list, or the one at
+ * the given path if path is not NULL.
+ */
+static int _x52io_open(libx52io_context *ctx, const char *path)
 {
     struct hid_device_info *devs, *cur_dev;
     int rc = LIBX52IO_ERROR_NO_DEVICE;
 
-    if (ctx == NULL) {
-        return LIBX52IO_ERROR_INVALID;
-    }
-
     /* Close any already open handles */
     libx52io_close(ctx);
 
     /* Enumerate all Saitek HID devices */
     devs = hid_enumerate(VENDOR_SAITEK, 0);
-    cur_dev = devs;
-    while (cur_dev) {
-        switch (cur_dev->product_id) {
-        case X52_PROD_X52_1:
-        case X52_PROD_X52_2:
-        case X52_PROD_X52PRO:
-            ctx->handle = hid_open_path(cur_dev->path);
-            if (ctx->handle == NULL) {
-                rc = LIBX52IO_ERROR_CONN;
-                goto finally;
-            }
-
-            _x52io_save_device_info(ctx, cur_dev);
-
-            rc = LIBX52IO_SUCCESS;
-            goto finally;
+    for (cur_dev = devs; cur_dev != NULL; cur_dev = cur_dev->next) {
+        if (!_x52io_is_supported(cur_dev)) {
+            continue;
+        }
 
-            break;
+        if (path != NULL && strcmp(path, cur_dev->path) != 0) {
+            continue;
+        }
 
-        default:
+        ctx->handle = hid_open_path(cur_dev->path);
+        if (ctx->handle == NULL) {
+            rc = LIBX52IO_ERROR_CONN;
             break;
         }
 
-        cur_dev = cur_dev->next;
+        _x52io_save_device_info(ctx, cur_dev);
+        _x52io_open_fd(ctx, cur_dev->path);
+        rc = LIBX52IO_SUCCESS;
+        break;
     }
 
-finally:
     hid_free_enumeration(devs);
     return rc;
 }
+
+int libx52io_open(libx52io_context *ctx)
+{
+    if (ctx == NULL) {
+        return LIBX52IO_ERROR_INVALID;
+    }
+
+    return _x52io_open(ctx, NULL);
+}
+
+int libx52io_open_path(libx52io_context *ctx, const char *path)
+{
+    if (ctx == NULL || path == NULL) {
+        return LIBX52IO_ERROR_INVALID;
+    }
+
+    return _x52io_open(ctx, path);
+}
+
+int libx52io_enumerate(libx52io_context *ctx, libx52io_device_info *info,
+                       size_t max, size_t *found)
+{
+    struct hid_device_info *devs, *cur_dev;
+    size_t n = 0;
+
+    if (ctx == NULL || found == NULL || (max > 0 && info == NULL)) {
+        return LIBX52IO_ERROR_INVALID;
+    }
+
+    devs = hid_enumerate(VENDOR_SAITEK, 0);
+    for (cur_dev = devs; cur_dev != NULL; cur_dev = cur_dev->next) {
+        if (!_x52io_is_supported(cur_dev)) {
+            continue;
+        }
+
+        if (n < max) {
+            _x52io_get_device_identity(&info[n], cur_dev);
+        }
+        n++;
+    }
+
+    hid_free_enumeration(devs);
+    *found = n;
+    return LIBX52IO_SUCCESS;
+}
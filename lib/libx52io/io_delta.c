@@ -0,0 +1,121 @@
+/*
+ * Saitek X52 IO driver - report deltas
+ *
+ * Copyright (C) 2012-2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include "io_common.h"
+
+void _x52io_reset_delta(libx52io_context *ctx)
+{
+    memset(&ctx->delta_last, 0, sizeof(ctx->delta_last));
+}
+
+void _x52io_compute_delta(libx52io_context *ctx, const libx52io_report *report,
+                          libx52io_delta *delta)
+{
+    libx52io_report *last = &ctx->delta_last;
+    int32_t diff;
+    int i;
+
+    delta->axis_mask = 0;
+    delta->button_mask = 0;
+
+    for (i = 0; i < LIBX52IO_AXIS_MAX; i++) {
+        diff = report->axis[i] - last->axis[i];
+        if (diff < 0) {
+            diff = -diff;
+        }
+
+        /*
+         * Only move the saved value when a change is reported, so that
+         * movements within the hysteresis add up until they are reported
+         */
+        if (diff > ctx->hysteresis[i]) {
+            delta->axis_mask |= (uint32_t)1 << i;
+            delta->old_axis[i] = last->axis[i];
+            last->axis[i] = report->axis[i];
+        }
+    }
+
+    for (i = 0; i < LIBX52IO_BUTTON_MAX; i++) {
+        if (report->button[i] != last->button[i]) {
+            delta->button_mask |= (uint64_t)1 << i;
+            last->button[i] = report->button[i];
+        }
+    }
+
+    last->mode = report->mode;
+    last->hat = report->hat;
+}
+
+int libx52io_read_delta(libx52io_context *ctx, libx52io_report *report,
+                        libx52io_delta *delta, int timeout)
+{
+    int rc;
+
+    if (delta == NULL) {
+        return LIBX52IO_ERROR_INVALID;
+    }
+
+    rc = libx52io_read_timeout(ctx, report, timeout);
+    if (rc == LIBX52IO_SUCCESS) {
+        _x52io_compute_delta(ctx, report, delta);
+    }
+
+    return rc;
+}
+
+int libx52io_set_axis_hysteresis(libx52io_context *ctx, libx52io_axis axis,
+                                 int32_t threshold)
+{
+    if (ctx == NULL || threshold < 0) {
+        return LIBX52IO_ERROR_INVALID;
+    }
+
+    if (!(axis >= LIBX52IO_AXIS_X && axis < LIBX52IO_AXIS_MAX)) {
+        return LIBX52IO_ERROR_INVALID;
+    }
+
+    ctx->hysteresis[axis] = threshold;
+    return LIBX52IO_SUCCESS;
+}
+
+size_t libx52io_delta_events(const libx52io_delta *delta,
+                             const libx52io_report *report,
+                             libx52io_event *events, size_t max)
+{
+    size_t n = 0;
+    int i;
+
+    if (delta == NULL || report == NULL || events == NULL) {
+        return 0;
+    }
+
+    for (i = 0; i < LIBX52IO_AXIS_MAX && n < max; i++) {
+        if (delta->axis_mask & ((uint32_t)1 << i)) {
+            events[n].type = LIBX52IO_EVENT_AXIS;
+            events[n].id = i;
+            events[n].old_value = delta->old_axis[i];
+            events[n].new_value = report->axis[i];
+            n++;
+        }
+    }
+
+    for (i = 0; i < LIBX52IO_BUTTON_MAX && n < max; i++) {
+        if (delta->button_mask & ((uint64_t)1 << i)) {
+            events[n].type = LIBX52IO_EVENT_BUTTON;
+            events[n].id = i;
+            events[n].old_value = !report->button[i];
+            events[n].new_value = report->button[i];
+            n++;
+        }
+    }
+
+    return n;
+}
@@ -70,6 +70,30 @@ void _x52io_save_device_info(libx52io_context *ctx, struct hid_device_info *dev)
     _x52io_set_report_parser(ctx);
 }
 
+void _x52io_get_device_identity(libx52io_device_info *info,
+                                const struct hid_device_info *dev)
+{
+    size_t n;
+
+    memset(info, 0, sizeof(*info));
+    info->vendor_id = dev->vendor_id;
+    info->product_id = dev->product_id;
+    info->version = dev->release_number;
+
+    if (dev->path != NULL) {
+        strncpy(info->path, dev->path, sizeof(info->path) - 1);
+    }
+
+    if (dev->serial_number != NULL) {
+        n = wcstombs(info->serial_number, dev->serial_number,
+                     sizeof(info->serial_number) - 1);
+        if (n == (size_t)-1) {
+            /* Unconvertible serial number, treat it as missing */
+            info->serial_number[0] = '\0';
+        }
+    }
+}
+
 void _x52io_release_device_info(libx52io_context *ctx)
 {
     ctx->vid = 0;
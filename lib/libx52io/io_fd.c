@@ -0,0 +1,96 @@
+/*
+ * Saitek X52 IO driver - pollable file descriptor
+ *
+ * Copyright (C) 2012-2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include "io_common.h"
+
+void _x52io_open_fd(libx52io_context *ctx, const char *path)
+{
+    ctx->fd = -1;
+
+    #ifdef __linux__
+    /*
+     * hidapi does not expose its file descriptor, but with the hidraw
+     * backend, the path is the hidraw node itself. Every open file on a
+     * hidraw node gets its own copy of the input reports, so the reports are
+     * read from this descriptor instead of the hidapi handle.
+     */
+    if (path != NULL && strncmp(path, "/dev/hidraw", 11) == 0) {
+        ctx->fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    }
+    #else
+    (void)path;
+    #endif
+}
+
+void _x52io_close_fd(libx52io_context *ctx)
+{
+    if (ctx->fd >= 0) {
+        close(ctx->fd);
+    }
+    ctx->fd = -1;
+}
+
+int _x52io_read_fd(libx52io_context *ctx, unsigned char *data, size_t length,
+                   int timeout)
+{
+    struct pollfd pfd;
+    ssize_t rc;
+
+    /* A timeout of 0 reads straight from the non-blocking descriptor */
+    if (timeout != 0) {
+        pfd.fd = ctx->fd;
+        pfd.events = POLLIN;
+        rc = poll(&pfd, 1, timeout);
+        if (rc == 0 || (rc < 0 && errno == EINTR)) {
+            return 0;
+        } else if (rc < 0) {
+            return -1;
+        }
+    }
+
+    rc = read(ctx->fd, data, length);
+    if (rc < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ?
+               0 : -1;
+    }
+
+    /* hidraw never returns an empty report, this is the end of the file */
+    if (rc == 0) {
+        return -1;
+    }
+
+    return (int)rc;
+}
+
+int libx52io_get_fd(libx52io_context *ctx, int *fd)
+{
+    if (ctx == NULL || fd == NULL) {
+        return LIBX52IO_ERROR_INVALID;
+    }
+
+    if (ctx->handle == NULL) {
+        return LIBX52IO_ERROR_NO_DEVICE;
+    }
+
+    if (ctx->reader != NULL) {
+        return LIBX52IO_ERROR_BUSY;
+    }
+
+    if (ctx->fd < 0) {
+        return LIBX52IO_ERROR_NOT_SUPPORTED;
+    }
+
+    *fd = ctx->fd;
+    return LIBX52IO_SUCCESS;
+}
@@ -0,0 +1,102 @@
+/*
+ * Saitek X52 IO driver - packed reports
+ *
+ * Copyright (C) 2012-2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdint.h>
+#include "io_common.h"
+
+static void map_hat(uint8_t hat, libx52io_report *report)
+{
+    /*
+     * Hat reports values from 0-8, but just to account for any spurious
+     * values, leave the remaining 7 entries blank.
+     *
+     * Pushing the hat North reports 1, and it increases to 2 for NE, 3 for
+     * East, 4 for SE and so on in a clockwise fashion until it hits 8 for NW.
+     *
+     * According to the USB spec, Y axis increases as it is pulled from front
+     * to back, i.e., further from the user to closer to the user, and X axis
+     * increases left to right. Therefore NE is X=+1, Y=-1.
+     */
+    static const int32_t hat_to_axis[16][2] = {
+        {0, 0},
+        {0, -1},
+        {1, -1},
+        {1, 0},
+        {1, 1},
+        {0, 1},
+        {-1, 1},
+        {-1, 0},
+        {-1, -1},
+    };
+
+    report->axis[LIBX52IO_AXIS_HATX] = hat_to_axis[hat & 0xf][0];
+    report->axis[LIBX52IO_AXIS_HATY] = hat_to_axis[hat & 0xf][1];
+}
+
+int libx52io_pack_report(const libx52io_report *report,
+                         libx52io_packed_report *packed)
+{
+    uint64_t buttons = 0;
+    int i;
+
+    if (report == NULL || packed == NULL) {
+        return LIBX52IO_ERROR_INVALID;
+    }
+
+    for (i = 0; i < LIBX52IO_BUTTON_MAX; i++) {
+        buttons |= (uint64_t)report->button[i] << i;
+    }
+
+    packed->buttons = buttons;
+    packed->x = report->axis[LIBX52IO_AXIS_X];
+    packed->y = report->axis[LIBX52IO_AXIS_Y];
+    packed->rz = report->axis[LIBX52IO_AXIS_RZ];
+    packed->z = report->axis[LIBX52IO_AXIS_Z];
+    packed->rx = report->axis[LIBX52IO_AXIS_RX];
+    packed->ry = report->axis[LIBX52IO_AXIS_RY];
+    packed->slider = report->axis[LIBX52IO_AXIS_SLIDER];
+    packed->thumbx = report->axis[LIBX52IO_AXIS_THUMBX];
+    packed->thumby = report->axis[LIBX52IO_AXIS_THUMBY];
+    packed->hat = report->hat;
+    packed->mode = report->mode;
+
+    return LIBX52IO_SUCCESS;
+}
+
+int libx52io_unpack_report(const libx52io_packed_report *packed,
+                           libx52io_report *report)
+{
+    uint64_t buttons;
+    int i;
+
+    if (packed == NULL || report == NULL) {
+        return LIBX52IO_ERROR_INVALID;
+    }
+
+    buttons = packed->buttons;
+    for (i = 0; i < LIBX52IO_BUTTON_MAX; i++) {
+        report->button[i] = (buttons >> i) & 1;
+    }
+
+    report->axis[LIBX52IO_AXIS_X] = packed->x;
+    report->axis[LIBX52IO_AXIS_Y] = packed->y;
+    report->axis[LIBX52IO_AXIS_RZ] = packed->rz;
+    report->axis[LIBX52IO_AXIS_Z] = packed->z;
+    report->axis[LIBX52IO_AXIS_RX] = packed->rx;
+    report->axis[LIBX52IO_AXIS_RY] = packed->ry;
+    report->axis[LIBX52IO_AXIS_SLIDER] = packed->slider;
+    report->axis[LIBX52IO_AXIS_THUMBX] = packed->thumbx;
+    report->axis[LIBX52IO_AXIS_THUMBY] = packed->thumby;
+    map_hat(packed->hat, report);
+
+    report->hat = packed->hat;
+    report->mode = packed->mode;
+
+    return LIBX52IO_SUCCESS;
+}
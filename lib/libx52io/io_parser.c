@@ -10,58 +10,28 @@
 #include "io_common.h"
 #include "usb-ids.h"
 
-static void map_hat(uint8_t hat, libx52io_report *report)
-{
-    /*
-     * Hat reports values from 0-8, but just to account for any spurious
-     * values, leave the remaining 7 entries blank.
-     *
-     * Pushing the hat North reports 1, and it increases to 2 for NE, 3 for
-     * East, 4 for SE and so on in a clockwise fashion until it hits 8 for NW.
-     *
-     * According to the USB spec, Y axis increases as it is pulled from front
-     * to back, i.e., further from the user to closer to the user, and X axis
-     * increases left to right. Therefore NE is X=+1, Y=-1.
-     */
-    static const int32_t hat_to_axis[16][2] = {
-        {0, 0},
-        {0, -1},
-        {1, -1},
-        {1, 0},
-        {1, 1},
-        {0, 1},
-        {-1, 1},
-        {-1, 0},
-        {-1, -1},
-    };
-
-    report->axis[LIBX52IO_AXIS_HATX] = hat_to_axis[hat][0];
-    report->axis[LIBX52IO_AXIS_HATY] = hat_to_axis[hat][1];
-}
-
-static void map_axis(unsigned char *data, int thumb_pos, libx52io_report *report)
+static void map_axis(unsigned char *data, int thumb_pos, libx52io_packed_report *packed)
 {
     /*
      * The bytes containing the throttle axes are the same, with only the
      * position of the thumbstick report varying between the X52 and X52Pro.
      * Therefore, we can share the code between the different parsers
      */
-    report->axis[LIBX52IO_AXIS_Z] = data[4];
-    report->axis[LIBX52IO_AXIS_RX] = data[5];
-    report->axis[LIBX52IO_AXIS_RY] = data[6];
-    report->axis[LIBX52IO_AXIS_SLIDER] = data[7];
-    report->axis[LIBX52IO_AXIS_THUMBX] = data[thumb_pos] & 0xf;
-    report->axis[LIBX52IO_AXIS_THUMBY] = data[thumb_pos] >> 4;
+    packed->z = data[4];
+    packed->rx = data[5];
+    packed->ry = data[6];
+    packed->slider = data[7];
+    packed->thumbx = data[thumb_pos] & 0xf;
+    packed->thumby = data[thumb_pos] >> 4;
 
     /*
      * The hat report is in the upper 4 bits of the byte preceding the
-     * thumbstick report. Use that to map to the axis values
+     * thumbstick report. The hat axes are derived from it when unpacking.
      */
-    report->hat = data[thumb_pos-1] >> 4;
-    map_hat(report->hat, report);
+    packed->hat = data[thumb_pos-1] >> 4;
 }
 
-static void map_buttons(unsigned char *data, const int *button_map, libx52io_report *report)
+static void map_buttons(unsigned char *data, const int *button_map, libx52io_packed_report *packed)
 {
     /*
      * The bytes containing the buttons are the same between the X52 and X52Pro.
@@ -69,6 +39,7 @@ static void map_buttons(unsigned char *data, const int *button_map, libx52io_rep
      * need a different button map for each device.
      */
     uint64_t buttons = 0;
+    uint64_t mask = 0;
     int i;
     buttons |= data[12]; buttons <<= 8;
     buttons |= data[11]; buttons <<= 8;
@@ -77,29 +48,31 @@ static void map_buttons(unsigned char *data, const int *button_map, libx52io_rep
     buttons |= data[8];
 
     for (i = 0; button_map[i] != -1; i++) {
-        int btn = button_map[i];
-        report->button[btn] = !!(buttons & ((uint64_t)1 << i));
+        mask |= ((buttons >> i) & 1) << button_map[i];
     }
-
-    if (report->button[LIBX52IO_BTN_MODE_1]) {
-        report->mode = 1;
-    } else if (report->button[LIBX52IO_BTN_MODE_2]) {
-        report->mode = 2;
-    } else if (report->button[LIBX52IO_BTN_MODE_3]) {
-        report->mode = 3;
+    packed->buttons = mask;
+
+    if (mask & ((uint64_t)1 << LIBX52IO_BTN_MODE_1)) {
+        packed->mode = 1;
+    } else if (mask & ((uint64_t)1 << LIBX52IO_BTN_MODE_2)) {
+        packed->mode = 2;
+    } else if (mask & ((uint64_t)1 << LIBX52IO_BTN_MODE_3)) {
+        packed->mode = 3;
+    } else {
+        /*
+         * NOTE: It is possible to hold the mode selector in a position such
+         * that none of the mode buttons actually report as selected. It is
+         * also possible that it could be in a transient state between two
+         * adjacent modes. Either way, report it as unknown, and leave it up
+         * to the application to handle the case where mode doesn't change.
+         */
+        packed->mode = 0;
     }
-    /*
-     * NOTE: It is possible to hold the mode selector in a position such that
-     * none of the mode buttons actually report as selected. It is also
-     * possible that it could be in a transient state between two adjacent
-     * modes. Either way, we don't want to modify the report, so leave it. It
-     * is up to the application to handle the case where mode doesn't change.
-     */
 }
 
 #define B(x) LIBX52IO_BTN_ ## x
 
-static int parse_x52(unsigned char *data, int length, libx52io_report *report)
+static int parse_x52(unsigned char *data, int length, libx52io_packed_report *packed)
 {
     /*
      * Report layout for X52
@@ -162,17 +135,17 @@ static int parse_x52(unsigned char *data, int length, libx52io_report *report)
            (data[1] <<  8) |
            data[0];
 
-    report->axis[LIBX52IO_AXIS_X] = axis & 0x7ff;
-    report->axis[LIBX52IO_AXIS_Y] = (axis >> 11) & 0x7ff;
-    report->axis[LIBX52IO_AXIS_RZ] = (axis >> 22) & 0x3ff;
-    map_axis(data, 13, report);
+    packed->x = axis & 0x7ff;
+    packed->y = (axis >> 11) & 0x7ff;
+    packed->rz = (axis >> 22) & 0x3ff;
+    map_axis(data, 13, packed);
 
-    map_buttons(data, button_map, report);
+    map_buttons(data, button_map, packed);
 
     return LIBX52IO_SUCCESS;
 }
 
-static int parse_x52pro(unsigned char *data, int length, libx52io_report *report)
+static int parse_x52pro(unsigned char *data, int length, libx52io_packed_report *packed)
 {
     /*
      * Report layout for X52Pro
@@ -240,12 +213,12 @@ static int parse_x52pro(unsigned char *data, int length, libx52io_report *report
            (data[1] <<  8) |
            data[0];
 
-    report->axis[LIBX52IO_AXIS_X] = axis & 0x3ff;
-    report->axis[LIBX52IO_AXIS_Y] = (axis >> 10) & 0x3ff;
-    report->axis[LIBX52IO_AXIS_RZ] = (axis >> 22) & 0x3ff;
-    map_axis(data, 14, report);
+    packed->x = axis & 0x3ff;
+    packed->y = (axis >> 10) & 0x3ff;
+    packed->rz = (axis >> 22) & 0x3ff;
+    map_axis(data, 14, packed);
 
-    map_buttons(data, button_map, report);
+    map_buttons(data, button_map, packed);
 
     return LIBX52IO_SUCCESS;
 }
@@ -266,14 +239,34 @@ void _x52io_set_report_parser(libx52io_context *ctx)
     }
 }
 
-int _x52io_parse_report(libx52io_context *ctx, libx52io_report *report,
+int _x52io_parse_packed(libx52io_context *ctx, libx52io_packed_report *packed,
                         unsigned char *data, int length)
 {
     if (ctx->parser == NULL) {
         return LIBX52IO_ERROR_NO_DEVICE;
     }
 
-    return (ctx->parser)(data, length, report);
+    return (ctx->parser)(data, length, packed);
+}
+
+int _x52io_parse_report(libx52io_context *ctx, libx52io_report *report,
+                        unsigned char *data, int length)
+{
+    libx52io_packed_report packed;
+    uint8_t mode;
+    int rc;
+
+    rc = _x52io_parse_packed(ctx, &packed, data, length);
+    if (rc == LIBX52IO_SUCCESS) {
+        /* Keep the previous mode if the mode selector is between positions */
+        mode = report->mode;
+        libx52io_unpack_report(&packed, report);
+        if (report->mode == 0) {
+            report->mode = mode;
+        }
+    }
+
+    return rc;
 }
 
 int libx52io_read(libx52io_context *ctx, libx52io_report *report)
@@ -281,11 +274,41 @@ int libx52io_read(libx52io_context *ctx, libx52io_report *report)
     return libx52io_read_timeout(ctx, report, -1);
 }
 
-int libx52io_read_timeout(libx52io_context *ctx, libx52io_report *report, int timeout)
+/* Read a raw HID report, returns the length, or a negative error code */
+static int read_raw(libx52io_context *ctx, unsigned char *data, size_t length,
+                    int timeout)
+{
+    int rc;
+
+    if (ctx->fd >= 0) {
+        rc = _x52io_read_fd(ctx, data, length, timeout);
+    } else {
+        rc = hid_read_timeout(ctx->handle, data, length, timeout);
+    }
+    if (rc == 0) {
+        return -LIBX52IO_ERROR_TIMEOUT;
+    } else if (rc < 0) {
+        return -LIBX52IO_ERROR_IO;
+    }
+
+    return rc;
+}
+
+int _x52io_read_report(libx52io_context *ctx, libx52io_report *report, int timeout)
 {
     int rc;
     unsigned char data[16];
 
+    rc = read_raw(ctx, data, sizeof(data), timeout);
+    if (rc < 0) {
+        return -rc;
+    }
+
+    return _x52io_parse_report(ctx, report, data, rc);
+}
+
+int libx52io_read_timeout(libx52io_context *ctx, libx52io_report *report, int timeout)
+{
     if (ctx == NULL || report == NULL) {
         return LIBX52IO_ERROR_INVALID;
     }
@@ -294,13 +317,91 @@ int libx52io_read_timeout(libx52io_context *ctx, libx52io_report *report, int ti
         return LIBX52IO_ERROR_NO_DEVICE;
     }
 
-    rc = hid_read_timeout(ctx->handle, data, sizeof(data), timeout);
-    if (rc == 0) {
-        return LIBX52IO_ERROR_TIMEOUT;
-    } else if (rc < 0) {
-        return LIBX52IO_ERROR_IO;
+    /* The reader thread owns the device while it is running */
+    if (ctx->reader != NULL) {
+        return LIBX52IO_ERROR_BUSY;
     }
 
-    // rc > 0
-    return _x52io_parse_report(ctx, report, data, rc);
+    return _x52io_read_report(ctx, report, timeout);
+}
+
+int libx52io_read_packed(libx52io_context *ctx, libx52io_packed_report *packed,
+                         int timeout)
+{
+    int rc;
+    unsigned char data[16];
+
+    if (ctx == NULL || packed == NULL) {
+        return LIBX52IO_ERROR_INVALID;
+    }
+
+    if (ctx->handle == NULL) {
+        return LIBX52IO_ERROR_NO_DEVICE;
+    }
+
+    if (ctx->reader != NULL) {
+        return LIBX52IO_ERROR_BUSY;
+    }
+
+    rc = read_raw(ctx, data, sizeof(data), timeout);
+    if (rc < 0) {
+        return -rc;
+    }
+
+    return _x52io_parse_packed(ctx, packed, data, rc);
+}
+
+int libx52io_read_batch(libx52io_context *ctx, libx52io_report *reports,
+                        size_t max, libx52io_batch_mode mode, int timeout,
+                        size_t *count, size_t *dropped)
+{
+    libx52io_report latest;
+    size_t n;
+    size_t skipped = 0;
+    int rc;
+
+    if (ctx == NULL || reports == NULL || max == 0 || count == NULL) {
+        return LIBX52IO_ERROR_INVALID;
+    }
+
+    if (mode != LIBX52IO_BATCH_ALL && mode != LIBX52IO_BATCH_LATEST) {
+        return LIBX52IO_ERROR_INVALID;
+    }
+
+    /* Wait for the first report, then take whatever else is queued */
+    *count = 0;
+    rc = libx52io_read_timeout(ctx, &reports[0], timeout);
+    if (rc != LIBX52IO_SUCCESS) {
+        return rc;
+    }
+
+    if (mode == LIBX52IO_BATCH_ALL) {
+        /* Anything beyond max stays queued for the next call */
+        for (n = 1; n < max; n++) {
+            /* Carry the mode over if the selector is between positions */
+            reports[n] = reports[n - 1];
+            if (libx52io_read_timeout(ctx, &reports[n], 0) != LIBX52IO_SUCCESS) {
+                break;
+            }
+        }
+    } else {
+        /* Collapse the backlog into the most recent report */
+        latest = reports[0];
+        while (libx52io_read_timeout(ctx, &latest, 0) == LIBX52IO_SUCCESS) {
+            reports[0] = latest;
+            skipped++;
+        }
+        n = 1;
+    }
+
+    /*
+     * The queue is empty, or the read failed. Either way, return what has
+     * been read so far, a persistent error shows up on the next call.
+     */
+    *count = n;
+    if (dropped != NULL) {
+        *dropped = skipped;
+    }
+
+    return LIBX52IO_SUCCESS;
 }
@@ -0,0 +1,218 @@
+/*
+ * Saitek X52 IO driver - reader thread
+ *
+ * Copyright (C) 2012-2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "io_common.h"
+
+/*
+ * The reader thread reads reports as soon as they arrive, and pushes them
+ * into a single producer, single consumer ring, which the application drains
+ * without taking a lock or waiting.
+ *
+ * head and tail are free running counters, and the slot index is the counter
+ * masked by the capacity, which is a power of 2. Only the reader thread
+ * writes head, and only the application writes tail. Each side keeps a
+ * cached copy of the other side's counter on its own cache line, and only
+ * reloads it when the ring looks full or empty, so that the two threads
+ * don't keep taking the same cache line away from each other.
+ */
+#define X52IO_CACHE_LINE    64
+
+/* Timeout for reads by the thread, which bounds the time taken to stop it */
+#define X52IO_READER_TIMEOUT_MS 100
+
+struct x52io_reader {
+    /* Written by the reader thread */
+    size_t head __attribute__((aligned(X52IO_CACHE_LINE)));
+    size_t tail_cache;
+    uint64_t dropped;
+    int status;
+
+    /* Written by the application */
+    size_t tail __attribute__((aligned(X52IO_CACHE_LINE)));
+    size_t head_cache;
+
+    /* Rarely changed while the thread is running */
+    bool stop __attribute__((aligned(X52IO_CACHE_LINE)));
+    libx52io_timed_report *slots;
+    size_t mask;
+    libx52io_context *ctx;
+    pthread_t thread;
+};
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void reader_push(struct x52io_reader *r, const libx52io_report *report,
+                        uint64_t timestamp_ns)
+{
+    libx52io_timed_report *slot;
+
+    if (r->head - r->tail_cache > r->mask) {
+        r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        if (r->head - r->tail_cache > r->mask) {
+            /* The application is behind, drop the new report */
+            __atomic_store_n(&r->dropped, r->dropped + 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    slot = &r->slots[r->head & r->mask];
+    slot->timestamp_ns = timestamp_ns;
+    slot->report = *report;
+    __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+static void *reader_main(void *arg)
+{
+    struct x52io_reader *r = arg;
+    libx52io_report report;
+    int rc;
+
+    /* The mode is unknown until a report has the selector in a position */
+    memset(&report, 0, sizeof(report));
+    while (!__atomic_load_n(&r->stop, __ATOMIC_ACQUIRE)) {
+        rc = _x52io_read_report(r->ctx, &report, X52IO_READER_TIMEOUT_MS);
+        if (rc == LIBX52IO_SUCCESS) {
+            reader_push(r, &report, monotonic_ns());
+        } else if (rc != LIBX52IO_ERROR_TIMEOUT) {
+            /* The device is gone, let the application know and exit */
+            __atomic_store_n(&r->status, rc, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static void reader_free(struct x52io_reader *r)
+{
+    free(r->slots);
+    free(r);
+}
+
+int libx52io_reader_start(libx52io_context *ctx, size_t capacity)
+{
+    struct x52io_reader *r;
+    void *mem;
+    int rc;
+
+    if (ctx == NULL || capacity < 2 || (capacity & (capacity - 1)) != 0) {
+        return LIBX52IO_ERROR_INVALID;
+    }
+
+    if (ctx->handle == NULL) {
+        return LIBX52IO_ERROR_NO_DEVICE;
+    }
+
+    if (ctx->reader != NULL) {
+        return LIBX52IO_ERROR_BUSY;
+    }
+
+    if (posix_memalign(&mem, X52IO_CACHE_LINE, sizeof(*r)) != 0) {
+        return LIBX52IO_ERROR_INIT_FAILURE;
+    }
+    r = mem;
+    memset(r, 0, sizeof(*r));
+
+    if (posix_memalign(&mem, X52IO_CACHE_LINE,
+                       capacity * sizeof(*r->slots)) != 0) {
+        free(r);
+        return LIBX52IO_ERROR_INIT_FAILURE;
+    }
+    r->slots = mem;
+    r->mask = capacity - 1;
+    r->ctx = ctx;
+    r->status = LIBX52IO_SUCCESS;
+
+    rc = pthread_create(&r->thread, NULL, reader_main, r);
+    if (rc != 0) {
+        reader_free(r);
+        return LIBX52IO_ERROR_INIT_FAILURE;
+    }
+
+    ctx->reader = r;
+    return LIBX52IO_SUCCESS;
+}
+
+int libx52io_reader_stop(libx52io_context *ctx)
+{
+    struct x52io_reader *r;
+
+    if (ctx == NULL) {
+        return LIBX52IO_ERROR_INVALID;
+    }
+
+    r = ctx->reader;
+    if (r == NULL) {
+        return LIBX52IO_SUCCESS;
+    }
+
+    __atomic_store_n(&r->stop, true, __ATOMIC_RELEASE);
+    pthread_join(r->thread, NULL);
+
+    ctx->reader = NULL;
+    reader_free(r);
+
+    return LIBX52IO_SUCCESS;
+}
+
+size_t libx52io_reader_drain(libx52io_context *ctx,
+                             libx52io_timed_report *reports, size_t max)
+{
+    struct x52io_reader *r;
+    size_t n;
+    size_t i;
+
+    if (ctx == NULL || ctx->reader == NULL || reports == NULL) {
+        return 0;
+    }
+
+    r = ctx->reader;
+    if (r->head_cache - r->tail < max) {
+        r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    }
+
+    n = r->head_cache - r->tail;
+    if (n > max) {
+        n = max;
+    }
+
+    for (i = 0; i < n; i++) {
+        reports[i] = r->slots[(r->tail + i) & r->mask];
+    }
+
+    /* Hand the slots back to the reader thread */
+    __atomic_store_n(&r->tail, r->tail + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+int libx52io_reader_get_status(libx52io_context *ctx, uint64_t *dropped)
+{
+    struct x52io_reader *r;
+
+    if (ctx == NULL || ctx->reader == NULL) {
+        return LIBX52IO_ERROR_INVALID;
+    }
+
+    r = ctx->reader;
+    if (dropped != NULL) {
+        *dropped = __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+    }
+
+    return __atomic_load_n(&r->status, __ATOMIC_ACQUIRE);
+}
@@ -121,6 +121,12 @@ const char * libx52io_strerror(libx52io_error_code code)
     case LIBX52IO_ERROR_TIMEOUT:
         return _("Read timeout");
 
+    case LIBX52IO_ERROR_NOT_SUPPORTED:
+        return _("Not supported");
+
+    case LIBX52IO_ERROR_BUSY:
+        return _("Device busy");
+
     default:
         snprintf(error_buffer, sizeof(error_buffer), _("Unknown error %d"), code);
         break;
@@ -20,6 +20,7 @@
 #ifndef LIBX52IO_H
 #define LIBX52IO_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -76,6 +77,12 @@ typedef enum {
 
     /** Timeout during read from device */
     LIBX52IO_ERROR_TIMEOUT,
+
+    /** Operation not supported on this platform */
+    LIBX52IO_ERROR_NOT_SUPPORTED,
+
+    /** Device is in use by the reader thread */
+    LIBX52IO_ERROR_BUSY,
 } libx52io_error_code;
 
 /**
@@ -268,6 +275,159 @@ struct libx52io_report {
  */
 typedef struct libx52io_report libx52io_report;
 
+/**
+ * @brief Packed X52 HID Report
+ *
+ * This structure holds the same information as \ref libx52io_report in 24
+ * bytes instead of 88, with each axis in a field just wide enough for its
+ * range. Use it to keep a long history of reports, and convert it with \ref
+ * libx52io_unpack_report when the individual values are needed.
+ *
+ * The hat axes are not stored, they are derived from \p hat.
+ */
+typedef struct {
+    /** Button values, bit \c n is set if \ref libx52io_button \c n is
+     * pressed */
+    uint64_t buttons;
+
+    /** X axis, 0-2047 on the X52, 0-1023 on the X52 Pro */
+    uint16_t x;
+
+    /** Y axis, 0-2047 on the X52, 0-1023 on the X52 Pro */
+    uint16_t y;
+
+    /** Rz axis, 0-1023 */
+    uint16_t rz;
+
+    /** Z (throttle) axis, 0-255 */
+    uint8_t z;
+
+    /** Rx axis, 0-255 */
+    uint8_t rx;
+
+    /** Ry axis, 0-255 */
+    uint8_t ry;
+
+    /** Slider, 0-255 */
+    uint8_t slider;
+
+    /** Thumbstick X axis, 0-15 */
+    uint8_t thumbx;
+
+    /** Thumbstick Y axis, 0-15 */
+    uint8_t thumby;
+
+    /** Hat position 0-8 */
+    uint8_t hat;
+
+    /** Current mode - 1, 2 or 3, or 0 if the mode selector is between
+     * positions */
+    uint8_t mode;
+} libx52io_packed_report;
+
+/**
+ * @brief HID report with its arrival time
+ *
+ * Reports queued by the reader thread, see \ref libx52io_reader_start
+ */
+typedef struct {
+    /** Time at which the reader thread received the report, in nanoseconds on
+     * the \c CLOCK_MONOTONIC clock */
+    uint64_t timestamp_ns;
+
+    /** Decoded HID report */
+    libx52io_report report;
+} libx52io_timed_report;
+
+/**
+ * @brief Modes for \ref libx52io_read_batch
+ */
+typedef enum {
+    /** Return every queued report, oldest first */
+    LIBX52IO_BATCH_ALL,
+
+    /** Return only the most recent report, and drop the older ones */
+    LIBX52IO_BATCH_LATEST,
+} libx52io_batch_mode;
+
+/**
+ * @brief Changes between two HID reports
+ *
+ * This structure is filled in by \ref libx52io_read_delta. Bit \c n of
+ * \p axis_mask is set if axis \c n changed, and bit \c n of \p button_mask
+ * is set if button \c n changed. The new values are in the report that was
+ * read along with the delta.
+ */
+typedef struct {
+    /** Mask of changed axes, indexed by \ref libx52io_axis */
+    uint32_t axis_mask;
+
+    /** Mask of changed buttons, indexed by \ref libx52io_button */
+    uint64_t button_mask;
+
+    /** Previous values of the changed axes */
+    int32_t old_axis[LIBX52IO_AXIS_MAX];
+} libx52io_delta;
+
+/**
+ * @brief Type of a change event
+ */
+typedef enum {
+    /** Axis change, the ID is a \ref libx52io_axis */
+    LIBX52IO_EVENT_AXIS,
+
+    /** Button change, the ID is a \ref libx52io_button */
+    LIBX52IO_EVENT_BUTTON,
+} libx52io_event_type;
+
+/**
+ * @brief A single change between two HID reports
+ *
+ * This is filled in by \ref libx52io_delta_events. For buttons, the values
+ * are 1 if the button is pressed, and 0 otherwise.
+ */
+typedef struct {
+    /** Type of control that changed */
+    libx52io_event_type type;
+
+    /** Axis or button ID */
+    int id;
+
+    /** Value before the change */
+    int32_t old_value;
+
+    /** Value after the change */
+    int32_t new_value;
+} libx52io_event;
+
+/**
+ * @brief Maximum number of events in a single delta
+ */
+#define LIBX52IO_EVENT_MAX  (LIBX52IO_AXIS_MAX + LIBX52IO_BUTTON_MAX)
+
+/**
+ * @brief Identity of a supported joystick
+ *
+ * This structure is filled in by \ref libx52io_enumerate, and identifies a
+ * single joystick when multiple joysticks are attached to the system.
+ */
+typedef struct {
+    /** USB vendor ID */
+    uint16_t vendor_id;
+
+    /** USB product ID */
+    uint16_t product_id;
+
+    /** Device release number */
+    uint16_t version;
+
+    /** Platform specific device path, as passed to \ref libx52io_open_path */
+    char path[256];
+
+    /** Serial number, or an empty string if the device does not report one */
+    char serial_number[64];
+} libx52io_device_info;
+
 /**
  * @brief Initialize the IO library
  *
@@ -324,6 +484,44 @@ void libx52io_exit(libx52io_context *ctx);
  */
 int libx52io_open(libx52io_context *ctx);
 
+/**
+ * @brief List all the supported joysticks attached to the system
+ *
+ * This function scans for all supported X52/X52Pro joysticks and saves the
+ * identity of up to \p max of them in \p info. The total number of
+ * joysticks found is saved in \p found, which may be larger than \p max.
+ * Passing a \p max of 0 can be used to query the number of joysticks.
+ *
+ * @param[in]   ctx     Pointer to the device context
+ * @param[out]  info    Array of at least \p max entries to save the identities
+ * @param[in]   max     Number of entries in \p info
+ * @param[out]  found   Number of supported joysticks found
+ *
+ * @returns
+ * - \ref LIBX52IO_SUCCESS on success, even if no joystick was found
+ * - \ref LIBX52IO_ERROR_INVALID if the context or output pointers are not valid
+ */
+int libx52io_enumerate(libx52io_context *ctx, libx52io_device_info *info,
+                       size_t max, size_t *found);
+
+/**
+ * @brief Open a connection to a specific joystick
+ *
+ * This function opens a connection to the joystick at the given path, as
+ * returned by \ref libx52io_enumerate. Use one context for each joystick
+ * when reading from multiple joysticks.
+ *
+ * @param[in]   ctx     Pointer to the device context
+ * @param[in]   path    Device path of the joystick
+ *
+ * @returns
+ * - \ref LIBX52IO_SUCCESS on successful opening
+ * - \ref LIBX52IO_ERROR_INVALID if the context or path pointers are not valid
+ * - \ref LIBX52IO_ERROR_NO_DEVICE if no supported joystick is at the path
+ * - \ref LIBX52IO_ERROR_CONN if the connection fails
+ */
+int libx52io_open_path(libx52io_context *ctx, const char *path);
+
 /**
  * @brief Close an existing connection to a supported joystick
  *
@@ -343,7 +541,8 @@ int libx52io_close(libx52io_context *ctx);
  *
  * This function reads and parses a HID report from a connected joystick. This
  * function will block until some data is available from the joystick, or the
- * timeout is hit, whichever is first.
+ * timeout is hit, whichever is first. A timeout of \c 0 does not block, and
+ * returns \ref LIBX52IO_ERROR_TIMEOUT if no report is queued.
  *
  * @param[in]   ctx     Pointer to the device context
  * @param[out]  report  Pointer to save the decoded HID report
@@ -356,6 +555,7 @@ int libx52io_close(libx52io_context *ctx);
  * - \ref LIBX52IO_ERROR_IO if there was an error reading from the device,
  *   including if the device was disconnected during the read.
  * - \ref LIBX52IO_ERROR_TIMEOUT if no report was read before timeout.
+ * - \ref LIBX52IO_ERROR_BUSY if the reader thread is running
  */
 int libx52io_read_timeout(libx52io_context *ctx, libx52io_report *report, int timeout);
 
@@ -377,6 +577,277 @@ int libx52io_read_timeout(libx52io_context *ctx, libx52io_report *report, int ti
  */
 int libx52io_read(libx52io_context *ctx, libx52io_report *report);
 
+/**
+ * @brief Get a file descriptor to wait for HID reports
+ *
+ * The file descriptor becomes readable when a HID report is available from
+ * the joystick, so that the application can wait for it with poll, select or
+ * epoll along with its other file descriptors, instead of blocking in \ref
+ * libx52io_read on a separate thread. Once it is readable, call \ref
+ * libx52io_read_timeout with a timeout of \c 0, until it returns \ref
+ * LIBX52IO_ERROR_TIMEOUT.
+ *
+ * The file descriptor belongs to the context, and remains valid until the
+ * joystick is closed. The application must not read from or close it.
+ *
+ * This is only supported on Linux, where it is backed by the hidraw node of
+ * the joystick.
+ *
+ * @param[in]   ctx     Pointer to the device context
+ * @param[out]  fd      Pointer to save the file descriptor
+ *
+ * @returns
+ * - \ref LIBX52IO_SUCCESS on success
+ * - \ref LIBX52IO_ERROR_INVALID if the context or fd pointers are not valid
+ * - \ref LIBX52IO_ERROR_NO_DEVICE if the device is disconnected
+ * - \ref LIBX52IO_ERROR_NOT_SUPPORTED if the HID backend has no file
+ *   descriptor for the joystick
+ * - \ref LIBX52IO_ERROR_BUSY if the reader thread is running
+ */
+int libx52io_get_fd(libx52io_context *ctx, int *fd);
+
+/**
+ * @brief Read and parse a HID report into a packed report
+ *
+ * This behaves the same as \ref libx52io_read_timeout, except that the
+ * report is parsed straight into the packed form. Unlike \ref
+ * libx52io_read_timeout, the mode is set to \c 0 if the mode selector is
+ * between positions.
+ *
+ * @param[in]   ctx     Pointer to the device context
+ * @param[out]  packed  Pointer to save the packed HID report
+ * @param[in]   timeout Timeout value in milliseconds
+ *
+ * @returns
+ * - \ref LIBX52IO_SUCCESS on read and parse success
+ * - \ref LIBX52IO_ERROR_INVALID if the context or report pointers are not valid
+ * - \ref LIBX52IO_ERROR_NO_DEVICE if the device is disconnected
+ * - \ref LIBX52IO_ERROR_IO if there was an error reading from the device,
+ *   including if the device was disconnected during the read.
+ * - \ref LIBX52IO_ERROR_TIMEOUT if no report was read before timeout.
+ * - \ref LIBX52IO_ERROR_BUSY if the reader thread is running
+ */
+int libx52io_read_packed(libx52io_context *ctx, libx52io_packed_report *packed,
+                         int timeout);
+
+/**
+ * @brief Convert a HID report to the packed form
+ *
+ * The axis values must be within the range reported by \ref
+ * libx52io_get_axis_range, otherwise they are truncated. The hat axes are
+ * not saved.
+ *
+ * @param[in]   report  Pointer to the HID report
+ * @param[out]  packed  Pointer to save the packed HID report
+ *
+ * @returns
+ * - \ref LIBX52IO_SUCCESS on success
+ * - \ref LIBX52IO_ERROR_INVALID if either pointer is not valid
+ */
+int libx52io_pack_report(const libx52io_report *report,
+                         libx52io_packed_report *packed);
+
+/**
+ * @brief Convert a packed HID report back to the full form
+ *
+ * The hat axes are derived from the hat position.
+ *
+ * @param[in]   packed  Pointer to the packed HID report
+ * @param[out]  report  Pointer to save the HID report
+ *
+ * @returns
+ * - \ref LIBX52IO_SUCCESS on success
+ * - \ref LIBX52IO_ERROR_INVALID if either pointer is not valid
+ */
+int libx52io_unpack_report(const libx52io_packed_report *packed,
+                           libx52io_report *report);
+
+/**
+ * @brief Read all the queued HID reports
+ *
+ * This function waits for a report in the same way as \ref
+ * libx52io_read_timeout, and then reads every other report which is already
+ * queued without waiting. Use this to catch up after the application has not
+ * read from the joystick for a while.
+ *
+ * In \ref LIBX52IO_BATCH_ALL mode, up to \p max reports are saved in \p
+ * reports, oldest first, and any remaining reports stay queued for the next
+ * call. In \ref LIBX52IO_BATCH_LATEST mode, the entire queue is read, and only
+ * the most recent report is saved in \p reports[0]. The number of older
+ * reports that were discarded is saved in \p dropped.
+ *
+ * If a read fails after at least one report has been read, the reports read
+ * so far are returned, and the error is returned by the next call.
+ *
+ * @param[in]   ctx     Pointer to the device context
+ * @param[out]  reports Array to save the decoded HID reports
+ * @param[in]   max     Number of entries in \p reports, must be at least 1
+ * @param[in]   mode    Batch mode - see \ref libx52io_batch_mode
+ * @param[in]   timeout Timeout for the first report in milliseconds
+ * @param[out]  count   Number of reports saved in \p reports
+ * @param[out]  dropped Number of reports discarded, may be NULL
+ *
+ * @returns
+ * - \ref LIBX52IO_SUCCESS if at least one report was read
+ * - \ref LIBX52IO_ERROR_INVALID if any of the parameters is not valid
+ * - \ref LIBX52IO_ERROR_NO_DEVICE if the device is disconnected
+ * - \ref LIBX52IO_ERROR_IO if there was an error reading from the device
+ * - \ref LIBX52IO_ERROR_TIMEOUT if no report was read before timeout.
+ */
+int libx52io_read_batch(libx52io_context *ctx, libx52io_report *reports,
+                        size_t max, libx52io_batch_mode mode, int timeout,
+                        size_t *count, size_t *dropped);
+
+/**
+ * @brief Start the reader thread
+ *
+ * This function starts a thread owned by the device context, which reads HID
+ * reports as soon as they arrive, and queues them with their arrival time.
+ * The application takes the reports from the queue with \ref
+ * libx52io_reader_drain, which never blocks, so that it does not need to wait
+ * for the joystick, and still gets an accurate time for every report.
+ *
+ * If the queue is full, new reports are dropped, and counted in the \p
+ * dropped count returned by \ref libx52io_reader_get_status.
+ *
+ * While the thread is running, the read functions and \ref libx52io_get_fd
+ * return \ref LIBX52IO_ERROR_BUSY. The thread stops reading if the joystick
+ * is disconnected. \ref libx52io_close stops the thread automatically.
+ *
+ * @param[in]   ctx         Pointer to the device context
+ * @param[in]   capacity    Number of reports in the queue, which must be a
+ *                          power of 2, and at least 2
+ *
+ * @returns
+ * - \ref LIBX52IO_SUCCESS if the thread was started
+ * - \ref LIBX52IO_ERROR_INVALID if the context is not valid, or the capacity
+ *   is not a power of 2
+ * - \ref LIBX52IO_ERROR_NO_DEVICE if the device is not open
+ * - \ref LIBX52IO_ERROR_BUSY if the thread is already running
+ * - \ref LIBX52IO_ERROR_INIT_FAILURE if the queue could not be allocated, or
+ *   the thread could not be created
+ */
+int libx52io_reader_start(libx52io_context *ctx, size_t capacity);
+
+/**
+ * @brief Stop the reader thread
+ *
+ * This function stops the thread started by \ref libx52io_reader_start and
+ * waits for it to exit. This can take up to 100 milliseconds. Any reports
+ * still in the queue are discarded.
+ *
+ * @param[in]   ctx     Pointer to the device context
+ *
+ * @returns
+ * - \ref LIBX52IO_SUCCESS on success, or if the thread is not running
+ * - \ref LIBX52IO_ERROR_INVALID if the context is not valid
+ */
+int libx52io_reader_stop(libx52io_context *ctx);
+
+/**
+ * @brief Take the queued reports from the reader thread
+ *
+ * This function copies up to \p max reports from the queue, oldest first,
+ * and removes them from the queue. It never blocks, and returns 0 if the
+ * queue is empty.
+ *
+ * This function must only be called from one thread at a time.
+ *
+ * @param[in]   ctx     Pointer to the device context
+ * @param[out]  reports Array to save the reports
+ * @param[in]   max     Number of entries in \p reports
+ *
+ * @returns Number of reports saved in \p reports, 0 if any of the parameters
+ * is not valid, or the thread is not running
+ */
+size_t libx52io_reader_drain(libx52io_context *ctx,
+                             libx52io_timed_report *reports, size_t max);
+
+/**
+ * @brief Get the status of the reader thread
+ *
+ * @param[in]   ctx     Pointer to the device context
+ * @param[out]  dropped Number of reports dropped because the queue was full,
+ *                      may be NULL
+ *
+ * @returns
+ * - \ref LIBX52IO_SUCCESS if the thread is reading reports
+ * - \ref LIBX52IO_ERROR_INVALID if the context is not valid, or the thread
+ *   is not running
+ * - \ref LIBX52IO_ERROR_IO or \ref LIBX52IO_ERROR_NO_DEVICE if the thread
+ *   stopped reading because of an error. Stop the thread, and reopen the
+ *   joystick.
+ */
+int libx52io_reader_get_status(libx52io_context *ctx, uint64_t *dropped);
+
+/**
+ * @brief Read a HID report, and the changes since the previous delta
+ *
+ * This reads a report in the same way as \ref libx52io_read_timeout, and
+ * compares it against the values the context saw at the previous call to
+ * this function, so that the application does not need to keep the previous
+ * report and compare it itself. The first call after the device is opened
+ * compares against a report with all axes at 0 and no buttons pressed.
+ *
+ * An axis only counts as changed if it moved by more than its hysteresis,
+ * see \ref libx52io_set_axis_hysteresis. Small movements are accumulated
+ * until they exceed the hysteresis, so slow movements are not lost.
+ *
+ * @param[in]   ctx     Pointer to the device context
+ * @param[out]  report  Pointer to save the decoded HID report
+ * @param[out]  delta   Pointer to save the changes
+ * @param[in]   timeout Timeout value in milliseconds
+ *
+ * @returns
+ * - \ref LIBX52IO_SUCCESS on read and parse success, even if nothing changed
+ * - \ref LIBX52IO_ERROR_INVALID if any of the pointers is not valid
+ * - \ref LIBX52IO_ERROR_NO_DEVICE if the device is disconnected
+ * - \ref LIBX52IO_ERROR_IO if there was an error reading from the device
+ * - \ref LIBX52IO_ERROR_TIMEOUT if no report was read before timeout.
+ */
+int libx52io_read_delta(libx52io_context *ctx, libx52io_report *report,
+                        libx52io_delta *delta, int timeout);
+
+/**
+ * @brief Set the hysteresis of an axis
+ *
+ * Changes of an axis by \p threshold or less from the value last reported
+ * by \ref libx52io_read_delta are not reported as changes. This reduces the
+ * events caused by noise on the axes with a large range. The default is 0,
+ * which reports every change. The hysteresis is kept when the device is
+ * closed and opened again.
+ *
+ * @param[in]   ctx         Pointer to the device context
+ * @param[in]   axis        Axis identifier - see \ref libx52io_axis
+ * @param[in]   threshold   Largest change to ignore
+ *
+ * @returns
+ * - \ref LIBX52IO_SUCCESS on success
+ * - \ref LIBX52IO_ERROR_INVALID if the context is not valid, the axis is not
+ *   a valid axis identifier, or the threshold is negative
+ */
+int libx52io_set_axis_hysteresis(libx52io_context *ctx, libx52io_axis axis,
+                                 int32_t threshold);
+
+/**
+ * @brief List the changes in a delta
+ *
+ * This converts a delta from \ref libx52io_read_delta into a list of
+ * events, with the axes first and then the buttons, each in order of their
+ * IDs. A delta never has more than \ref LIBX52IO_EVENT_MAX events.
+ *
+ * @param[in]   delta   Delta returned by \ref libx52io_read_delta
+ * @param[in]   report  Report returned along with the delta
+ * @param[out]  events  Array to save the events
+ * @param[in]   max     Number of entries in \p events
+ *
+ * @returns Number of events saved in \p events, or 0 if any of the pointers
+ * is not valid
+ */
+size_t libx52io_delta_events(const libx52io_delta *delta,
+                             const libx52io_report *report,
+                             libx52io_event *events, size_t max);
+
 /**
  * @brief Retrieve the range of an axis
  *
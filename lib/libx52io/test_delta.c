@@ -0,0 +1,250 @@
+/*
+ * Saitek X52 IO driver - Delta test suite
+ *
+ * Copyright (C) 2012-2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+
+#include "io_common.h"
+
+static int group_setup(void **state)
+{
+    libx52io_context *ctx;
+    int rc;
+
+    rc = libx52io_init(&ctx);
+    if (rc != LIBX52IO_SUCCESS) {
+        return rc;
+    }
+
+    *state = ctx;
+    return 0;
+}
+
+static int test_setup(void **state)
+{
+    libx52io_context *ctx = *state;
+
+    _x52io_reset_delta(ctx);
+    memset(ctx->hysteresis, 0, sizeof(ctx->hysteresis));
+
+    return 0;
+}
+
+static int group_teardown(void **state)
+{
+    libx52io_context *ctx = *state;
+
+    libx52io_exit(ctx);
+    return 0;
+}
+
+static void test_first_report(void **state)
+{
+    /* The first report is compared against an idle report */
+    libx52io_context *ctx = *state;
+    libx52io_report report;
+    libx52io_delta delta;
+
+    memset(&report, 0, sizeof(report));
+    report.axis[LIBX52IO_AXIS_X] = 512;
+    report.axis[LIBX52IO_AXIS_HATY] = -1;
+    report.button[LIBX52IO_BTN_TRIGGER] = true;
+
+    _x52io_compute_delta(ctx, &report, &delta);
+    assert_int_equal(delta.axis_mask, (1 << LIBX52IO_AXIS_X) | (1 << LIBX52IO_AXIS_HATY));
+    assert_true(delta.button_mask == (1ULL << LIBX52IO_BTN_TRIGGER));
+    assert_int_equal(delta.old_axis[LIBX52IO_AXIS_X], 0);
+    assert_int_equal(delta.old_axis[LIBX52IO_AXIS_HATY], 0);
+}
+
+static void test_unchanged(void **state)
+{
+    /* The same report twice has no changes the second time */
+    libx52io_context *ctx = *state;
+    libx52io_report report;
+    libx52io_delta delta;
+
+    memset(&report, 0, sizeof(report));
+    report.axis[LIBX52IO_AXIS_Z] = 100;
+    report.button[LIBX52IO_BTN_MODE_1] = true;
+
+    _x52io_compute_delta(ctx, &report, &delta);
+    _x52io_compute_delta(ctx, &report, &delta);
+    assert_int_equal(delta.axis_mask, 0);
+    assert_true(delta.button_mask == 0);
+}
+
+static void test_changes(void **state)
+{
+    /* Only the controls which changed are reported */
+    libx52io_context *ctx = *state;
+    libx52io_report report;
+    libx52io_delta delta;
+
+    memset(&report, 0, sizeof(report));
+    report.axis[LIBX52IO_AXIS_Y] = 300;
+    report.button[LIBX52IO_BTN_SELECT] = true;
+    report.button[LIBX52IO_BTN_FIRE] = true;
+    _x52io_compute_delta(ctx, &report, &delta);
+
+    report.axis[LIBX52IO_AXIS_Y] = 310;
+    report.button[LIBX52IO_BTN_FIRE] = false;
+    _x52io_compute_delta(ctx, &report, &delta);
+    assert_int_equal(delta.axis_mask, 1 << LIBX52IO_AXIS_Y);
+    assert_true(delta.button_mask == (1ULL << LIBX52IO_BTN_FIRE));
+    assert_int_equal(delta.old_axis[LIBX52IO_AXIS_Y], 300);
+}
+
+static void test_hysteresis(void **state)
+{
+    /* Small changes add up until they exceed the hysteresis */
+    libx52io_context *ctx = *state;
+    libx52io_report report;
+    libx52io_delta delta;
+    int rc;
+
+    rc = libx52io_set_axis_hysteresis(ctx, LIBX52IO_AXIS_X, 4);
+    assert_int_equal(rc, LIBX52IO_SUCCESS);
+
+    memset(&report, 0, sizeof(report));
+    report.axis[LIBX52IO_AXIS_X] = 3;
+    report.axis[LIBX52IO_AXIS_Y] = 1;
+    _x52io_compute_delta(ctx, &report, &delta);
+    assert_int_equal(delta.axis_mask, 1 << LIBX52IO_AXIS_Y);
+
+    report.axis[LIBX52IO_AXIS_X] = 5;
+    _x52io_compute_delta(ctx, &report, &delta);
+    assert_int_equal(delta.axis_mask, 1 << LIBX52IO_AXIS_X);
+    assert_int_equal(delta.old_axis[LIBX52IO_AXIS_X], 0);
+
+    report.axis[LIBX52IO_AXIS_X] = 1;
+    _x52io_compute_delta(ctx, &report, &delta);
+    assert_int_equal(delta.axis_mask, 0);
+
+    report.axis[LIBX52IO_AXIS_X] = 0;
+    _x52io_compute_delta(ctx, &report, &delta);
+    assert_int_equal(delta.axis_mask, 1 << LIBX52IO_AXIS_X);
+    assert_int_equal(delta.old_axis[LIBX52IO_AXIS_X], 5);
+}
+
+static void test_hysteresis_invalid(void **state)
+{
+    libx52io_context *ctx = *state;
+
+    assert_int_equal(libx52io_set_axis_hysteresis(NULL, LIBX52IO_AXIS_X, 1),
+                     LIBX52IO_ERROR_INVALID);
+    assert_int_equal(libx52io_set_axis_hysteresis(ctx, LIBX52IO_AXIS_MAX, 1),
+                     LIBX52IO_ERROR_INVALID);
+    assert_int_equal(libx52io_set_axis_hysteresis(ctx, LIBX52IO_AXIS_X, -1),
+                     LIBX52IO_ERROR_INVALID);
+}
+
+static void test_events(void **state)
+{
+    /* Events list the axes and then the buttons, with old and new values */
+    libx52io_context *ctx = *state;
+    libx52io_report report;
+    libx52io_delta delta;
+    libx52io_event events[LIBX52IO_EVENT_MAX];
+    size_t n;
+
+    memset(&report, 0, sizeof(report));
+    report.axis[LIBX52IO_AXIS_RZ] = 200;
+    report.button[LIBX52IO_BTN_A] = true;
+    _x52io_compute_delta(ctx, &report, &delta);
+
+    report.axis[LIBX52IO_AXIS_RZ] = 210;
+    report.axis[LIBX52IO_AXIS_SLIDER] = 40;
+    report.button[LIBX52IO_BTN_A] = false;
+    report.button[LIBX52IO_BTN_CLUTCH] = true;
+    _x52io_compute_delta(ctx, &report, &delta);
+
+    n = libx52io_delta_events(&delta, &report, events, LIBX52IO_EVENT_MAX);
+    assert_int_equal(n, 4);
+
+    assert_int_equal(events[0].type, LIBX52IO_EVENT_AXIS);
+    assert_int_equal(events[0].id, LIBX52IO_AXIS_RZ);
+    assert_int_equal(events[0].old_value, 200);
+    assert_int_equal(events[0].new_value, 210);
+
+    assert_int_equal(events[1].type, LIBX52IO_EVENT_AXIS);
+    assert_int_equal(events[1].id, LIBX52IO_AXIS_SLIDER);
+    assert_int_equal(events[1].old_value, 0);
+    assert_int_equal(events[1].new_value, 40);
+
+    assert_int_equal(events[2].type, LIBX52IO_EVENT_BUTTON);
+    assert_int_equal(events[2].id, LIBX52IO_BTN_A);
+    assert_int_equal(events[2].old_value, 1);
+    assert_int_equal(events[2].new_value, 0);
+
+    assert_int_equal(events[3].type, LIBX52IO_EVENT_BUTTON);
+    assert_int_equal(events[3].id, LIBX52IO_BTN_CLUTCH);
+    assert_int_equal(events[3].old_value, 0);
+    assert_int_equal(events[3].new_value, 1);
+
+    /* The list is truncated to the size of the array */
+    n = libx52io_delta_events(&delta, &report, events, 3);
+    assert_int_equal(n, 3);
+    assert_int_equal(events[2].id, LIBX52IO_BTN_A);
+
+    n = libx52io_delta_events(NULL, &report, events, 3);
+    assert_int_equal(n, 0);
+}
+
+static void test_reset_on_close(void **state)
+{
+    /* Closing the device forgets the previous report */
+    libx52io_context *ctx = *state;
+    libx52io_report report;
+    libx52io_delta delta;
+
+    memset(&report, 0, sizeof(report));
+    report.axis[LIBX52IO_AXIS_THUMBX] = 8;
+    _x52io_compute_delta(ctx, &report, &delta);
+
+    libx52io_close(ctx);
+    _x52io_compute_delta(ctx, &report, &delta);
+    assert_int_equal(delta.axis_mask, 1 << LIBX52IO_AXIS_THUMBX);
+}
+
+static void test_read_invalid(void **state)
+{
+    libx52io_context *ctx = *state;
+    libx52io_report report;
+    libx52io_delta delta;
+
+    assert_int_equal(libx52io_read_delta(ctx, &report, NULL, 0),
+                     LIBX52IO_ERROR_INVALID);
+    assert_int_equal(libx52io_read_delta(NULL, &report, &delta, 0),
+                     LIBX52IO_ERROR_INVALID);
+    assert_int_equal(libx52io_read_delta(ctx, &report, &delta, 0),
+                     LIBX52IO_ERROR_NO_DEVICE);
+}
+
+#define TEST(tc) cmocka_unit_test_setup(tc, test_setup)
+
+const struct CMUnitTest tests[] = {
+    TEST(test_first_report),
+    TEST(test_unchanged),
+    TEST(test_changes),
+    TEST(test_hysteresis),
+    TEST(test_hysteresis_invalid),
+    TEST(test_events),
+    TEST(test_reset_on_close),
+    TEST(test_read_invalid),
+};
+
+int main(void)
+{
+    cmocka_set_message_output(CM_OUTPUT_TAP);
+    cmocka_run_group_tests(tests, group_setup, group_teardown);
+    return 0;
+}
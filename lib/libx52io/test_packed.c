@@ -0,0 +1,197 @@
+/*
+ * Saitek X52 IO driver - Packed report test suite
+ *
+ * Copyright (C) 2012-2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "io_common.h"
+#include "usb-ids.h"
+
+static int group_setup(void **state)
+{
+    libx52io_context *ctx;
+    int rc;
+
+    rc = libx52io_init(&ctx);
+    if (rc != LIBX52IO_SUCCESS) {
+        return rc;
+    }
+
+    *state = ctx;
+    return 0;
+}
+
+static int group_teardown(void **state)
+{
+    libx52io_context *ctx = *state;
+
+    libx52io_exit(ctx);
+    return 0;
+}
+
+/* Fill the report data with a pattern which sets every axis and button */
+static void fill_data(unsigned char *data, size_t length, unsigned int seed)
+{
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        data[i] = (uint8_t)(seed * 37 + i * 101);
+    }
+}
+
+static void test_size(void **state)
+{
+    assert_true(sizeof(libx52io_packed_report) <= 24);
+}
+
+static void test_round_trip(void **state)
+{
+    /* Packing and unpacking a report gives the same report */
+    libx52io_report report;
+    libx52io_report unpacked;
+    libx52io_packed_report packed;
+    int i;
+
+    memset(&report, 0, sizeof(report));
+    report.axis[LIBX52IO_AXIS_X] = 2047;
+    report.axis[LIBX52IO_AXIS_Y] = 1234;
+    report.axis[LIBX52IO_AXIS_RZ] = 1023;
+    report.axis[LIBX52IO_AXIS_Z] = 255;
+    report.axis[LIBX52IO_AXIS_RX] = 128;
+    report.axis[LIBX52IO_AXIS_RY] = 1;
+    report.axis[LIBX52IO_AXIS_SLIDER] = 77;
+    report.axis[LIBX52IO_AXIS_THUMBX] = 15;
+    report.axis[LIBX52IO_AXIS_THUMBY] = 7;
+    report.axis[LIBX52IO_AXIS_HATX] = -1;
+    report.axis[LIBX52IO_AXIS_HATY] = -1;
+    report.hat = 8;
+    report.mode = 2;
+    for (i = 0; i < LIBX52IO_BUTTON_MAX; i += 3) {
+        report.button[i] = true;
+    }
+    report.button[LIBX52IO_BUTTON_MAX - 1] = true;
+
+    assert_int_equal(libx52io_pack_report(&report, &packed), LIBX52IO_SUCCESS);
+    assert_true(packed.buttons & ((uint64_t)1 << (LIBX52IO_BUTTON_MAX - 1)));
+    assert_int_equal(packed.x, 2047);
+    assert_int_equal(packed.hat, 8);
+
+    memset(&unpacked, 0xff, sizeof(unpacked));
+    assert_int_equal(libx52io_unpack_report(&packed, &unpacked), LIBX52IO_SUCCESS);
+    assert_memory_equal(unpacked.axis, report.axis, sizeof(report.axis));
+    assert_memory_equal(unpacked.button, report.button, sizeof(report.button));
+    assert_int_equal(unpacked.hat, report.hat);
+    assert_int_equal(unpacked.mode, report.mode);
+}
+
+static void check_parsers(libx52io_context *ctx, size_t length)
+{
+    /* Parsing straight into a packed report matches packing a full report */
+    libx52io_report report;
+    libx52io_packed_report packed;
+    libx52io_packed_report expected;
+    unsigned char data[15];
+    unsigned int seed;
+
+    for (seed = 0; seed < 64; seed++) {
+        fill_data(data, length, seed);
+
+        memset(&report, 0, sizeof(report));
+        assert_int_equal(_x52io_parse_report(ctx, &report, data, length),
+                         LIBX52IO_SUCCESS);
+        assert_int_equal(_x52io_parse_packed(ctx, &packed, data, length),
+                         LIBX52IO_SUCCESS);
+
+        /* The full report keeps the previous mode, 0 here */
+        libx52io_pack_report(&report, &expected);
+        assert_int_equal(packed.buttons, expected.buttons);
+        assert_int_equal(packed.x, expected.x);
+        assert_int_equal(packed.y, expected.y);
+        assert_int_equal(packed.rz, expected.rz);
+        assert_int_equal(packed.z, expected.z);
+        assert_int_equal(packed.rx, expected.rx);
+        assert_int_equal(packed.ry, expected.ry);
+        assert_int_equal(packed.slider, expected.slider);
+        assert_int_equal(packed.thumbx, expected.thumbx);
+        assert_int_equal(packed.thumby, expected.thumby);
+        assert_int_equal(packed.hat, expected.hat);
+        assert_int_equal(packed.mode, expected.mode);
+    }
+}
+
+static void test_parse_x52(void **state)
+{
+    libx52io_context *ctx = *state;
+
+    ctx->pid = X52_PROD_X52_1;
+    _x52io_set_report_parser(ctx);
+    check_parsers(ctx, 14);
+}
+
+static void test_parse_pro(void **state)
+{
+    libx52io_context *ctx = *state;
+
+    ctx->pid = X52_PROD_X52PRO;
+    _x52io_set_report_parser(ctx);
+    check_parsers(ctx, 15);
+}
+
+static void test_mode_unknown(void **state)
+{
+    /* The full report keeps the previous mode between positions */
+    libx52io_context *ctx = *state;
+    libx52io_report report;
+    libx52io_packed_report packed;
+    unsigned char data[15] = { 0 };
+
+    ctx->pid = X52_PROD_X52PRO;
+    _x52io_set_report_parser(ctx);
+
+    memset(&report, 0, sizeof(report));
+    report.mode = 3;
+    assert_int_equal(_x52io_parse_report(ctx, &report, data, sizeof(data)),
+                     LIBX52IO_SUCCESS);
+    assert_int_equal(report.mode, 3);
+
+    assert_int_equal(_x52io_parse_packed(ctx, &packed, data, sizeof(data)),
+                     LIBX52IO_SUCCESS);
+    assert_int_equal(packed.mode, 0);
+}
+
+static void test_invalid(void **state)
+{
+    libx52io_report report;
+    libx52io_packed_report packed;
+
+    assert_int_equal(libx52io_pack_report(NULL, &packed), LIBX52IO_ERROR_INVALID);
+    assert_int_equal(libx52io_pack_report(&report, NULL), LIBX52IO_ERROR_INVALID);
+    assert_int_equal(libx52io_unpack_report(NULL, &report), LIBX52IO_ERROR_INVALID);
+    assert_int_equal(libx52io_unpack_report(&packed, NULL), LIBX52IO_ERROR_INVALID);
+    assert_int_equal(libx52io_read_packed(NULL, &packed, 0), LIBX52IO_ERROR_INVALID);
+}
+
+const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_size),
+    cmocka_unit_test(test_round_trip),
+    cmocka_unit_test(test_parse_x52),
+    cmocka_unit_test(test_parse_pro),
+    cmocka_unit_test(test_mode_unknown),
+    cmocka_unit_test(test_invalid),
+};
+
+int main(void)
+{
+    cmocka_set_message_output(CM_OUTPUT_TAP);
+    cmocka_run_group_tests(tests, group_setup, group_teardown);
+    return 0;
+}
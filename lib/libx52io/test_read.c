@@ -0,0 +1,350 @@
+/*
+ * Saitek X52 IO driver - Batch read test suite
+ *
+ * Copyright (C) 2012-2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "io_common.h"
+#include "usb-ids.h"
+
+/* Size of an X52 Pro report */
+#define REPORT_SIZE 15
+
+/* Mocked HID read, the queued reports are set up with will_read */
+int hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+{
+    int rc;
+
+    check_expected(milliseconds);
+    rc = mock_type(int);
+    if (rc > 0) {
+        memcpy(data, mock_ptr_type(unsigned char *), rc);
+    }
+
+    return rc;
+}
+
+/* Queue a report with the given throttle value */
+static void will_read(int milliseconds, unsigned char *data, uint8_t throttle)
+{
+    memset(data, 0, REPORT_SIZE);
+    data[4] = throttle;
+
+    expect_value(hid_read_timeout, milliseconds, milliseconds);
+    will_return(hid_read_timeout, REPORT_SIZE);
+    will_return(hid_read_timeout, data);
+}
+
+static void will_fail(int milliseconds, int rc)
+{
+    expect_value(hid_read_timeout, milliseconds, milliseconds);
+    will_return(hid_read_timeout, rc);
+}
+
+static int group_setup(void **state)
+{
+    libx52io_context *ctx;
+    int rc;
+
+    rc = libx52io_init(&ctx);
+    if (rc != LIBX52IO_SUCCESS) {
+        return rc;
+    }
+
+    /* The handle is never dereferenced, since hid_read_timeout is mocked */
+    ctx->handle = (hid_device *)(uintptr_t)-1;
+    ctx->pid = X52_PROD_X52PRO;
+    _x52io_set_report_parser(ctx);
+
+    *state = ctx;
+    return 0;
+}
+
+static int group_teardown(void **state)
+{
+    libx52io_context *ctx = *state;
+
+    ctx->handle = NULL;
+    libx52io_exit(ctx);
+    return 0;
+}
+
+static void test_all(void **state)
+{
+    /* All the queued reports are returned, oldest first */
+    libx52io_context *ctx = *state;
+    libx52io_report reports[8];
+    unsigned char data[3][REPORT_SIZE];
+    size_t count;
+    size_t dropped = 42;
+    int rc;
+
+    will_read(100, data[0], 10);
+    will_read(0, data[1], 20);
+    will_read(0, data[2], 30);
+    will_fail(0, 0);
+
+    rc = libx52io_read_batch(ctx, reports, 8, LIBX52IO_BATCH_ALL, 100,
+                             &count, &dropped);
+    assert_int_equal(rc, LIBX52IO_SUCCESS);
+    assert_int_equal(count, 3);
+    assert_int_equal(dropped, 0);
+    assert_int_equal(reports[0].axis[LIBX52IO_AXIS_Z], 10);
+    assert_int_equal(reports[1].axis[LIBX52IO_AXIS_Z], 20);
+    assert_int_equal(reports[2].axis[LIBX52IO_AXIS_Z], 30);
+}
+
+static void test_all_max(void **state)
+{
+    /* Reports beyond the size of the array are left queued */
+    libx52io_context *ctx = *state;
+    libx52io_report reports[2];
+    unsigned char data[2][REPORT_SIZE];
+    size_t count;
+    int rc;
+
+    will_read(-1, data[0], 10);
+    will_read(0, data[1], 20);
+
+    rc = libx52io_read_batch(ctx, reports, 2, LIBX52IO_BATCH_ALL, -1,
+                             &count, NULL);
+    assert_int_equal(rc, LIBX52IO_SUCCESS);
+    assert_int_equal(count, 2);
+    assert_int_equal(reports[1].axis[LIBX52IO_AXIS_Z], 20);
+}
+
+static void test_latest(void **state)
+{
+    /* Only the most recent report is returned */
+    libx52io_context *ctx = *state;
+    libx52io_report report;
+    unsigned char data[4][REPORT_SIZE];
+    size_t count;
+    size_t dropped;
+    int rc;
+
+    will_read(50, data[0], 10);
+    will_read(0, data[1], 20);
+    will_read(0, data[2], 30);
+    will_read(0, data[3], 40);
+    will_fail(0, 0);
+
+    rc = libx52io_read_batch(ctx, &report, 1, LIBX52IO_BATCH_LATEST, 50,
+                             &count, &dropped);
+    assert_int_equal(rc, LIBX52IO_SUCCESS);
+    assert_int_equal(count, 1);
+    assert_int_equal(dropped, 3);
+    assert_int_equal(report.axis[LIBX52IO_AXIS_Z], 40);
+}
+
+static void test_latest_error(void **state)
+{
+    /* A failed read after the first keeps the last good report */
+    libx52io_context *ctx = *state;
+    libx52io_report report;
+    unsigned char data[2][REPORT_SIZE];
+    size_t count;
+    size_t dropped;
+    int rc;
+
+    will_read(0, data[0], 10);
+    will_read(0, data[1], 20);
+    will_fail(0, -1);
+
+    rc = libx52io_read_batch(ctx, &report, 1, LIBX52IO_BATCH_LATEST, 0,
+                             &count, &dropped);
+    assert_int_equal(rc, LIBX52IO_SUCCESS);
+    assert_int_equal(count, 1);
+    assert_int_equal(dropped, 1);
+    assert_int_equal(report.axis[LIBX52IO_AXIS_Z], 20);
+}
+
+static void test_mode_carried(void **state)
+{
+    /* Reports with the mode selector between positions keep the last mode */
+    libx52io_context *ctx = *state;
+    libx52io_report reports[3];
+    unsigned char data[5][REPORT_SIZE];
+    size_t count;
+    size_t dropped;
+    int rc;
+
+    /* Button 27 is MODE_1 on the X52 Pro */
+    memset(reports, 0xa5, sizeof(reports));
+    will_read(0, data[0], 10);
+    data[0][11] |= 1 << 3;
+    will_read(0, data[1], 20);
+    will_fail(0, 0);
+
+    rc = libx52io_read_batch(ctx, reports, 3, LIBX52IO_BATCH_ALL, 0,
+                             &count, NULL);
+    assert_int_equal(rc, LIBX52IO_SUCCESS);
+    assert_int_equal(count, 2);
+    assert_int_equal(reports[0].mode, 1);
+    assert_int_equal(reports[1].mode, 1);
+    assert_false(reports[1].button[LIBX52IO_BTN_MODE_1]);
+
+    memset(reports, 0xa5, sizeof(reports));
+    will_read(0, data[2], 10);
+    data[2][11] |= 1 << 4;
+    will_read(0, data[3], 20);
+    will_read(0, data[4], 30);
+    will_fail(0, 0);
+
+    rc = libx52io_read_batch(ctx, reports, 1, LIBX52IO_BATCH_LATEST, 0,
+                             &count, &dropped);
+    assert_int_equal(rc, LIBX52IO_SUCCESS);
+    assert_int_equal(dropped, 2);
+    assert_int_equal(reports[0].axis[LIBX52IO_AXIS_Z], 30);
+    assert_int_equal(reports[0].mode, 2);
+}
+
+static void test_first_fails(void **state)
+{
+    /* Errors on the first read are returned as is */
+    libx52io_context *ctx = *state;
+    libx52io_report report;
+    size_t count = 42;
+    int rc;
+
+    will_fail(10, 0);
+    rc = libx52io_read_batch(ctx, &report, 1, LIBX52IO_BATCH_ALL, 10,
+                             &count, NULL);
+    assert_int_equal(rc, LIBX52IO_ERROR_TIMEOUT);
+    assert_int_equal(count, 0);
+
+    will_fail(10, -1);
+    rc = libx52io_read_batch(ctx, &report, 1, LIBX52IO_BATCH_LATEST, 10,
+                             &count, NULL);
+    assert_int_equal(rc, LIBX52IO_ERROR_IO);
+    assert_int_equal(count, 0);
+}
+
+static void test_invalid(void **state)
+{
+    libx52io_context *ctx = *state;
+    libx52io_report report;
+    size_t count;
+
+    assert_int_equal(libx52io_read_batch(NULL, &report, 1, LIBX52IO_BATCH_ALL,
+                                         0, &count, NULL),
+                     LIBX52IO_ERROR_INVALID);
+    assert_int_equal(libx52io_read_batch(ctx, NULL, 1, LIBX52IO_BATCH_ALL,
+                                         0, &count, NULL),
+                     LIBX52IO_ERROR_INVALID);
+    assert_int_equal(libx52io_read_batch(ctx, &report, 0, LIBX52IO_BATCH_ALL,
+                                         0, &count, NULL),
+                     LIBX52IO_ERROR_INVALID);
+    assert_int_equal(libx52io_read_batch(ctx, &report, 1, LIBX52IO_BATCH_ALL,
+                                         0, NULL, NULL),
+                     LIBX52IO_ERROR_INVALID);
+    assert_int_equal(libx52io_read_batch(ctx, &report, 1,
+                                         (libx52io_batch_mode)2,
+                                         0, &count, NULL),
+                     LIBX52IO_ERROR_INVALID);
+}
+
+static void test_fd_read(void **state)
+{
+    /* Reports are read from the file descriptor when there is one */
+    libx52io_context *ctx = *state;
+    libx52io_report report;
+    unsigned char data[REPORT_SIZE];
+    int fds[2];
+    int fd;
+    int rc;
+
+    assert_int_equal(pipe(fds), 0);
+    assert_int_not_equal(fcntl(fds[0], F_SETFL, O_NONBLOCK), -1);
+    ctx->fd = fds[0];
+
+    rc = libx52io_get_fd(ctx, &fd);
+    assert_int_equal(rc, LIBX52IO_SUCCESS);
+    assert_int_equal(fd, fds[0]);
+
+    memset(data, 0, sizeof(data));
+    data[4] = 77;
+    assert_int_equal(write(fds[1], data, sizeof(data)), sizeof(data));
+
+    rc = libx52io_read_timeout(ctx, &report, 0);
+    assert_int_equal(rc, LIBX52IO_SUCCESS);
+    assert_int_equal(report.axis[LIBX52IO_AXIS_Z], 77);
+
+    /* Nothing is queued */
+    rc = libx52io_read_timeout(ctx, &report, 0);
+    assert_int_equal(rc, LIBX52IO_ERROR_TIMEOUT);
+    rc = libx52io_read_timeout(ctx, &report, 10);
+    assert_int_equal(rc, LIBX52IO_ERROR_TIMEOUT);
+
+    /* The other end went away */
+    close(fds[1]);
+    rc = libx52io_read_timeout(ctx, &report, 10);
+    assert_int_equal(rc, LIBX52IO_ERROR_IO);
+
+    ctx->fd = -1;
+    close(fds[0]);
+}
+
+static void test_fd_invalid(void **state)
+{
+    libx52io_context *ctx = *state;
+    hid_device *handle = ctx->handle;
+    int fd;
+
+    assert_int_equal(libx52io_get_fd(NULL, &fd), LIBX52IO_ERROR_INVALID);
+    assert_int_equal(libx52io_get_fd(ctx, NULL), LIBX52IO_ERROR_INVALID);
+    assert_int_equal(libx52io_get_fd(ctx, &fd), LIBX52IO_ERROR_NOT_SUPPORTED);
+
+    ctx->handle = NULL;
+    assert_int_equal(libx52io_get_fd(ctx, &fd), LIBX52IO_ERROR_NO_DEVICE);
+    ctx->handle = handle;
+}
+
+static void test_read_packed(void **state)
+{
+    /* Reports can be read straight into the packed form */
+    libx52io_context *ctx = *state;
+    libx52io_packed_report packed;
+    unsigned char data[REPORT_SIZE];
+    int rc;
+
+    will_read(20, data, 99);
+    rc = libx52io_read_packed(ctx, &packed, 20);
+    assert_int_equal(rc, LIBX52IO_SUCCESS);
+    assert_int_equal(packed.z, 99);
+
+    will_fail(20, 0);
+    rc = libx52io_read_packed(ctx, &packed, 20);
+    assert_int_equal(rc, LIBX52IO_ERROR_TIMEOUT);
+}
+
+const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_all),
+    cmocka_unit_test(test_all_max),
+    cmocka_unit_test(test_latest),
+    cmocka_unit_test(test_latest_error),
+    cmocka_unit_test(test_mode_carried),
+    cmocka_unit_test(test_first_fails),
+    cmocka_unit_test(test_invalid),
+    cmocka_unit_test(test_fd_read),
+    cmocka_unit_test(test_fd_invalid),
+    cmocka_unit_test(test_read_packed),
+};
+
+int main(void)
+{
+    cmocka_set_message_output(CM_OUTPUT_TAP);
+    cmocka_run_group_tests(tests, group_setup, group_teardown);
+    return 0;
+}
@@ -0,0 +1,298 @@
+/*
+ * Saitek X52 IO driver - Reader thread test suite
+ *
+ * Copyright (C) 2012-2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "io_common.h"
+#include "usb-ids.h"
+
+/* Size of an X52 Pro report */
+#define REPORT_SIZE 15
+
+/* Time to wait for the reader thread, in milliseconds */
+#define WAIT_MS     2000
+
+/*
+ * Reports are fed to the reader thread through a socket in place of hidraw,
+ * which keeps the boundaries between reports in the same way
+ */
+static int feed[2];
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void send_report(uint8_t throttle)
+{
+    unsigned char data[REPORT_SIZE];
+
+    memset(data, 0, sizeof(data));
+    data[4] = throttle;
+    assert_int_equal(write(feed[1], data, sizeof(data)), sizeof(data));
+}
+
+/* Drain the queue until count reports have been received */
+static size_t drain(libx52io_context *ctx, libx52io_timed_report *reports,
+                    size_t count)
+{
+    size_t n = 0;
+    int i;
+
+    for (i = 0; i < WAIT_MS && n < count; i++) {
+        n += libx52io_reader_drain(ctx, reports + n, count - n);
+        if (n < count) {
+            usleep(1000);
+        }
+    }
+
+    return n;
+}
+
+static int group_setup(void **state)
+{
+    libx52io_context *ctx;
+    int rc;
+
+    rc = libx52io_init(&ctx);
+    if (rc != LIBX52IO_SUCCESS) {
+        return rc;
+    }
+
+    /* The handle is never used, since the reports come from the socket */
+    ctx->handle = (hid_device *)(uintptr_t)-1;
+    ctx->pid = X52_PROD_X52PRO;
+    _x52io_set_report_parser(ctx);
+
+    *state = ctx;
+    return 0;
+}
+
+static int group_teardown(void **state)
+{
+    libx52io_context *ctx = *state;
+
+    ctx->handle = NULL;
+    libx52io_exit(ctx);
+    return 0;
+}
+
+static int test_setup(void **state)
+{
+    libx52io_context *ctx = *state;
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, feed) != 0) {
+        return -1;
+    }
+    fcntl(feed[0], F_SETFL, O_NONBLOCK);
+    ctx->fd = feed[0];
+
+    return 0;
+}
+
+static int test_teardown(void **state)
+{
+    libx52io_context *ctx = *state;
+
+    libx52io_reader_stop(ctx);
+    ctx->fd = -1;
+    close(feed[0]);
+    if (feed[1] >= 0) {
+        close(feed[1]);
+    }
+
+    return 0;
+}
+
+static void test_queue(void **state)
+{
+    /* Reports are queued in order, with their arrival time */
+    libx52io_context *ctx = *state;
+    libx52io_timed_report reports[4];
+    uint64_t start;
+    uint64_t end;
+    uint64_t dropped;
+    int rc;
+
+    rc = libx52io_reader_start(ctx, 8);
+    assert_int_equal(rc, LIBX52IO_SUCCESS);
+    assert_int_equal(libx52io_reader_drain(ctx, reports, 4), 0);
+
+    start = monotonic_ns();
+    send_report(10);
+    send_report(20);
+    send_report(30);
+    assert_int_equal(drain(ctx, reports, 3), 3);
+    end = monotonic_ns();
+
+    assert_int_equal(reports[0].report.axis[LIBX52IO_AXIS_Z], 10);
+    assert_int_equal(reports[1].report.axis[LIBX52IO_AXIS_Z], 20);
+    assert_int_equal(reports[2].report.axis[LIBX52IO_AXIS_Z], 30);
+
+    assert_true(reports[0].timestamp_ns >= start);
+    assert_true(reports[1].timestamp_ns >= reports[0].timestamp_ns);
+    assert_true(reports[2].timestamp_ns >= reports[1].timestamp_ns);
+    assert_true(reports[2].timestamp_ns <= end);
+
+    assert_int_equal(libx52io_reader_get_status(ctx, &dropped), LIBX52IO_SUCCESS);
+    assert_int_equal(dropped, 0);
+}
+
+static void test_mode(void **state)
+{
+    /* The mode starts unknown, and is kept between selector positions */
+    libx52io_context *ctx = *state;
+    libx52io_timed_report reports[3];
+    unsigned char data[REPORT_SIZE];
+
+    assert_int_equal(libx52io_reader_start(ctx, 4), LIBX52IO_SUCCESS);
+
+    send_report(1);
+
+    /* Button 28 is MODE_2 on the X52 Pro */
+    memset(data, 0, sizeof(data));
+    data[11] = 1 << 4;
+    assert_int_equal(write(feed[1], data, sizeof(data)), sizeof(data));
+
+    send_report(3);
+    assert_int_equal(drain(ctx, reports, 3), 3);
+
+    assert_int_equal(reports[0].report.mode, 0);
+    assert_int_equal(reports[1].report.mode, 2);
+    assert_int_equal(reports[2].report.mode, 2);
+}
+
+static void test_wrap(void **state)
+{
+    /* The queue is reused once the reports have been drained */
+    libx52io_context *ctx = *state;
+    libx52io_timed_report reports[2];
+    int i;
+
+    assert_int_equal(libx52io_reader_start(ctx, 2), LIBX52IO_SUCCESS);
+
+    for (i = 0; i < 10; i++) {
+        send_report(i);
+        assert_int_equal(drain(ctx, reports, 1), 1);
+        assert_int_equal(reports[0].report.axis[LIBX52IO_AXIS_Z], i);
+    }
+}
+
+static void test_overflow(void **state)
+{
+    /* New reports are dropped while the queue is full */
+    libx52io_context *ctx = *state;
+    libx52io_timed_report reports[4];
+    uint64_t dropped = 0;
+    int i;
+
+    assert_int_equal(libx52io_reader_start(ctx, 2), LIBX52IO_SUCCESS);
+
+    for (i = 1; i <= 5; i++) {
+        send_report(i);
+    }
+
+    for (i = 0; i < WAIT_MS && dropped < 3; i++) {
+        libx52io_reader_get_status(ctx, &dropped);
+        usleep(1000);
+    }
+    assert_int_equal(dropped, 3);
+
+    assert_int_equal(libx52io_reader_drain(ctx, reports, 4), 2);
+    assert_int_equal(reports[0].report.axis[LIBX52IO_AXIS_Z], 1);
+    assert_int_equal(reports[1].report.axis[LIBX52IO_AXIS_Z], 2);
+}
+
+static void test_disconnect(void **state)
+{
+    /* The thread reports an error once the device is gone */
+    libx52io_context *ctx = *state;
+    int rc = LIBX52IO_SUCCESS;
+    int i;
+
+    assert_int_equal(libx52io_reader_start(ctx, 4), LIBX52IO_SUCCESS);
+
+    close(feed[1]);
+    feed[1] = -1;
+
+    for (i = 0; i < WAIT_MS && rc == LIBX52IO_SUCCESS; i++) {
+        rc = libx52io_reader_get_status(ctx, NULL);
+        usleep(1000);
+    }
+    assert_int_equal(rc, LIBX52IO_ERROR_IO);
+
+    assert_int_equal(libx52io_reader_stop(ctx), LIBX52IO_SUCCESS);
+    assert_int_equal(libx52io_reader_get_status(ctx, NULL), LIBX52IO_ERROR_INVALID);
+}
+
+static void test_busy(void **state)
+{
+    /* The device can't be read directly while the thread is running */
+    libx52io_context *ctx = *state;
+    libx52io_report report;
+    int fd;
+
+    assert_int_equal(libx52io_reader_start(ctx, 4), LIBX52IO_SUCCESS);
+    assert_int_equal(libx52io_reader_start(ctx, 4), LIBX52IO_ERROR_BUSY);
+    assert_int_equal(libx52io_read_timeout(ctx, &report, 0), LIBX52IO_ERROR_BUSY);
+    assert_int_equal(libx52io_get_fd(ctx, &fd), LIBX52IO_ERROR_BUSY);
+
+    assert_int_equal(libx52io_reader_stop(ctx), LIBX52IO_SUCCESS);
+    assert_int_equal(libx52io_reader_stop(ctx), LIBX52IO_SUCCESS);
+    assert_int_equal(libx52io_read_timeout(ctx, &report, 0), LIBX52IO_ERROR_TIMEOUT);
+}
+
+static void test_invalid(void **state)
+{
+    libx52io_context *ctx = *state;
+    libx52io_timed_report report;
+    hid_device *handle = ctx->handle;
+
+    assert_int_equal(libx52io_reader_start(NULL, 4), LIBX52IO_ERROR_INVALID);
+    assert_int_equal(libx52io_reader_start(ctx, 0), LIBX52IO_ERROR_INVALID);
+    assert_int_equal(libx52io_reader_start(ctx, 1), LIBX52IO_ERROR_INVALID);
+    assert_int_equal(libx52io_reader_start(ctx, 6), LIBX52IO_ERROR_INVALID);
+    assert_int_equal(libx52io_reader_stop(NULL), LIBX52IO_ERROR_INVALID);
+    assert_int_equal(libx52io_reader_drain(ctx, &report, 1), 0);
+    assert_int_equal(libx52io_reader_get_status(ctx, NULL), LIBX52IO_ERROR_INVALID);
+
+    ctx->handle = NULL;
+    assert_int_equal(libx52io_reader_start(ctx, 4), LIBX52IO_ERROR_NO_DEVICE);
+    ctx->handle = handle;
+}
+
+#define TEST(tc) cmocka_unit_test_setup_teardown(tc, test_setup, test_teardown)
+
+const struct CMUnitTest tests[] = {
+    TEST(test_queue),
+    TEST(test_mode),
+    TEST(test_wrap),
+    TEST(test_overflow),
+    TEST(test_disconnect),
+    TEST(test_busy),
+    TEST(test_invalid),
+};
+
+int main(void)
+{
+    cmocka_set_message_output(CM_OUTPUT_TAP);
+    cmocka_run_group_tests(tests, group_setup, group_teardown);
+    return 0;
+}
@@ -0,0 +1,1016 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - daemon
+ *
+ * Copyright (C) 2012-2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+/**
+@page x52d Daemon for the X52 joystick
+
+\htmlonly
+<b>x52d</b> - Daemon which owns the X52 joystick
+\endhtmlonly
+
+# SYNOPSIS
+<tt>\b x52d [\b -s \a socket]</tt>
+
+# DESCRIPTION
+
+\b x52d keeps the joystick open, and accepts commands from other processes on
+a Unix domain socket, so that scripts and applications do not need to
+initialize libx52 and scan the USB bus for every change. The socket is
+created at \a socket, or at <tt>$XDG_RUNTIME_DIR/x52d.sock</tt> if \b -s is
+not given, or at <tt>/tmp/x52d.sock</tt> if \c XDG_RUNTIME_DIR is not set.
+
+\b x52d runs in the foreground, and exits on \c SIGINT or \c SIGTERM.
+
+# PROTOCOL
+
+Clients send commands as lines of text. The commands and their arguments are
+the same as for \ref x52cli, except that there is no \b raw command. Text
+containing spaces must be enclosed in double quotes, e.g.,
+<tt>mfd 0 "Hello World"</tt>.
+
+\b x52d replies to every command with a line containing \c OK, or \c ERR
+followed by a description of the error. All the commands which are received
+together, from any number of clients, are applied as a single frame, and
+written to the joystick in a single update. A client can therefore send a
+batch of commands, and then wait for all the replies.
+
+The \b clock command keeps clock 1 in sync with the system clock until the
+next \b clock, \b time or \b date command.
+
+Two additional commands control the input reports:
+
+- <tt>\b subscribe</tt>\n \manonly \fR \endmanonly
+  Send a line to this client every time the state of the joystick changes.
+
+- <tt>\b unsubscribe</tt>\n \manonly \fR \endmanonly
+  Stop sending input reports to this client.
+
+Each input report is a line of the form
+<tt>report \a mode \a hat \a buttons \a axis...</tt>, where \a buttons has a
+\c 0 or \c 1 for every button, in the order of \ref libx52io_button, and the
+axes are given in the order of \ref libx52io_axis. Reports are dropped for a
+client which does not read them quickly enough.
+
+# EXAMPLES
+
+- Set the first two lines of the MFD with a single update.
+  > <tt>printf 'mfd 0 "Hello"\\nmfd 1 "World"\\n' | socat - UNIX-CONNECT:/tmp/x52d.sock</tt>
+
+*/
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "libx52.h"
+#include "libx52io.h"
+#include "gettext.h"
+
+/* For i18n */
+#define _(x) gettext(x)
+
+/* Maximum number of clients connected at the same time */
+#define X52D_CLIENTS_MAX    16
+
+/* Maximum length of a command line, including the newline */
+#define X52D_LINE_MAX       256
+
+/* Maximum number of arguments to a command */
+#define X52D_ARGS_MAX       4
+
+/* Timeout for input reads, which bounds the time taken to exit */
+#define X52D_INPUT_TIMEOUT_MS   100
+
+/* Interval between attempts to connect to a missing joystick */
+#define X52D_RETRY_MS       1000
+
+/* Length of a formatted input report */
+#define X52D_REPORT_MAX     (32 + LIBX52IO_BUTTON_MAX + 12 * LIBX52IO_AXIS_MAX)
+
+struct client {
+    int fd;
+    bool subscribed;
+    /* Set while the rest of an overlong line is being discarded */
+    bool overflow;
+    size_t len;
+    char buf[X52D_LINE_MAX];
+};
+
+static volatile sig_atomic_t exit_loop = 0;
+
+static libx52_device *x52;
+static struct client clients[X52D_CLIENTS_MAX];
+static int clock_fd = -1;
+
+/*
+ * Input reports are read in the main loop from the libx52io file descriptor.
+ * If the HID backend does not have one, they are read on a separate thread,
+ * and passed to the main loop over a pipe.
+ */
+static int input_fd = -1;
+static int input_pipe[2] = { -1, -1 };
+static bool input_threaded;
+static pthread_t input_thread_id;
+
+static void signal_handler(int sig)
+{
+    exit_loop = 1;
+}
+
+/* Lookup tables for the command arguments */
+struct string_map {
+    const char *key;
+    int value;
+};
+
+static const struct string_map led_id_map[] = {
+    { "fire", LIBX52_LED_FIRE },
+    { "a", LIBX52_LED_A },
+    { "b", LIBX52_LED_B },
+    { "d", LIBX52_LED_D },
+    { "e", LIBX52_LED_E },
+    { "t1", LIBX52_LED_T1 },
+    { "t2", LIBX52_LED_T2 },
+    { "t3", LIBX52_LED_T3 },
+    { "pov", LIBX52_LED_POV },
+    { "clutch", LIBX52_LED_CLUTCH },
+    { "throttle", LIBX52_LED_THROTTLE },
+    { NULL, -1 }
+};
+
+static const struct string_map led_state_map[] = {
+    { "off", LIBX52_LED_STATE_OFF },
+    { "on", LIBX52_LED_STATE_ON },
+    { "red", LIBX52_LED_STATE_RED },
+    { "amber", LIBX52_LED_STATE_AMBER },
+    { "green", LIBX52_LED_STATE_GREEN },
+    { NULL, -1 }
+};
+
+static const struct string_map brightness_map[] = {
+    { "mfd", 1 },
+    { "led", 0 },
+    { NULL, -1 }
+};
+
+static const struct string_map on_off_map[] = {
+    { "off", 0 },
+    { "on", 1 },
+    { NULL, -1 }
+};
+
+static const struct string_map timezone_map[] = {
+    { "gmt", 0 },
+    { "local", 1 },
+    { NULL, -1 }
+};
+
+static const struct string_map offset_clock_map[] = {
+    { "2", LIBX52_CLOCK_2 },
+    { "3", LIBX52_CLOCK_3 },
+    { NULL, -1 }
+};
+
+static const struct string_map time_format_map[] = {
+    { "12hr", LIBX52_CLOCK_FORMAT_12HR },
+    { "24hr", LIBX52_CLOCK_FORMAT_24HR },
+    { NULL, -1 }
+};
+
+static const struct string_map date_format_map[] = {
+    { "ddmmyy", LIBX52_DATE_FORMAT_DDMMYY },
+    { "mmddyy", LIBX52_DATE_FORMAT_MMDDYY },
+    { "yymmdd", LIBX52_DATE_FORMAT_YYMMDD },
+    { NULL, -1 }
+};
+
+/* Returns -1 if the string does not match any key in the map */
+static int map_lookup(const struct string_map *map, const char *str)
+{
+    for (; map->key != NULL; map++) {
+        if (!strcasecmp(str, map->key)) {
+            return map->value;
+        }
+    }
+
+    return -1;
+}
+
+/* Parse a decimal or hex integer, which must make up the whole argument */
+static bool parse_int(const char *str, long *value)
+{
+    char *end;
+
+    errno = 0;
+    *value = strtol(str, &end, 0);
+    return (errno == 0 && end != str && *end == '\0');
+}
+
+/* Stop keeping clock 1 in sync with the system clock */
+static void stop_clock_service(void)
+{
+    (void)libx52_clock_service_stop(x52);
+    clock_fd = -1;
+}
+
+/*
+ * Command handlers. Each returns a libx52 error code, or -1 if the arguments
+ * are not valid.
+ */
+typedef int (*handler_cb)(struct client *c, char *args[]);
+
+static int cmd_led(struct client *c, char *args[])
+{
+    int led = map_lookup(led_id_map, args[0]);
+    int state = map_lookup(led_state_map, args[1]);
+
+    if (led < 0 || state < 0) {
+        return -1;
+    }
+
+    return libx52_set_led_state(x52, led, state);
+}
+
+static int cmd_bri(struct client *c, char *args[])
+{
+    int mfd = map_lookup(brightness_map, args[0]);
+    long brightness;
+
+    if (mfd < 0 || !parse_int(args[1], &brightness) ||
+        brightness < 0 || brightness > UINT16_MAX) {
+        return -1;
+    }
+
+    return libx52_set_brightness(x52, mfd, (uint16_t)brightness);
+}
+
+static int cmd_mfd(struct client *c, char *args[])
+{
+    long line;
+
+    if (!parse_int(args[0], &line) || line < 0 || line > 2) {
+        return -1;
+    }
+
+    return libx52_set_text(x52, line, args[1], strlen(args[1]));
+}
+
+static int cmd_blink(struct client *c, char *args[])
+{
+    int state = map_lookup(on_off_map, args[0]);
+
+    if (state < 0) {
+        return -1;
+    }
+
+    return libx52_set_blink(x52, state);
+}
+
+static int cmd_shift(struct client *c, char *args[])
+{
+    int state = map_lookup(on_off_map, args[0]);
+
+    if (state < 0) {
+        return -1;
+    }
+
+    return libx52_set_shift(x52, state);
+}
+
+static int cmd_clock(struct client *c, char *args[])
+{
+    int local = map_lookup(timezone_map, args[0]);
+    int time_format = map_lookup(time_format_map, args[1]);
+    int date_format = map_lookup(date_format_map, args[2]);
+    int rc;
+
+    if (local < 0 || time_format < 0 || date_format < 0) {
+        return -1;
+    }
+
+    /* The clock service sets the clock as soon as it is started */
+    stop_clock_service();
+    rc = libx52_clock_service_start(x52, local, &clock_fd);
+    if (rc == LIBX52_ERROR_NOT_SUPPORTED) {
+        clock_fd = -1;
+        rc = libx52_set_clock(x52, time(NULL), local);
+    }
+
+    if (rc == LIBX52_SUCCESS) {
+        rc = libx52_set_clock_format(x52, LIBX52_CLOCK_1, time_format);
+    }
+
+    if (rc == LIBX52_SUCCESS) {
+        rc = libx52_set_date_format(x52, date_format);
+    }
+
+    return rc;
+}
+
+static int cmd_offset(struct client *c, char *args[])
+{
+    int clock = map_lookup(offset_clock_map, args[0]);
+    int time_format = map_lookup(time_format_map, args[2]);
+    long offset;
+    int rc;
+
+    if (clock < 0 || time_format < 0 || !parse_int(args[1], &offset) ||
+        offset < INT16_MIN || offset > INT16_MAX) {
+        return -1;
+    }
+
+    rc = libx52_set_clock_timezone(x52, clock, (int)offset);
+    if (rc == LIBX52_SUCCESS) {
+        rc = libx52_set_clock_format(x52, clock, time_format);
+    }
+
+    return rc;
+}
+
+static int cmd_time(struct client *c, char *args[])
+{
+    int time_format = map_lookup(time_format_map, args[2]);
+    long hh, mm;
+    int rc;
+
+    if (time_format < 0 || !parse_int(args[0], &hh) || !parse_int(args[1], &mm) ||
+        hh < 0 || hh > UINT8_MAX || mm < 0 || mm > UINT8_MAX) {
+        return -1;
+    }
+
+    /* The time no longer follows the system clock */
+    stop_clock_service();
+    rc = libx52_set_time(x52, hh, mm);
+    if (rc == LIBX52_SUCCESS) {
+        rc = libx52_set_clock_format(x52, LIBX52_CLOCK_1, time_format);
+    }
+
+    return rc;
+}
+
+static int cmd_date(struct client *c, char *args[])
+{
+    int date_format = map_lookup(date_format_map, args[3]);
+    long dd, mm, yy;
+    int rc;
+
+    if (date_format < 0 || !parse_int(args[0], &dd) ||
+        !parse_int(args[1], &mm) || !parse_int(args[2], &yy) ||
+        dd < 0 || dd > UINT8_MAX || mm < 0 || mm > UINT8_MAX ||
+        yy < 0 || yy > UINT8_MAX) {
+        return -1;
+    }
+
+    /* The date no longer follows the system clock */
+    stop_clock_service();
+    rc = libx52_set_date(x52, dd, mm, yy);
+    if (rc == LIBX52_SUCCESS) {
+        rc = libx52_set_date_format(x52, date_format);
+    }
+
+    return rc;
+}
+
+static int cmd_subscribe(struct client *c, char *args[])
+{
+    c->subscribed = true;
+    return LIBX52_SUCCESS;
+}
+
+static int cmd_unsubscribe(struct client *c, char *args[])
+{
+    c->subscribed = false;
+    return LIBX52_SUCCESS;
+}
+
+static const struct {
+    const char *name;
+    int num_args;
+    handler_cb handler;
+    const char *usage;
+} commands[] = {
+    { "led", 2, cmd_led, "led <led-id> <state>" },
+    { "bri", 2, cmd_bri, "bri {mfd | led} <brightness level>" },
+    { "mfd", 2, cmd_mfd, "mfd <line> <text>" },
+    { "blink", 1, cmd_blink, "blink { on | off }" },
+    { "shift", 1, cmd_shift, "shift { on | off }" },
+    { "clock", 3, cmd_clock,
+      "clock {local | gmt} {12hr | 24hr} {ddmmyy | mmddyy | yymmdd}" },
+    { "offset", 3, cmd_offset,
+      "offset {2 | 3} <offset from clock 1 in minutes> {12hr | 24hr}" },
+    { "time", 3, cmd_time, "time <hour> <minute> {12hr | 24hr}" },
+    { "date", 4, cmd_date, "date <dd> <mm> <yy> {ddmmyy | mmddyy | yymmdd}" },
+    { "subscribe", 0, cmd_subscribe, "subscribe" },
+    { "unsubscribe", 0, cmd_unsubscribe, "unsubscribe" },
+};
+
+static void client_close(struct client *c)
+{
+    close(c->fd);
+    c->fd = -1;
+}
+
+/* Send a complete line to the client, closing it if the line cannot be sent */
+static void client_send(struct client *c, const char *line, size_t len)
+{
+    ssize_t rc;
+
+    rc = send(c->fd, line, len, MSG_NOSIGNAL);
+    if (rc != (ssize_t)len) {
+        client_close(c);
+    }
+}
+
+static void client_reply(struct client *c, const char *fmt, const char *arg)
+{
+    char reply[X52D_LINE_MAX];
+    int len;
+
+    len = snprintf(reply, sizeof(reply), fmt, arg);
+    if (len >= (int)sizeof(reply)) {
+        len = sizeof(reply) - 1;
+        reply[len - 1] = '\n';
+    }
+
+    client_send(c, reply, len);
+}
+
+/*
+ * Split a command line into words. Words are separated by blanks, and a word
+ * which starts with a double quote runs until the next double quote.
+ */
+static int split_line(char *line, char *words[], int max_words)
+{
+    int count = 0;
+    char *p = line;
+
+    while (*p != '\0') {
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+
+        if (*p == '\0') {
+            break;
+        }
+
+        if (count == max_words) {
+            return -1;
+        }
+
+        if (*p == '"') {
+            words[count++] = ++p;
+            p = strchr(p, '"');
+            if (p == NULL) {
+                return -1;
+            }
+        } else {
+            words[count++] = p;
+            p += strcspn(p, " \t");
+            if (*p == '\0') {
+                break;
+            }
+        }
+
+        *p++ = '\0';
+    }
+
+    return count;
+}
+
+/* Run a single command, returns true if it changed the pending state */
+static bool run_command(struct client *c, char *line)
+{
+    char *words[X52D_ARGS_MAX + 1];
+    size_t i;
+    int count;
+    int rc;
+
+    count = split_line(line, words, X52D_ARGS_MAX + 1);
+    if (count == 0) {
+        /* Ignore blank lines */
+        return false;
+    }
+
+    if (count < 0) {
+        client_reply(c, "ERR %s\n", "Invalid command line");
+        return false;
+    }
+
+    for (i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        if (!strcasecmp(words[0], commands[i].name)) {
+            break;
+        }
+    }
+
+    if (i == sizeof(commands) / sizeof(commands[0])) {
+        client_reply(c, "ERR Unsupported command %s\n", words[0]);
+        return false;
+    }
+
+    if (count - 1 != commands[i].num_args) {
+        client_reply(c, "ERR Usage: %s\n", commands[i].usage);
+        return false;
+    }
+
+    rc = commands[i].handler(c, &words[1]);
+    if (rc < 0) {
+        client_reply(c, "ERR Usage: %s\n", commands[i].usage);
+        return false;
+    }
+
+    if (rc != LIBX52_SUCCESS) {
+        client_reply(c, "ERR %s\n", libx52_strerror(rc));
+        return false;
+    }
+
+    client_reply(c, "%s", "OK\n");
+    return true;
+}
+
+/*
+ * Read the available data from the client, and run every complete command
+ * line. Returns true if any command changed the pending state.
+ */
+static bool client_read(struct client *c)
+{
+    bool changed = false;
+    char *start;
+    char *nl;
+    size_t used;
+    ssize_t rc;
+
+    rc = recv(c->fd, c->buf + c->len, sizeof(c->buf) - c->len, 0);
+    if (rc <= 0) {
+        if (rc == 0 || (errno != EAGAIN && errno != EINTR)) {
+            client_close(c);
+        }
+        return false;
+    }
+
+    c->len += rc;
+    start = c->buf;
+    while (c->fd >= 0 &&
+           (nl = memchr(start, '\n', c->len - (start - c->buf))) != NULL) {
+        *nl = '\0';
+        if (nl > start && nl[-1] == '\r') {
+            nl[-1] = '\0';
+        }
+
+        if (c->overflow) {
+            /* This is the end of a line which was too long */
+            c->overflow = false;
+        } else if (run_command(c, start)) {
+            changed = true;
+        }
+        start = nl + 1;
+    }
+
+    if (c->fd < 0) {
+        return changed;
+    }
+
+    used = start - c->buf;
+    if (used == 0 && c->len == sizeof(c->buf)) {
+        /* The buffer is full without a complete line, discard it */
+        if (!c->overflow) {
+            client_reply(c, "ERR %s\n", "Command line too long");
+        }
+        c->overflow = true;
+        c->len = 0;
+    } else {
+        memmove(c->buf, start, c->len - used);
+        c->len -= used;
+    }
+
+    return changed;
+}
+
+static void client_accept(int listen_fd)
+{
+    static const char busy[] = "ERR Too many clients\n";
+    int fd;
+    int i;
+
+    fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+
+    for (i = 0; i < X52D_CLIENTS_MAX; i++) {
+        if (clients[i].fd < 0) {
+            memset(&clients[i], 0, sizeof(clients[i]));
+            clients[i].fd = fd;
+            return;
+        }
+    }
+
+    /* No room for another client */
+    (void)send(fd, busy, strlen(busy), MSG_NOSIGNAL);
+    close(fd);
+}
+
+static int format_report(const libx52io_report *report, char *line, size_t size)
+{
+    size_t len;
+    int i;
+
+    len = snprintf(line, size, "report %u %u ", report->mode, report->hat);
+    for (i = 0; i < LIBX52IO_BUTTON_MAX; i++) {
+        line[len++] = report->button[i] ? '1' : '0';
+    }
+
+    for (i = 0; i < LIBX52IO_AXIS_MAX; i++) {
+        len += snprintf(line + len, size - len, " %d", report->axis[i]);
+    }
+
+    line[len++] = '\n';
+    return len;
+}
+
+/* Send the report to all subscribers, dropping it for slow clients */
+static void publish_report(const libx52io_report *report)
+{
+    char line[X52D_REPORT_MAX];
+    ssize_t rc;
+    int len;
+    int i;
+
+    len = format_report(report, line, sizeof(line));
+    for (i = 0; i < X52D_CLIENTS_MAX; i++) {
+        if (clients[i].fd < 0 || !clients[i].subscribed) {
+            continue;
+        }
+
+        rc = send(clients[i].fd, line, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (rc < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            client_close(&clients[i]);
+        }
+    }
+}
+
+/* Compare the fields, since the padding in the structures is undefined */
+static bool report_changed(const libx52io_report *a, const libx52io_report *b)
+{
+    return a->mode != b->mode || a->hat != b->hat ||
+           memcmp(a->axis, b->axis, sizeof(a->axis)) != 0 ||
+           memcmp(a->button, b->button, sizeof(a->button)) != 0;
+}
+
+static void handle_report(const libx52io_report *report, libx52io_report *last)
+{
+    if (report_changed(report, last)) {
+        publish_report(report);
+        *last = *report;
+    }
+}
+
+/*
+ * Read input reports on a separate thread, since libx52io reads block. The
+ * thread reopens the joystick if it is disconnected.
+ */
+static void *input_thread(void *arg)
+{
+    libx52io_context *ctx = arg;
+    libx52io_report report;
+    bool opened = false;
+    int rc;
+
+    /* The mode is kept between reads while the selector is between positions */
+    memset(&report, 0, sizeof(report));
+    while (!exit_loop) {
+        if (!opened) {
+            opened = (libx52io_open(ctx) == LIBX52IO_SUCCESS);
+            if (!opened) {
+                usleep(X52D_RETRY_MS * 1000);
+                continue;
+            }
+        }
+
+        rc = libx52io_read_timeout(ctx, &report, X52D_INPUT_TIMEOUT_MS);
+        if (rc == LIBX52IO_SUCCESS) {
+            if (write(input_pipe[1], &report, sizeof(report)) < 0) {
+                /* The pipe is full, the main loop is behind. Drop the report */
+            }
+        } else if (rc != LIBX52IO_ERROR_TIMEOUT) {
+            libx52io_close(ctx);
+            opened = false;
+        }
+    }
+
+    libx52io_close(ctx);
+    return NULL;
+}
+
+static void start_input_thread(libx52io_context *ctx)
+{
+    sigset_t sigs;
+    sigset_t old_sigs;
+    int rc;
+
+    /* The signals must interrupt the poll in the main thread */
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &sigs, &old_sigs);
+    rc = pthread_create(&input_thread_id, NULL, input_thread, ctx);
+    pthread_sigmask(SIG_SETMASK, &old_sigs, NULL);
+
+    input_threaded = (rc == 0);
+    if (!input_threaded) {
+        fprintf(stderr, _("Error creating input thread: %s\n"), strerror(rc));
+        exit_loop = 1;
+    }
+}
+
+/*
+ * Open the joystick for input reports in the main loop. If the HID backend
+ * has no file descriptor to poll, hand the joystick over to the input thread.
+ */
+static void open_input(libx52io_context *ctx)
+{
+    int rc;
+
+    if (libx52io_open(ctx) != LIBX52IO_SUCCESS) {
+        return;
+    }
+
+    rc = libx52io_get_fd(ctx, &input_fd);
+    if (rc != LIBX52IO_SUCCESS) {
+        libx52io_close(ctx);
+        if (rc == LIBX52IO_ERROR_NOT_SUPPORTED) {
+            start_input_thread(ctx);
+        }
+    }
+}
+
+/* Read all the queued reports, the file descriptor is non-blocking */
+static void read_input(libx52io_context *ctx, libx52io_report *last)
+{
+    libx52io_report report;
+    int rc;
+
+    /* Start from the last report, which holds the current mode */
+    report = *last;
+    while ((rc = libx52io_read_timeout(ctx, &report, 0)) == LIBX52IO_SUCCESS) {
+        handle_report(&report, last);
+    }
+
+    if (rc != LIBX52IO_ERROR_TIMEOUT) {
+        /* The joystick was disconnected, look for it again */
+        libx52io_close(ctx);
+        input_fd = -1;
+    }
+}
+
+static int open_socket(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, _("Socket path %s is too long\n"), path);
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    /* Remove the socket left behind by a previous instance */
+    (void)unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        chmod(path, 0660) < 0 ||
+        listen(fd, X52D_CLIENTS_MAX) < 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/* Write the pending updates, and connect to the joystick if necessary */
+static void update_device(void)
+{
+    int rc;
+
+    if (!libx52_is_connected(x52)) {
+        rc = libx52_connect(x52);
+        if (rc != LIBX52_SUCCESS) {
+            return;
+        }
+    }
+
+    rc = libx52_update(x52);
+    if (rc != LIBX52_SUCCESS) {
+        fprintf(stderr, _("Error updating joystick: %s\n"), libx52_strerror(rc));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct pollfd fds[4 + X52D_CLIENTS_MAX];
+    struct client *owner[4 + X52D_CLIENTS_MAX];
+    libx52io_context *ctx;
+    libx52io_report report;
+    libx52io_report last;
+    char default_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    const char *path = NULL;
+    const char *runtime_dir;
+    bool changed;
+    int listen_fd;
+    int nfds;
+    int opt;
+    int rc;
+    int i;
+
+    /* Initialize gettext */
+    #if ENABLE_NLS
+    setlocale(LC_ALL, "");
+    bindtextdomain(PACKAGE, LOCALEDIR);
+    textdomain(PACKAGE);
+    #endif
+
+    while ((opt = getopt(argc, argv, "s:")) != -1) {
+        switch (opt) {
+        case 's':
+            path = optarg;
+            break;
+
+        default:
+            fprintf(stderr, _("Usage: %s [-s socket]\n"), argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (path == NULL) {
+        runtime_dir = getenv("XDG_RUNTIME_DIR");
+        snprintf(default_path, sizeof(default_path), "%s/x52d.sock",
+                 runtime_dir ? runtime_dir : "/tmp");
+        path = default_path;
+    }
+
+    rc = libx52_init(&x52);
+    if (rc != LIBX52_SUCCESS) {
+        fprintf(stderr, _("Error initializing X52 library: %s\n"),
+                libx52_strerror(rc));
+        return EXIT_FAILURE;
+    }
+
+    rc = libx52io_init(&ctx);
+    if (rc != LIBX52IO_SUCCESS) {
+        fprintf(stderr, "%s\n", libx52io_strerror(rc));
+        libx52_exit(x52);
+        return EXIT_FAILURE;
+    }
+
+    listen_fd = open_socket(path);
+    if (listen_fd < 0 ||
+        pipe2(input_pipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+        libx52io_exit(ctx);
+        libx52_exit(x52);
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < X52D_CLIENTS_MAX; i++) {
+        clients[i].fd = -1;
+    }
+
+    /* Set up the signal handler to terminate the loop on SIGTERM or SIGINT */
+    signal(SIGTERM, signal_handler);
+    signal(SIGINT, signal_handler);
+    signal(SIGPIPE, SIG_IGN);
+
+    (void)libx52_connect(x52);
+    memset(&last, 0, sizeof(last));
+
+    while (!exit_loop) {
+        if (input_fd < 0 && !input_threaded) {
+            open_input(ctx);
+        }
+
+        nfds = 0;
+        fds[nfds].fd = listen_fd;
+        fds[nfds].events = POLLIN;
+        owner[nfds++] = NULL;
+        fds[nfds].fd = input_pipe[0];
+        fds[nfds].events = POLLIN;
+        owner[nfds++] = NULL;
+        if (input_fd >= 0) {
+            fds[nfds].fd = input_fd;
+            fds[nfds].events = POLLIN;
+            owner[nfds++] = NULL;
+        }
+        if (clock_fd >= 0) {
+            fds[nfds].fd = clock_fd;
+            fds[nfds].events = POLLIN;
+            owner[nfds++] = NULL;
+        }
+
+        for (i = 0; i < X52D_CLIENTS_MAX; i++) {
+            if (clients[i].fd >= 0) {
+                fds[nfds].fd = clients[i].fd;
+                fds[nfds].events = POLLIN;
+                owner[nfds++] = &clients[i];
+            }
+        }
+
+        /* Without a joystick, wake up periodically to look for one */
+        rc = poll(fds, nfds, (libx52_is_connected(x52) &&
+                              (input_fd >= 0 || input_threaded)) ?
+                             -1 : X52D_RETRY_MS);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+
+        /*
+         * Everything received in this pass is collected into a single frame,
+         * so that it is written to the joystick in one update.
+         */
+        changed = false;
+        (void)libx52_begin_frame(x52);
+
+        for (i = 0; i < nfds; i++) {
+            if (fds[i].revents == 0) {
+                continue;
+            }
+
+            if (owner[i] != NULL) {
+                if (owner[i]->fd >= 0 && client_read(owner[i])) {
+                    changed = true;
+                }
+            } else if (fds[i].fd == listen_fd) {
+                client_accept(listen_fd);
+            } else if (fds[i].fd == input_pipe[0]) {
+                while (read(input_pipe[0], &report, sizeof(report)) ==
+                       sizeof(report)) {
+                    handle_report(&report, &last);
+                }
+            } else if (fds[i].fd == input_fd) {
+                read_input(ctx, &last);
+            } else if (fds[i].fd == clock_fd) {
+                rc = libx52_clock_service_dispatch(x52);
+                if (rc == LIBX52_SUCCESS) {
+                    changed = true;
+                }
+            }
+        }
+
+        (void)libx52_commit_frame(x52);
+        if (changed || !libx52_is_connected(x52)) {
+            update_device();
+        }
+    }
+
+    exit_loop = 1;
+    if (input_threaded) {
+        pthread_join(input_thread_id, NULL);
+    }
+
+    for (i = 0; i < X52D_CLIENTS_MAX; i++) {
+        if (clients[i].fd >= 0) {
+            client_close(&clients[i]);
+        }
+    }
+
+    close(listen_fd);
+    (void)unlink(path);
+    close(input_pipe[0]);
+    close(input_pipe[1]);
+
+    stop_clock_service();
+    libx52io_exit(ctx);
+    libx52_exit(x52);
+
+    return EXIT_SUCCESS;
+}
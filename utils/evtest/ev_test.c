@@ -55,8 +55,10 @@ static bool denoise = true;
 int main(int argc, char **argv)
 {
     libx52io_context *ctx;
-    libx52io_report last, curr;
-    int32_t denoise_mask[LIBX52IO_AXIS_MAX] = { 0 };
+    libx52io_report curr;
+    libx52io_delta delta;
+    libx52io_event events[LIBX52IO_EVENT_MAX];
+    size_t count;
     int rc;
     #define CHECK_RC() do { \
         if (rc != LIBX52IO_SUCCESS) { \
@@ -72,7 +74,6 @@ int main(int argc, char **argv)
     textdomain(LOCALEDIR);
     #endif
 
-    memset(&last, 0, sizeof(last));
     memset(&curr, 0, sizeof(curr));
 
     /* Initialize libx52io */
@@ -91,12 +92,13 @@ int main(int argc, char **argv)
             CHECK_RC();
 
             /*
-             * Denoising algorithm ignores the last few bits of the axis,
-             * and is based on the maximum value of the axis. The mask is
-             * ~(max >> 6) which will do nothing for the axis with a small
-             * range, but reduce the noise on those with a larger range.
+             * Denoising ignores small changes of the axis, and is based on
+             * the maximum value of the axis. The hysteresis is max >> 6,
+             * which will do nothing for the axis with a small range, but
+             * reduce the noise on those with a larger range.
              */
-            denoise_mask[i] = ~(max >> 6);
+            rc = libx52io_set_axis_hysteresis(ctx, i, max >> 6);
+            CHECK_RC();
         }
     }
 
@@ -119,10 +121,9 @@ int main(int argc, char **argv)
     /* Wait until we get an event */
     while (!exit_loop) {
         struct timeval tv;
-        bool printed = false;
 
         /* Wait for 1 second before timing out */
-        rc = libx52io_read_timeout(ctx, &curr, 1000);
+        rc = libx52io_read_delta(ctx, &curr, &delta, 1000);
         if (rc == LIBX52IO_ERROR_TIMEOUT) {
             continue;
         } else if (rc != LIBX52IO_SUCCESS) {
@@ -130,50 +131,30 @@ int main(int argc, char **argv)
             break;
         }
 
-        /*
-         * Successful read, compare the current report against the previous
-         * one and display the result
-         */
-        if (memcmp(&last, &curr, sizeof(curr)) == 0) {
+        /* Successful read, display the changes since the previous report */
+        count = libx52io_delta_events(&delta, &curr, events, LIBX52IO_EVENT_MAX);
+        if (count == 0) {
             /* No change, ignore the output */
             continue;
         }
 
         /* Get the current timeval - we don't need a timezone */
         gettimeofday(&tv, NULL);
-        for (int axis = 0; axis < LIBX52IO_AXIS_MAX; axis++) {
-            if (last.axis[axis] != curr.axis[axis]) {
-                /* Account for denoising */
-                if (denoise) {
-                    int32_t last_v = last.axis[axis] & denoise_mask[axis];
-                    int32_t curr_v = curr.axis[axis] & denoise_mask[axis];
-
-                    if (last_v == curr_v) {
-                        /* Within the noise threshold */
-                        continue;
-                    }
-                }
-
-                printf(_("Event @ %ld.%06ld: %s, value %d\n"),
-                    (long int)tv.tv_sec, (long int)tv.tv_usec,
-                    libx52io_axis_to_str(axis), curr.axis[axis]);
-                printed = true;
-            }
-        }
-        for (int btn = 0; btn < LIBX52IO_BUTTON_MAX; btn++) {
-            if (last.button[btn] != curr.button[btn]) {
-                printf(_("Event @ %ld.%06ld: %s, value %d\n"),
-                    (long int)tv.tv_sec, (long int)tv.tv_usec,
-                    libx52io_button_to_str(btn), curr.button[btn]);
-                printed = true;
+        for (size_t i = 0; i < count; i++) {
+            const char *name;
+
+            if (events[i].type == LIBX52IO_EVENT_AXIS) {
+                name = libx52io_axis_to_str(events[i].id);
+            } else {
+                name = libx52io_button_to_str(events[i].id);
             }
-        }
 
-        if (printed) {
-            puts("");
+            printf(_("Event @ %ld.%06ld: %s, value %d\n"),
+                (long int)tv.tv_sec, (long int)tv.tv_usec,
+                name, events[i].new_value);
         }
 
-        memcpy(&last, &curr, sizeof(curr));
+        puts("");
     }
 
     /* Close and exit the libx52io library */
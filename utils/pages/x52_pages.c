@@ -0,0 +1,190 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - MFD pages utility
+ *
+ * Copyright (C) 2012-2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <string.h>
+
+#include "libx52.h"
+#include "libx52io.h"
+#include "gettext.h"
+
+/*
+Usage
+=====
+
+x52pages <page> [<page> ...]
+
+Each page is given as a single argument, with the lines separated by '|',
+e.g., x52pages "Page 1|Line 2|Line 3" "This line is long enough to scroll"
+
+PgUp and PgDn switch between the pages, and the Up, Down and Select buttons
+are reported on the standard output.
+ */
+
+/* For i18n */
+#define _(x) gettext(x)
+
+static bool exit_loop = false;
+
+static void signal_handler(int sig)
+{
+    exit_loop = true;
+}
+
+/* Map the buttons below the MFD to page events */
+static const struct {
+    libx52io_button button;
+    libx52_page_event event;
+} page_buttons[] = {
+    { LIBX52IO_BTN_PG_UP, LIBX52_PAGE_EVENT_PG_UP },
+    { LIBX52IO_BTN_PG_DN, LIBX52_PAGE_EVENT_PG_DN },
+    { LIBX52IO_BTN_UP, LIBX52_PAGE_EVENT_UP },
+    { LIBX52IO_BTN_DN, LIBX52_PAGE_EVENT_DN },
+    { LIBX52IO_BTN_SELECT, LIBX52_PAGE_EVENT_SELECT },
+};
+
+static void page_callback(libx52_device *x52, uint8_t page_id,
+                          libx52_page_event event, bool pressed,
+                          void *user_data)
+{
+    static const char *names[] = {
+        [LIBX52_PAGE_EVENT_PG_UP] = "PgUp",
+        [LIBX52_PAGE_EVENT_PG_DN] = "PgDn",
+        [LIBX52_PAGE_EVENT_UP] = "Up",
+        [LIBX52_PAGE_EVENT_DN] = "Down",
+        [LIBX52_PAGE_EVENT_SELECT] = "Select",
+    };
+
+    printf(_("Page %u: %s %s\n"), page_id, names[event],
+           pressed ? _("pressed") : _("released"));
+}
+
+static int add_page(libx52_device *x52, char *spec)
+{
+    uint8_t page_id;
+    uint8_t line;
+    char *text;
+    int rc;
+
+    rc = libx52_page_create(x52, &page_id, page_callback, NULL);
+    if (rc != LIBX52_SUCCESS) {
+        return rc;
+    }
+
+    for (line = 0; line < 3 && spec != NULL; line++) {
+        text = strsep(&spec, "|");
+        rc = libx52_page_set_line(x52, page_id, line, text, strlen(text));
+        if (rc != LIBX52_SUCCESS) {
+            return rc;
+        }
+    }
+
+    return LIBX52_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+    libx52_device *x52;
+    libx52io_context *ctx;
+    libx52io_report last, curr;
+    unsigned int next_ms;
+    uint8_t page_id;
+    size_t i;
+    int rc;
+    int io_rc;
+
+    /* Initialize gettext */
+    #if ENABLE_NLS
+    setlocale(LC_ALL, "");
+    bindtextdomain(PACKAGE, LOCALEDIR);
+    textdomain(PACKAGE);
+    #endif
+
+    if (argc < 2) {
+        fprintf(stderr, _("Usage: %s <page> [<page> ...]\n"), argv[0]);
+        fprintf(stderr, _("Separate the lines of each page with '|'\n"));
+        return EXIT_FAILURE;
+    }
+
+    rc = libx52_init(&x52);
+    if (rc != LIBX52_SUCCESS) {
+        fprintf(stderr, "%s\n", libx52_strerror(rc));
+        return rc;
+    }
+
+    io_rc = libx52io_init(&ctx);
+    if (io_rc == LIBX52IO_SUCCESS) {
+        io_rc = libx52io_open(ctx);
+    }
+    if (io_rc != LIBX52IO_SUCCESS) {
+        fprintf(stderr, "%s\n", libx52io_strerror(io_rc));
+        libx52_exit(x52);
+        return io_rc;
+    }
+
+    for (i = 1; i < (size_t)argc; i++) {
+        rc = add_page(x52, argv[i]);
+        if (rc != LIBX52_SUCCESS) {
+            fprintf(stderr, "%s\n", libx52_strerror(rc));
+            goto cleanup;
+        }
+    }
+
+    rc = libx52_page_get_active(x52, &page_id);
+    if (rc == LIBX52_SUCCESS) {
+        rc = libx52_page_activate(x52, page_id);
+    }
+    if (rc == LIBX52_SUCCESS) {
+        rc = libx52_update(x52);
+    }
+
+    /* Set up the signal handler to terminate the loop on SIGTERM or SIGINT */
+    signal(SIGTERM, signal_handler);
+    signal(SIGINT, signal_handler);
+
+    memset(&last, 0, sizeof(last));
+    next_ms = LIBX52_PAGE_SCROLL_MS;
+    while (!exit_loop) {
+        /* Wake up in time for the next scroll step */
+        io_rc = libx52io_read_timeout(ctx, &curr, (int)next_ms);
+        if (io_rc == LIBX52IO_SUCCESS) {
+            for (i = 0; i < sizeof(page_buttons) / sizeof(page_buttons[0]); i++) {
+                libx52io_button btn = page_buttons[i].button;
+
+                if (last.button[btn] != curr.button[btn]) {
+                    (void)libx52_page_input(x52, page_buttons[i].event,
+                                            curr.button[btn]);
+                }
+            }
+            memcpy(&last, &curr, sizeof(curr));
+        } else if (io_rc != LIBX52IO_ERROR_TIMEOUT) {
+            /* Some other error while reading. Abort the loop */
+            fprintf(stderr, "%s\n", libx52io_strerror(io_rc));
+            break;
+        }
+
+        (void)libx52_page_tick(x52, &next_ms);
+        rc = libx52_update(x52);
+        if (rc != LIBX52_SUCCESS) {
+            fprintf(stderr, "%s\n", libx52_strerror(rc));
+            break;
+        }
+    }
+
+cleanup:
+    libx52io_close(ctx);
+    libx52io_exit(ctx);
+    libx52_exit(x52);
+
+    return rc;
+}
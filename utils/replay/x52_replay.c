@@ -0,0 +1,229 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - command journal replay
+ *
+ * Copyright (C) 2012-2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+/**
+@page x52replay Replay a libx52 command journal
+
+\htmlonly
+<b>x52replay</b> - Send the commands in a libx52 journal to the joystick
+\endhtmlonly
+
+# SYNOPSIS
+<tt>\b x52replay [\b -s \a speed] [\b -v] \a journal</tt>
+
+# DESCRIPTION
+
+\b x52replay reads a journal recorded by \ref libx52_journal_start, and sends
+every vendor command in it to the joystick again, with the same timing as
+when it was recorded.
+
+- <tt>\b -s \a speed</tt>\n \manonly \fR \endmanonly
+  Replay \a speed times faster than the original, e.g., \c 2 for twice the
+  speed, or \c 0.5 for half the speed. A \a speed of \c 0 sends the commands
+  back to back, as fast as the joystick accepts them.
+
+- <tt>\b -v</tt>\n \manonly \fR \endmanonly
+  Print every command, along with its recorded and its new result.
+
+At the end, \b x52replay prints the number of commands sent, the number which
+failed, the number whose result differs from the recorded one, and the rate
+at which they were sent. It exits with status \c 0 if every command had the
+same result as when it was recorded, even if some of them failed both times.
+
+To replay a journal against the libusbx52 stub instead of a joystick, run
+\b x52replay with the stub library in \c LD_PRELOAD, as the x52cli tests do.
+
+*/
+
+#include "config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "libx52.h"
+#include "gettext.h"
+
+/* For i18n */
+#define _(x) gettext(x)
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t deadline_ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = deadline_ns / 1000000000ULL;
+    ts.tv_nsec = deadline_ns % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+        /* Keep sleeping until the deadline */
+    }
+}
+
+/* Map the journal, and check that it is one that we can read */
+static const libx52_journal_header *map_journal(const char *path, size_t *count)
+{
+    const libx52_journal_header *header;
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return NULL;
+    }
+
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*header)) {
+        fprintf(stderr, _("%s is not a libx52 journal\n"), path);
+        close(fd);
+        return NULL;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror(path);
+        return NULL;
+    }
+
+    header = map;
+    if (header->magic != LIBX52_JOURNAL_MAGIC) {
+        fprintf(stderr, _("%s is not a libx52 journal\n"), path);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    if (header->version != LIBX52_JOURNAL_VERSION ||
+        header->record_size != sizeof(libx52_journal_record)) {
+        fprintf(stderr, _("%s has unsupported journal version %u\n"),
+                path, header->version);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    /* A partial record at the end is from a journal which was cut short */
+    *count = (st.st_size - sizeof(*header)) / sizeof(libx52_journal_record);
+    return header;
+}
+
+int main(int argc, char **argv)
+{
+    const libx52_journal_header *header;
+    const libx52_journal_record *records;
+    libx52_device *x52;
+    double speed = 1.0;
+    bool verbose = false;
+    unsigned long failed = 0;
+    unsigned long mismatched = 0;
+    uint64_t start_ns;
+    uint64_t elapsed_ns;
+    size_t count;
+    size_t i;
+    char *end;
+    int opt;
+    int rc;
+
+    /* Initialize gettext */
+    #if ENABLE_NLS
+    setlocale(LC_ALL, "");
+    bindtextdomain(PACKAGE, LOCALEDIR);
+    textdomain(PACKAGE);
+    #endif
+
+    while ((opt = getopt(argc, argv, "s:v")) != -1) {
+        switch (opt) {
+        case 's':
+            speed = strtod(optarg, &end);
+            if (*end != '\0' || speed < 0) {
+                fprintf(stderr, _("Invalid speed %s\n"), optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'v':
+            verbose = true;
+            break;
+
+        default:
+            optind = argc;
+            break;
+        }
+    }
+
+    if (optind != argc - 1) {
+        fprintf(stderr, _("Usage: %s [-s speed] [-v] <journal>\n"), argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    header = map_journal(argv[optind], &count);
+    if (header == NULL) {
+        return EXIT_FAILURE;
+    }
+    records = (const libx52_journal_record *)(header + 1);
+
+    rc = libx52_init(&x52);
+    if (rc != LIBX52_SUCCESS) {
+        fprintf(stderr, _("Error initializing X52 library: %s\n"),
+                libx52_strerror(rc));
+        return EXIT_FAILURE;
+    }
+
+    rc = libx52_connect(x52);
+    if (rc != LIBX52_SUCCESS) {
+        fprintf(stderr, _("Error connecting to joystick: %s\n"),
+                libx52_strerror(rc));
+        libx52_exit(x52);
+        return EXIT_FAILURE;
+    }
+
+    start_ns = monotonic_ns();
+    for (i = 0; i < count; i++) {
+        const libx52_journal_record *r = &records[i];
+
+        if (speed > 0) {
+            sleep_until(start_ns + (uint64_t)(r->time_ns / speed));
+        }
+
+        rc = libx52_vendor_command(x52, r->index, r->value);
+        if (rc != LIBX52_SUCCESS) {
+            failed++;
+        }
+        if (rc != r->result) {
+            mismatched++;
+        }
+
+        if (verbose) {
+            printf("%10.6f %04x %04x %s -> %s\n", r->time_ns / 1e9,
+                   r->index, r->value, libx52_strerror(r->result),
+                   libx52_strerror(rc));
+        }
+    }
+    elapsed_ns = monotonic_ns() - start_ns;
+
+    printf(_("Commands: %zu, failed: %lu, different result: %lu\n"),
+           count, failed, mismatched);
+    printf(_("Time: %.3f s, %.0f commands/s\n"), elapsed_ns / 1e9,
+           elapsed_ns ? count * 1e9 / elapsed_ns : 0.0);
+
+    libx52_exit(x52);
+    return (mismatched == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}